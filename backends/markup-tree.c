@@ -22,6 +22,7 @@
 #include <glib.h>
 #include "gconf/gconf-internals.h"
 #include "gconf/gconf-schema.h"
+#include "gconf/gconf.h"
 #include "markup-tree.h"
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -82,13 +83,18 @@ typedef struct
 struct _MarkupEntry
 {
   MarkupDir  *dir;
-  char       *name;
+  /* interned */
+  const char *name;
   GConfValue *value;
   /* list of LocalSchemaInfo */
   GSList     *local_schemas;
   char       *schema_name;
   char       *mod_user;
   GTime       mod_time;
+  /* Where in the subtree's snapshot @value and @local_schemas are,
+   * if they haven't been read yet; 0 otherwise
+   */
+  guint32     snapshot_offset;
 };
 
 static LocalSchemaInfo* local_schema_info_new  (void);
@@ -111,6 +117,22 @@ static void       markup_dir_setup_as_subtree_root (MarkupDir  *dir);
 static MarkupEntry* markup_entry_new  (MarkupDir   *dir,
 				       const char  *name);
 static void         markup_entry_free (MarkupEntry *entry);
+static void         markup_entry_merge_local_schema (MarkupEntry     *entry,
+                                                     LocalSchemaInfo *local_schema);
+static void         markup_entry_load_snapshot      (MarkupEntry     *entry);
+
+static LocalSchemaInfo* get_local_schema_info (MarkupEntry *entry,
+                                               const char  *locale);
+
+typedef struct _MarkupSnapshot MarkupSnapshot;
+
+static gboolean markup_dir_open_snapshot         (MarkupDir      *dir);
+static void     markup_dir_load_snapshot         (MarkupDir      *dir);
+static gboolean markup_dir_load_locale_snapshot  (MarkupDir      *dir,
+                                                  const char     *locale);
+static void     markup_dir_write_snapshot        (MarkupDir      *dir,
+                                                  const char     *locale);
+static void     markup_snapshot_free             (MarkupSnapshot *snap);
 
 static void parse_tree (MarkupDir   *root,
 			gboolean     parse_subtree,
@@ -132,9 +154,26 @@ struct _MarkupTree
 
   guint refcount;
 
+  /* Append-only log of the changes made since the last sync,
+   * -1 until the first change opens it
+   */
+  int journal_fd;
+  /* Idle that makes the records written since the last one durable */
+  guint journal_flush_id;
+
   guint merged : 1;
+
+  /* There may be a journal file on disk */
+  guint journal_exists : 1;
+
+  /* Applying the journal on load, don't log the changes again */
+  guint replaying_journal : 1;
 };
 
+static void markup_tree_replay_journal (MarkupTree *tree);
+static void markup_tree_flush_journal  (MarkupTree *tree);
+static void markup_tree_clear_journal  (MarkupTree *tree);
+
 static GHashTable *trees_by_root_dir = NULL;
 
 MarkupTree*
@@ -168,8 +207,11 @@ markup_tree_get (const char *root_dir,
   tree->root = markup_dir_new (tree, NULL, "/");  
 
   tree->refcount = 1;
+  tree->journal_fd = -1;
 
   g_hash_table_insert (trees_by_root_dir, tree->dirname, tree);
+
+  markup_tree_replay_journal (tree);
   
   return tree;
 }
@@ -196,6 +238,11 @@ markup_tree_unref (MarkupTree *tree)
   markup_dir_free (tree->root);
   tree->root = NULL;
 
+  /* Anything not synced yet stays in the journal for next time */
+  markup_tree_flush_journal (tree);
+  if (tree->journal_fd >= 0)
+    close (tree->journal_fd);
+
   g_free (tree->dirname);
 
   g_free (tree);
@@ -215,14 +262,31 @@ struct _MarkupDir
   MarkupTree *tree;
   MarkupDir *parent;
   MarkupDir *subtree_root;
-  char *name;
+  /* interned, lots of dirs share names like "general" */
+  const char *name;
 
   GSList *entries;
   GSList *subdirs;
 
+  /* Name -> MarkupEntry/MarkupDir indexes of the above lists, the
+   * lists still own the items and keep them in file order.  When
+   * a name appears twice the index points to the first item, like
+   * a list walk would.
+   */
+  GHashTable *entries_by_name;
+  GHashTable *subdirs_by_name;
+
   /* Available %gconf-tree-$(locale).xml files */
   GHashTable *available_local_descs;
 
+  /* Subtree roots loaded from a snapshot keep it mapped here */
+  MarkupSnapshot *snapshot;
+
+  /* Where in subtree_root->snapshot our contents are, if they
+   * haven't been read yet; 0 otherwise
+   */
+  guint32 snapshot_offset;
+
   /* Have read the existing XML file */
   guint entries_loaded : 1;
   /* Need to rewrite the XML file since we changed
@@ -264,14 +328,19 @@ markup_dir_new (MarkupTree *tree,
 
   dir = g_new0 (MarkupDir, 1);
 
-  dir->name = g_strdup (name);
+  dir->name = gconf_key_intern (name);
   dir->tree = tree;
   dir->parent = parent;
 
+  dir->entries_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+  dir->subdirs_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+
   if (parent)
     {
       dir->subtree_root = parent->subtree_root;
       parent->subdirs = g_slist_prepend (parent->subdirs, dir);
+      if (g_hash_table_lookup (parent->subdirs_by_name, dir->name) == NULL)
+        g_hash_table_insert (parent->subdirs_by_name, (char *) dir->name, dir);
     }
   else
     {
@@ -292,6 +361,9 @@ markup_dir_free (MarkupDir *dir)
       dir->available_local_descs = NULL;
     }
 
+  g_hash_table_destroy (dir->entries_by_name);
+  g_hash_table_destroy (dir->subdirs_by_name);
+
   tmp = dir->entries;
   while (tmp)
     {
@@ -314,11 +386,55 @@ markup_dir_free (MarkupDir *dir)
     }
   g_slist_free (dir->subdirs);
 
-  g_free (dir->name);
+  if (dir->snapshot != NULL)
+    markup_snapshot_free (dir->snapshot);
+
+  gconf_key_unintern (dir->name);
 
   g_free (dir);
 }
 
+/* Rebuild the name indexes after items were dropped from the lists;
+ * walking in list order keeps "first item wins" for duplicate names.
+ */
+static void
+markup_dir_reindex_entries (MarkupDir *dir)
+{
+  GSList *tmp;
+
+  g_hash_table_remove_all (dir->entries_by_name);
+
+  tmp = dir->entries;
+  while (tmp != NULL)
+    {
+      MarkupEntry *entry = tmp->data;
+
+      if (g_hash_table_lookup (dir->entries_by_name, entry->name) == NULL)
+        g_hash_table_insert (dir->entries_by_name, (char *) entry->name, entry);
+
+      tmp = tmp->next;
+    }
+}
+
+static void
+markup_dir_reindex_subdirs (MarkupDir *dir)
+{
+  GSList *tmp;
+
+  g_hash_table_remove_all (dir->subdirs_by_name);
+
+  tmp = dir->subdirs;
+  while (tmp != NULL)
+    {
+      MarkupDir *subdir = tmp->data;
+
+      if (g_hash_table_lookup (dir->subdirs_by_name, subdir->name) == NULL)
+        g_hash_table_insert (dir->subdirs_by_name, (char *) subdir->name, subdir);
+
+      tmp = tmp->next;
+    }
+}
+
 static void
 markup_dir_queue_sync (MarkupDir *dir)
 {
@@ -439,9 +555,360 @@ markup_tree_sync (MarkupTree *tree,
         }
     }
 
+  /* Everything in the journal is in the XML files now */
+  markup_tree_clear_journal (tree);
+
+  return TRUE;
+}
+
+/*
+ * Journal
+ *
+ * Between syncs every change to an entry is also appended to
+ * $(root)/%gconf-journal, one line per change:
+ *
+ *   op TAB mod_time TAB key TAB argument TAB "." NEWLINE
+ *
+ * op is 's' (set value, the argument is gconf_value_encode() output),
+ * 'u' (unset, the argument is the locale) or 'n' (set schema name).
+ * Arguments are g_strescape()d and an empty one means NULL.
+ *
+ * Appending a line is much cheaper than rewriting %gconf.xml, so the
+ * XML files are still only rewritten when the tree is synced.  A record
+ * is written to the journal right away but only sits in the page cache
+ * until the main loop goes idle; then one fdatasync() covers the whole
+ * burst of changes.  Without a main loop, as with gconftool --direct,
+ * that happens when the tree is unreffed.  A successful
+ * markup_tree_sync() removes the journal, and markup_tree_get()
+ * replays whatever is left over on top of the XML files, skipping
+ * records older than the entry they find there.  Replaying is
+ * idempotent, so dying between writing the XML files and removing the
+ * journal is harmless; a line cut short by a crash lacks the final "."
+ * and is skipped.
+ */
+
+#define JOURNAL_FILE "%gconf-journal"
+
+static char*
+markup_tree_build_journal_path (MarkupTree *tree)
+{
+  return g_build_filename (tree->dirname, JOURNAL_FILE, NULL);
+}
+
+static gboolean
+markup_tree_open_journal (MarkupTree *tree)
+{
+  char *path;
+  char last;
+
+  if (tree->journal_fd >= 0)
+    return TRUE;
+
+  path = markup_tree_build_journal_path (tree);
+
+  tree->journal_fd = g_open (path, O_RDWR | O_CREAT | O_APPEND,
+                             tree->file_mode);
+  if (tree->journal_fd < 0)
+    {
+      gconf_log (GCL_WARNING, _("Failed to open journal \"%s\": %s"),
+                 path, g_strerror (errno));
+      g_free (path);
+      return FALSE;
+    }
+
+  g_free (path);
+
+  tree->journal_exists = TRUE;
+
+  /* If a crash cut the last line short, start a new one so the
+   * next record isn't glued onto it.
+   */
+  if (lseek (tree->journal_fd, -1, SEEK_END) >= 0 &&
+      read (tree->journal_fd, &last, 1) == 1 &&
+      last != '\n')
+    {
+      if (write (tree->journal_fd, "\n", 1) != 1)
+        {
+          gconf_log (GCL_WARNING, _("Failed to write journal in \"%s\": %s"),
+                     tree->dirname, g_strerror (errno));
+          close (tree->journal_fd);
+          tree->journal_fd = -1;
+          return FALSE;
+        }
+    }
+
   return TRUE;
 }
 
+static void
+markup_tree_flush_journal (MarkupTree *tree)
+{
+  if (tree->journal_flush_id != 0)
+    {
+      g_source_remove (tree->journal_flush_id);
+      tree->journal_flush_id = 0;
+    }
+
+  if (tree->journal_fd < 0)
+    return;
+
+  /* The file only grows, so there's no metadata worth waiting for */
+#ifdef HAVE_FDATASYNC
+  if (fdatasync (tree->journal_fd) < 0)
+#else
+  if (fsync (tree->journal_fd) < 0)
+#endif
+    {
+      /* The changes still reach the XML files on the next sync */
+      gconf_log (GCL_WARNING, _("Failed to write journal in \"%s\": %s"),
+                 tree->dirname, g_strerror (errno));
+
+      close (tree->journal_fd);
+      tree->journal_fd = -1;
+    }
+}
+
+static gboolean
+markup_tree_flush_journal_idle (gpointer data)
+{
+  MarkupTree *tree = data;
+
+  tree->journal_flush_id = 0;
+  markup_tree_flush_journal (tree);
+
+  return FALSE;
+}
+
+static void
+markup_tree_journal_append (MarkupTree *tree,
+                            char        op,
+                            GTime       mod_time,
+                            const char *key,
+                            const char *arg)
+{
+  GString *record;
+  char *escaped;
+  const char *p;
+  gssize remaining;
+
+  if (!markup_tree_open_journal (tree))
+    return;
+
+  escaped = g_strescape (arg ? arg : "", NULL);
+  record = g_string_new (NULL);
+  g_string_printf (record, "%c\t%ld\t%s\t%s\t.\n",
+                   op, (long) mod_time, key, escaped);
+  g_free (escaped);
+
+  p = record->str;
+  remaining = record->len;
+  while (remaining > 0)
+    {
+      gssize written;
+
+      written = write (tree->journal_fd, p, remaining);
+      if (written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          goto failed;
+        }
+
+      p += written;
+      remaining -= written;
+    }
+
+  if (tree->journal_flush_id == 0)
+    tree->journal_flush_id = g_idle_add (markup_tree_flush_journal_idle,
+                                         tree);
+
+  g_string_free (record, TRUE);
+
+  return;
+
+ failed:
+  /* The change still reaches the XML files on the next sync */
+  gconf_log (GCL_WARNING, _("Failed to write journal in \"%s\": %s"),
+             tree->dirname, g_strerror (errno));
+
+  close (tree->journal_fd);
+  tree->journal_fd = -1;
+
+  g_string_free (record, TRUE);
+}
+
+static gboolean
+markup_tree_replay_record (MarkupTree *tree,
+                           const char *line)
+{
+  char **fields;
+  char *arg;
+  char *parent;
+  MarkupDir *dir;
+  MarkupEntry *entry;
+  GError *error;
+  GTime mod_time;
+  gboolean retval;
+
+  retval = FALSE;
+
+  fields = g_strsplit (line, "\t", 6);
+  if (g_strv_length (fields) != 5 ||
+      strlen (fields[0]) != 1 ||
+      strcmp (fields[4], ".") != 0 ||
+      !gconf_valid_key (fields[2], NULL))
+    goto out;
+
+  parent = gconf_key_directory (fields[2]);
+
+  error = NULL;
+  entry = NULL;
+  dir = markup_tree_ensure_dir (tree, parent, &error);
+  if (dir != NULL)
+    entry = markup_dir_ensure_entry (dir, gconf_key_key (fields[2]), &error);
+
+  g_free (parent);
+
+  if (error != NULL)
+    {
+      gconf_log (GCL_WARNING, _("Failed to replay journal entry for \"%s\": %s"),
+                 fields[2], error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  mod_time = (GTime) strtol (fields[1], NULL, 10);
+
+  /* Someone else changed the XML files after this record was made */
+  if (entry->mod_time > mod_time)
+    {
+      retval = TRUE;
+      goto out;
+    }
+
+  arg = *fields[3] != '\0' ? g_strcompress (fields[3]) : NULL;
+
+  switch (*fields[0])
+    {
+    case 's':
+      {
+        GConfValue *value;
+
+        value = arg ? gconf_value_decode (arg) : NULL;
+        if (value != NULL)
+          {
+            markup_entry_set_value (entry, value);
+            gconf_value_free (value);
+            retval = TRUE;
+          }
+      }
+      break;
+
+    case 'u':
+      markup_entry_unset_value (entry, arg);
+      retval = TRUE;
+      break;
+
+    case 'n':
+      markup_entry_set_schema_name (entry, arg);
+      retval = TRUE;
+      break;
+
+    default:
+      break;
+    }
+
+  /* Keep the time of the original change, not of the replay */
+  if (retval)
+    entry->mod_time = mod_time;
+
+  g_free (arg);
+
+ out:
+  g_strfreev (fields);
+
+  return retval;
+}
+
+static void
+markup_tree_replay_journal (MarkupTree *tree)
+{
+  char *path;
+  char *contents;
+  char **lines;
+  GError *error;
+  int i;
+
+  path = markup_tree_build_journal_path (tree);
+
+  error = NULL;
+  if (!g_file_get_contents (path, &contents, NULL, &error))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        gconf_log (GCL_WARNING, _("Failed to read journal \"%s\": %s"),
+                   path, error->message);
+      g_error_free (error);
+      g_free (path);
+      return;
+    }
+
+  tree->journal_exists = TRUE;
+
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  /* The changes are already in the journal, only the tree needs them */
+  tree->replaying_journal = TRUE;
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      if (*lines[i] == '\0')
+        continue;
+
+      if (!markup_tree_replay_record (tree, lines[i]))
+        gconf_log (GCL_DEBUG, "Skipping bad line %d of journal \"%s\"",
+                   i + 1, path);
+    }
+
+  tree->replaying_journal = FALSE;
+
+  g_strfreev (lines);
+  g_free (path);
+}
+
+static void
+markup_tree_clear_journal (MarkupTree *tree)
+{
+  char *path;
+
+  if (!tree->journal_exists)
+    return;
+
+  /* No point making durable what is about to go */
+  if (tree->journal_flush_id != 0)
+    {
+      g_source_remove (tree->journal_flush_id);
+      tree->journal_flush_id = 0;
+    }
+
+  if (tree->journal_fd >= 0)
+    {
+      close (tree->journal_fd);
+      tree->journal_fd = -1;
+    }
+
+  path = markup_tree_build_journal_path (tree);
+
+  if (g_unlink (path) < 0 && errno != ENOENT)
+    gconf_log (GCL_WARNING, _("Failed to remove journal \"%s\": %s"),
+               path, g_strerror (errno));
+
+  g_free (path);
+
+  tree->journal_exists = FALSE;
+}
+
 static void
 markup_dir_setup_as_subtree_root (MarkupDir *dir)
 {
@@ -548,6 +1015,13 @@ load_subtree (MarkupDir *dir)
   markup_dir_setup_as_subtree_root (dir);
   markup_dir_list_available_local_descs (dir);
 
+  if (markup_dir_open_snapshot (dir))
+    {
+      markup_dir_load_snapshot (dir);
+      g_free (markup_file);
+      return TRUE;
+    }
+
   parse_tree (dir, TRUE, NULL, &tmp_err);
   if (tmp_err)
     {
@@ -564,6 +1038,10 @@ load_subtree (MarkupDir *dir)
 		 markup_file, tmp_err->message);
       g_error_free (tmp_err);
     }
+  else
+    {
+      markup_dir_write_snapshot (dir, NULL);
+    }
 
   g_free (markup_file);
 
@@ -578,6 +1056,12 @@ load_entries (MarkupDir *dir)
   if (dir->entries_loaded)
     return TRUE;
 
+  if (dir->snapshot_offset != 0)
+    {
+      markup_dir_load_snapshot (dir);
+      return TRUE;
+    }
+
   /* We mark it loaded even if the next stuff
    * fails, because we don't want to keep trying and
    * failing, plus we have invariants
@@ -629,6 +1113,12 @@ load_subdirs (MarkupDir *dir)
   
   if (dir->subdirs_loaded)
     return TRUE;
+
+  if (dir->snapshot_offset != 0)
+    {
+      markup_dir_load_snapshot (dir);
+      return TRUE;
+    }
   
   /* We mark it loaded even if the next stuff
    * fails, because we don't want to keep trying and
@@ -724,22 +1214,9 @@ markup_dir_lookup_entry (MarkupDir   *dir,
                          const char  *relative_key,
                          GError     **err)
 {
-  GSList *tmp;
-
   load_entries (dir);
-  
-  tmp = dir->entries;
-  while (tmp != NULL)
-    {
-      MarkupEntry *entry = tmp->data;
 
-      if (strcmp (relative_key, entry->name) == 0)
-        return entry;
-      
-      tmp = tmp->next;
-    }
-
-  return NULL;
+  return g_hash_table_lookup (dir->entries_by_name, relative_key);
 }
 
 MarkupEntry*
@@ -778,23 +1255,10 @@ markup_dir_lookup_subdir (MarkupDir   *dir,
                           const char  *relative_key,
                           GError     **err)
 {
-  GSList *tmp;
-  
   load_subdirs (dir);
 
-  tmp = dir->subdirs;
-  while (tmp != NULL)
-    {
-      MarkupDir *subdir = tmp->data;
-
-      if (strcmp (subdir->name, relative_key) == 0)
-        return subdir;
-
-      tmp = tmp->next;
-    }
-
-  return NULL;
-}
+  return g_hash_table_lookup (dir->subdirs_by_name, relative_key);
+}
 
 MarkupDir*
 markup_dir_ensure_subdir (MarkupDir   *dir,
@@ -879,6 +1343,8 @@ clean_old_local_schemas (MarkupEntry *entry)
   GSList *kept_schemas;
 
   kept_schemas = NULL;
+
+  markup_entry_load_snapshot (entry);
   
   tmp = entry->local_schemas;
   while (tmp != NULL)
@@ -1027,6 +1493,9 @@ delete_useless_subdirs (MarkupDir *dir)
   g_slist_free (dir->subdirs);
   dir->subdirs = g_slist_reverse (kept_subdirs);
 
+  if (some_deleted)
+    markup_dir_reindex_subdirs (dir);
+
   return some_deleted;
 }
 
@@ -1070,6 +1539,8 @@ delete_useless_entries (MarkupDir *dir)
       MarkupEntry *entry = tmp->data;
 
       /* mod_user and mod_time don't keep an entry alive */
+
+      markup_entry_load_snapshot (entry);
       
       if (entry->value == NULL &&
           entry->local_schemas == NULL &&
@@ -1089,6 +1560,9 @@ delete_useless_entries (MarkupDir *dir)
   g_slist_free (dir->entries);
   dir->entries = g_slist_reverse (kept_entries);
 
+  if (some_deleted)
+    markup_dir_reindex_entries (dir);
+
   return some_deleted;
 }
 
@@ -1123,6 +1597,14 @@ recursively_load_subtree (MarkupDir *dir)
   load_entries (dir);
   load_subdirs (dir);
 
+  tmp = dir->entries;
+  while (tmp != NULL)
+    {
+      markup_entry_load_snapshot (tmp->data);
+
+      tmp = tmp->next;
+    }
+
   tmp = dir->subdirs;
   while (tmp != NULL)
     {
@@ -1155,6 +1637,18 @@ markup_dir_sync (MarkupDir *dir)
   if (dir->not_in_filesystem)
     return TRUE;
 
+  /* A subtree read from a snapshot may not be fully built yet */
+  if (dir->save_as_subtree)
+    {
+      recursively_load_subtree (dir);
+
+      if (dir->snapshot != NULL)
+        {
+          markup_snapshot_free (dir->snapshot);
+          dir->snapshot = NULL;
+        }
+    }
+
   /* Sanitize the entries */
   clean_old_local_schemas_recurse (dir, dir->save_as_subtree);
 
@@ -1320,7 +1814,7 @@ markup_dir_build_path (MarkupDir  *dir,
   iter = dir;
   while (iter->parent != NULL) /* exclude root dir */
     {
-      components = g_slist_prepend (components, iter->name);
+      components = g_slist_prepend (components, (char *) iter->name);
       iter = iter->parent;
     }
 
@@ -1372,10 +1866,12 @@ markup_entry_new (MarkupDir  *dir,
 
   entry = g_new0 (MarkupEntry, 1);
 
-  entry->name = g_strdup (name);
+  entry->name = gconf_key_intern (name);
 
   entry->dir = dir;
   dir->entries = g_slist_prepend (dir->entries, entry);
+  if (g_hash_table_lookup (dir->entries_by_name, entry->name) == NULL)
+    g_hash_table_insert (dir->entries_by_name, (char *) entry->name, entry);
 
   return entry;
 }
@@ -1383,7 +1879,7 @@ markup_entry_new (MarkupDir  *dir,
 static void
 markup_entry_free (MarkupEntry *entry)
 {
-  g_free (entry->name);
+  gconf_key_unintern (entry->name);
   if (entry->value)
     gconf_value_free (entry->value);
   g_free (entry->schema_name);
@@ -1398,27 +1894,82 @@ markup_entry_free (MarkupEntry *entry)
   g_free (entry);
 }
 
+/* Adds the descriptions from a %gconf-tree-$(locale).xml file to
+ * @entry, taking ownership of @local_schema
+ */
+static void
+markup_entry_merge_local_schema (MarkupEntry     *entry,
+                                 LocalSchemaInfo *local_schema)
+{
+  GSList *tmp;
+
+  markup_entry_load_snapshot (entry);
+
+  if (entry->value == NULL ||
+      entry->value->type != GCONF_VALUE_SCHEMA)
+    {
+      local_schema_info_free (local_schema);
+      return;
+    }
+
+  tmp = entry->local_schemas;
+  while (tmp != NULL)
+    {
+      LocalSchemaInfo *lsi = tmp->data;
+
+      if (strcmp (local_schema->locale, lsi->locale) == 0)
+        {
+          g_free (lsi->short_desc);
+          lsi->short_desc = local_schema->short_desc;
+          local_schema->short_desc = NULL;
+
+          g_free (lsi->long_desc);
+          lsi->long_desc = local_schema->long_desc;
+          local_schema->long_desc = NULL;
+
+          local_schema_info_free (local_schema);
+
+          return;
+        }
+
+      tmp = tmp->next;
+    }
+
+  entry->local_schemas = g_slist_append (entry->local_schemas,
+                                         local_schema);
+}
+
 static void
 load_schema_descs_for_locale (MarkupDir  *dir,
                               const char *locale)
 {
   GError *error;
 
-  error = NULL;
-  parse_tree (dir, TRUE, locale, &error);
-  if (error != NULL)
+  if (!markup_dir_load_locale_snapshot (dir, locale))
     {
-      char *markup_file;
+      error = NULL;
+      parse_tree (dir, TRUE, locale, &error);
+      if (error != NULL)
+        {
+          char *markup_file;
 
-      markup_file = markup_dir_build_file_path (dir, TRUE, locale);
+          markup_file = markup_dir_build_file_path (dir, TRUE, locale);
 
-      gconf_log (GCL_ERR,
-                 _("Failed to load file \"%s\": %s"),
-                 markup_file,
-                 error->message);
+          gconf_log (GCL_ERR,
+                     _("Failed to load file \"%s\": %s"),
+                     markup_file,
+                     error->message);
 
-      g_free (markup_file);
-      g_error_free (error);
+          g_free (markup_file);
+          g_error_free (error);
+        }
+      else if (!markup_dir_needs_sync (dir))
+        {
+          /* Only when nothing has changed since loading, so the tree
+           * still holds exactly what the file has
+           */
+          markup_dir_write_snapshot (dir, locale);
+        }
     }
 
   g_hash_table_replace (dir->available_local_descs,
@@ -1498,6 +2049,27 @@ ensure_schema_descs_loaded (MarkupEntry *entry,
     }
 }
 
+static void
+markup_entry_journal (MarkupEntry *entry,
+                      char         op,
+                      const char  *arg)
+{
+  char *dir_key;
+  char *key;
+
+  if (entry->dir->tree->replaying_journal)
+    return;
+
+  dir_key = markup_dir_build_dir_path (entry->dir, FALSE);
+  key = gconf_concat_dir_and_key (dir_key, entry->name);
+
+  markup_tree_journal_append (entry->dir->tree, op,
+                              entry->mod_time, key, arg);
+
+  g_free (key);
+  g_free (dir_key);
+}
+
 void
 markup_entry_set_value (MarkupEntry       *entry,
                         const GConfValue  *value)
@@ -1509,6 +2081,8 @@ markup_entry_set_value (MarkupEntry       *entry,
   g_return_if_fail (entry->dir != NULL);
   g_return_if_fail (entry->dir->entries_loaded);
   g_return_if_fail (value != NULL);
+
+  markup_entry_load_snapshot (entry);
   
   if (value->type != GCONF_VALUE_SCHEMA)
     {
@@ -1638,6 +2212,15 @@ markup_entry_set_value (MarkupEntry       *entry,
   /* Need to save to disk */
   markup_dir_set_entries_need_save (entry->dir);
   markup_dir_queue_sync (entry->dir);
+
+  if (!entry->dir->tree->replaying_journal)
+    {
+      char *encoded;
+
+      encoded = gconf_value_encode ((GConfValue *) value);
+      markup_entry_journal (entry, 's', encoded);
+      g_free (encoded);
+    }
 }
 
 void
@@ -1651,6 +2234,8 @@ markup_entry_unset_value (MarkupEntry *entry,
   g_return_if_fail (entry->dir != NULL);
   g_return_if_fail (entry->dir->entries_loaded);
 
+  markup_entry_load_snapshot (entry);
+
   if (entry->value == NULL)
     {
       /* nothing to do */
@@ -1692,212 +2277,1477 @@ markup_entry_unset_value (MarkupEntry *entry,
                     g_slist_remove (entry->local_schemas,
                                     local_schema);
 
-                  local_schema_info_free (local_schema);
-                  break;
-                }
+                  local_schema_info_free (local_schema);
+                  break;
+                }
+
+              tmp = tmp->next;
+            }
+        }
+    }
+  else
+    {
+      gconf_value_free (entry->value);
+      entry->value = NULL;
+    }
+
+  /* Update mod time */
+  entry->mod_time = time (NULL);
+
+  /* Need to save to disk */
+  markup_dir_set_entries_need_save (entry->dir);
+  markup_dir_queue_sync (entry->dir);
+  markup_entry_journal (entry, 'u', locale);
+}
+
+void
+markup_entry_set_schema_name (MarkupEntry *entry,
+                              const char  *schema_name)
+{
+  /* We have to have loaded entries, because
+   * someone called ensure_entry to get this
+   * entry.
+   */
+  g_return_if_fail (entry->dir != NULL);
+  g_return_if_fail (entry->dir->entries_loaded);
+
+  /* schema_name may be NULL to unset it */
+  
+  g_free (entry->schema_name);
+  entry->schema_name = g_strdup (schema_name);
+  
+  /* Update mod time */
+  entry->mod_time = time (NULL);
+
+  /* Need to save to disk */
+  markup_dir_set_entries_need_save (entry->dir);
+  markup_dir_queue_sync (entry->dir);
+  markup_entry_journal (entry, 'n', schema_name);
+}
+
+GConfValue*
+markup_entry_get_value (MarkupEntry *entry,
+                        const char **locales)
+{
+  /* We have to have loaded entries, because
+   * someone called ensure_entry to get this
+   * entry.
+   */
+  g_return_val_if_fail (entry->dir != NULL, NULL);
+  g_return_val_if_fail (entry->dir->entries_loaded, NULL);
+
+  markup_entry_load_snapshot (entry);
+
+  if (entry->value == NULL)
+    {
+      return NULL;
+    }
+  else if (entry->value->type != GCONF_VALUE_SCHEMA)
+    {
+      return gconf_value_copy (entry->value);
+    }
+  else
+    {
+      GConfValue *retval;
+      GConfSchema *schema;
+      static const char *fallback_locales[2] = {
+        "C", NULL
+      };
+      LocalSchemaInfo *best;
+      LocalSchemaInfo *c_local_schema;
+      int i;
+
+      retval = gconf_value_copy (entry->value);
+      schema = gconf_value_get_schema (retval);
+      g_return_val_if_fail (schema != NULL, NULL);
+
+      /* Find the best local schema */
+
+      if (locales == NULL || locales[0] == NULL)
+        locales = fallback_locales;
+
+      best = NULL;
+      c_local_schema = NULL;
+
+      i = 0;
+      while (locales[i] != NULL)
+        {
+          GSList *tmp;
+
+          ensure_schema_descs_loaded (entry, locales[i]);
+
+          tmp = entry->local_schemas;
+          while (tmp != NULL)
+            {
+              LocalSchemaInfo *lsi = tmp->data;
+
+              if (c_local_schema == NULL &&
+                  strcmp (lsi->locale, "C") == 0)
+                {
+                  c_local_schema = lsi;
+                  if (best != NULL)
+                    break;
+                }
+
+              if (best == NULL &&
+                  strcmp (locales[i], lsi->locale) == 0)
+                {
+                  best = lsi;
+                  if (c_local_schema != NULL)
+                    break;
+                }
+
+              tmp = tmp->next;
+            }
+
+          /* Quit as soon as we have the best possible locale */
+          if (best != NULL && c_local_schema != NULL)
+            break;
+
+          ++i;
+        }
+
+      /* If we found localized info, add it to the return value,
+       * fall back to C locale if we can
+       */
+
+      if (best && best->locale)
+	gconf_schema_set_locale (schema, best->locale);
+      else
+	gconf_schema_set_locale (schema, "C");
+
+      if (best && best->default_value)
+        gconf_schema_set_default_value (schema, best->default_value);
+      else if (c_local_schema && c_local_schema->default_value)
+        gconf_schema_set_default_value (schema, c_local_schema->default_value);
+
+      if (best && best->short_desc)
+        gconf_schema_set_short_desc (schema, best->short_desc);
+      else if (c_local_schema && c_local_schema->short_desc)
+        gconf_schema_set_short_desc (schema, c_local_schema->short_desc);
+
+      if (best && best->long_desc)
+        gconf_schema_set_long_desc (schema, best->long_desc);
+      else if (c_local_schema && c_local_schema->long_desc)
+        gconf_schema_set_long_desc (schema, c_local_schema->long_desc);
+
+      return retval;
+    }
+}
+
+const char*
+markup_entry_get_name (MarkupEntry *entry)
+{
+  g_return_val_if_fail (entry->dir != NULL, NULL);
+  g_return_val_if_fail (entry->dir->entries_loaded, NULL);
+
+  return entry->name;
+}
+
+const char*
+markup_entry_get_schema_name (MarkupEntry  *entry)
+{
+  g_return_val_if_fail (entry->dir != NULL, NULL);
+  g_return_val_if_fail (entry->dir->entries_loaded, NULL);
+
+  return entry->schema_name;
+}
+
+const char*
+markup_entry_get_mod_user (MarkupEntry *entry)
+{
+  g_return_val_if_fail (entry->dir != NULL, NULL);
+  g_return_val_if_fail (entry->dir->entries_loaded, NULL);
+
+  return entry->mod_user;
+}
+
+GTime
+markup_entry_get_mod_time (MarkupEntry *entry)
+{
+  g_return_val_if_fail (entry->dir != NULL, 0);
+  g_return_val_if_fail (entry->dir->entries_loaded, 0);
+
+  return entry->mod_time;
+}
+
+static void
+markup_entry_set_mod_user (MarkupEntry *entry,
+                           const char  *muser)
+{
+  if (muser == entry->mod_user)
+    return;
+
+  g_free (entry->mod_user);
+  entry->mod_user = g_strdup (muser);
+}
+
+static void
+markup_entry_set_mod_time (MarkupEntry *entry,
+                           GTime        mtime)
+{
+  entry->mod_time = mtime;
+}
+
+/*
+ * Snapshots
+ *
+ * Parsing a big %gconf-tree.xml, and then each %gconf-tree-$(locale).xml
+ * as clients ask for it, dominates startup with large merged trees.
+ * So whenever one of those files has been parsed or saved we also try
+ * to write "$(file).snapshot" next to it: the same data in a flat
+ * binary form which is mapped and read in place.  A snapshot records
+ * the inode, size and mtime of the XML file it was made from and is
+ * ignored once they don't match anymore.
+ *
+ * A subtree loaded from a snapshot is built lazily: each MarkupDir
+ * remembers where its record is (snapshot_offset) and reads its
+ * entries and subdirs from there the first time they are needed,
+ * and each MarkupEntry in turn only decodes its value and local
+ * schemas when they are first asked for.
+ *
+ * Snapshots are in host byte order, every record is 4-byte aligned
+ * and every reference is a 32-bit offset from the start of the file,
+ * with 0 meaning NULL:
+ *
+ *   string: length, bytes, nul
+ *   dir:    name, n_entries, n_subdirs, entries[], subdirs[]
+ *   entry:  name, mod_time, mod_user, schema_name, value,
+ *           n_local_schemas,
+ *           { locale, short_desc, long_desc, default_value }[]
+ *   value:  type, then
+ *             int, bool: the value
+ *             float:     the 8 bytes of the double
+ *             string:    string
+ *             schema:    type, list_type, car_type, cdr_type, locale,
+ *                        short_desc, long_desc, owner, default_value
+ *             list:      list_type, n_values, values[]
+ *             pair:      car, cdr
+ *
+ * A locale snapshot uses the same records, each entry holding only
+ * the descriptions for that locale.
+ */
+
+#define SNAPSHOT_SUFFIX     ".snapshot"
+#define SNAPSHOT_MAGIC      "GConfSnp"
+#define SNAPSHOT_VERSION    1
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+
+/* Lists and pairs only nest a couple of levels, this catches loops */
+#define SNAPSHOT_MAX_VALUE_DEPTH 8
+
+typedef struct
+{
+  char    magic[8];
+  guint32 version;
+  guint32 byte_order;
+  guint64 xml_ino;
+  guint64 xml_size;
+  gint64  xml_mtime;
+  guint32 root;
+  guint32 reserved;
+} SnapshotHeader;
+
+struct _MarkupSnapshot
+{
+  GMappedFile *mapped;
+  const char  *data;
+  gsize        len;
+  char        *filename;
+  guint32      root;
+
+  guint        corrupt : 1;
+};
+
+static void
+markup_snapshot_free (MarkupSnapshot *snap)
+{
+  g_mapped_file_unref (snap->mapped);
+  g_free (snap->filename);
+  g_free (snap);
+}
+
+static MarkupSnapshot*
+markup_snapshot_open (const char *xml_filename)
+{
+  MarkupSnapshot *snap;
+  GMappedFile *mapped;
+  SnapshotHeader header;
+  struct stat statbuf;
+  char *filename;
+
+  if (g_stat (xml_filename, &statbuf) < 0)
+    return NULL;
+
+  filename = g_strconcat (xml_filename, SNAPSHOT_SUFFIX, NULL);
+
+  mapped = g_mapped_file_new (filename, FALSE, NULL);
+  if (mapped == NULL)
+    {
+      g_free (filename);
+      return NULL;
+    }
+
+  if (g_mapped_file_get_length (mapped) < sizeof (header) ||
+      g_mapped_file_get_length (mapped) > G_MAXUINT32)
+    goto stale;
+
+  memcpy (&header, g_mapped_file_get_contents (mapped), sizeof (header));
+
+  if (memcmp (header.magic, SNAPSHOT_MAGIC, sizeof (header.magic)) != 0 ||
+      header.version != SNAPSHOT_VERSION ||
+      header.byte_order != SNAPSHOT_BYTE_ORDER ||
+      header.xml_ino != (guint64) statbuf.st_ino ||
+      header.xml_size != (guint64) statbuf.st_size ||
+      header.xml_mtime != (gint64) statbuf.st_mtime)
+    goto stale;
+
+  snap = g_new0 (MarkupSnapshot, 1);
+
+  snap->mapped = mapped;
+  snap->data = g_mapped_file_get_contents (mapped);
+  snap->len = g_mapped_file_get_length (mapped);
+  snap->filename = filename;
+  snap->root = header.root;
+
+  return snap;
+
+ stale:
+  gconf_log (GCL_DEBUG, "Ignoring out of date snapshot \"%s\"", filename);
+
+  g_mapped_file_unref (mapped);
+  g_free (filename);
+
+  return NULL;
+}
+
+static gboolean
+snapshot_corrupt (MarkupSnapshot *snap)
+{
+  if (!snap->corrupt)
+    {
+      gconf_log (GCL_WARNING, _("Snapshot \"%s\" is corrupt, removing it"),
+                 snap->filename);
+      g_unlink (snap->filename);
+      snap->corrupt = TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+snapshot_get_u32 (MarkupSnapshot *snap,
+                  guint32         offset,
+                  guint32        *value)
+{
+  if (offset % 4 != 0 || offset < sizeof (SnapshotHeader) ||
+      offset > snap->len - 4)
+    return snapshot_corrupt (snap);
+
+  memcpy (value, snap->data + offset, 4);
+
+  return TRUE;
+}
+
+static gboolean
+snapshot_get_string (MarkupSnapshot  *snap,
+                     guint32          offset,
+                     const char     **str)
+{
+  guint32 len;
+
+  *str = NULL;
+
+  if (offset == 0)
+    return TRUE;
+
+  if (!snapshot_get_u32 (snap, offset, &len))
+    return FALSE;
+
+  offset += 4;
+
+  if (len >= snap->len - offset || snap->data[offset + len] != '\0')
+    return snapshot_corrupt (snap);
+
+  *str = snap->data + offset;
+
+  return TRUE;
+}
+
+/* Reads @n_words words starting at @offset */
+static gboolean
+snapshot_get_record (MarkupSnapshot *snap,
+                     guint32         offset,
+                     guint32        *words,
+                     guint           n_words)
+{
+  guint i;
+
+  for (i = 0; i < n_words; i++)
+    {
+      if (!snapshot_get_u32 (snap, offset + i * 4, &words[i]))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static GConfValue* snapshot_read_value (MarkupSnapshot *snap,
+                                        guint32         offset,
+                                        int             depth);
+
+static gboolean
+snapshot_read_optional_value (MarkupSnapshot  *snap,
+                              guint32          offset,
+                              int              depth,
+                              GConfValue     **value)
+{
+  *value = NULL;
+
+  if (offset == 0)
+    return TRUE;
+
+  *value = snapshot_read_value (snap, offset, depth);
+
+  return *value != NULL;
+}
+
+static GConfValue*
+snapshot_read_value (MarkupSnapshot *snap,
+                     guint32         offset,
+                     int             depth)
+{
+  GConfValue *value;
+  guint32 type;
+  guint32 words[9];
+
+  if (depth > SNAPSHOT_MAX_VALUE_DEPTH)
+    {
+      snapshot_corrupt (snap);
+      return NULL;
+    }
+
+  if (!snapshot_get_u32 (snap, offset, &type))
+    return NULL;
+
+  if (!GCONF_VALUE_TYPE_VALID (type))
+    {
+      snapshot_corrupt (snap);
+      return NULL;
+    }
+
+  offset += 4;
+  value = gconf_value_new (type);
+
+  switch (type)
+    {
+    case GCONF_VALUE_INT:
+      if (!snapshot_get_record (snap, offset, words, 1))
+        goto failed;
+      gconf_value_set_int (value, (gint32) words[0]);
+      break;
+
+    case GCONF_VALUE_BOOL:
+      if (!snapshot_get_record (snap, offset, words, 1))
+        goto failed;
+      gconf_value_set_bool (value, words[0] != 0);
+      break;
+
+    case GCONF_VALUE_FLOAT:
+      {
+        gdouble d;
+
+        if (!snapshot_get_record (snap, offset, words, 2))
+          goto failed;
+        memcpy (&d, words, sizeof (d));
+        gconf_value_set_float (value, d);
+      }
+      break;
+
+    case GCONF_VALUE_STRING:
+      {
+        const char *str;
+
+        if (!snapshot_get_record (snap, offset, words, 1) ||
+            !snapshot_get_string (snap, words[0], &str))
+          goto failed;
+        gconf_value_set_string (value, str ? str : "");
+      }
+      break;
+
+    case GCONF_VALUE_SCHEMA:
+      {
+        GConfSchema *schema;
+        GConfValue *default_value;
+        const char *locale, *short_desc, *long_desc, *owner;
+
+        if (!snapshot_get_record (snap, offset, words, 9) ||
+            !snapshot_get_string (snap, words[4], &locale) ||
+            !snapshot_get_string (snap, words[5], &short_desc) ||
+            !snapshot_get_string (snap, words[6], &long_desc) ||
+            !snapshot_get_string (snap, words[7], &owner) ||
+            !snapshot_read_optional_value (snap, words[8], depth + 1,
+                                           &default_value))
+          goto failed;
+
+        schema = gconf_schema_new ();
+        gconf_schema_set_type (schema, words[0]);
+        gconf_schema_set_list_type (schema, words[1]);
+        gconf_schema_set_car_type (schema, words[2]);
+        gconf_schema_set_cdr_type (schema, words[3]);
+        gconf_schema_set_locale (schema, locale);
+        gconf_schema_set_short_desc (schema, short_desc);
+        gconf_schema_set_long_desc (schema, long_desc);
+        gconf_schema_set_owner (schema, owner);
+        if (default_value != NULL)
+          gconf_schema_set_default_value_nocopy (schema, default_value);
+
+        gconf_value_set_schema_nocopy (value, schema);
+      }
+      break;
+
+    case GCONF_VALUE_LIST:
+      {
+        GSList *list;
+        guint32 i;
+
+        if (!snapshot_get_record (snap, offset, words, 2))
+          goto failed;
+
+        if (!GCONF_VALUE_TYPE_VALID (words[0]) ||
+            words[1] > snap->len / 4)
+          {
+            snapshot_corrupt (snap);
+            goto failed;
+          }
+
+        gconf_value_set_list_type (value, words[0]);
+
+        list = NULL;
+        for (i = 0; i < words[1]; i++)
+          {
+            guint32 item_offset;
+            GConfValue *item;
+
+            item = NULL;
+            if (snapshot_get_u32 (snap, offset + 8 + i * 4, &item_offset))
+              item = snapshot_read_value (snap, item_offset, depth + 1);
+
+            if (item == NULL)
+              {
+                g_slist_foreach (list, (GFunc) gconf_value_free, NULL);
+                g_slist_free (list);
+                goto failed;
+              }
+
+            list = g_slist_prepend (list, item);
+          }
+
+        gconf_value_set_list_nocopy (value, g_slist_reverse (list));
+      }
+      break;
+
+    case GCONF_VALUE_PAIR:
+      {
+        GConfValue *car, *cdr;
+
+        if (!snapshot_get_record (snap, offset, words, 2) ||
+            !snapshot_read_optional_value (snap, words[0], depth + 1, &car))
+          goto failed;
+
+        if (!snapshot_read_optional_value (snap, words[1], depth + 1, &cdr))
+          {
+            if (car != NULL)
+              gconf_value_free (car);
+            goto failed;
+          }
+
+        if (car != NULL)
+          gconf_value_set_car_nocopy (value, car);
+        if (cdr != NULL)
+          gconf_value_set_cdr_nocopy (value, cdr);
+      }
+      break;
+
+    default:
+      g_assert_not_reached ();
+      break;
+    }
+
+  return value;
+
+ failed:
+  gconf_value_free (value);
+
+  return NULL;
+}
+
+static LocalSchemaInfo*
+snapshot_read_local_schema (MarkupSnapshot *snap,
+                            guint32         offset)
+{
+  LocalSchemaInfo *local_schema;
+  GConfValue *default_value;
+  const char *locale, *short_desc, *long_desc;
+  guint32 words[4];
+
+  if (!snapshot_get_record (snap, offset, words, 4) ||
+      !snapshot_get_string (snap, words[0], &locale) ||
+      !snapshot_get_string (snap, words[1], &short_desc) ||
+      !snapshot_get_string (snap, words[2], &long_desc) ||
+      !snapshot_read_optional_value (snap, words[3], 0, &default_value))
+    return NULL;
+
+  if (locale == NULL)
+    {
+      if (default_value != NULL)
+        gconf_value_free (default_value);
+      snapshot_corrupt (snap);
+      return NULL;
+    }
+
+  local_schema = local_schema_info_new ();
+  local_schema->locale = g_strdup (locale);
+  local_schema->short_desc = g_strdup (short_desc);
+  local_schema->long_desc = g_strdup (long_desc);
+  local_schema->default_value = default_value;
+
+  return local_schema;
+}
+
+/* Only reads what's needed to list and look up the entry, see
+ * markup_entry_load_snapshot() for the rest
+ */
+static gboolean
+snapshot_read_entry (MarkupSnapshot *snap,
+                     MarkupDir      *dir,
+                     guint32         offset)
+{
+  MarkupEntry *entry;
+  const char *name, *mod_user, *schema_name;
+  guint32 words[4];
+
+  if (!snapshot_get_record (snap, offset, words, 4) ||
+      !snapshot_get_string (snap, words[0], &name) ||
+      !snapshot_get_string (snap, words[2], &mod_user) ||
+      !snapshot_get_string (snap, words[3], &schema_name))
+    return FALSE;
+
+  if (name == NULL)
+    return snapshot_corrupt (snap);
+
+  entry = markup_entry_new (dir, name);
+  entry->mod_time = (GTime) words[1];
+  entry->mod_user = g_strdup (mod_user);
+  entry->schema_name = g_strdup (schema_name);
+  entry->snapshot_offset = offset;
+
+  return TRUE;
+}
+
+/* Reads the value and local schemas of an entry built by
+ * snapshot_read_entry(); a client usually only ever looks at a few
+ * of the entries in a big tree, so we don't decode the others.
+ */
+static void
+markup_entry_load_snapshot (MarkupEntry *entry)
+{
+  MarkupSnapshot *snap;
+  GConfValue *value;
+  guint32 offset;
+  guint32 words[2];
+  guint32 i;
+
+  if (entry->snapshot_offset == 0)
+    return;
+
+  snap = entry->dir->subtree_root->snapshot;
+  offset = entry->snapshot_offset;
+
+  entry->snapshot_offset = 0;
+
+  if (!snapshot_get_record (snap, offset + 16, words, 2) ||
+      !snapshot_read_optional_value (snap, words[0], 0, &value))
+    return;
+
+  entry->value = value;
+
+  if (words[1] > snap->len / 16)
+    {
+      snapshot_corrupt (snap);
+      return;
+    }
+
+  for (i = 0; i < words[1]; i++)
+    {
+      LocalSchemaInfo *local_schema;
+
+      local_schema = snapshot_read_local_schema (snap, offset + 24 + i * 16);
+      if (local_schema == NULL)
+        break;
+
+      entry->local_schemas = g_slist_prepend (entry->local_schemas,
+                                              local_schema);
+    }
+
+  entry->local_schemas = g_slist_reverse (entry->local_schemas);
+}
+
+/*
+ * Checking a whole snapshot before using it, so that the lazy loading
+ * above never finds a bad record halfway through building a subtree.
+ * The checks follow the readers; @budget is the number of records
+ * still allowed, so that loops between records end.
+ */
+
+static gboolean snapshot_check_value (MarkupSnapshot *snap,
+                                      guint32         offset,
+                                      int             depth,
+                                      guint32        *budget);
+
+static gboolean
+snapshot_check_optional_value (MarkupSnapshot *snap,
+                               guint32         offset,
+                               int             depth,
+                               guint32        *budget)
+{
+  return offset == 0 || snapshot_check_value (snap, offset, depth, budget);
+}
+
+static gboolean
+snapshot_check_value (MarkupSnapshot *snap,
+                      guint32         offset,
+                      int             depth,
+                      guint32        *budget)
+{
+  const char *str;
+  guint32 type;
+  guint32 words[9];
+  guint32 i;
+
+  if (depth > SNAPSHOT_MAX_VALUE_DEPTH || *budget == 0)
+    return snapshot_corrupt (snap);
+  *budget -= 1;
+
+  if (!snapshot_get_u32 (snap, offset, &type))
+    return FALSE;
+
+  if (!GCONF_VALUE_TYPE_VALID (type))
+    return snapshot_corrupt (snap);
+
+  offset += 4;
+
+  switch (type)
+    {
+    case GCONF_VALUE_INT:
+    case GCONF_VALUE_BOOL:
+      return snapshot_get_record (snap, offset, words, 1);
+
+    case GCONF_VALUE_FLOAT:
+      return snapshot_get_record (snap, offset, words, 2);
+
+    case GCONF_VALUE_STRING:
+      return snapshot_get_record (snap, offset, words, 1) &&
+        snapshot_get_string (snap, words[0], &str);
+
+    case GCONF_VALUE_SCHEMA:
+      if (!snapshot_get_record (snap, offset, words, 9))
+        return FALSE;
+      for (i = 4; i < 8; i++)
+        {
+          if (!snapshot_get_string (snap, words[i], &str))
+            return FALSE;
+        }
+      return snapshot_check_optional_value (snap, words[8], depth + 1, budget);
+
+    case GCONF_VALUE_LIST:
+      if (!snapshot_get_record (snap, offset, words, 2))
+        return FALSE;
+
+      if (!GCONF_VALUE_TYPE_VALID (words[0]) ||
+          words[1] > snap->len / 4)
+        return snapshot_corrupt (snap);
+
+      for (i = 0; i < words[1]; i++)
+        {
+          guint32 item_offset;
+
+          if (!snapshot_get_u32 (snap, offset + 8 + i * 4, &item_offset) ||
+              !snapshot_check_value (snap, item_offset, depth + 1, budget))
+            return FALSE;
+        }
+      return TRUE;
+
+    case GCONF_VALUE_PAIR:
+      return snapshot_get_record (snap, offset, words, 2) &&
+        snapshot_check_optional_value (snap, words[0], depth + 1, budget) &&
+        snapshot_check_optional_value (snap, words[1], depth + 1, budget);
+
+    default:
+      g_assert_not_reached ();
+      return FALSE;
+    }
+}
+
+static gboolean
+snapshot_check_entry (MarkupSnapshot *snap,
+                      guint32         offset,
+                      guint32        *budget)
+{
+  const char *name, *str;
+  guint32 words[6];
+  guint32 i;
+
+  if (*budget == 0)
+    return snapshot_corrupt (snap);
+  *budget -= 1;
+
+  if (!snapshot_get_record (snap, offset, words, 6) ||
+      !snapshot_get_string (snap, words[0], &name) ||
+      !snapshot_get_string (snap, words[2], &str) ||
+      !snapshot_get_string (snap, words[3], &str) ||
+      !snapshot_check_optional_value (snap, words[4], 0, budget))
+    return FALSE;
+
+  if (name == NULL || words[5] > snap->len / 16)
+    return snapshot_corrupt (snap);
+
+  for (i = 0; i < words[5]; i++)
+    {
+      guint32 local_words[4];
+      const char *locale;
+
+      if (!snapshot_get_record (snap, offset + 24 + i * 16, local_words, 4) ||
+          !snapshot_get_string (snap, local_words[0], &locale) ||
+          !snapshot_get_string (snap, local_words[1], &str) ||
+          !snapshot_get_string (snap, local_words[2], &str) ||
+          !snapshot_check_optional_value (snap, local_words[3], 0, budget))
+        return FALSE;
+
+      if (locale == NULL)
+        return snapshot_corrupt (snap);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+snapshot_check_dir (MarkupSnapshot *snap,
+                    guint32         offset,
+                    guint32        *budget)
+{
+  guint32 words[3];
+  guint32 i;
+
+  if (*budget == 0)
+    return snapshot_corrupt (snap);
+  *budget -= 1;
+
+  if (!snapshot_get_record (snap, offset, words, 3))
+    return FALSE;
+
+  if (words[1] > snap->len / 4 || words[2] > snap->len / 4)
+    return snapshot_corrupt (snap);
+
+  offset += 12;
+
+  for (i = 0; i < words[1]; i++, offset += 4)
+    {
+      guint32 entry_offset;
+
+      if (!snapshot_get_u32 (snap, offset, &entry_offset) ||
+          !snapshot_check_entry (snap, entry_offset, budget))
+        return FALSE;
+    }
+
+  for (i = 0; i < words[2]; i++, offset += 4)
+    {
+      guint32 subdir_offset;
+      guint32 name_offset;
+      const char *name;
+
+      if (!snapshot_get_u32 (snap, offset, &subdir_offset) ||
+          !snapshot_get_u32 (snap, subdir_offset, &name_offset) ||
+          !snapshot_get_string (snap, name_offset, &name))
+        return FALSE;
+
+      if (name == NULL)
+        return snapshot_corrupt (snap);
+
+      if (!snapshot_check_dir (snap, subdir_offset, budget))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Returns FALSE if there's no usable snapshot, in which case nothing
+ * was loaded from it and the caller parses the XML file instead.
+ */
+static gboolean
+markup_dir_open_snapshot (MarkupDir *dir)
+{
+  char *xml_filename;
+  guint32 budget;
+
+  g_assert (dir->subtree_root == dir);
+  g_assert (dir->snapshot == NULL);
+
+  xml_filename = markup_dir_build_file_path (dir, TRUE, NULL);
+  dir->snapshot = markup_snapshot_open (xml_filename);
+  g_free (xml_filename);
+
+  if (dir->snapshot == NULL)
+    return FALSE;
+
+  /* Every record takes at least a word */
+  budget = dir->snapshot->len / 4;
+  if (!snapshot_check_dir (dir->snapshot, dir->snapshot->root, &budget))
+    {
+      markup_snapshot_free (dir->snapshot);
+      dir->snapshot = NULL;
+      return FALSE;
+    }
+
+  dir->snapshot_offset = dir->snapshot->root;
+
+  return TRUE;
+}
+
+/* Builds the entries and (still unread) subdirs of @dir from its
+ * record in the subtree's snapshot.  markup_dir_open_snapshot()
+ * checked every record, so the early returns below are only there
+ * in case of bugs.
+ */
+static void
+markup_dir_load_snapshot (MarkupDir *dir)
+{
+  MarkupSnapshot *snap;
+  guint32 offset;
+  guint32 words[3];
+  guint32 i;
+
+  g_assert (dir->snapshot_offset != 0);
+
+  snap = dir->subtree_root->snapshot;
+  offset = dir->snapshot_offset;
+
+  dir->snapshot_offset = 0;
+  dir->entries_loaded = TRUE;
+  dir->subdirs_loaded = TRUE;
+
+  if (!snapshot_get_record (snap, offset, words, 3))
+    return;
+
+  if (words[1] > snap->len / 4 || words[2] > snap->len / 4)
+    {
+      snapshot_corrupt (snap);
+      return;
+    }
+
+  offset += 12;
+
+  for (i = 0; i < words[1]; i++, offset += 4)
+    {
+      guint32 entry_offset;
+
+      if (!snapshot_get_u32 (snap, offset, &entry_offset) ||
+          !snapshot_read_entry (snap, dir, entry_offset))
+        goto out;
+    }
+
+  for (i = 0; i < words[2]; i++, offset += 4)
+    {
+      MarkupDir *subdir;
+      guint32 subdir_offset;
+      guint32 name_offset;
+      const char *name;
+
+      if (!snapshot_get_u32 (snap, offset, &subdir_offset) ||
+          !snapshot_get_u32 (snap, subdir_offset, &name_offset) ||
+          !snapshot_get_string (snap, name_offset, &name))
+        goto out;
+
+      if (name == NULL)
+        {
+          snapshot_corrupt (snap);
+          goto out;
+        }
+
+      subdir = markup_dir_new (dir->tree, dir, name);
+
+      subdir->not_in_filesystem = TRUE;
+      subdir->snapshot_offset = subdir_offset;
+    }
+
+ out:
+  /* Same order as the XML file */
+  dir->entries = g_slist_reverse (dir->entries);
+  dir->subdirs = g_slist_reverse (dir->subdirs);
+}
+
+static gboolean
+snapshot_apply_local_descs (MarkupSnapshot *snap,
+                            MarkupDir      *dir,
+                            guint32         offset)
+{
+  guint32 words[3];
+  guint32 i;
+
+  if (!snapshot_get_record (snap, offset, words, 3))
+    return FALSE;
+
+  if (words[1] > snap->len / 4 || words[2] > snap->len / 4)
+    return snapshot_corrupt (snap);
+
+  offset += 12;
+
+  for (i = 0; i < words[1]; i++, offset += 4)
+    {
+      MarkupEntry *entry;
+      LocalSchemaInfo *local_schema;
+      guint32 entry_words[6];
+      const char *name;
+
+      guint32 entry_offset;
+
+      if (!snapshot_get_u32 (snap, offset, &entry_offset) ||
+          !snapshot_get_record (snap, entry_offset, entry_words, 6) ||
+          !snapshot_get_string (snap, entry_words[0], &name))
+        return FALSE;
+
+      if (name == NULL || entry_words[5] != 1)
+        return snapshot_corrupt (snap);
+
+      local_schema = snapshot_read_local_schema (snap, entry_offset + 24);
+      if (local_schema == NULL)
+        return FALSE;
+
+      entry = markup_dir_lookup_entry (dir, name, NULL);
+      if (entry != NULL)
+        markup_entry_merge_local_schema (entry, local_schema);
+      else
+        local_schema_info_free (local_schema);
+    }
+
+  for (i = 0; i < words[2]; i++, offset += 4)
+    {
+      MarkupDir *subdir;
+      guint32 subdir_offset;
+      guint32 name_offset;
+      const char *name;
+
+      if (!snapshot_get_u32 (snap, offset, &subdir_offset) ||
+          !snapshot_get_u32 (snap, subdir_offset, &name_offset) ||
+          !snapshot_get_string (snap, name_offset, &name))
+        return FALSE;
+
+      if (name == NULL)
+        return snapshot_corrupt (snap);
+
+      subdir = markup_dir_lookup_subdir (dir, name, NULL);
+      if (subdir != NULL &&
+          !snapshot_apply_local_descs (snap, subdir, subdir_offset))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Returns FALSE if there's no usable snapshot; applying a locale
+ * file twice is harmless so the caller can then parse the XML file.
+ */
+static gboolean
+markup_dir_load_locale_snapshot (MarkupDir  *dir,
+                                 const char *locale)
+{
+  MarkupSnapshot *snap;
+  char *xml_filename;
+  gboolean retval;
+
+  xml_filename = markup_dir_build_file_path (dir, TRUE, locale);
+  snap = markup_snapshot_open (xml_filename);
+  g_free (xml_filename);
+
+  if (snap == NULL)
+    return FALSE;
+
+  retval = snapshot_apply_local_descs (snap, dir, snap->root);
+
+  markup_snapshot_free (snap);
+
+  return retval;
+}
+
+typedef struct
+{
+  GByteArray *data;
+  /* string -> offset, strings repeat a lot (locales, users, types) */
+  GHashTable *strings;
+  /* NULL when writing the snapshot of %gconf-tree.xml */
+  const char *locale;
+} SnapshotWriter;
+
+static guint32
+snapshot_write_words (SnapshotWriter *writer,
+                      const guint32  *words,
+                      guint           n_words)
+{
+  guint32 offset;
+
+  offset = writer->data->len;
+
+  g_byte_array_append (writer->data, (const guint8 *) words, n_words * 4);
+
+  return offset;
+}
+
+static guint32
+snapshot_write_string (SnapshotWriter *writer,
+                       const char     *str)
+{
+  static const guint8 padding[4] = { 0, 0, 0, 0 };
+  gpointer cached;
+  guint32 offset;
+  guint32 len;
+
+  if (str == NULL)
+    return 0;
+
+  if (g_hash_table_lookup_extended (writer->strings, str, NULL, &cached))
+    return GPOINTER_TO_UINT (cached);
+
+  len = strlen (str);
+  offset = snapshot_write_words (writer, &len, 1);
+
+  /* nul plus padding up to the next record */
+  g_byte_array_append (writer->data, (const guint8 *) str, len);
+  g_byte_array_append (writer->data, padding, 4 - len % 4);
+
+  g_hash_table_insert (writer->strings, g_strdup (str),
+                       GUINT_TO_POINTER (offset));
+
+  return offset;
+}
+
+static guint32
+snapshot_write_value (SnapshotWriter *writer,
+                      GConfValue     *value)
+{
+  GArray *words;
+  guint32 word;
+  guint32 offset;
+
+  if (value == NULL)
+    return 0;
+
+  words = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+  word = value->type;
+  g_array_append_val (words, word);
+
+  switch (value->type)
+    {
+    case GCONF_VALUE_INT:
+      word = (guint32) gconf_value_get_int (value);
+      g_array_append_val (words, word);
+      break;
+
+    case GCONF_VALUE_BOOL:
+      word = gconf_value_get_bool (value) ? 1 : 0;
+      g_array_append_val (words, word);
+      break;
+
+    case GCONF_VALUE_FLOAT:
+      {
+        gdouble d;
+        guint32 d_words[2];
+
+        d = gconf_value_get_float (value);
+        memcpy (d_words, &d, sizeof (d));
+        g_array_append_vals (words, d_words, 2);
+      }
+      break;
+
+    case GCONF_VALUE_STRING:
+      word = snapshot_write_string (writer, gconf_value_get_string (value));
+      g_array_append_val (words, word);
+      break;
+
+    case GCONF_VALUE_SCHEMA:
+      {
+        GConfSchema *schema;
+        guint32 s_words[9];
+
+        schema = gconf_value_get_schema (value);
+
+        s_words[0] = gconf_schema_get_type (schema);
+        s_words[1] = gconf_schema_get_list_type (schema);
+        s_words[2] = gconf_schema_get_car_type (schema);
+        s_words[3] = gconf_schema_get_cdr_type (schema);
+        s_words[4] = snapshot_write_string (writer, gconf_schema_get_locale (schema));
+        s_words[5] = snapshot_write_string (writer, gconf_schema_get_short_desc (schema));
+        s_words[6] = snapshot_write_string (writer, gconf_schema_get_long_desc (schema));
+        s_words[7] = snapshot_write_string (writer, gconf_schema_get_owner (schema));
+        s_words[8] = snapshot_write_value (writer, gconf_schema_get_default_value (schema));
+
+        g_array_append_vals (words, s_words, 9);
+      }
+      break;
+
+    case GCONF_VALUE_LIST:
+      {
+        GSList *tmp;
+
+        word = gconf_value_get_list_type (value);
+        g_array_append_val (words, word);
+        word = g_slist_length (gconf_value_get_list (value));
+        g_array_append_val (words, word);
+
+        tmp = gconf_value_get_list (value);
+        while (tmp != NULL)
+          {
+            word = snapshot_write_value (writer, tmp->data);
+            g_array_append_val (words, word);
+
+            tmp = tmp->next;
+          }
+      }
+      break;
+
+    case GCONF_VALUE_PAIR:
+      word = snapshot_write_value (writer, gconf_value_get_car (value));
+      g_array_append_val (words, word);
+      word = snapshot_write_value (writer, gconf_value_get_cdr (value));
+      g_array_append_val (words, word);
+      break;
 
-              tmp = tmp->next;
-            }
-        }
-    }
-  else
-    {
-      gconf_value_free (entry->value);
-      entry->value = NULL;
+    case GCONF_VALUE_INVALID:
+      g_assert_not_reached ();
+      break;
     }
 
-  /* Update mod time */
-  entry->mod_time = time (NULL);
+  offset = snapshot_write_words (writer, (guint32 *) words->data, words->len);
 
-  /* Need to save to disk */
-  markup_dir_set_entries_need_save (entry->dir);
-  markup_dir_queue_sync (entry->dir);
+  g_array_free (words, TRUE);
+
+  return offset;
 }
 
-void
-markup_entry_set_schema_name (MarkupEntry *entry,
-                              const char  *schema_name)
+static void
+snapshot_write_local_schema (SnapshotWriter  *writer,
+                             LocalSchemaInfo *local_schema,
+                             gboolean         write_descs,
+                             gboolean         write_default,
+                             GArray          *words)
 {
-  /* We have to have loaded entries, because
-   * someone called ensure_entry to get this
-   * entry.
-   */
-  g_return_if_fail (entry->dir != NULL);
-  g_return_if_fail (entry->dir->entries_loaded);
+  guint32 ls_words[4];
 
-  /* schema_name may be NULL to unset it */
-  
-  g_free (entry->schema_name);
-  entry->schema_name = g_strdup (schema_name);
-  
-  /* Update mod time */
-  entry->mod_time = time (NULL);
+  ls_words[0] = snapshot_write_string (writer, local_schema->locale);
+  ls_words[1] = write_descs ? snapshot_write_string (writer, local_schema->short_desc) : 0;
+  ls_words[2] = write_descs ? snapshot_write_string (writer, local_schema->long_desc) : 0;
+  ls_words[3] = write_default ? snapshot_write_value (writer, local_schema->default_value) : 0;
 
-  /* Need to save to disk */
-  markup_dir_set_entries_need_save (entry->dir);
-  markup_dir_queue_sync (entry->dir);
+  g_array_append_vals (words, ls_words, 4);
 }
 
-GConfValue*
-markup_entry_get_value (MarkupEntry *entry,
-                        const char **locales)
+/* Returns 0 if there's nothing to write for @entry */
+static guint32
+snapshot_write_entry (SnapshotWriter *writer,
+                      MarkupEntry    *entry)
 {
-  /* We have to have loaded entries, because
-   * someone called ensure_entry to get this
-   * entry.
-   */
-  g_return_val_if_fail (entry->dir != NULL, NULL);
-  g_return_val_if_fail (entry->dir->entries_loaded, NULL);
+  GArray *words;
+  guint32 e_words[6];
+  guint32 offset;
+  GSList *tmp;
 
-  if (entry->value == NULL)
-    {
-      return NULL;
-    }
-  else if (entry->value->type != GCONF_VALUE_SCHEMA)
+  /* Descriptions are only merged into entries that have been read */
+  if (writer->locale != NULL && entry->snapshot_offset != 0)
+    return 0;
+
+  markup_entry_load_snapshot (entry);
+
+  words = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+  if (writer->locale == NULL)
     {
-      return gconf_value_copy (entry->value);
+      e_words[0] = snapshot_write_string (writer, entry->name);
+      e_words[1] = (guint32) entry->mod_time;
+      e_words[2] = snapshot_write_string (writer, entry->mod_user);
+      e_words[3] = snapshot_write_string (writer, entry->schema_name);
+      e_words[4] = snapshot_write_value (writer, entry->value);
+      e_words[5] = g_slist_length (entry->local_schemas);
+
+      /* Like %gconf-tree.xml only keep the C descriptions, the
+       * others are in the locale files
+       */
+      tmp = entry->local_schemas;
+      while (tmp != NULL)
+        {
+          LocalSchemaInfo *local_schema = tmp->data;
+
+          snapshot_write_local_schema (writer, local_schema,
+                                       strcmp (local_schema->locale, "C") == 0,
+                                       TRUE, words);
+
+          tmp = tmp->next;
+        }
     }
   else
     {
-      GConfValue *retval;
-      GConfSchema *schema;
-      static const char *fallback_locales[2] = {
-        "C", NULL
-      };
-      LocalSchemaInfo *best;
-      LocalSchemaInfo *c_local_schema;
-      int i;
+      LocalSchemaInfo *local_schema;
 
-      retval = gconf_value_copy (entry->value);
-      schema = gconf_value_get_schema (retval);
-      g_return_val_if_fail (schema != NULL, NULL);
+      local_schema = get_local_schema_info (entry, writer->locale);
+      if (local_schema == NULL ||
+          (local_schema->short_desc == NULL && local_schema->long_desc == NULL))
+        {
+          g_array_free (words, TRUE);
+          return 0;
+        }
 
-      /* Find the best local schema */
+      e_words[0] = snapshot_write_string (writer, entry->name);
+      e_words[1] = 0;
+      e_words[2] = 0;
+      e_words[3] = 0;
+      e_words[4] = 0;
+      e_words[5] = 1;
 
-      if (locales == NULL || locales[0] == NULL)
-        locales = fallback_locales;
+      snapshot_write_local_schema (writer, local_schema, TRUE, FALSE, words);
+    }
 
-      best = NULL;
-      c_local_schema = NULL;
+  g_array_prepend_vals (words, e_words, 6);
 
-      i = 0;
-      while (locales[i] != NULL)
-        {
-          GSList *tmp;
+  offset = snapshot_write_words (writer, (guint32 *) words->data, words->len);
 
-          ensure_schema_descs_loaded (entry, locales[i]);
+  g_array_free (words, TRUE);
 
-          tmp = entry->local_schemas;
-          while (tmp != NULL)
-            {
-              LocalSchemaInfo *lsi = tmp->data;
+  return offset;
+}
 
-              if (c_local_schema == NULL &&
-                  strcmp (lsi->locale, "C") == 0)
-                {
-                  c_local_schema = lsi;
-                  if (best != NULL)
-                    break;
-                }
+/* Returns 0 if there's nothing to write for @dir */
+static guint32
+snapshot_write_dir (SnapshotWriter *writer,
+                    MarkupDir      *dir)
+{
+  GArray *entries;
+  GArray *subdirs;
+  guint32 d_words[3];
+  guint32 offset;
+  GSList *tmp;
 
-              if (best == NULL &&
-                  strcmp (locales[i], lsi->locale) == 0)
-                {
-                  best = lsi;
-                  if (c_local_schema != NULL)
-                    break;
-                }
+  /* A locale file only covers what was loaded while reading it */
+  if (dir->snapshot_offset != 0)
+    {
+      if (writer->locale != NULL)
+        return 0;
 
-              tmp = tmp->next;
-            }
+      markup_dir_load_snapshot (dir);
+    }
 
-          /* Quit as soon as we have the best possible locale */
-          if (best != NULL && c_local_schema != NULL)
-            break;
+  entries = g_array_new (FALSE, FALSE, sizeof (guint32));
+  subdirs = g_array_new (FALSE, FALSE, sizeof (guint32));
 
-          ++i;
-        }
+  tmp = dir->entries;
+  while (tmp != NULL)
+    {
+      offset = snapshot_write_entry (writer, tmp->data);
+      if (offset != 0)
+        g_array_append_val (entries, offset);
 
-      /* If we found localized info, add it to the return value,
-       * fall back to C locale if we can
-       */
+      tmp = tmp->next;
+    }
 
-      if (best && best->locale)
-	gconf_schema_set_locale (schema, best->locale);
-      else
-	gconf_schema_set_locale (schema, "C");
+  tmp = dir->subdirs;
+  while (tmp != NULL)
+    {
+      offset = snapshot_write_dir (writer, tmp->data);
+      if (offset != 0)
+        g_array_append_val (subdirs, offset);
 
-      if (best && best->default_value)
-        gconf_schema_set_default_value (schema, best->default_value);
-      else if (c_local_schema && c_local_schema->default_value)
-        gconf_schema_set_default_value (schema, c_local_schema->default_value);
+      tmp = tmp->next;
+    }
 
-      if (best && best->short_desc)
-        gconf_schema_set_short_desc (schema, best->short_desc);
-      else if (c_local_schema && c_local_schema->short_desc)
-        gconf_schema_set_short_desc (schema, c_local_schema->short_desc);
+  offset = 0;
 
-      if (best && best->long_desc)
-        gconf_schema_set_long_desc (schema, best->long_desc);
-      else if (c_local_schema && c_local_schema->long_desc)
-        gconf_schema_set_long_desc (schema, c_local_schema->long_desc);
+  if (writer->locale == NULL || dir->subtree_root == dir ||
+      entries->len > 0 || subdirs->len > 0)
+    {
+      d_words[0] = snapshot_write_string (writer, dir->name);
+      d_words[1] = entries->len;
+      d_words[2] = subdirs->len;
 
-      return retval;
+      offset = snapshot_write_words (writer, d_words, 3);
+      snapshot_write_words (writer, (guint32 *) entries->data, entries->len);
+      snapshot_write_words (writer, (guint32 *) subdirs->data, subdirs->len);
     }
-}
 
-const char*
-markup_entry_get_name (MarkupEntry *entry)
-{
-  g_return_val_if_fail (entry->dir != NULL, NULL);
-  g_return_val_if_fail (entry->dir->entries_loaded, NULL);
+  g_array_free (entries, TRUE);
+  g_array_free (subdirs, TRUE);
 
-  return entry->name;
+  return offset;
 }
 
-const char*
-markup_entry_get_schema_name (MarkupEntry  *entry)
+/* Writes the snapshot of the subtree file (or its @locale file)
+ * rooted at @dir, which must hold exactly what that file has.
+ * Failing is fine; system-wide trees usually aren't writable.
+ */
+static void
+markup_dir_write_snapshot (MarkupDir  *dir,
+                           const char *locale)
 {
-  g_return_val_if_fail (entry->dir != NULL, NULL);
-  g_return_val_if_fail (entry->dir->entries_loaded, NULL);
+  SnapshotWriter writer;
+  SnapshotHeader header;
+  struct stat statbuf;
+  char *xml_filename;
+  char *filename;
+  GError *error;
 
-  return entry->schema_name;
-}
+  if (dir->subtree_root != dir)
+    return;
 
-const char*
-markup_entry_get_mod_user (MarkupEntry *entry)
-{
-  g_return_val_if_fail (entry->dir != NULL, NULL);
-  g_return_val_if_fail (entry->dir->entries_loaded, NULL);
+  xml_filename = markup_dir_build_file_path (dir, TRUE, locale);
 
-  return entry->mod_user;
-}
+  if (g_stat (xml_filename, &statbuf) < 0)
+    {
+      g_free (xml_filename);
+      return;
+    }
 
-GTime
-markup_entry_get_mod_time (MarkupEntry *entry)
-{
-  g_return_val_if_fail (entry->dir != NULL, 0);
-  g_return_val_if_fail (entry->dir->entries_loaded, 0);
+  writer.data = g_byte_array_new ();
+  writer.strings = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          g_free, NULL);
+  writer.locale = locale;
 
-  return entry->mod_time;
-}
+  memset (&header, 0, sizeof (header));
+  g_byte_array_append (writer.data, (const guint8 *) &header, sizeof (header));
 
-static void
-markup_entry_set_mod_user (MarkupEntry *entry,
-                           const char  *muser)
-{
-  if (muser == entry->mod_user)
-    return;
+  memcpy (header.magic, SNAPSHOT_MAGIC, sizeof (header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.byte_order = SNAPSHOT_BYTE_ORDER;
+  header.xml_ino = statbuf.st_ino;
+  header.xml_size = statbuf.st_size;
+  header.xml_mtime = statbuf.st_mtime;
+  header.root = snapshot_write_dir (&writer, dir);
 
-  g_free (entry->mod_user);
-  entry->mod_user = g_strdup (muser);
-}
+  memcpy (writer.data->data, &header, sizeof (header));
 
-static void
-markup_entry_set_mod_time (MarkupEntry *entry,
-                           GTime        mtime)
-{
-  entry->mod_time = mtime;
+  filename = g_strconcat (xml_filename, SNAPSHOT_SUFFIX, NULL);
+
+  error = NULL;
+  if (writer.data->len > G_MAXUINT32 ||
+      !g_file_set_contents (filename, (const char *) writer.data->data,
+                            writer.data->len, &error))
+    {
+      gconf_log (GCL_DEBUG, "Could not write snapshot \"%s\": %s",
+                 filename, error ? error->message : "too large");
+      if (error != NULL)
+        g_error_free (error);
+    }
+
+  g_hash_table_destroy (writer.strings);
+  g_byte_array_free (writer.data, TRUE);
+  g_free (filename);
+  g_free (xml_filename);
 }
 
 /*
@@ -2798,7 +4648,6 @@ parse_entry_element (GMarkupParseContext  *context,
   else
     {
       MarkupDir  *dir;
-      GSList     *tmp;
       const char *name;
   
       name = NULL;
@@ -2819,20 +4668,10 @@ parse_entry_element (GMarkupParseContext  *context,
 
       dir = dir_stack_peek (info);
 
-      entry = NULL;
-
-      tmp = dir->entries;
-      while (tmp != NULL)
-        {
-          entry = tmp->data;
-
-          if (strcmp (entry->name, name) == 0)
-            break;
-          else
-            entry = NULL;
+      if (dir->snapshot_offset != 0)
+        markup_dir_load_snapshot (dir);
 
-          tmp = tmp->next;
-        }
+      entry = g_hash_table_lookup (dir->entries_by_name, name);
 
       /* Note: entry can be NULL here, in which case we'll discard
        * the LocalSchemaInfo once we've finished parsing this entry
@@ -2888,20 +4727,10 @@ parse_dir_element (GMarkupParseContext  *context,
     }
   else
     {
-      GSList *tmp;
-
-      tmp = parent->subdirs;
-      while (tmp != NULL)
-        {
-          dir = tmp->data;
-
-          if (strcmp (dir->name, name) == 0)
-            break;
-          else
-            dir = NULL;
+      if (parent->snapshot_offset != 0)
+        markup_dir_load_snapshot (parent);
 
-          tmp = tmp->next;
-        }
+      dir = g_hash_table_lookup (parent->subdirs_by_name, name);
 
       if (dir == NULL)
         {
@@ -3403,46 +5232,11 @@ end_element_handler (GMarkupParseContext *context,
           g_slist_free (info->local_schemas);
           info->local_schemas = NULL;
 
-          if (info->current_entry != NULL &&
-              info->current_entry->value != NULL &&
-              info->current_entry->value->type == GCONF_VALUE_SCHEMA)
-            {
-              GSList *tmp;
-
-              tmp = info->current_entry->local_schemas;
-              while (tmp != NULL)
-                {
-                  LocalSchemaInfo *lsi = tmp->data;
-
-                  if (strcmp (local_schema->locale, lsi->locale) == 0)
-                    {
-                      g_free (lsi->short_desc);
-                      lsi->short_desc = local_schema->short_desc;
-                      local_schema->short_desc = NULL;
-
-                      g_free (lsi->long_desc);
-                      lsi->long_desc = local_schema->short_desc;
-                      local_schema->long_desc = NULL;
-
-                      local_schema_info_free (local_schema);
-
-                      break;
-                    }
-
-                  tmp = tmp->next;
-                }
-
-              if (tmp == NULL)
-                {
-                  info->current_entry->local_schemas =
-                    g_slist_append (info->current_entry->local_schemas,
-                                    local_schema);
-                }
-            }
+          if (info->current_entry != NULL)
+            markup_entry_merge_local_schema (info->current_entry,
+                                             local_schema);
           else
-            {
-              local_schema_info_free (local_schema);
-            }
+            local_schema_info_free (local_schema);
         }
       
       info->current_entry = NULL;
@@ -3490,6 +5284,7 @@ end_element_handler (GMarkupParseContext *context,
         else if (dir->is_parser_dummy)
           {
             dir->parent->subdirs = g_slist_remove (dir->parent->subdirs, dir);
+            g_hash_table_remove (dir->parent->subdirs_by_name, dir->name);
             markup_dir_free (dir);
           }
 
@@ -4174,6 +5969,8 @@ write_entry (MarkupEntry *entry,
   retval = FALSE;
   local_schema_info = NULL;
 
+  markup_entry_load_snapshot (entry);
+
   if (save_as_subtree)
     {
       if (locale == NULL)
@@ -4588,7 +6385,9 @@ other_locales_foreach (const char *locale,
                          NULL,
                          data->file_mode,
                          &error);
-  if (error != NULL)
+  if (error == NULL)
+    markup_dir_write_snapshot (data->dir, locale);
+  else
     {
       if (data->first_error != NULL)
         data->first_error = error;
@@ -4611,6 +6410,7 @@ save_tree (MarkupDir  *dir,
     {
       OtherLocalesForeachData other_locales_foreach_data;
       GHashTable *other_locales;
+      GError *tmp_err;
 
       /* First save %gconf-tree.xml with all values and C locale
        * schema descriptions; then save schema descriptions for
@@ -4619,12 +6419,17 @@ save_tree (MarkupDir  *dir,
 
       other_locales = g_hash_table_new (g_str_hash, g_str_equal);
 
+      tmp_err = NULL;
       save_tree_with_locale (dir,
                              TRUE,
                              NULL,
                              other_locales,
                              file_mode,
-                             err);
+                             &tmp_err);
+      if (tmp_err == NULL)
+        markup_dir_write_snapshot (dir, NULL);
+      else
+        g_propagate_error (err, tmp_err);
 
       other_locales_foreach_data.dir         = dir;
       other_locales_foreach_data.file_mode   = file_mode;
@@ -85,16 +85,21 @@
  * We'll save the mod time of parse trees when we load them, so we can 
  * paranoia check that no one has change the file before we save.
  *
- * Ideally we could monitor our own process size and also free up
- * cache whenever we started to use massive RAM. However, not sure
- * this can be done at all portably. Could possibly have some measure
- * of parse tree size.
+ * Each cached directory also keeps a rough count of the bytes it
+ * holds, and the "cachesize=KIB" address flag puts a ceiling on the
+ * total: past it, the least recently used directories that are
+ * synced to disk get dropped.
  *
- * The libxml parse trees are pretty huge, so in theory we could
- * "compress" them by extracting all the information we want into a
- * specialized data structure, then nuking the parse tree. However,
- * that would add more CPU overhead at load and save time. Anyway, as
- * a first cut I'm not going to do this, we might do it later.
+ * The libxml parse trees are pretty huge, so with the "compact"
+ * address flag (e.g. oldxml:readwrite,compact:$(HOME)/.gconf) a
+ * directory extracts its entries into Entry structs as it is loaded
+ * and frees the parse tree. Schemas keep a detached node holding
+ * their locales. The tree is regenerated each time the directory is
+ * synced, which costs some CPU at save time.
+ *
+ * All the sources for one directory share its cache, so the flags of
+ * the first address for it win; a later address asking for a
+ * different "compact" or "cachesize" gets a warning.
  *
  * Atomic Saving
  *
@@ -129,6 +134,8 @@ struct _XMLSource {
 static XMLSource* xs_new       (const gchar* root_dir,
                                 guint dir_mode,
                                 guint file_mode,
+                                gboolean compact,
+                                gsize max_cache_bytes,
                                 GConfLock* lock);
 static void       xs_destroy   (XMLSource* source);
 
@@ -323,6 +330,8 @@ resolve_address (const gchar* address, GError** err)
   gchar** address_flags;
   gchar** iter;
   gboolean force_readonly;
+  gboolean compact;
+  gsize max_cache_bytes;
   
   root_dir = get_dir_from_address (address, err);
   if (root_dir == NULL)
@@ -347,6 +356,8 @@ resolve_address (const gchar* address, GError** err)
     }
 
   force_readonly = FALSE;
+  compact = FALSE;
+  max_cache_bytes = 0;
   
   address_flags = gconf_address_flags (address);  
   if (address_flags)
@@ -355,10 +366,12 @@ resolve_address (const gchar* address, GError** err)
       while (*iter)
         {
           if (strcmp (*iter, "readonly") == 0)
-            {
-              force_readonly = TRUE;
-              break;
-            }
+            force_readonly = TRUE;
+          else if (strcmp (*iter, "compact") == 0)
+            compact = TRUE;
+          else if (g_str_has_prefix (*iter, "cachesize="))
+            max_cache_bytes = (gsize) g_ascii_strtoull (*iter + strlen ("cachesize="),
+                                                        NULL, 10) * 1024;
 
           ++iter;
         }
@@ -448,7 +461,7 @@ resolve_address (const gchar* address, GError** err)
   
   /* Create the new source */
 
-  xsource = xs_new(root_dir, dir_mode, file_mode, lock);
+  xsource = xs_new(root_dir, dir_mode, file_mode, compact, max_cache_bytes, lock);
 
   gconf_log(GCL_DEBUG,
             _("Directory/file permissions for XML source at root %s are: %o/%o"),
@@ -844,7 +857,8 @@ cleanup_timeout(gpointer data)
 }
 
 static XMLSource*
-xs_new       (const gchar* root_dir, guint dir_mode, guint file_mode, GConfLock* lock)
+xs_new       (const gchar* root_dir, guint dir_mode, guint file_mode, gboolean compact,
+              gsize max_cache_bytes, GConfLock* lock)
 {
   XMLSource* xs;
 
@@ -854,7 +868,7 @@ xs_new       (const gchar* root_dir, guint dir_mode, guint file_mode, GConfLock*
 
   xs->root_dir = g_strdup(root_dir);
 
-  xs->cache = cache_get(xs->root_dir, dir_mode, file_mode);
+  xs->cache = cache_get(xs->root_dir, dir_mode, file_mode, compact, max_cache_bytes);
 
   xs->timeout_id = g_timeout_add_seconds(60*5, /* 1 sec * 60 s/min * 5 min */
                                  cleanup_timeout,
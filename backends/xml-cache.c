@@ -58,6 +58,10 @@ static void     cache_insert          (Cache       *cache,
 
 static void     cache_remove_from_parent (Cache *cache,
                                           Dir   *d);
+static void     cache_evict              (Cache *cache,
+                                          Dir   *d);
+static void     cache_enforce_budget     (Cache *cache,
+                                          Dir   *keep);
 static void     cache_add_to_parent      (Cache *cache,
                                           Dir   *d);
 
@@ -70,12 +74,22 @@ struct _Cache {
   guint dir_mode;
   guint file_mode;
   guint refcount;
+  guint compact : 1;
+  /* Every Dir, most recently looked up first. Cleaning walks it from
+   * the tail, so it never has to look at Dirs that are still in use.
+   */
+  GQueue lru;
+  gsize n_bytes;            /* sum of dir_get_size() */
+  gsize max_bytes;          /* 0 for no limit */
+  guint busy;               /* don't evict, someone holds a Dir */
 };
 
 Cache*
 cache_get (const gchar  *root_dir,
            guint dir_mode,
-           guint file_mode)
+           guint file_mode,
+           gboolean compact,
+           gsize max_bytes)
 {
   Cache* cache = NULL;
 
@@ -86,6 +100,13 @@ cache_get (const gchar  *root_dir,
 
   if (cache != NULL)
     {
+      /* Two caches of the same files would undo each other's writes */
+      if (cache->compact != (compact != FALSE) ||
+          cache->max_bytes != max_bytes)
+        gconf_log (GCL_WARNING,
+                   _("\"%s\" is already in use with other compact or cachesize flags, keeping those"),
+                   root_dir);
+
       cache->refcount += 1;
       return cache;
     }
@@ -101,6 +122,11 @@ cache_get (const gchar  *root_dir,
   cache->dir_mode = dir_mode;
   cache->file_mode = file_mode;
   cache->refcount = 1;
+  cache->compact = compact;
+  g_queue_init (&cache->lru);
+  cache->n_bytes = 0;
+  cache->max_bytes = max_bytes;
+  cache->busy = 0;
 
   safe_g_hash_table_insert (caches_by_root_dir, cache->root_dir, cache);
   
@@ -183,6 +209,7 @@ cache_sync_foreach (Dir      *dir,
           cache_remove_from_parent (sd->dc, dir);
           g_hash_table_remove (sd->dc->cache,
                                dir_get_name (dir));
+          g_queue_unlink (&sd->dc->lru, dir_get_cache_link (dir));
           cache_set_nonexistent (sd->dc, dir_get_name (dir),
                                  TRUE);
           dir_destroy (dir);
@@ -256,6 +283,9 @@ cache_sync (Cache    *cache,
 
   gconf_log (GCL_DEBUG, "Syncing the dir cache");
 
+  /* list holds on to every Dir */
+  cache->busy += 1;
+
  redo:
   sd.failed = FALSE;
   sd.deleted_some = FALSE;
@@ -281,6 +311,8 @@ cache_sync (Cache    *cache,
    */
   if (!sd.failed && sd.deleted_some)
     goto redo;
+
+  cache->busy -= 1;
   
   if (sd.failed && err && *err == NULL)
     {
@@ -291,63 +323,86 @@ cache_sync (Cache    *cache,
   return !sd.failed;  
 }
 
-typedef struct _CleanData CleanData;
-struct _CleanData {
-  GTime now;
-  Cache* cache;
-  GTime length;
-};
-
-static gboolean
-cache_clean_foreach(const gchar* key,
-                    Dir* dir, CleanData* cd)
+void
+cache_clean      (Cache        *cache,
+                  GTime         older_than)
 {
-  GTime last_access;
+  GTime now;
+  GList *link;
 
-  last_access = dir_get_last_access(dir);
+  now = time(NULL); /* ha ha, it's an online store! */
 
-  if ((cd->now - last_access) >= cd->length)
+  /* Everything goes through cache_lookup(), so the LRU order is the
+   * order of last access; dir_sync() can make a dir look younger
+   * than its place in the list, which only means it is kept longer.
+   */
+  link = cache->lru.tail;
+  while (link != NULL)
     {
+      Dir *dir = link->data;
+      GList *prev = link->prev;
+
+      if ((now - dir_get_last_access(dir)) < older_than)
+        break;
+
       if (!dir_sync_pending(dir))
-        {
-          dir_destroy(dir);
-          return TRUE;
-        }
+        cache_evict(cache, dir);
       else
-        {
-          gconf_log(GCL_WARNING, _("Unable to remove directory `%s' from the XML backend cache, because it has not been successfully synced to disk"),
-                    dir_get_name(dir));
-          return FALSE;
-        }
+        gconf_log(GCL_WARNING, _("Unable to remove directory `%s' from the XML backend cache, because it has not been successfully synced to disk"),
+                  dir_get_name(dir));
+
+      link = prev;
     }
-  else
-    return FALSE;
+
+  cache_enforce_budget(cache, NULL);
 }
 
-void
-cache_clean      (Cache        *cache,
-                  GTime         older_than)
+/* Drops a synced Dir from the cache; it is reloaded if needed again */
+static void
+cache_evict (Cache *cache,
+             Dir   *d)
 {
-  CleanData cd = { 0, NULL, 0 };
-  cd.cache = cache;
-  cd.length = older_than;
-  
-  cd.now = time(NULL); /* ha ha, it's an online store! */
-  
-  g_hash_table_foreach_remove(cache->cache, (GHRFunc)cache_clean_foreach,
-                              &cd);
+  g_queue_unlink (&cache->lru, dir_get_cache_link (d));
+  g_hash_table_remove (cache->cache, dir_get_name (d));
+  dir_destroy (d);
+}
+
+/* Evicts the least recently used synced Dirs other than keep
+ * until the cache is under budget. Dirs with changes that are not
+ * on disk yet can't go, so the cache can stay over budget until the
+ * next sync.
+ */
+static void
+cache_enforce_budget (Cache *cache,
+                      Dir   *keep)
+{
+  GList *link;
 
-#if 0
-  size = g_hash_table_size(cache->cache);
+  if (cache->max_bytes == 0 || cache->busy > 0)
+    return;
 
-  if (size != 0)
-    gconf_log (GCL_DEBUG,
-               "%u items remain in the cache after cleaning already-synced items older than %u seconds",
-               size,
-               older_than);
-#endif
+  link = cache->lru.tail;
+  while (link != NULL && cache->n_bytes > cache->max_bytes)
+    {
+      Dir *dir = link->data;
+      GList *prev = link->prev;
+
+      if (dir != keep && !dir_sync_pending (dir))
+        {
+          gconf_log (GCL_DEBUG, "Evicting dir %s to stay under %" G_GSIZE_FORMAT " bytes",
+                     dir_get_name (dir), cache->max_bytes);
+          cache_evict (cache, dir);
+        }
+
+      link = prev;
+    }
 }
 
+static Dir* cache_lookup_internal (Cache        *cache,
+                                   const gchar  *key,
+                                   gboolean      create_if_missing,
+                                   GError      **err);
+
 Dir*
 cache_lookup     (Cache        *cache,
                   const gchar  *key,
@@ -355,6 +410,32 @@ cache_lookup     (Cache        *cache,
                   GError  **err)
 {
   Dir* dir;
+
+  cache->busy += 1;
+  dir = cache_lookup_internal (cache, key, create_if_missing, err);
+  cache->busy -= 1;
+
+  if (dir != NULL)
+    {
+      GList *link = dir_get_cache_link (dir);
+
+      g_queue_unlink (&cache->lru, link);
+      g_queue_push_head_link (&cache->lru, link);
+
+      /* The caller only holds on to the Dir we return */
+      cache_enforce_budget (cache, dir);
+    }
+
+  return dir;
+}
+
+static Dir*
+cache_lookup_internal (Cache        *cache,
+                       const gchar  *key,
+                       gboolean      create_if_missing,
+                       GError      **err)
+{
+  Dir* dir;
   
   g_assert(key != NULL);
   g_return_val_if_fail(cache != NULL, NULL);
@@ -384,6 +465,8 @@ cache_lookup     (Cache        *cache,
           if (dir != NULL)
             {
               g_assert(err == NULL || *err == NULL);
+
+              dir_set_compact (dir, cache->compact);
               
               /* Cache it and add to parent */
               cache_insert (cache, dir);
@@ -421,6 +504,7 @@ cache_lookup     (Cache        *cache,
       gconf_log(GCL_DEBUG, "Creating new dir %s", key);
       
       dir = dir_new(key, cache->root_dir, cache->dir_mode, cache->file_mode);
+      dir_set_compact (dir, cache->compact);
 
       if (!dir_ensure_exists(dir, err))
         {
@@ -495,6 +579,10 @@ cache_insert (Cache* cache,
   gconf_log(GCL_DEBUG, "Caching dir %s", dir_get_name(d));
   
   safe_g_hash_table_insert(cache->cache, (gchar*)dir_get_name(d), d);
+
+  /* cache_lookup() moves it to the head */
+  g_queue_push_tail_link(&cache->lru, dir_get_cache_link(d));
+  dir_set_size_account(d, &cache->n_bytes);
 }
 
 static void
@@ -28,7 +28,9 @@ typedef struct _Cache Cache;
 
 Cache*   cache_get        (const gchar  *root_dir,
                            guint         dir_mode,
-                           guint         file_mode);
+                           guint         file_mode,
+                           gboolean      compact,
+                           gsize         max_bytes);
 void     cache_unref      (Cache        *cache);
 gboolean cache_sync       (Cache        *cache,
                            GError      **err);
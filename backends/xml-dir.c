@@ -77,8 +77,20 @@ struct _Dir {
   GSList *subdir_names;
   guint dirty : 1;
   guint need_rescan_subdirs : 1;
+  guint loaded : 1;
+  /* keep no parse tree outside of dir_sync() */
+  guint compact : 1;
+  gsize size;               /* see dir_get_size() */
+  gsize doc_size;           /* guess at what the parse tree takes */
+  gsize *size_account;      /* a total kept in step with size */
+  GList cache_link;         /* for the cache's LRU list */
 };
 
+/* A libxml tree takes several times the size of the file it was
+ * parsed from; this is only meant to be in the right ballpark.
+ */
+#define TREE_BYTES_PER_FILE_BYTE 6
+
 static void
 dir_load_doc(Dir* d, GError** err);
 
@@ -86,6 +98,12 @@ static Entry* dir_make_new_entry(Dir* d, const gchar* relative_key);
 
 static gboolean dir_forget_entry_if_useless(Dir* d, Entry* e);
 
+static void dir_free_doc(Dir* d);
+
+static void dir_set_size(Dir* d, gsize size);
+static void dir_entry_resized(Dir* d, gsize old_size, Entry* e);
+static void dir_recompute_size(Dir* d);
+
 static Dir*
 dir_blank(const gchar* key)
 {
@@ -119,10 +137,50 @@ dir_blank(const gchar* key)
   
   d->dir_mode = 0700;
   d->file_mode = 0600;
+
+  d->cache_link.data = d;
   
   return d;
 }
 
+void
+dir_set_compact (Dir      *d,
+                 gboolean  compact)
+{
+  g_return_if_fail (!d->loaded);
+
+  d->compact = compact;
+}
+
+/* Rough number of bytes the Dir keeps alive, updated as it changes */
+gsize
+dir_get_size (Dir *d)
+{
+  return d->size;
+}
+
+/* From now on *account is adjusted whenever the size of d changes,
+ * including when d is destroyed.
+ */
+void
+dir_set_size_account (Dir   *d,
+                      gsize *account)
+{
+  if (d->size_account)
+    *d->size_account -= d->size;
+
+  d->size_account = account;
+
+  if (d->size_account)
+    *d->size_account += d->size;
+}
+
+GList*
+dir_get_cache_link (Dir *d)
+{
+  return &d->cache_link;
+}
+
 Dir*
 dir_new (const gchar  *keyname,
          const gchar  *xml_root_dir,
@@ -140,6 +198,8 @@ dir_new (const gchar  *keyname,
 
   d->dir_mode = dir_mode;
   d->file_mode = file_mode;
+
+  dir_recompute_size (d);
   
   return d;
 }
@@ -210,6 +270,8 @@ dir_load (const gchar* key, const gchar* xml_root_dir, GError** err)
 
   d->dir_mode = dir_mode;
   d->file_mode = file_mode;
+
+  dir_recompute_size (d);
   
   gconf_log (GCL_DEBUG, "loaded dir %s", fs_dirname);
   
@@ -241,6 +303,9 @@ dir_destroy(Dir* d)
 
   if (d->doc != NULL)
     xmlFreeDoc (d->doc);
+
+  if (d->size_account)
+    *d->size_account -= d->size;
   
   g_free (d);
 }
@@ -277,6 +342,18 @@ entry_sync_foreach(const gchar* name, Entry* e, gpointer data)
   entry_sync_to_node(e);
 }
 
+static void
+entry_attach_foreach(const gchar* name, Entry* e, xmlNodePtr root)
+{
+  entry_attach_node(e, root);
+}
+
+static void
+entry_detach_foreach(const gchar* name, Entry* e, gpointer data)
+{
+  entry_detach_node(e);
+}
+
 gboolean
 dir_sync_pending (Dir *d)
 {
@@ -333,7 +410,7 @@ dir_child_added (Dir        *d,
 static gboolean
 dir_useless (Dir *d)
 {
-  if (d->doc == NULL)
+  if (!d->loaded)
     dir_load_doc (d, NULL);
 
   if (d->need_rescan_subdirs)
@@ -439,6 +516,15 @@ dir_sync (Dir      *d,
       gchar* old_filename;
       FILE* outfile;
 
+      if (d->compact)
+        {
+          /* Regenerate the parse tree just for writing it out */
+          d->doc = xmlNewDoc((xmlChar *)"1.0");
+          d->doc->xmlRootNode = xmlNewDocNode(d->doc, NULL, (xmlChar *)"gconf", NULL);
+          g_hash_table_foreach(d->entry_cache, (GHFunc)entry_attach_foreach,
+                               d->doc->xmlRootNode);
+        }
+
       /* We should have a doc if deleted is FALSE */
       g_assert(d->doc != NULL);
       
@@ -501,6 +587,14 @@ dir_sync (Dir      *d,
           goto failed_end_of_sync;
         }
 
+      if (!d->compact)
+        {
+          long written = ftell (outfile);
+
+          if (written > 0)
+            d->doc_size = written * TREE_BYTES_PER_FILE_BYTE;
+        }
+
       if (fclose (outfile) < 0)
         {
           gconf_set_error (err, GCONF_ERROR_FAILED, 
@@ -574,6 +668,11 @@ dir_sync (Dir      *d,
       g_free(tmp_filename);
       if (outfile)
         fclose (outfile);
+
+      if (d->compact)
+        dir_free_doc(d);
+
+      dir_recompute_size(d);
     }
 
   if (retval)
@@ -587,11 +686,12 @@ dir_set_value (Dir* d, const gchar* relative_key,
                const GConfValue* value, GError** err)
 {
   Entry* e;
+  gsize old_size;
   
-  if (d->doc == NULL)
+  if (!d->loaded)
     dir_load_doc(d, err);
 
-  if (d->doc == NULL)
+  if (!d->loaded)
     {
       g_return_if_fail( (err == NULL) || (*err != NULL) );
       return;
@@ -602,12 +702,16 @@ dir_set_value (Dir* d, const gchar* relative_key,
   if (e == NULL)
     e = dir_make_new_entry(d, relative_key);
 
+  old_size = entry_get_size(e);
+
   entry_set_value(e, value);
 
   d->last_access = time(NULL);
   entry_set_mod_time(e, d->last_access);
 
   entry_set_mod_user(e, g_get_user_name());
+
+  dir_entry_resized(d, old_size, e);
   
   d->dirty = TRUE;
 }
@@ -627,10 +731,10 @@ dir_get_value   (Dir* d,
 {
   Entry* e;
   
-  if (d->doc == NULL)
+  if (!d->loaded)
     dir_load_doc(d, err);
 
-  if (d->doc == NULL)
+  if (!d->loaded)
     {
       g_return_val_if_fail( (err == NULL) || (*err != NULL), NULL );
       return NULL;
@@ -648,10 +752,14 @@ dir_get_value   (Dir* d,
   else
     {
       GConfValue* val;
+      gsize old_size;
 
       g_assert(e != NULL);
 
+      /* may load a schema for another locale */
+      old_size = entry_get_size (e);
       val = entry_get_value (e, locales, err);
+      dir_entry_resized (d, old_size, e);
 
       /* Get schema name if requested */
       if (schema_name && entry_get_schema_name (e))
@@ -686,10 +794,10 @@ dir_get_metainfo(Dir* d, const gchar* relative_key, GError** err)
   
   d->last_access = time(NULL);
   
-  if (d->doc == NULL)
+  if (!d->loaded)
     dir_load_doc(d, err);
 
-  if (d->doc == NULL)
+  if (!d->loaded)
     {
       g_return_val_if_fail( (err == NULL) || (*err != NULL), NULL );
       return NULL;
@@ -708,13 +816,14 @@ dir_unset_value (Dir* d, const gchar* relative_key,
                  const gchar* locale, GError** err)
 {
   Entry* e;
+  gsize old_size;
   
   d->last_access = time(NULL);
   
-  if (d->doc == NULL)
+  if (!d->loaded)
     dir_load_doc(d, err);
 
-  if (d->doc == NULL)
+  if (!d->loaded)
     {
       g_return_if_fail( (err == NULL) || (*err != NULL) );
       return;
@@ -725,12 +834,16 @@ dir_unset_value (Dir* d, const gchar* relative_key,
   if (e == NULL)     /* nothing to change */
     return;
 
+  old_size = entry_get_size(e);
+
   if (entry_unset_value(e, locale))
     {
       /* If entry_unset() returns TRUE then
          the entry was changed (not already unset) */
       
       d->dirty = TRUE;
+
+      dir_entry_resized(d, old_size, e);
       
       if (dir_forget_entry_if_useless(d, e))
         {
@@ -739,8 +852,10 @@ dir_unset_value (Dir* d, const gchar* relative_key,
         }
       else
         {
+          old_size = entry_get_size(e);
           entry_set_mod_time(e, d->last_access);
           entry_set_mod_user(e, g_get_user_name());
+          dir_entry_resized(d, old_size, e);
         }
     }
   else
@@ -756,7 +871,7 @@ typedef struct _ListifyData ListifyData;
 
 struct _ListifyData {
   GSList* list;
-  const gchar* name;
+  Dir* dir;
   const gchar** locales;
 };
 
@@ -766,8 +881,11 @@ listify_foreach(const gchar* key, Entry* e, ListifyData* ld)
   GConfValue* val;
   GConfEntry* entry;
   GError* error = NULL;
+  gsize old_size;
   
+  old_size = entry_get_size (e);
   val = entry_get_value (e, ld->locales, &error);
+  dir_entry_resized (ld->dir, old_size, e);
 
   if (error != NULL)
     {
@@ -792,17 +910,17 @@ dir_all_entries (Dir* d, const gchar** locales, GError** err)
 {
   ListifyData ld;
   
-  if (d->doc == NULL)
+  if (!d->loaded)
     dir_load_doc(d, err);
 
-  if (d->doc == NULL)
+  if (!d->loaded)
     {
       g_return_val_if_fail( (err == NULL) || (*err != NULL), NULL );
       return NULL;
     }
   
   ld.list = NULL;
-  ld.name = d->key;
+  ld.dir = d;
   ld.locales = locales;
 
   g_hash_table_foreach(d->entry_cache, (GHFunc)listify_foreach,
@@ -842,10 +960,10 @@ dir_rescan_subdirs (Dir* d, GError** err)
   guint len;
   guint subdir_len;
   
-  if (d->doc == NULL)
+  if (!d->loaded)
     dir_load_doc (d, err);
   
-  if (d->doc == NULL)
+  if (!d->loaded)
     {
       g_return_val_if_fail ((err == NULL) || (*err != NULL), FALSE);
       return FALSE;
@@ -931,11 +1049,12 @@ dir_set_schema  (Dir         *d,
                  GError     **err)
 {
   Entry* e;
+  gsize old_size;
 
-  if (d->doc == NULL)
+  if (!d->loaded)
     dir_load_doc (d, err);
 
-  if (d->doc == NULL)
+  if (!d->loaded)
     {
       g_return_if_fail ((err == NULL) || (*err != NULL));
       return;
@@ -949,10 +1068,14 @@ dir_set_schema  (Dir         *d,
   if (e == NULL)
     e = dir_make_new_entry (d, relative_key);
 
+  old_size = entry_get_size (e);
+
   entry_set_mod_time (e, d->last_access);
 
   entry_set_schema_name (e, schema_key);
 
+  dir_entry_resized (d, old_size, e);
+
   if (schema_key == NULL)
     dir_forget_entry_if_useless (d, e);
 }
@@ -969,7 +1092,7 @@ dir_load_doc(Dir* d, GError** err)
   gboolean need_backup = FALSE;
   struct stat statbuf;
   
-  g_return_if_fail(d->doc == NULL);
+  g_return_if_fail(!d->loaded);
 
   if (stat(d->xml_filename, &statbuf) < 0)
     {
@@ -1005,6 +1128,8 @@ dir_load_doc(Dir* d, GError** err)
       GError *tmp_err;
       gboolean error_was_fatal;
 
+      d->doc_size = statbuf.st_size * TREE_BYTES_PER_FILE_BYTE;
+
       error_was_fatal = FALSE;
       tmp_err = NULL;
       d->doc = my_xml_parse_file (d->xml_filename, &tmp_err);
@@ -1072,6 +1197,8 @@ dir_load_doc(Dir* d, GError** err)
       dir_fill_cache_from_doc(d);
     }
 
+  d->loaded = TRUE;
+
   if (need_backup)
     {
       /* Back up the file we failed to parse, if it exists,
@@ -1096,6 +1223,60 @@ dir_load_doc(Dir* d, GError** err)
   
   g_assert(d->doc != NULL);
   g_assert(d->doc->xmlRootNode != NULL);
+
+  if (d->compact)
+    dir_free_doc(d);
+
+  dir_recompute_size(d);
+}
+
+/* Leaves the entries with only what they need, and drops the tree */
+static void
+dir_free_doc(Dir* d)
+{
+  g_hash_table_foreach(d->entry_cache, (GHFunc)entry_detach_foreach, NULL);
+
+  xmlFreeDoc(d->doc);
+  d->doc = NULL;
+  d->doc_size = 0;
+}
+
+static void
+dir_set_size(Dir* d, gsize size)
+{
+  /* unsigned wraparound makes this right for shrinking too */
+  if (d->size_account)
+    *d->size_account += size - d->size;
+
+  d->size = size;
+}
+
+static void
+dir_entry_resized(Dir* d, gsize old_size, Entry* e)
+{
+  dir_set_size(d, d->size - old_size + entry_get_size(e));
+}
+
+static void
+entry_size_foreach(const gchar* name, Entry* e, gsize* size)
+{
+  *size += entry_get_size(e);
+}
+
+static void
+dir_recompute_size(Dir* d)
+{
+  gsize size;
+
+  size = sizeof(Dir) + strlen(d->key) * 2 + 2;
+  if (d->xml_filename)
+    size += strlen(d->xml_filename) * 2 + 2;
+
+  size += d->doc_size;
+
+  g_hash_table_foreach(d->entry_cache, (GHFunc)entry_size_foreach, &size);
+
+  dir_set_size(d, size);
 }
 
 static Entry*
@@ -1103,12 +1284,15 @@ dir_make_new_entry(Dir* d, const gchar* relative_key)
 {
   Entry* e;
 
-  g_return_val_if_fail(d->doc != NULL, NULL);
-  g_return_val_if_fail(d->doc->xmlRootNode != NULL, NULL);
+  g_return_val_if_fail(d->loaded, NULL);
   
   e = entry_new(relative_key);
 
-  entry_set_node(e, xmlNewChild(d->doc->xmlRootNode, NULL, (xmlChar *)"entry", NULL));
+  /* compact dirs create the node when they sync */
+  if (d->doc != NULL)
+    entry_set_node(e, xmlNewChild(d->doc->xmlRootNode, NULL, (xmlChar *)"entry", NULL));
+
+  dir_set_size(d, d->size + entry_get_size(e));
   
   safe_g_hash_table_insert(d->entry_cache, (gchar*)entry_get_name(e), e);
   
@@ -1130,6 +1314,8 @@ dir_forget_entry_if_useless(Dir* d, Entry* e)
       
   g_hash_table_remove(d->entry_cache, entry_get_name(e));
 
+  dir_set_size(d, d->size - entry_get_size(e));
+
   entry_destroy(e);
 
   return TRUE;
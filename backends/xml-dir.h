@@ -33,6 +33,8 @@ Dir*           dir_new             (const gchar  *keyname,
 Dir*           dir_load            (const gchar  *key,
                                     const gchar  *xml_root_dir,
                                     GError      **err);
+void           dir_set_compact     (Dir          *d,
+                                    gboolean      compact);
 void           dir_destroy         (Dir          *d);
 void           dir_clear_cache     (Dir          *d);
 gboolean       dir_ensure_exists   (Dir          *d,
@@ -71,6 +73,10 @@ void           dir_set_schema      (Dir          *d,
                                     const gchar  *schema_key,
                                     GError  **err);
 GTime          dir_get_last_access (Dir          *d);
+gsize          dir_get_size        (Dir          *d);
+void           dir_set_size_account (Dir         *d,
+                                     gsize       *account);
+GList*         dir_get_cache_link  (Dir          *d);
 
 gboolean       dir_sync_pending    (Dir          *d);
 
@@ -88,6 +88,28 @@ entry_get_name(Entry* e)
   return e->name;
 }
 
+/* Rough number of bytes the entry keeps alive, not counting any
+ * parse tree node
+ */
+gsize
+entry_get_size (Entry *e)
+{
+  gsize size;
+
+  size = sizeof(Entry) + strlen(e->name) + 1;
+
+  if (e->schema_name)
+    size += strlen(e->schema_name) + 1;
+
+  if (e->mod_user)
+    size += strlen(e->mod_user) + 1;
+
+  if (e->cached_value)
+    size += gconf_value_get_size(e->cached_value);
+
+  return size;
+}
+
 void
 entry_set_node (Entry*e, xmlNodePtr node)
 {
@@ -102,6 +124,55 @@ entry_get_node (Entry*e)
   return e->node;
 }
 
+/* Used by compact dirs, which only keep a parse tree while syncing.
+ * Other values are fully described by the Entry itself, but a schema
+ * keeps its other locales in the node, so it gets a private copy of
+ * it that belongs to no document.
+ */
+void
+entry_detach_node (Entry *e)
+{
+  if (e->node == NULL)
+    return;
+
+  xmlUnlinkNode(e->node);
+
+  if (e->cached_value &&
+      e->cached_value->type == GCONF_VALUE_SCHEMA)
+    {
+      xmlNodePtr copy;
+
+      entry_sync_if_needed(e);
+
+      /* the original may use strings from its document's dict */
+      copy = xmlDocCopyNode(e->node, NULL, 1);
+      xmlFreeNode(e->node);
+      e->node = copy;
+    }
+  else
+    {
+      xmlFreeNode(e->node);
+      e->node = NULL;
+
+      /* a new node will have to be filled in */
+      e->dirty = TRUE;
+    }
+}
+
+void
+entry_attach_node (Entry      *e,
+                   xmlNodePtr  parent)
+{
+  if (e->node == NULL)
+    {
+      e->node = xmlNewNode(NULL, (xmlChar *)"entry");
+      e->dirty = TRUE;
+    }
+
+  /* also moves the node into parent's document */
+  xmlAddChild(parent, e->node);
+}
+
 GConfValue*
 entry_get_value(Entry* e, const gchar** locales, GError** err)
 {
@@ -190,6 +261,7 @@ entry_unset_value     (Entry        *e,
           GError* error = NULL;
           
           /* Remove the localized node from the XML tree */
+          entry_sync_if_needed(e);
           g_assert(e->node != NULL);
           node_unset_by_locale(e->node, locale);
 
@@ -398,11 +470,14 @@ void
 entry_sync_to_node (Entry* e)
 {
   g_return_if_fail(e != NULL);
-  g_return_if_fail(e->node != NULL);
   
   if (!e->dirty)
     return;
 
+  /* Entries of compact dirs may not have a node yet */
+  if (e->node == NULL)
+    e->node = xmlNewNode(NULL, (xmlChar *)"entry");
+
   /* Unset all properties, so we don't have old cruft. */
   if (e->node->properties)
     xmlFreePropList(e->node->properties);
@@ -29,6 +29,7 @@ typedef struct _Entry Entry;
 Entry*         entry_new             (const gchar  *relative_name);
 void           entry_destroy         (Entry        *entry);
 const gchar*   entry_get_name        (Entry        *entry);
+gsize          entry_get_size        (Entry        *entry);
 
 
 
@@ -36,6 +37,9 @@ const gchar*   entry_get_name        (Entry        *entry);
 void           entry_set_node        (Entry        *entry,
                                       xmlNodePtr    node);
 xmlNodePtr     entry_get_node        (Entry        *entry);
+void           entry_detach_node     (Entry        *entry);
+void           entry_attach_node     (Entry        *entry,
+                                      xmlNodePtr    parent);
 void           entry_fill_from_node  (Entry        *entry);
 void           entry_sync_to_node    (Entry        *entry);
 GConfValue*    entry_get_value       (Entry        *entry,
@@ -20,6 +20,7 @@
 #include <config.h>
 #include "gconf-changeset.h"
 #include "gconf-internals.h"
+#include <string.h>
 
 typedef enum {
   CHANGE_INVALID,
@@ -30,7 +31,7 @@ typedef enum {
 typedef struct _Change Change;
 
 struct _Change {
-  gchar* key;
+  const gchar* key;
   ChangeType type;
   GConfValue* value;
 };
@@ -155,7 +156,7 @@ get_change_unconditional (GConfChangeSet* cs,
     {
       c = change_new(key);
 
-      g_hash_table_insert(cs->hash, c->key, c);
+      g_hash_table_insert(cs->hash, (gchar*) c->key, c);
     }
 
   return c;
@@ -448,7 +449,7 @@ change_new    (const gchar* key)
 
   c = g_new(Change, 1);
 
-  c->key  = g_strdup(key);
+  c->key  = gconf_key_intern(key);
   c->type = CHANGE_INVALID;
   c->value = NULL;
 
@@ -460,7 +461,7 @@ change_destroy(Change* c)
 {
   g_return_if_fail(c != NULL);
   
-  g_free(c->key);
+  gconf_key_unintern(c->key);
 
   if (c->value)
     gconf_value_free(c->value);
@@ -505,6 +506,7 @@ struct CommitData {
   GError* error;
   GSList* remove_list;
   gboolean remove_committed;
+  GSList* failed_keys;
 };
 
 static void
@@ -533,6 +535,19 @@ commit_foreach (GConfChangeSet* cs,
     }
 }
 
+/* After a commit in one go, picks out the keys that made it */
+static void
+committed_foreach (GConfChangeSet* cs,
+                   const gchar* key,
+                   GConfValue* value,
+                   gpointer user_data)
+{
+  struct CommitData* cd = user_data;
+
+  if (g_slist_find_custom(cd->failed_keys, key, (GCompareFunc)strcmp) == NULL)
+    cd->remove_list = g_slist_prepend(cd->remove_list, (gchar*)key);
+}
+
 gboolean
 gconf_engine_commit_change_set   (GConfEngine* conf,
                            GConfChangeSet* cs,
@@ -550,13 +565,22 @@ gconf_engine_commit_change_set   (GConfEngine* conf,
   cd.error = NULL;
   cd.remove_list = NULL;
   cd.remove_committed = remove_committed;
+  cd.failed_keys = NULL;
 
   /* Because the commit could have lots of side
      effects, this makes it safer */
   gconf_change_set_ref(cs);
   gconf_engine_ref(conf);
   
-  gconf_change_set_foreach(cs, commit_foreach, &cd);
+  /* gconfd can take the whole set in one message and one sync */
+  if (gconf_engine_commit_change_set_at_once(conf, cs, &cd.failed_keys,
+                                             &cd.error))
+    {
+      if (remove_committed)
+        gconf_change_set_foreach(cs, committed_foreach, &cd);
+    }
+  else
+    gconf_change_set_foreach(cs, commit_foreach, &cd);
 
   tmp = cd.remove_list;
   while (tmp != NULL)
@@ -571,6 +595,8 @@ gconf_engine_commit_change_set   (GConfEngine* conf,
     }
 
   g_slist_free(cd.remove_list);
+  g_slist_foreach(cd.failed_keys, (GFunc)g_free, NULL);
+  g_slist_free(cd.failed_keys);
   
   gconf_change_set_unref(cs);
   gconf_engine_unref(conf);
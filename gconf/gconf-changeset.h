@@ -132,6 +132,18 @@ void     gconf_change_set_set_user_data (GConfChangeSet *cs,
                                          GDestroyNotify  dnotify);
 gpointer gconf_change_set_get_user_data (GConfChangeSet *cs);
 
+#ifdef GCONF_ENABLE_INTERNALS
+/* Sends all of cs to gconfd in one CommitChangeSet call. FALSE, with
+ * nothing done, if the engine can't (local engines, CORBA, an older
+ * gconfd). Otherwise TRUE; the keys that were not changed are copied
+ * into failed_keys and the first of their errors goes in err.
+ */
+gboolean gconf_engine_commit_change_set_at_once (GConfEngine     *conf,
+                                                 GConfChangeSet  *cs,
+                                                 GSList         **failed_keys,
+                                                 GError         **err);
+#endif /* GCONF_ENABLE_INTERNALS */
+
 
 
 G_END_DECLS
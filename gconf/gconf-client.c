@@ -103,10 +103,104 @@ static Listener* listener_new(GConfClientNotifyFunc func,
 
 static void listener_destroy(Listener* l);
 
+typedef struct _BatchListener BatchListener;
+
+struct _BatchListener {
+  GConfClientBatchNotifyFunc func;
+  gpointer data;
+  GFreeFunc destroy_notify;
+};
+
+static void batch_listener_destroy (BatchListener *l);
+
+/*
+ * Cache item (value of cache_hash)
+ */
+
+typedef struct _CacheItem CacheItem;
+
+struct _CacheItem {
+  GConfEntry* entry;
+  /* Position in the client's cache_clock; data points back at the item */
+  GList link;
+  gsize size;
+  /* Read since the clock hand last went past it */
+  guint referenced : 1;
+  /* Has a notification queued, which needs the cached entry */
+  guint pinned : 1;
+};
+
+static void cache_item_forget (GConfClient *client,
+                               CacheItem   *item);
+static void cache_enforce_limit (GConfClient *client,
+                                 CacheItem   *keep);
+
+/*
+ * Cached dir tree: one node per path component, so that whether a
+ * key is known not to exist can be answered in a single walk over
+ * the key without copying it.
+ */
+
+typedef struct _CacheDir CacheDir;
+
+struct _CacheDir {
+  CacheDir* parent;
+  /* Children, each mapped to itself; NULL until there are any */
+  GHashTable* children;
+  guint flags;
+  guint name_len;
+  const gchar* name; /* not nul-terminated in lookups */
+};
+
+enum {
+  /* Every entry directly in the dir is in cache_hash */
+  CACHE_DIR_CACHED    = 1 << 0,
+  /* Every dir below it has a node */
+  CACHE_DIR_RECURSIVE = 1 << 1
+};
+
+static void     cache_dir_mark      (GConfClient *client,
+                                     const gchar *dir,
+                                     guint        flags);
+static void     cache_dir_unmark    (GConfClient *client,
+                                     const gchar *dir,
+                                     gsize        len,
+                                     guint        flags);
+static void     cache_dir_unmark_below (GConfClient *client,
+                                        const gchar *dir,
+                                        guint        flags);
+static gboolean cache_dir_is_cached (GConfClient *client,
+                                     const gchar *dir);
+static gboolean cache_key_known_absent (GConfClient *client,
+                                        const gchar *key);
+static void     cache_dir_free      (CacheDir    *d);
+
 /*
  * GConfClient proper
  */
 
+typedef struct _GConfClientPrivate GConfClientPrivate;
+
+struct _GConfClientPrivate {
+  /* Keys with a notification queued, see gconf_client_set_notify_interval() */
+  GHashTable *notify_set;
+  guint notify_interval;
+  /* Which dirs are fully cached, by path component */
+  CacheDir *cache_dir_tree;
+  guint cache_serial;
+  /* Cache budget, see gconf_client_set_cache_limit() */
+  GQueue cache_clock;
+  guint cache_max_entries;
+  gsize cache_max_bytes;
+  gsize cache_bytes;
+  guint cache_hits;
+  guint cache_misses;
+  guint cache_evictions;
+  GConfListeners* batch_listeners;
+};
+
+#define GCONF_CLIENT_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), GCONF_TYPE_CLIENT, GConfClientPrivate))
+
 #define PUSH_USE_ENGINE(client) do { if ((client)->engine) gconf_engine_push_owner_usage ((client)->engine, client); } while (0)
 #define POP_USE_ENGINE(client) do { if ((client)->engine) gconf_engine_pop_owner_usage ((client)->engine, client); } while (0)
 
@@ -226,6 +320,8 @@ gconf_client_class_init (GConfClientClass *class)
 
   object_class->finalize  = gconf_client_finalize;
 
+  g_type_class_add_private (class, sizeof (GConfClientPrivate));
+
   if (g_getenv ("GCONF_DEBUG_TRACE_CLIENT") != NULL)
     do_trace = TRUE;
 }
@@ -233,18 +329,25 @@ gconf_client_class_init (GConfClientClass *class)
 static void
 gconf_client_init (GConfClient *client)
 {
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+
   client->engine = NULL;
   client->error_mode = GCONF_CLIENT_HANDLE_UNRETURNED;
   client->dir_hash = g_hash_table_new (g_str_hash, g_str_equal);
   client->cache_hash = g_hash_table_new (g_str_hash, g_str_equal);
-  client->cache_dirs = g_hash_table_new_full (g_str_hash, g_str_equal,
-					      g_free, NULL);
-  client->cache_recursive_dirs = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                        g_free, NULL);
+  priv->cache_dir_tree = NULL;
+  g_queue_init (&priv->cache_clock);
   /* We create the listeners only if they're actually used */
   client->listeners = NULL;
-  client->notify_list = NULL;
+  priv->batch_listeners = NULL;
+  priv->notify_set = NULL;
   client->notify_handler = 0;
+  priv->notify_interval = 0;
+  /* Public fields only kept for ABI, the state lives in priv */
+  client->notify_list = NULL;
+  client->pending_notify_count = 0;
+  client->cache_dirs = NULL;
+  client->cache_recursive_dirs = NULL;
 }
 
 static gboolean
@@ -298,6 +401,7 @@ static void
 gconf_client_finalize (GObject* object)
 {
   GConfClient* client = GCONF_CLIENT(object);
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
 
   gconf_client_unqueue_notifies (client);
   
@@ -312,17 +416,23 @@ gconf_client_finalize (GObject* object)
       client->listeners = NULL;
     }
 
+  if (priv->batch_listeners != NULL)
+    {
+      gconf_listeners_free (priv->batch_listeners);
+      priv->batch_listeners = NULL;
+    }
+
   g_hash_table_destroy (client->dir_hash);
   client->dir_hash = NULL;
   
   g_hash_table_destroy (client->cache_hash);
   client->cache_hash = NULL;
 
-  g_hash_table_destroy (client->cache_recursive_dirs);
-  client->cache_recursive_dirs = NULL;
-
-  g_hash_table_destroy (client->cache_dirs);
-  client->cache_dirs = NULL;
+  if (priv->cache_dir_tree != NULL)
+    {
+      cache_dir_free (priv->cache_dir_tree);
+      priv->cache_dir_tree = NULL;
+    }
 
   unregister_client (client);
 
@@ -421,6 +531,7 @@ notify_from_server_callback (GConfEngine* conf, guint cnxn_id,
    * listeners or functions connected to value_changed.
    * We know this key is under a directory in our dir list.
    */
+  GCONF_CLIENT_GET_PRIVATE (client)->cache_serial++;
   changed = gconf_client_cache (client, FALSE, entry, TRUE);
 
   if (!changed)
@@ -682,37 +793,30 @@ foreach_add_notifies(gpointer key, gpointer value, gpointer user_data)
     }
 }
 
+typedef struct {
+  GConfClient *client;
+  const gchar *key;
+} CacheForeachData;
+
 static gboolean
-clear_dir_cache_foreach (char* key, GConfEntry* entry, char *dir)
+clear_dir_cache_foreach (char* key, CacheItem* item, CacheForeachData* data)
 {
-  if (gconf_key_is_below (dir, key))
+  if (gconf_key_is_below (data->key, key))
     {
-      gconf_entry_free (entry);
+      cache_item_forget (data->client, item);
       return TRUE;
     }
   else
     return FALSE;
 }
 
-static gboolean
-clear_cache_dirs_foreach (char *key, gpointer value, char *dir)
-{
-  if (strcmp (dir, key) == 0 ||
-      gconf_key_is_below (dir, key))
-    {
-      trace ("'%s' no longer fully cached", dir);
-      return TRUE;
-    }
-
-  return FALSE;
-}
-
 static void
 gconf_client_real_remove_dir    (GConfClient* client,
                                  Dir* d,
                                  GError** err)
 {
   AddNotifiesData ad;
+  CacheForeachData cd;
 
   g_return_if_fail(d != NULL);
   g_return_if_fail(d->add_count == 0);
@@ -730,12 +834,12 @@ gconf_client_real_remove_dir    (GConfClient* client,
       d->notify_id = 0;
     }
   
+  cd.client = client;
+  cd.key = d->name;
   g_hash_table_foreach_remove (client->cache_hash,
                                (GHRFunc)clear_dir_cache_foreach,
-                               d->name);
-  g_hash_table_foreach_remove (client->cache_dirs,
-                               (GHRFunc)clear_cache_dirs_foreach,
-                               d->name);
+                               &cd);
+  cache_dir_unmark_below (client, d->name, CACHE_DIR_CACHED);
   dir_destroy(d);
 
   ad.client = client;
@@ -824,6 +928,96 @@ gconf_client_notify_remove  (GConfClient* client,
     }
 }
 
+/**
+ * gconf_client_batch_notify_add:
+ * @client: a #GConfClient.
+ * @namespace_section: the key or directory to listen to.
+ * @func: (scope notified) (closure user_data) (destroy destroy_notify):
+ * function called with the list of changed #GConfEntry.
+ * @user_data: data to pass to @func.
+ * @destroy_notify: function to call on @user_data when the
+ * notify is removed.
+ *
+ * Like gconf_client_notify_add(), but @func is called once for each
+ * flush of the notify queue, with all the entries at or below
+ * @namespace_section that changed since the last one. The list and
+ * the entries are only valid during the call.
+ *
+ * Return value: an ID to pass to gconf_client_batch_notify_remove().
+ */
+guint
+gconf_client_batch_notify_add (GConfClient* client,
+                               const gchar* namespace_section,
+                               GConfClientBatchNotifyFunc func,
+                               gpointer user_data,
+                               GFreeFunc destroy_notify)
+{
+  GConfClientPrivate *priv;
+  BatchListener *l;
+
+  g_return_val_if_fail(GCONF_IS_CLIENT(client), 0);
+  g_return_val_if_fail(func != NULL, 0);
+
+  priv = GCONF_CLIENT_GET_PRIVATE (client);
+
+  if (priv->batch_listeners == NULL)
+    priv->batch_listeners = gconf_listeners_new();
+
+  l = g_new(BatchListener, 1);
+  l->func = func;
+  l->data = user_data;
+  l->destroy_notify = destroy_notify;
+
+  return gconf_listeners_add (priv->batch_listeners,
+                              namespace_section,
+                              l,
+                              (GFreeFunc)batch_listener_destroy);
+}
+
+/**
+ * gconf_client_batch_notify_remove:
+ * @client: a #GConfClient.
+ * @cnxn: an ID returned by gconf_client_batch_notify_add().
+ *
+ * Stops calling the batch notify function added as @cnxn.
+ */
+void
+gconf_client_batch_notify_remove (GConfClient* client,
+                                  guint cnxn)
+{
+  GConfClientPrivate *priv;
+
+  g_return_if_fail(GCONF_IS_CLIENT(client));
+
+  priv = GCONF_CLIENT_GET_PRIVATE (client);
+
+  g_return_if_fail(priv->batch_listeners != NULL);
+
+  gconf_listeners_remove(priv->batch_listeners, cnxn);
+}
+
+/**
+ * gconf_client_set_notify_interval:
+ * @client: a #GConfClient.
+ * @interval_msec: how long to collect changes for, or 0.
+ *
+ * By default, changes are delivered to notify functions and the
+ * value_changed signal as soon as the main loop is idle. With a
+ * nonzero @interval_msec, they are collected for that long after the
+ * first one arrives and then delivered together, so listeners of
+ * @client see at most one round of notifications per interval. A key
+ * that changes several times meanwhile is only notified once, with
+ * its latest value.
+ */
+void
+gconf_client_set_notify_interval (GConfClient* client,
+                                  guint interval_msec)
+{
+  g_return_if_fail(GCONF_IS_CLIENT(client));
+
+  GCONF_CLIENT_GET_PRIVATE (client)->notify_interval = interval_msec;
+}
+
 void
 gconf_client_notify (GConfClient* client, const char* key)
 {
@@ -852,9 +1046,9 @@ gconf_client_set_error_handling(GConfClient* client,
 }
 
 static gboolean
-clear_cache_foreach (char* key, GConfEntry* entry, GConfClient* client)
+clear_cache_foreach (char* key, CacheItem* item, GConfClient* client)
 {
-  gconf_entry_free (entry);
+  cache_item_forget (client, item);
 
   return TRUE;
 }
@@ -866,41 +1060,66 @@ gconf_client_clear_cache(GConfClient* client)
   g_return_if_fail(GCONF_IS_CLIENT(client));
 
   trace ("Clearing cache");
+
+  GCONF_CLIENT_GET_PRIVATE (client)->cache_serial++;
   
   g_hash_table_foreach_remove (client->cache_hash, (GHRFunc)clear_cache_foreach,
                                client);
 
-  g_hash_table_remove_all (client->cache_dirs);
+  cache_dir_unmark_below (client, "/", CACHE_DIR_CACHED);
 }
 
-static void
-cache_pairs_in_dir(GConfClient* client, const gchar* path, gboolean recursive);
-
-static void 
-recurse_subdir_list(GConfClient* client, GSList* subdirs)
+/**
+ * gconf_client_set_cache_limit:
+ * @client: a #GConfClient.
+ * @max_entries: most entries to keep, or 0 for no limit.
+ * @max_bytes: roughly how much memory the entries may use, or 0 for no limit.
+ *
+ * Bounds the cache of @client. When it grows past either limit, the
+ * entries that haven't been read for the longest are dropped; they are
+ * fetched from the server again when asked for. Entries with a
+ * notification still queued are kept until it has been delivered.
+ * By default the cache is unbounded.
+ */
+void
+gconf_client_set_cache_limit (GConfClient *client,
+                              guint        max_entries,
+                              gsize        max_bytes)
 {
-  GSList* tmp;
+  GConfClientPrivate *priv;
+  g_return_if_fail (GCONF_IS_CLIENT (client));
 
-  tmp = subdirs;
-  
-  while (tmp != NULL)
-    {
-      gchar* s = tmp->data;
-      
-      cache_pairs_in_dir(client, s, TRUE);
+  priv = GCONF_CLIENT_GET_PRIVATE (client);
 
-      trace ("REMOTE: All dirs at '%s'", s);
-      PUSH_USE_ENGINE (client);
-      recurse_subdir_list(client,
-                          gconf_engine_all_dirs (client->engine, s, NULL));
-      POP_USE_ENGINE (client);
+  priv->cache_max_entries = max_entries;
+  priv->cache_max_bytes = max_bytes;
 
-      g_free(s);
-      
-      tmp = g_slist_next(tmp);
-    }
-  
-  g_slist_free(subdirs);
+  cache_enforce_limit (client, NULL);
+}
+
+/**
+ * gconf_client_get_cache_stats:
+ * @client: a #GConfClient.
+ * @stats: (out caller-allocates): return location for the statistics.
+ *
+ * Fills in @stats with how well the cache of @client has been doing
+ * since @client was created.
+ */
+void
+gconf_client_get_cache_stats (GConfClient           *client,
+                              GConfClientCacheStats *stats)
+{
+  GConfClientPrivate *priv;
+  g_return_if_fail (GCONF_IS_CLIENT (client));
+  g_return_if_fail (stats != NULL);
+
+  priv = GCONF_CLIENT_GET_PRIVATE (client);
+
+  stats->hits = priv->cache_hits;
+  stats->misses = priv->cache_misses;
+  stats->evictions = priv->cache_evictions;
+  stats->n_entries = g_hash_table_size (client->cache_hash);
+  stats->n_bytes = priv->cache_bytes;
 }
 
 static gboolean
@@ -977,12 +1196,57 @@ cache_pairs_in_dir(GConfClient* client, const gchar* dir, gboolean recursive)
       error = NULL;
     }
 
-  cache_entry_list_destructively (client, pairs);
+  /* Mark first: evicting one of the pairs to make room for the
+   * others takes the mark away again.
+   */
   trace ("Mark '%s' as fully cached", dir);
-  g_hash_table_insert (client->cache_dirs, g_strdup (dir), GINT_TO_POINTER (1));
-  
-  if (recursive)
-    g_hash_table_insert (client->cache_recursive_dirs, g_strdup (dir), GINT_TO_POINTER (1));
+  cache_dir_mark (client, dir,
+                  recursive ? CACHE_DIR_CACHED | CACHE_DIR_RECURSIVE : CACHE_DIR_CACHED);
+
+  cache_entry_list_destructively (client, pairs);
+}
+
+/* Fills the cache with everything below dir from a single engine call
+ * instead of two round trips per directory.
+ */
+static void
+cache_pairs_in_tree (GConfClient* client, const gchar* dir)
+{
+  GSList* pairs;
+  GSList* subdirs;
+  GSList* tmp;
+  GError* error = NULL;
+
+  trace ("REMOTE: Caching values recursively in '%s'", dir);
+
+  PUSH_USE_ENGINE (client);
+  pairs = gconf_engine_all_entries_recursive (client->engine, dir,
+                                              &subdirs, &error);
+  POP_USE_ENGINE (client);
+
+  if (error != NULL)
+    {
+      g_printerr (_("GConf warning: failure listing pairs in `%s': %s"),
+                  dir, error->message);
+      g_error_free (error);
+      return;
+    }
+
+  trace ("Mark '%s' and everything below it as fully cached", dir);
+  cache_dir_mark (client, dir, CACHE_DIR_CACHED | CACHE_DIR_RECURSIVE);
+
+  for (tmp = subdirs; tmp != NULL; tmp = tmp->next)
+    {
+      gchar* s = tmp->data;
+
+      cache_dir_mark (client, s, CACHE_DIR_CACHED | CACHE_DIR_RECURSIVE);
+
+      g_free (s);
+    }
+
+  g_slist_free (subdirs);
+
+  cache_entry_list_destructively (client, pairs);
 }
 
 void
@@ -1021,18 +1285,9 @@ gconf_client_preload    (GConfClient* client,
 
     case GCONF_CLIENT_PRELOAD_RECURSIVE:
       {
-        GSList* subdirs;
-
         trace ("Recursive preload of '%s'", dirname);
-        
-	trace ("REMOTE: All dirs at '%s'", dirname);
-        PUSH_USE_ENGINE (client);
-        subdirs = gconf_engine_all_dirs(client->engine, dirname, NULL);
-        POP_USE_ENGINE (client);
-        
-        cache_pairs_in_dir(client, dirname, TRUE);
-          
-        recurse_subdir_list(client, subdirs);
+
+        cache_pairs_in_tree (client, dirname);
       }
       break;
 
@@ -1050,45 +1305,14 @@ gconf_client_preload    (GConfClient* client,
  * ensure a consistent state
  */
 static gboolean
-remove_key_from_cache_foreach (const gchar *cached_key,
-                               GConfEntry  *entry,
-                               const gchar *key)
-{
-  if (strcmp (cached_key, key) == 0)
-    {
-      gconf_entry_free (entry);
-      return TRUE;
-    }
-
-  return FALSE;
-}
-
-static gboolean
-remove_key_from_cache_recursively_foreach (const gchar *cached_key,
-                                           GConfEntry  *entry,
-                                           const gchar *key)
+remove_key_from_cache_recursively_foreach (const gchar      *cached_key,
+                                           CacheItem        *item,
+                                           CacheForeachData *data)
 {
-  if (gconf_key_is_below (cached_key, key) == 0 || strcmp (cached_key, key) == 0)
+  if (gconf_key_is_below (cached_key, data->key) == 0 ||
+      strcmp (cached_key, data->key) == 0)
     {
-      /* Not sure why a null entry would be in the cache, but it happens
-       * sometimes, workaround for now to avoid crashing.
-       */
-      if (entry)
-        gconf_entry_free (entry);
-      return TRUE;
-    }
-
-  return FALSE;
-}
-
-static gboolean
-remove_dir_from_cache_foreach (char     *cached_dir,
-                               gpointer  value,
-                               char     *dir)
-{
-  if (strcmp (dir, cached_dir) == 0)
-    {
-      trace ("'%s' no longer fully cached", dir);
+      cache_item_forget (data->client, item);
       return TRUE;
     }
 
@@ -1103,25 +1327,26 @@ remove_dir_from_cache_foreach (char     *cached_dir,
 static void remove_dir_from_cache (GConfClient *client,
                                    const gchar *key)
 {
-  char *dir, *last_slash;
-  dir = g_strdup (key);
-  last_slash = strrchr (dir, '/');
+  const char *last_slash;
+
+  last_slash = strrchr (key, '/');
   g_assert (last_slash != NULL);
-  *last_slash = 0;
-  trace ("Remove dir '%s' from cache since one of keys is changed", dir);
-  g_hash_table_foreach_remove (client->cache_dirs,
-                               (GHRFunc) remove_dir_from_cache_foreach,
-                               dir);
-  g_free (dir);
+  trace ("Remove dir of '%s' from cache since one of keys is changed", key);
+  cache_dir_unmark (client, key, last_slash - key, CACHE_DIR_CACHED);
 }
 
 static void
 remove_key_from_cache (GConfClient *client,
                        const gchar *key)
 {
-  g_hash_table_foreach_remove (client->cache_hash,
-                               (GHRFunc) remove_key_from_cache_foreach,
-                               (char *) key);
+  CacheItem *item;
+
+  item = g_hash_table_lookup (client->cache_hash, key);
+  if (item != NULL)
+    {
+      g_hash_table_remove (client->cache_hash, key);
+      cache_item_forget (client, item);
+    }
   remove_dir_from_cache (client, key);
 }
 
@@ -1129,9 +1354,13 @@ static void
 remove_key_from_cache_recursively (GConfClient *client,
                                    const gchar *key)
 {
+  CacheForeachData cd;
+
+  cd.client = client;
+  cd.key = key;
   g_hash_table_foreach_remove (client->cache_hash,
                                (GHRFunc) remove_key_from_cache_recursively_foreach,
-                               (char *) key);
+                               &cd);
   remove_dir_from_cache (client, key);
 }
 
@@ -1181,6 +1410,8 @@ gconf_client_set             (GConfClient* client,
   gconf_engine_set (client->engine, key, val, &error);
   POP_USE_ENGINE (client);
 
+  GCONF_CLIENT_GET_PRIVATE (client)->cache_serial++;
+
 #ifdef HAVE_DBUS
   if (!error)
     cache_key_value_and_notify (client, key, (GConfValue *) val, FALSE);
@@ -1200,6 +1431,8 @@ gconf_client_unset          (GConfClient* client,
   gconf_engine_unset(client->engine, key, &error);
   POP_USE_ENGINE (client);
 
+  GCONF_CLIENT_GET_PRIVATE (client)->cache_serial++;
+
 #ifdef HAVE_DBUS
   if (!error)
     remove_key_from_cache (client, key);
@@ -1227,6 +1460,8 @@ gconf_client_recursive_unset (GConfClient *client,
   gconf_engine_recursive_unset(client->engine, key, flags, &error);
   POP_USE_ENGINE (client);
 
+  GCONF_CLIENT_GET_PRIVATE (client)->cache_serial++;
+
 #ifdef HAVE_DBUS
   if (!error)
     remove_key_from_cache_recursively (client, key);
@@ -1260,6 +1495,34 @@ copy_entry_list (GSList *list)
   return copy;
 }
 
+/* Only valid if dir is fully cached */
+static GSList*
+copy_cached_entries_in_dir (GConfClient *client,
+                            const gchar *dir)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  GSList *retval;
+  int dirlen;
+
+  dirlen = strlen (dir);
+  retval = NULL;
+  g_hash_table_iter_init (&iter, client->cache_hash);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      const gchar *id = key;
+      CacheItem *item = value;
+      if (g_str_has_prefix (id, dir) &&
+          id + dirlen == strrchr (id, '/'))
+        {
+          item->referenced = TRUE;
+          retval = g_slist_prepend (retval, gconf_entry_copy (item->entry));
+        }
+    }
+
+  return retval;
+}
+
 /**
  * gconf_client_all_entries:
  * @client: a #GConfClient.
@@ -1283,28 +1546,12 @@ gconf_client_all_entries    (GConfClient* client,
 {
   GError *error = NULL;
   GSList *retval;
-  int dirlen;
 
-  if (g_hash_table_lookup (client->cache_dirs, dir))
+  if (cache_dir_is_cached (client, dir))
     {
-      GHashTableIter iter;
-      gpointer key, value;
-
       trace ("CACHED: Getting all values in '%s'", dir);
 
-      dirlen = strlen (dir);
-      retval = NULL;
-      g_hash_table_iter_init (&iter, client->cache_hash);
-      while (g_hash_table_iter_next (&iter, &key, &value))
-        {
-          const gchar *id = key;
-          GConfEntry *entry = value;
-          if (g_str_has_prefix (id, dir) &&
-              id + dirlen == strrchr (id, '/'))
-            retval = g_slist_prepend (retval, gconf_entry_copy (entry));
-        }
-
-      return retval;
+      return copy_cached_entries_in_dir (client, dir);
     }
 
   trace ("REMOTE: Getting all values in '%s'", dir);
@@ -1320,9 +1567,9 @@ gconf_client_all_entries    (GConfClient* client,
 
   if (key_being_monitored (client, dir))
     {
-      cache_entry_list_destructively (client, copy_entry_list (retval));
       trace ("Mark '%s' as fully cached", dir);
-      g_hash_table_insert (client->cache_dirs, g_strdup (dir), GINT_TO_POINTER (1));
+      cache_dir_mark (client, dir, CACHE_DIR_CACHED);
+      cache_entry_list_destructively (client, copy_entry_list (retval));
     }
 
   return retval;
@@ -1583,36 +1830,147 @@ gconf_client_get_entry (GConfClient* client,
   return entry;
 }
 
-GConfValue*
-gconf_client_get             (GConfClient* client,
-                              const gchar* key,
-                              GError** err)
+/**
+ * gconf_client_get_many:
+ * @client: a #GConfClient.
+ * @keys: (element-type utf8): list of keys to look up.
+ * @err: the return location for an allocated #GError, or <symbol>NULL</symbol> to ignore errors.
+ *
+ * Like gconf_client_get_entry() for each of @keys, with schema
+ * defaults.  Keys found in the client-side cache are answered from
+ * it; all the others are fetched from the server in one request, see
+ * gconf_engine_get_many(), and cached if they are in a directory
+ * added with gconf_client_add_dir().
+ *
+ * Return value: (element-type GConfEntry) (transfer full): a list with
+ * one #GConfEntry per key, in the order of @keys; the entry's value is
+ * <symbol>NULL</symbol> if the key is unset.
+ */
+GSList*
+gconf_client_get_many (GConfClient* client,
+                       GSList* keys,
+                       GError** err)
 {
-  g_return_val_if_fail (GCONF_IS_CLIENT (client), NULL);
-  g_return_val_if_fail (key != NULL, NULL);
-  return gconf_client_get_full (client, key, NULL, TRUE, err);
-}
+  GError *error = NULL;
+  GSList *retval;
+  GSList *missing;
+  GSList *fetched;
+  GSList *tmp;
+  GSList *k;
+  GSList *f;
 
-GConfValue*
-gconf_client_get_without_default  (GConfClient* client,
-                                   const gchar* key,
-                                   GError** err)
-{
   g_return_val_if_fail (GCONF_IS_CLIENT (client), NULL);
-  g_return_val_if_fail (key != NULL, NULL);
-  return gconf_client_get_full (client, key, NULL, FALSE, err);
-}
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
 
-GConfValue*
-gconf_client_get_default_from_schema (GConfClient* client,
-                                      const gchar* key,
-                                      GError** err)
-{
-  GError* error = NULL;
-  GConfEntry *entry = NULL;
-  GConfValue *val = NULL;
-  
-  g_return_val_if_fail (err == NULL || *err == NULL, NULL);  
+  /* Answer what we can from the cache, leaving NULL holes for the rest */
+  retval = NULL;
+  missing = NULL;
+  for (tmp = keys; tmp != NULL; tmp = tmp->next)
+    {
+      const gchar *key = tmp->data;
+      GConfEntry *entry = NULL;
+
+      if (gconf_client_lookup (client, key, &entry))
+        {
+          trace ("CACHED: Query for '%s'", key);
+
+          if (entry != NULL)
+            entry = gconf_entry_copy (entry);
+          else
+            entry = gconf_entry_new (key, NULL);
+        }
+      else
+        missing = g_slist_prepend (missing, (gchar*) key);
+
+      retval = g_slist_prepend (retval, entry);
+    }
+
+  retval = g_slist_reverse (retval);
+
+  if (missing == NULL)
+    return retval;
+
+  missing = g_slist_reverse (missing);
+
+  trace ("REMOTE: Query for %u keys", g_slist_length (missing));
+  PUSH_USE_ENGINE (client);
+  fetched = gconf_engine_get_many (client->engine, missing, &error);
+  POP_USE_ENGINE (client);
+
+  g_slist_free (missing);
+
+  if (error != NULL)
+    {
+      for (tmp = retval; tmp != NULL; tmp = tmp->next)
+        {
+          if (tmp->data != NULL)
+            gconf_entry_free (tmp->data);
+        }
+      g_slist_free (retval);
+
+      handle_error (client, error, err);
+
+      return NULL;
+    }
+
+  /* Fill the holes in order */
+  f = fetched;
+  for (tmp = retval, k = keys; tmp != NULL; tmp = tmp->next, k = k->next)
+    {
+      GConfEntry *entry;
+
+      if (tmp->data != NULL)
+        continue;
+
+      if (f != NULL)
+        {
+          entry = f->data;
+          f = f->next;
+        }
+      else
+        entry = gconf_entry_new (k->data, NULL);
+
+      if (key_being_monitored (client, entry->key))
+        gconf_client_cache (client, FALSE, entry, FALSE);
+
+      tmp->data = entry;
+    }
+
+  g_slist_free (fetched);
+
+  return retval;
+}
+
+GConfValue*
+gconf_client_get             (GConfClient* client,
+                              const gchar* key,
+                              GError** err)
+{
+  g_return_val_if_fail (GCONF_IS_CLIENT (client), NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+  return gconf_client_get_full (client, key, NULL, TRUE, err);
+}
+
+GConfValue*
+gconf_client_get_without_default  (GConfClient* client,
+                                   const gchar* key,
+                                   GError** err)
+{
+  g_return_val_if_fail (GCONF_IS_CLIENT (client), NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+  return gconf_client_get_full (client, key, NULL, FALSE, err);
+}
+
+GConfValue*
+gconf_client_get_default_from_schema (GConfClient* client,
+                                      const gchar* key,
+                                      GError** err)
+{
+  GError* error = NULL;
+  GConfEntry *entry = NULL;
+  GConfValue *val = NULL;
+  
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);  
   g_return_val_if_fail (client != NULL, NULL);
   g_return_val_if_fail (GCONF_IS_CLIENT(client), NULL);
   g_return_val_if_fail (key != NULL, NULL);
@@ -2279,199 +2637,1178 @@ gconf_client_value_changed          (GConfClient* client,
 }
 
 /*
- * Internal utility
+ * Asynchronous API
+ *
+ * Requests go out through the engine's non-blocking calls and the
+ * answers arrive from the main loop, so many of them can be in flight
+ * at once.  A reply only goes into the cache if nothing has written to
+ * the cache since the request was sent (see cache_serial); otherwise it
+ * could be older than what we already have.
  */
 
-static gboolean
-gconf_client_cache (GConfClient *client,
-                    gboolean     take_ownership,
-                    GConfEntry  *new_entry,
-                    gboolean     preserve_schema_name)
+typedef struct {
+  gchar      *key;
+  GConfValue *value;
+  guint       cache_serial;
+} AsyncData;
+
+static AsyncData*
+async_data_new (GConfClient      *client,
+                const gchar      *key,
+                const GConfValue *value)
 {
-  gpointer oldkey = NULL, oldval = NULL;
-
-  if (g_hash_table_lookup_extended (client->cache_hash, new_entry->key, &oldkey, &oldval))
-    {
-      /* Already have a value, update it */
-      GConfEntry *entry = oldval;
-      gboolean changed;
-      
-      g_assert (entry != NULL);
+  AsyncData *data;
 
-      changed = ! gconf_entry_equal (entry, new_entry);
+  data = g_new (AsyncData, 1);
+  data->key = g_strdup (key);
+  data->value = value ? gconf_value_copy (value) : NULL;
+  data->cache_serial = GCONF_CLIENT_GET_PRIVATE (client)->cache_serial;
 
-      if (changed)
-        {
-          trace ("Updating value of '%s' in the cache",
-                 new_entry->key);
+  return data;
+}
 
-          if (!take_ownership)
-            new_entry = gconf_entry_copy (new_entry);
-          
-          if (preserve_schema_name)
-            gconf_entry_set_schema_name (new_entry, 
-                                         gconf_entry_get_schema_name (entry));
+static void
+async_data_free (gpointer p)
+{
+  AsyncData *data = p;
 
-          g_hash_table_replace (client->cache_hash,
-                                new_entry->key,
-                                new_entry);
+  g_free (data->key);
+  if (data->value)
+    gconf_value_free (data->value);
+  g_free (data);
+}
 
-          /* oldkey is inside entry */
-          gconf_entry_free (entry);
-        }
-      else
-        {
-          trace ("Value of '%s' hasn't actually changed, would have updated in cache if it had",
-                 new_entry->key);
+static void
+get_async_ready (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GTask *task = user_data;
+  GConfClient *client = g_task_get_source_object (task);
+  AsyncData *data = g_task_get_task_data (task);
+  GConfEntry *entry;
+  GConfValue *value;
+  GError *error = NULL;
 
-          if (take_ownership)
-            gconf_entry_free (new_entry);
-        }
+  entry = gconf_engine_get_entry_finish (client->engine, result, &error);
 
-      return changed;
-    }
-  else
+  if (error != NULL)
     {
-      /* Create a new entry */
-      if (!take_ownership)
-        new_entry = gconf_entry_copy (new_entry);
-      
-      g_hash_table_insert (client->cache_hash, new_entry->key, new_entry);
-      trace ("Added value of '%s' to the cache",
-             new_entry->key);
-
-      return TRUE; /* changed */
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
     }
+
+  if (GCONF_CLIENT_GET_PRIVATE (client)->cache_serial == data->cache_serial &&
+      key_being_monitored (client, data->key))
+    gconf_client_cache (client, FALSE, entry, FALSE);
+
+  value = gconf_entry_get_value (entry);
+  if (value != NULL)
+    value = gconf_value_copy (value);
+
+  gconf_entry_free (entry);
+
+  g_task_return_pointer (task, value, (GDestroyNotify) gconf_value_free);
+  g_object_unref (task);
 }
 
-static gboolean
-gconf_client_lookup (GConfClient *client,
-                     const char  *key,
-                     GConfEntry **entryp)
+/**
+ * gconf_client_get_async:
+ * @client: a #GConfClient.
+ * @key: key to get.
+ * @callback: (scope async): called when the value is available.
+ * @user_data: data for @callback.
+ *
+ * Starts looking up @key like gconf_client_get(), without waiting for
+ * the configuration server.  Call gconf_client_get_finish() from
+ * @callback to get the value.  Cached keys are answered from the cache.
+ */
+void
+gconf_client_get_async (GConfClient         *client,
+                        const gchar         *key,
+                        GAsyncReadyCallback  callback,
+                        gpointer             user_data)
 {
-  GConfEntry *entry;
+  GTask *task;
+  GConfEntry *entry = NULL;
 
-  g_return_val_if_fail (entryp != NULL, FALSE);
-  g_return_val_if_fail (*entryp == NULL, FALSE);
-  
-  entry = g_hash_table_lookup (client->cache_hash, key);
+  g_return_if_fail (GCONF_IS_CLIENT (client));
+  g_return_if_fail (key != NULL);
 
-  *entryp = entry;
+  task = g_task_new (client, NULL, callback, user_data);
+  g_task_set_source_tag (task, gconf_client_get_async);
 
-  if (!entry)
-  {
-    char *dir, *last_slash;
+  if (gconf_client_lookup (client, key, &entry))
+    {
+      GConfValue *value = NULL;
 
-    dir = g_strdup (key);
-    last_slash = strrchr (dir, '/');
-    g_assert (last_slash != NULL);
-    *last_slash = 0;
+      trace ("CACHED: Async query for '%s'", key);
 
-    if (g_hash_table_lookup (client->cache_dirs, dir))
-      {
-        g_free (dir);
-        trace ("Negative cache hit on %s", key);
-        return TRUE;
-      }
-    else 
-      {
-        gboolean not_cached = FALSE;
-        while(not_cached || (!g_hash_table_lookup (client->cache_recursive_dirs, dir)))
-          {
-            last_slash = strrchr (dir, '/');
-            if (last_slash == NULL)
-              break;
-            else
-              *last_slash = 0;
-            if (g_hash_table_lookup (client->cache_recursive_dirs, dir))
-              {
-                g_free (dir);
-                trace ("Non-existing dir for %s", key);
-                return TRUE;
-              }
-            not_cached = TRUE;
-          }
-      }
-    g_free (dir);
-  }
+      if (entry != NULL && gconf_entry_get_value (entry) != NULL)
+        value = gconf_value_copy (gconf_entry_get_value (entry));
+
+      g_task_return_pointer (task, value, (GDestroyNotify) gconf_value_free);
+      g_object_unref (task);
+      return;
+    }
 
-  return entry != NULL;
+  g_task_set_task_data (task, async_data_new (client, key, NULL),
+                        async_data_free);
+
+  trace ("REMOTE: Async query for '%s'", key);
+  PUSH_USE_ENGINE (client);
+  gconf_engine_get_entry_async (client->engine, key, TRUE,
+                                get_async_ready, task);
+  POP_USE_ENGINE (client);
 }
 
-/*
- * Dir
+/**
+ * gconf_client_get_finish:
+ * @client: a #GConfClient.
+ * @result: the #GAsyncResult passed to the callback.
+ * @err: the return location for an allocated #GError, or <symbol>NULL</symbol> to ignore errors.
+ *
+ * Finishes a gconf_client_get_async() call.
+ *
+ * Return value: (transfer full): the value, or <symbol>NULL</symbol> if
+ * the key is unset or on error.
  */
-
-static Dir*
-dir_new(const gchar* name, guint notify_id)
+GConfValue*
+gconf_client_get_finish (GConfClient   *client,
+                         GAsyncResult  *result,
+                         GError       **err)
 {
-  Dir* d;
+  GError *error = NULL;
+  GConfValue *value;
 
-  d = g_new(Dir, 1);
+  g_return_val_if_fail (g_task_is_valid (result, client), NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
 
-  d->name = g_strdup(name);
-  d->notify_id = notify_id;
-  d->add_count = 0;
-  
-  return d;
+  value = g_task_propagate_pointer (G_TASK (result), &error);
+
+  if (error != NULL)
+    handle_error (client, error, err);
+
+  return value;
 }
 
 static void
-dir_destroy(Dir* d)
+set_async_ready (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
 {
-  g_return_if_fail(d != NULL);
-  g_return_if_fail(d->notify_id == 0);
-  
-  g_free(d->name);
-  g_free(d);
-}
+  GTask *task = user_data;
+  GConfClient *client = g_task_get_source_object (task);
+  AsyncData *data = g_task_get_task_data (task);
+  GError *error = NULL;
 
-/*
- * Listener
- */
+  GCONF_CLIENT_GET_PRIVATE (client)->cache_serial++;
 
-static Listener* 
-listener_new(GConfClientNotifyFunc func,
-             GFreeFunc destroy_notify,
-             gpointer data)
-{
-  Listener* l;
+  if (!gconf_engine_set_finish (client->engine, result, &error))
+    {
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
 
-  l = g_new(Listener, 1);
+#ifdef HAVE_DBUS
+  cache_key_value_and_notify (client, data->key, data->value, FALSE);
+#endif
 
-  l->func = func;
-  l->data = data;
-  l->destroy_notify = destroy_notify;
-  
-  return l;
+  g_task_return_boolean (task, TRUE);
+  g_object_unref (task);
 }
 
-static void
-listener_destroy(Listener* l)
+/**
+ * gconf_client_set_async:
+ * @client: a #GConfClient.
+ * @key: key to set.
+ * @val: new value.
+ * @callback: (scope async): called when the server has answered.
+ * @user_data: data for @callback.
+ *
+ * Starts setting @key like gconf_client_set(), without waiting for the
+ * configuration server.  Call gconf_client_set_finish() from @callback
+ * to find out whether it worked.  Sets issued in a row reach the server
+ * in that order.
+ */
+void
+gconf_client_set_async (GConfClient         *client,
+                        const gchar         *key,
+                        const GConfValue    *val,
+                        GAsyncReadyCallback  callback,
+                        gpointer             user_data)
 {
-  g_return_if_fail(l != NULL);
+  GTask *task;
 
-  if (l->destroy_notify)
-    (* l->destroy_notify) (l->data);
-  
-  g_free(l);
+  g_return_if_fail (GCONF_IS_CLIENT (client));
+  g_return_if_fail (key != NULL);
+  g_return_if_fail (val != NULL);
+
+  task = g_task_new (client, NULL, callback, user_data);
+  g_task_set_source_tag (task, gconf_client_set_async);
+  g_task_set_task_data (task, async_data_new (client, key, val),
+                        async_data_free);
+
+  trace ("REMOTE: Async setting value of '%s'", key);
+  PUSH_USE_ENGINE (client);
+  gconf_engine_set_async (client->engine, key, val, set_async_ready, task);
+  POP_USE_ENGINE (client);
 }
 
-/*
- * Change sets
+/**
+ * gconf_client_set_finish:
+ * @client: a #GConfClient.
+ * @result: the #GAsyncResult passed to the callback.
+ * @err: the return location for an allocated #GError, or <symbol>NULL</symbol> to ignore errors.
+ *
+ * Finishes a gconf_client_set_async() call.
+ *
+ * Return value: <symbol>TRUE</symbol> if the value was set.
  */
+gboolean
+gconf_client_set_finish (GConfClient   *client,
+                         GAsyncResult  *result,
+                         GError       **err)
+{
+  GError *error = NULL;
 
+  g_return_val_if_fail (g_task_is_valid (result, client), FALSE);
+  g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
 
-struct CommitData {
-  GConfClient* client;
-  GError* error;
-  GSList* remove_list;
-  gboolean remove_committed;
-};
+  if (!g_task_propagate_boolean (G_TASK (result), &error))
+    {
+      handle_error (client, error, err);
+      return FALSE;
+    }
+
+  return TRUE;
+}
 
 static void
-commit_foreach (GConfChangeSet* cs,
-                const gchar* key,
+all_entries_async_ready (GObject      *source,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  GTask *task = user_data;
+  GConfClient *client = g_task_get_source_object (task);
+  AsyncData *data = g_task_get_task_data (task);
+  GSList *entries;
+  GError *error = NULL;
+
+  entries = gconf_engine_all_entries_finish (client->engine, result, &error);
+
+  if (error != NULL)
+    {
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  if (GCONF_CLIENT_GET_PRIVATE (client)->cache_serial == data->cache_serial &&
+      key_being_monitored (client, data->key))
+    {
+      trace ("Mark '%s' as fully cached", data->key);
+      cache_dir_mark (client, data->key, CACHE_DIR_CACHED);
+      cache_entry_list_destructively (client, copy_entry_list (entries));
+    }
+
+  g_task_return_pointer (task, entries, gconf_entry_list_free);
+  g_object_unref (task);
+}
+
+/**
+ * gconf_client_all_entries_async:
+ * @client: a #GConfClient.
+ * @dir: directory to list.
+ * @callback: (scope async): called when the entries are available.
+ * @user_data: data for @callback.
+ *
+ * Starts listing @dir like gconf_client_all_entries(), without waiting
+ * for the configuration server.  Call gconf_client_all_entries_finish()
+ * from @callback to get the entries.
+ */
+void
+gconf_client_all_entries_async (GConfClient         *client,
+                                const gchar         *dir,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+  GTask *task;
+
+  g_return_if_fail (GCONF_IS_CLIENT (client));
+  g_return_if_fail (dir != NULL);
+
+  task = g_task_new (client, NULL, callback, user_data);
+  g_task_set_source_tag (task, gconf_client_all_entries_async);
+
+  if (cache_dir_is_cached (client, dir))
+    {
+      trace ("CACHED: Async getting all values in '%s'", dir);
+
+      g_task_return_pointer (task, copy_cached_entries_in_dir (client, dir),
+                             gconf_entry_list_free);
+      g_object_unref (task);
+      return;
+    }
+
+  g_task_set_task_data (task, async_data_new (client, dir, NULL),
+                        async_data_free);
+
+  trace ("REMOTE: Async getting all values in '%s'", dir);
+  PUSH_USE_ENGINE (client);
+  gconf_engine_all_entries_async (client->engine, dir,
+                                  all_entries_async_ready, task);
+  POP_USE_ENGINE (client);
+}
+
+/**
+ * gconf_client_all_entries_finish:
+ * @client: a #GConfClient.
+ * @result: the #GAsyncResult passed to the callback.
+ * @err: the return location for an allocated #GError, or <symbol>NULL</symbol> to ignore errors.
+ *
+ * Finishes a gconf_client_all_entries_async() call.
+ *
+ * Return value: (element-type GConfEntry) (transfer full): List of #GConfEntry.
+ */
+GSList*
+gconf_client_all_entries_finish (GConfClient   *client,
+                                 GAsyncResult  *result,
+                                 GError       **err)
+{
+  GError *error = NULL;
+  GSList *entries;
+
+  g_return_val_if_fail (g_task_is_valid (result, client), NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  entries = g_task_propagate_pointer (G_TASK (result), &error);
+
+  if (error != NULL)
+    handle_error (client, error, err);
+
+  return entries;
+}
+
+typedef struct {
+  GConfChangeSet *cs;
+  gboolean        remove_committed;
+  guint           n_pending;
+  GSList         *committed; /* of AsyncData */
+  GError         *error;
+} AsyncCommit;
+
+static void
+async_commit_free (gpointer p)
+{
+  AsyncCommit *commit = p;
+
+  gconf_change_set_unref (commit->cs);
+  g_slist_foreach (commit->committed, (GFunc) async_data_free, NULL);
+  g_slist_free (commit->committed);
+  if (commit->error)
+    g_error_free (commit->error);
+  g_free (commit);
+}
+
+static void
+commit_async_done (GTask *task)
+{
+  AsyncCommit *commit = g_task_get_task_data (task);
+  GSList *tmp;
+
+  /* Leave alone anything that was changed again while we committed */
+  for (tmp = commit->committed; tmp != NULL; tmp = tmp->next)
+    {
+      AsyncData *data = tmp->data;
+      GConfValue *value = NULL;
+
+      if (!gconf_change_set_check_value (commit->cs, data->key, &value))
+        continue;
+
+      if (value == NULL && data->value == NULL)
+        gconf_change_set_remove (commit->cs, data->key);
+      else if (value != NULL && data->value != NULL &&
+               gconf_value_compare (value, data->value) == 0)
+        gconf_change_set_remove (commit->cs, data->key);
+    }
+
+  if (commit->error != NULL)
+    {
+      g_task_return_error (task, commit->error);
+      commit->error = NULL;
+    }
+  else
+    g_task_return_boolean (task, TRUE);
+
+  g_object_unref (task);
+}
+
+typedef struct {
+  GTask     *task;
+  AsyncData *data;
+} CommitChange;
+
+static void
+commit_change_async_ready (GObject      *source,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  CommitChange *change = user_data;
+  GTask *task = change->task;
+  GConfClient *client = g_task_get_source_object (task);
+  AsyncCommit *commit = g_task_get_task_data (task);
+  AsyncData *data = change->data;
+  GError *error = NULL;
+  gboolean committed;
+
+  g_free (change);
+
+  GCONF_CLIENT_GET_PRIVATE (client)->cache_serial++;
+
+  if (data->value != NULL)
+    committed = gconf_engine_set_finish (client->engine, result, &error);
+  else
+    committed = gconf_engine_unset_finish (client->engine, result, &error);
+
+  if (committed)
+    {
+#ifdef HAVE_DBUS
+      if (data->value != NULL)
+        cache_key_value_and_notify (client, data->key, data->value, FALSE);
+      else
+        remove_key_from_cache (client, data->key);
+#endif
+    }
+  else if (commit->error == NULL)
+    commit->error = error;
+  else
+    g_error_free (error);
+
+  if (committed && commit->remove_committed)
+    commit->committed = g_slist_prepend (commit->committed, data);
+  else
+    async_data_free (data);
+
+  commit->n_pending -= 1;
+  if (commit->n_pending == 0)
+    commit_async_done (task);
+}
+
+static void
+commit_async_foreach (GConfChangeSet *cs,
+                      const gchar    *key,
+                      GConfValue     *value,
+                      gpointer        user_data)
+{
+  GTask *task = user_data;
+  GConfClient *client = g_task_get_source_object (task);
+  CommitChange *change;
+
+  change = g_new (CommitChange, 1);
+  change->task = task;
+  change->data = async_data_new (client, key, value);
+
+  PUSH_USE_ENGINE (client);
+  if (value != NULL)
+    gconf_engine_set_async (client->engine, key, value,
+                            commit_change_async_ready, change);
+  else
+    gconf_engine_unset_async (client->engine, key,
+                              commit_change_async_ready, change);
+  POP_USE_ENGINE (client);
+}
+
+/**
+ * gconf_client_commit_change_set_async:
+ * @client: a #GConfClient.
+ * @cs: a #GConfChangeSet.
+ * @remove_committed: whether to remove successfully-committed changes from the set
+ * @callback: (scope async): called once every change has been answered.
+ * @user_data: data for @callback.
+ *
+ * Starts committing @cs like gconf_client_commit_change_set(), without
+ * waiting for the configuration server.  All changes are sent at once
+ * rather than stopping at the first failure; gconf_client_commit_change_set_finish()
+ * reports the first error.  With @remove_committed, changes that made
+ * it are removed from @cs, unless @cs was changed again meanwhile.
+ */
+void
+gconf_client_commit_change_set_async (GConfClient         *client,
+                                      GConfChangeSet      *cs,
+                                      gboolean             remove_committed,
+                                      GAsyncReadyCallback  callback,
+                                      gpointer             user_data)
+{
+  GTask *task;
+  AsyncCommit *commit;
+
+  g_return_if_fail (GCONF_IS_CLIENT (client));
+  g_return_if_fail (cs != NULL);
+
+  task = g_task_new (client, NULL, callback, user_data);
+  g_task_set_source_tag (task, gconf_client_commit_change_set_async);
+
+  commit = g_new0 (AsyncCommit, 1);
+  commit->cs = gconf_change_set_ref (cs);
+  commit->remove_committed = remove_committed;
+  commit->n_pending = gconf_change_set_size (cs);
+  g_task_set_task_data (task, commit, async_commit_free);
+
+  if (commit->n_pending == 0)
+    {
+      g_task_return_boolean (task, TRUE);
+      g_object_unref (task);
+      return;
+    }
+
+  gconf_change_set_foreach (cs, commit_async_foreach, task);
+}
+
+/**
+ * gconf_client_commit_change_set_finish:
+ * @client: a #GConfClient.
+ * @result: the #GAsyncResult passed to the callback.
+ * @err: the return location for an allocated #GError, or <symbol>NULL</symbol> to ignore errors.
+ *
+ * Finishes a gconf_client_commit_change_set_async() call.
+ *
+ * Return value: <symbol>TRUE</symbol> if every change was committed.
+ */
+gboolean
+gconf_client_commit_change_set_finish (GConfClient   *client,
+                                       GAsyncResult  *result,
+                                       GError       **err)
+{
+  GError *error = NULL;
+
+  g_return_val_if_fail (g_task_is_valid (result, client), FALSE);
+  g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error))
+    {
+      handle_error (client, error, err);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Internal utility
+ */
+
+/* A rough figure of what an entry costs to keep around */
+static gsize
+cache_entry_size (const GConfEntry *entry)
+{
+  gsize size;
+  const char *schema_name;
+
+  size = sizeof (CacheItem) + 4 * sizeof (gpointer) + strlen (entry->key) + 1;
+
+  schema_name = gconf_entry_get_schema_name (entry);
+  if (schema_name)
+    size += strlen (schema_name) + 1;
+
+  if (entry->value)
+    size += gconf_value_get_size (entry->value);
+
+  return size;
+}
+
+/* Unlinks item from the clock and frees it; the caller removes it
+ * from cache_hash.
+ */
+static void
+cache_item_forget (GConfClient *client,
+                   CacheItem   *item)
+{
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+
+  g_queue_unlink (&priv->cache_clock, &item->link);
+  priv->cache_bytes -= item->size;
+
+  gconf_entry_free (item->entry);
+  g_slice_free (CacheItem, item);
+}
+
+static gboolean
+cache_over_limit (GConfClient *client)
+{
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+
+  return (priv->cache_max_entries != 0 &&
+          priv->cache_clock.length > priv->cache_max_entries) ||
+    (priv->cache_max_bytes != 0 &&
+     priv->cache_bytes > priv->cache_max_bytes);
+}
+
+static void
+cache_evict (GConfClient *client,
+             CacheItem   *item)
+{
+  const char *key = item->entry->key;
+
+  trace ("Evicting '%s' from the cache", key);
+
+  /* Its dir isn't fully cached anymore. Recursive marks only say
+   * which subdirs exist, so they stay.
+   */
+  cache_dir_unmark (client, key, strrchr (key, '/') - key, CACHE_DIR_CACHED);
+
+  g_hash_table_remove (client->cache_hash, item->entry->key);
+  cache_item_forget (client, item);
+
+  GCONF_CLIENT_GET_PRIVATE (client)->cache_evictions++;
+}
+
+/* CLOCK: the hand goes round from the head, giving entries read since
+ * its last visit a second chance, until the cache fits again.  @keep,
+ * the entry just cached if any, is never evicted.
+ */
+static void
+cache_enforce_limit (GConfClient *client,
+                     CacheItem   *keep)
+{
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+  guint steps;
+
+  /* Every entry could be referenced or pinned; two laps at most */
+  steps = 2 * priv->cache_clock.length;
+
+  while (cache_over_limit (client) && steps-- > 0)
+    {
+      GList *link = g_queue_peek_head_link (&priv->cache_clock);
+      CacheItem *item = link->data;
+
+      if (item->referenced || item->pinned || item == keep)
+        {
+          item->referenced = FALSE;
+          g_queue_unlink (&priv->cache_clock, link);
+          g_queue_push_tail_link (&priv->cache_clock, link);
+        }
+      else
+        cache_evict (client, item);
+    }
+}
+
+static gboolean
+gconf_client_cache (GConfClient *client,
+                    gboolean     take_ownership,
+                    GConfEntry  *new_entry,
+                    gboolean     preserve_schema_name)
+{
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+  CacheItem *item;
+
+  item = g_hash_table_lookup (client->cache_hash, new_entry->key);
+
+  if (item != NULL)
+    {
+      /* Already have a value, update it */
+      GConfEntry *entry = item->entry;
+      gboolean changed;
+      
+      g_assert (entry != NULL);
+
+      changed = ! gconf_entry_equal (entry, new_entry);
+
+      if (changed)
+        {
+          trace ("Updating value of '%s' in the cache",
+                 new_entry->key);
+
+          if (!take_ownership)
+            new_entry = gconf_entry_copy (new_entry);
+          
+          if (preserve_schema_name)
+            gconf_entry_set_schema_name (new_entry, 
+                                         gconf_entry_get_schema_name (entry));
+
+          /* The table key is inside the old entry */
+          g_hash_table_steal (client->cache_hash, entry->key);
+          g_hash_table_insert (client->cache_hash, new_entry->key, item);
+
+          item->entry = new_entry;
+          item->referenced = TRUE;
+          priv->cache_bytes -= item->size;
+          item->size = cache_entry_size (new_entry);
+          priv->cache_bytes += item->size;
+
+          gconf_entry_free (entry);
+
+          cache_enforce_limit (client, item);
+        }
+      else
+        {
+          trace ("Value of '%s' hasn't actually changed, would have updated in cache if it had",
+                 new_entry->key);
+
+          if (take_ownership)
+            gconf_entry_free (new_entry);
+        }
+
+      return changed;
+    }
+  else
+    {
+      /* Create a new entry */
+      if (!take_ownership)
+        new_entry = gconf_entry_copy (new_entry);
+
+      item = g_slice_new (CacheItem);
+      item->entry = new_entry;
+      item->link.data = item;
+      item->link.prev = NULL;
+      item->link.next = NULL;
+      item->size = cache_entry_size (new_entry);
+      /* So it isn't the first thing the hand takes */
+      item->referenced = TRUE;
+      item->pinned = FALSE;
+
+      g_hash_table_insert (client->cache_hash, new_entry->key, item);
+      g_queue_push_tail_link (&priv->cache_clock, &item->link);
+      priv->cache_bytes += item->size;
+      trace ("Added value of '%s' to the cache",
+             new_entry->key);
+
+      cache_enforce_limit (client, item);
+
+      return TRUE; /* changed */
+    }
+}
+
+static gboolean
+gconf_client_lookup (GConfClient *client,
+                     const char  *key,
+                     GConfEntry **entryp)
+{
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+  CacheItem *item;
+
+  g_return_val_if_fail (entryp != NULL, FALSE);
+  g_return_val_if_fail (*entryp == NULL, FALSE);
+  
+  item = g_hash_table_lookup (client->cache_hash, key);
+
+  if (item)
+    {
+      item->referenced = TRUE;
+      *entryp = item->entry;
+      priv->cache_hits++;
+      return TRUE;
+    }
+
+  if (cache_key_known_absent (client, key))
+    {
+      priv->cache_hits++;
+      return TRUE;
+    }
+
+  priv->cache_misses++;
+
+  return FALSE;
+}
+
+/*
+ * Cached dir tree
+ */
+
+static guint
+cache_dir_hash (gconstpointer v)
+{
+  const CacheDir *d = v;
+  guint h = 5381;
+  guint i;
+
+  for (i = 0; i < d->name_len; i++)
+    h = (h << 5) + h + (guchar) d->name[i];
+
+  return h;
+}
+
+static gboolean
+cache_dir_equal (gconstpointer a,
+                 gconstpointer b)
+{
+  const CacheDir *da = a;
+  const CacheDir *db = b;
+
+  return da->name_len == db->name_len &&
+    memcmp (da->name, db->name, da->name_len) == 0;
+}
+
+static CacheDir*
+cache_dir_new (CacheDir    *parent,
+               const gchar *name,
+               guint        len)
+{
+  CacheDir *d;
+  gchar *copy;
+
+  /* The name lives right after the node */
+  d = g_malloc (sizeof (CacheDir) + len + 1);
+  copy = (gchar *) (d + 1);
+  memcpy (copy, name, len);
+  copy[len] = '\0';
+
+  d->parent = parent;
+  d->children = NULL;
+  d->flags = 0;
+  d->name_len = len;
+  d->name = copy;
+
+  return d;
+}
+
+static void
+cache_dir_free (CacheDir *d)
+{
+  if (d->children != NULL)
+    g_hash_table_destroy (d->children);
+
+  g_free (d);
+}
+
+static CacheDir*
+cache_dir_child (CacheDir    *d,
+                 const gchar *name,
+                 guint        len)
+{
+  CacheDir probe;
+
+  if (d->children == NULL)
+    return NULL;
+
+  probe.name = name;
+  probe.name_len = len;
+
+  return g_hash_table_lookup (d->children, &probe);
+}
+
+/* The node for the first len bytes of dir */
+static CacheDir*
+cache_dir_lookup (GConfClient *client,
+                  const gchar *dir,
+                  gsize        len,
+                  gboolean     create)
+{
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+  const gchar *p = dir;
+  const gchar *end = dir + len;
+  CacheDir *d;
+
+  if (priv->cache_dir_tree == NULL)
+    {
+      if (!create)
+        return NULL;
+
+      priv->cache_dir_tree = cache_dir_new (NULL, "", 0);
+    }
+
+  d = priv->cache_dir_tree;
+
+  while (p < end)
+    {
+      const gchar *slash;
+      CacheDir *child;
+
+      if (*p == '/')
+        {
+          p++;
+          continue;
+        }
+
+      slash = memchr (p, '/', end - p);
+      if (slash == NULL)
+        slash = end;
+
+      child = cache_dir_child (d, p, slash - p);
+      if (child == NULL)
+        {
+          if (!create)
+            return NULL;
+
+          child = cache_dir_new (d, p, slash - p);
+          if (d->children == NULL)
+            d->children = g_hash_table_new_full (cache_dir_hash,
+                                                 cache_dir_equal,
+                                                 NULL,
+                                                 (GDestroyNotify) cache_dir_free);
+          g_hash_table_insert (d->children, child, child);
+        }
+
+      d = child;
+      p = slash;
+    }
+
+  return d;
+}
+
+/* Drops d and any parents that no longer carry information */
+static void
+cache_dir_prune (GConfClient *client,
+                 CacheDir    *d)
+{
+  while (d->flags == 0 && d->children == NULL)
+    {
+      CacheDir *parent = d->parent;
+
+      if (parent == NULL)
+        {
+          cache_dir_free (d);
+          GCONF_CLIENT_GET_PRIVATE (client)->cache_dir_tree = NULL;
+          return;
+        }
+
+      g_hash_table_remove (parent->children, d);
+      if (g_hash_table_size (parent->children) == 0)
+        {
+          g_hash_table_destroy (parent->children);
+          parent->children = NULL;
+        }
+
+      d = parent;
+    }
+}
+
+static void
+cache_dir_mark (GConfClient *client,
+                const gchar *dir,
+                guint        flags)
+{
+  CacheDir *d;
+
+  d = cache_dir_lookup (client, dir, strlen (dir), TRUE);
+  d->flags |= flags;
+}
+
+static void
+cache_dir_unmark (GConfClient *client,
+                  const gchar *dir,
+                  gsize        len,
+                  guint        flags)
+{
+  CacheDir *d;
+
+  d = cache_dir_lookup (client, dir, len, FALSE);
+  if (d == NULL || (d->flags & flags) == 0)
+    return;
+
+  trace ("'%.*s' no longer fully cached", (int) len, dir);
+
+  d->flags &= ~flags;
+  cache_dir_prune (client, d);
+}
+
+/* TRUE if d is left without flags or children */
+static gboolean
+cache_dir_clear_flags (CacheDir *d,
+                       guint     flags)
+{
+  if (d->children != NULL)
+    {
+      GHashTableIter iter;
+      gpointer child;
+
+      g_hash_table_iter_init (&iter, d->children);
+      while (g_hash_table_iter_next (&iter, &child, NULL))
+        {
+          if (cache_dir_clear_flags (child, flags))
+            g_hash_table_iter_remove (&iter);
+        }
+
+      if (g_hash_table_size (d->children) == 0)
+        {
+          g_hash_table_destroy (d->children);
+          d->children = NULL;
+        }
+    }
+
+  d->flags &= ~flags;
+
+  return d->flags == 0 && d->children == NULL;
+}
+
+static void
+cache_dir_unmark_below (GConfClient *client,
+                        const gchar *dir,
+                        guint        flags)
+{
+  CacheDir *d;
+
+  d = cache_dir_lookup (client, dir, strlen (dir), FALSE);
+  if (d == NULL)
+    return;
+
+  trace ("'%s' and below no longer fully cached", dir);
+
+  if (cache_dir_clear_flags (d, flags))
+    cache_dir_prune (client, d);
+}
+
+static gboolean
+cache_dir_is_cached (GConfClient *client,
+                     const gchar *dir)
+{
+  CacheDir *d;
+
+  d = cache_dir_lookup (client, dir, strlen (dir), FALSE);
+
+  return d != NULL && (d->flags & CACHE_DIR_CACHED) != 0;
+}
+
+/* Whether key is known not to exist: its dir is fully cached, or a
+ * dir above it is recursively cached and its dir isn't among the
+ * dirs that were found there.
+ */
+static gboolean
+cache_key_known_absent (GConfClient *client,
+                        const gchar *key)
+{
+  CacheDir *d = GCONF_CLIENT_GET_PRIVATE (client)->cache_dir_tree;
+  const gchar *p = key;
+  const gchar *end;
+  gboolean below_recursive = FALSE;
+
+  if (d == NULL)
+    return FALSE;
+
+  end = strrchr (key, '/');
+  g_assert (end != NULL);
+
+  while (p < end)
+    {
+      const gchar *slash;
+
+      if (*p == '/')
+        {
+          p++;
+          continue;
+        }
+
+      slash = memchr (p, '/', end - p);
+      if (slash == NULL)
+        slash = end;
+
+      if (d->flags & CACHE_DIR_RECURSIVE)
+        below_recursive = TRUE;
+
+      d = cache_dir_child (d, p, slash - p);
+      if (d == NULL)
+        {
+          if (below_recursive)
+            trace ("Non-existing dir for %s", key);
+          return below_recursive;
+        }
+
+      p = slash;
+    }
+
+  if (d->flags & CACHE_DIR_CACHED)
+    {
+      trace ("Negative cache hit on %s", key);
+      return TRUE;
+    }
+
+  if (below_recursive && (d->flags & CACHE_DIR_RECURSIVE) == 0)
+    {
+      trace ("Non-existing dir for %s", key);
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+/*
+ * Dir
+ */
+
+static Dir*
+dir_new(const gchar* name, guint notify_id)
+{
+  Dir* d;
+
+  d = g_new(Dir, 1);
+
+  d->name = g_strdup(name);
+  d->notify_id = notify_id;
+  d->add_count = 0;
+  
+  return d;
+}
+
+static void
+dir_destroy(Dir* d)
+{
+  g_return_if_fail(d != NULL);
+  g_return_if_fail(d->notify_id == 0);
+  
+  g_free(d->name);
+  g_free(d);
+}
+
+/*
+ * Listener
+ */
+
+static Listener* 
+listener_new(GConfClientNotifyFunc func,
+             GFreeFunc destroy_notify,
+             gpointer data)
+{
+  Listener* l;
+
+  l = g_new(Listener, 1);
+
+  l->func = func;
+  l->data = data;
+  l->destroy_notify = destroy_notify;
+  
+  return l;
+}
+
+static void
+listener_destroy(Listener* l)
+{
+  g_return_if_fail(l != NULL);
+
+  if (l->destroy_notify)
+    (* l->destroy_notify) (l->data);
+  
+  g_free(l);
+}
+
+static void
+batch_listener_destroy (BatchListener *l)
+{
+  g_return_if_fail(l != NULL);
+
+  if (l->destroy_notify)
+    (* l->destroy_notify) (l->data);
+
+  g_free(l);
+}
+
+/*
+ * Change sets
+ */
+
+
+struct CommitData {
+  GConfClient* client;
+  GError* error;
+  GSList* remove_list;
+  gboolean remove_committed;
+  GSList* failed_keys;
+};
+
+static void
+commit_foreach (GConfChangeSet* cs,
+                const gchar* key,
                 GConfValue* value,
                 gpointer user_data)
 {
@@ -2495,6 +3832,31 @@ commit_foreach (GConfChangeSet* cs,
     }
 }
 
+/* After a commit in one go, does for the keys that made it what
+ * gconf_client_set() and gconf_client_unset() would have done
+ */
+static void
+committed_foreach (GConfChangeSet* cs,
+                   const gchar* key,
+                   GConfValue* value,
+                   gpointer user_data)
+{
+  struct CommitData* cd = user_data;
+
+  if (g_slist_find_custom (cd->failed_keys, key, (GCompareFunc) strcmp) != NULL)
+    return;
+
+#ifdef HAVE_DBUS
+  if (value)
+    cache_key_value_and_notify (cd->client, key, value, FALSE);
+  else
+    remove_key_from_cache (cd->client, key);
+#endif
+
+  if (cd->remove_committed)
+    cd->remove_list = g_slist_prepend (cd->remove_list, (gchar*)key);
+}
+
 gboolean
 gconf_client_commit_change_set   (GConfClient* client,
                                   GConfChangeSet* cs,
@@ -2513,13 +3875,37 @@ gconf_client_commit_change_set   (GConfClient* client,
   cd.error = NULL;
   cd.remove_list = NULL;
   cd.remove_committed = remove_committed;
+  cd.failed_keys = NULL;
 
   /* Because the commit could have lots of side
      effects, this makes it safer */
   gconf_change_set_ref(cs);
   g_object_ref(G_OBJECT(client));
   
-  gconf_change_set_foreach(cs, commit_foreach, &cd);
+  trace ("REMOTE: Committing %u changes", gconf_change_set_size (cs));
+  PUSH_USE_ENGINE (client);
+  if (gconf_engine_commit_change_set_at_once (client->engine, cs,
+                                              &cd.failed_keys, &cd.error))
+    {
+      POP_USE_ENGINE (client);
+
+      GCONF_CLIENT_GET_PRIVATE (client)->cache_serial++;
+      gconf_change_set_foreach (cs, committed_foreach, &cd);
+
+      if (cd.error != NULL)
+        {
+          GError *error = cd.error;
+
+          cd.error = NULL;
+          handle_error (client, error, &cd.error);
+        }
+    }
+  else
+    {
+      POP_USE_ENGINE (client);
+
+      gconf_change_set_foreach(cs, commit_foreach, &cd);
+    }
 
   tmp = cd.remove_list;
   while (tmp != NULL)
@@ -2534,6 +3920,8 @@ gconf_client_commit_change_set   (GConfClient* client,
     }
 
   g_slist_free(cd.remove_list);
+  g_slist_foreach(cd.failed_keys, (GFunc)g_free, NULL);
+  g_slist_free(cd.failed_keys);
   
   gconf_change_set_unref(cs);
   g_object_unref(G_OBJECT(client));
@@ -2774,14 +4162,38 @@ static void
 gconf_client_queue_notify (GConfClient *client,
                            const char  *key)
 {
-  trace ("Queing notify on '%s', %d pending already", key,
-         client->pending_notify_count);
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+  CacheItem *item;
+
+  /* Keep the entry around until the notify goes out; the key may
+   * have been recached with a fresh item since it was queued.
+   */
+  item = g_hash_table_lookup (client->cache_hash, key);
+  if (item != NULL)
+    item->pinned = TRUE;
+
+  if (priv->notify_set == NULL)
+    priv->notify_set = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, NULL);
+  else if (g_hash_table_contains (priv->notify_set, key))
+    {
+      trace ("Notify on '%s' already queued", key);
+      return;
+    }
+
+  trace ("Queing notify on '%s', %u pending already", key,
+         g_hash_table_size (priv->notify_set));
   
   if (client->notify_handler == 0)
-    client->notify_handler = g_idle_add (notify_idle_callback, client);
+    {
+      if (priv->notify_interval == 0)
+        client->notify_handler = g_idle_add (notify_idle_callback, client);
+      else
+        client->notify_handler = g_timeout_add (priv->notify_interval,
+                                                notify_idle_callback, client);
+    }
   
-  client->notify_list = g_slist_prepend (client->notify_list, g_strdup (key));
-  client->pending_notify_count += 1;
+  g_hash_table_add (priv->notify_set, g_strdup (key));
 }
 
 struct ClientAndEntry {
@@ -2840,43 +4252,114 @@ notify_one_entry (GConfClient *client,
   g_object_unref (G_OBJECT (client));
 }
 
+struct BatchClosure {
+  GConfEntry *entry;
+  GHashTable *batches; /* cnxn_id -> entries for it, reversed */
+};
+
 static void
-gconf_client_flush_notifies (GConfClient *client)
+batch_listeners_callback (GConfListeners* listeners,
+                          const gchar* key,
+                          guint cnxn_id,
+                          gpointer listener_data,
+                          gpointer user_data)
+{
+  struct BatchClosure *closure = user_data;
+  GSList *entries;
+
+  entries = g_hash_table_lookup (closure->batches, GUINT_TO_POINTER (cnxn_id));
+  entries = g_slist_prepend (entries, closure->entry);
+  g_hash_table_insert (closure->batches, GUINT_TO_POINTER (cnxn_id), entries);
+}
+
+static void
+notify_batch_listeners (GConfClient *client,
+                        GSList      *notified)
 {
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+  struct BatchClosure closure;
+  GHashTableIter iter;
+  gpointer key, value;
   GSList *tmp;
-  GSList *to_notify;
-  GConfEntry *last_entry;
+
+  if (priv->batch_listeners == NULL || notified == NULL)
+    return;
+
+  closure.batches = g_hash_table_new (NULL, NULL);
+
+  for (tmp = notified; tmp != NULL; tmp = tmp->next)
+    {
+      closure.entry = tmp->data;
+      gconf_listeners_notify (priv->batch_listeners,
+                              closure.entry->key,
+                              batch_listeners_callback,
+                              &closure);
+    }
+
+  g_hash_table_iter_init (&iter, closure.batches);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      guint cnxn_id = GPOINTER_TO_UINT (key);
+      GSList *entries = g_slist_reverse (value);
+      gpointer data;
+
+      /* An earlier one may have removed it */
+      if (gconf_listeners_get_data (priv->batch_listeners, cnxn_id,
+                                    &data, NULL))
+        {
+          BatchListener *l = data;
+
+          (* l->func) (client, cnxn_id, entries, l->data);
+        }
+
+      g_slist_free (entries);
+    }
+
+  g_hash_table_destroy (closure.batches);
+}
+
+static void
+gconf_client_flush_notifies (GConfClient *client)
+{
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+  GHashTable *to_notify;
+  GHashTableIter iter;
+  gpointer key;
+  GSList *notified;
 
   trace ("Flushing notify queue");
   
-  /* Adopt notify list and clear it, to avoid reentrancy concerns.
-   * Sort it to compress duplicates, and keep people from relying on
-   * the notify order.
+  /* Adopt notify set and clear it, to avoid reentrancy concerns.
+   * Its order also keeps people from relying on the notify order.
    */
-  to_notify = g_slist_sort (client->notify_list, (GCompareFunc) strcmp);
-  client->notify_list = NULL;
-  client->pending_notify_count = 0;
+  to_notify = priv->notify_set;
+  priv->notify_set = NULL;
 
   gconf_client_unqueue_notifies (client);
 
-  last_entry = NULL;
-  tmp = to_notify;
-  while (tmp != NULL)
+  if (to_notify == NULL)
+    return;
+
+  g_object_ref (G_OBJECT (client));
+
+  notified = NULL;
+  g_hash_table_iter_init (&iter, to_notify);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
     {
       GConfEntry *entry = NULL;
+      CacheItem *item;
 
-      if (gconf_client_lookup (client, tmp->data, &entry) && entry != NULL)
+      item = g_hash_table_lookup (client->cache_hash, key);
+      if (item != NULL)
         {
-          if (entry != last_entry)
-            {
-              trace ("Doing notification for '%s'", entry->key);
-              notify_one_entry (client, entry);
-              last_entry = entry;
-            }
-          else
-            {
-              trace ("Ignoring duplicate notify for '%s'", entry->key);
-            }
+          item->pinned = FALSE;
+          entry = item->entry;
+
+          /* Listeners may replace or drop the cached entry */
+          notified = g_slist_prepend (notified, gconf_entry_ref (entry));
+
+          trace ("Doing notification for '%s'", entry->key);
+          notify_one_entry (client, entry);
         }
       else
         {
@@ -2886,51 +4369,66 @@ gconf_client_flush_notifies (GConfClient *client)
            * have to check if the key is supposed to be monitored here, we can't
            * just rely on it being in the cache.
            */
-          if (key_being_monitored (client, tmp->data))
+          if (key_being_monitored (client, key))
             {
               trace ("Key %s was in notify queue but not in cache, but is being monitored",
-                     tmp->data);
+                     key);
 
-              entry = gconf_client_get_entry (client, tmp->data, NULL, TRUE, NULL);
+              entry = gconf_client_get_entry (client, key, NULL, TRUE, NULL);
               if (entry != NULL)
                 {
                   notify_one_entry (client, entry);
-                  gconf_entry_unref (entry);
-                  last_entry = NULL;
+                  notified = g_slist_prepend (notified, entry);
                 }
             }
           else
             {
               trace ("Key '%s' was in notify queue but not in cache; we must have stopped monitoring it; not notifying",
-                     tmp->data);
+                     key);
             }
 #else
               trace ("Key '%s' was in notify queue but not in cache; we must have stopped monitoring it; not notifying",
-                     tmp->data);
+                     key);
 #endif
         }
-      
-      tmp = tmp->next;
     }
-  
-  g_slist_foreach (to_notify, (GFunc) g_free, NULL);
-  g_slist_free (to_notify);
+
+  notify_batch_listeners (client, notified);
+
+  g_slist_foreach (notified, (GFunc) gconf_entry_unref, NULL);
+  g_slist_free (notified);
+  g_hash_table_destroy (to_notify);
+
+  g_object_unref (G_OBJECT (client));
 }
 
 static void
 gconf_client_unqueue_notifies (GConfClient *client)
 {
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+
   if (client->notify_handler != 0)
     {
       g_source_remove (client->notify_handler);
       client->notify_handler = 0;
     }
   
-  if (client->notify_list != NULL)
+  if (priv->notify_set != NULL)
     {
-      g_slist_foreach (client->notify_list, (GFunc) g_free, NULL);
-      g_slist_free (client->notify_list);
-      client->notify_list = NULL;
-      client->pending_notify_count = 0;
+      GHashTableIter iter;
+      gpointer key;
+
+      g_hash_table_iter_init (&iter, priv->notify_set);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        {
+          CacheItem *item;
+
+          item = g_hash_table_lookup (client->cache_hash, key);
+          if (item != NULL)
+            item->pinned = FALSE;
+        }
+
+      g_hash_table_destroy (priv->notify_set);
+      priv->notify_set = NULL;
     }
 }
@@ -22,6 +22,7 @@
 #define GCONF_GCONF_CLIENT_H
 
 #include <glib-object.h>
+#include <gio/gio.h>
 #include "gconf/gconf.h"
 #include "gconf/gconf-listeners.h"
 #include "gconf/gconf-changeset.h"
@@ -76,6 +77,11 @@ typedef void (*GConfClientNotifyFunc)(GConfClient* client,
                                       GConfEntry *entry,
                                       gpointer user_data);
 
+typedef void (*GConfClientBatchNotifyFunc)(GConfClient* client,
+                                           guint cnxn_id,
+                                           GSList *entries,
+                                           gpointer user_data);
+
 typedef void (*GConfClientErrorHandlerFunc) (GConfClient* client,
                                              GError* error);
 
@@ -95,6 +101,7 @@ struct _GConfClient
   GConfEngine* engine;
   GConfClientErrorHandlingMode error_mode;
   GHashTable* dir_hash;
+  /* Values are private cache items now, not GConfEntry */
   GHashTable* cache_hash;
   GConfListeners* listeners;
   GSList *notify_list;
@@ -189,6 +196,26 @@ void         gconf_client_notify_remove  (GConfClient* client,
                                           guint cnxn);
 void         gconf_client_notify (GConfClient* client, const char* key);
 
+/* Like a notify function, but called once per flush of the notify
+ * queue with all the changed entries at or below namespace_section,
+ * after the per-key notify functions have run. The list and the
+ * entries belong to the GConfClient.
+ */
+guint        gconf_client_batch_notify_add    (GConfClient* client,
+                                               const gchar* namespace_section,
+                                               GConfClientBatchNotifyFunc func,
+                                               gpointer user_data,
+                                               GFreeFunc destroy_notify);
+void         gconf_client_batch_notify_remove (GConfClient* client,
+                                               guint cnxn);
+
+/* Changes are delivered when the main loop is idle by default. With
+ * an interval, they are collected for that many milliseconds and
+ * then delivered at once, at most once per interval.
+ */
+void         gconf_client_set_notify_interval (GConfClient* client,
+                                               guint interval_msec);
+
 /*
  * Error handling convenience; if you don't want the default handler,
  * set the error handling to GCONF_CLIENT_HANDLE_NONE
@@ -214,6 +241,33 @@ void              gconf_client_set_global_default_error_handler(GConfClientError
  */
 void              gconf_client_clear_cache(GConfClient* client);
 
+/*
+ * Bounds the cache to max_entries entries and roughly max_bytes
+ * bytes, 0 meaning no bound. Entries that haven't been read for the
+ * longest are dropped first and fetched from the server again when
+ * needed. There is no bound by default.
+ */
+void              gconf_client_set_cache_limit (GConfClient* client,
+                                                guint        max_entries,
+                                                gsize        max_bytes);
+
+typedef struct _GConfClientCacheStats GConfClientCacheStats;
+
+struct _GConfClientCacheStats
+{
+  /* Lookups answered from the cache, including "no such key" */
+  guint hits;
+  /* Lookups that had to ask the server */
+  guint misses;
+  /* Entries dropped to stay within the limit */
+  guint evictions;
+  guint n_entries;
+  gsize n_bytes;
+};
+
+void              gconf_client_get_cache_stats (GConfClient*           client,
+                                                GConfClientCacheStats* stats);
+
 /*
  * Preload a directory; the directory must have been added already.
  * This is only useful as an optimization if you clear the cache,
@@ -250,6 +304,10 @@ GConfEntry*       gconf_client_get_entry        (GConfClient* client,
                                                  gboolean use_schema_default,
                                                  GError** err);
 
+GSList*           gconf_client_get_many         (GConfClient* client,
+                                                 GSList* keys,
+                                                 GError** err);
+
 GConfValue*       gconf_client_get_default_from_schema (GConfClient* client,
                                                         const gchar* key,
                                                         GError** err);
@@ -368,6 +426,45 @@ gboolean        gconf_client_commit_change_set   (GConfClient* client,
                                                   gboolean remove_committed,
                                                   GError** err);
 
+/*
+ * Asynchronous versions of the above; the callback runs in the
+ * thread-default main context of the caller.
+ */
+
+void            gconf_client_get_async                (GConfClient*         client,
+                                                       const gchar*         key,
+                                                       GAsyncReadyCallback  callback,
+                                                       gpointer             user_data);
+GConfValue*     gconf_client_get_finish               (GConfClient*         client,
+                                                       GAsyncResult*        result,
+                                                       GError**             err);
+
+void            gconf_client_set_async                (GConfClient*         client,
+                                                       const gchar*         key,
+                                                       const GConfValue*    val,
+                                                       GAsyncReadyCallback  callback,
+                                                       gpointer             user_data);
+gboolean        gconf_client_set_finish               (GConfClient*         client,
+                                                       GAsyncResult*        result,
+                                                       GError**             err);
+
+void            gconf_client_all_entries_async        (GConfClient*         client,
+                                                       const gchar*         dir,
+                                                       GAsyncReadyCallback  callback,
+                                                       gpointer             user_data);
+GSList*         gconf_client_all_entries_finish       (GConfClient*         client,
+                                                       GAsyncResult*        result,
+                                                       GError**             err);
+
+void            gconf_client_commit_change_set_async  (GConfClient*         client,
+                                                       GConfChangeSet*      cs,
+                                                       gboolean             remove_committed,
+                                                       GAsyncReadyCallback  callback,
+                                                       gpointer             user_data);
+gboolean        gconf_client_commit_change_set_finish (GConfClient*         client,
+                                                       GAsyncResult*        result,
+                                                       GError**             err);
+
 /* Create a change set that would revert the given change set
    for the given GConfClient */
 GConfChangeSet* gconf_client_reverse_change_set  (GConfClient* client,
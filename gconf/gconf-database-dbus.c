@@ -20,6 +20,7 @@
 
 #include <config.h>
 #include <string.h>
+#include <stdlib.h>
 #include "gconfd.h"
 #include "gconf-dbus-utils.h"
 #include "gconfd-dbus.h"
@@ -37,8 +38,56 @@ typedef struct {
 typedef struct {
   gchar *service;
   gint nr_of_notifications;
+  /* Client asked for NotifyBatch in AddNotify */
+  gboolean supports_batch;
+  /* Entry encoding the client asked for in AddNotify */
+  guint32 protocol;
 } ListeningClientData;
 
+/* A changed key waiting to be sent to a batching client. If the
+ * key changes again before the batch goes out, only the last
+ * value is sent.
+ */
+typedef struct {
+  gchar      *key;
+  GConfValue *value;
+  gboolean    is_default;
+  gboolean    is_writable;
+  guint       change_serial;
+  /* The namespace sections the client listens on that cover key */
+  GSList     *namespace_sections;
+} PendingNotify;
+
+typedef struct {
+  /* PendingNotify, in the order the keys first changed */
+  GQueue     *notifies;
+  GHashTable *notifies_by_key;
+} PendingBatch;
+
+/* Bumped for every change so repeated queueing of the same change
+ * for several namespace sections doesn't copy the value each time.
+ */
+static guint change_serial = 0;
+
+/* Puts a value a client just read where every client on the host can
+ * read it without a round trip. Schema defaults aren't published: they
+ * change without a notification when schemas are installed.
+ */
+static void
+database_publish_value (GConfDatabase    *db,
+			const gchar      *key,
+			const GConfValue *value,
+			gboolean          is_default,
+			gboolean          is_writable,
+			const gchar      *schema_name)
+{
+  if (db->value_cache == NULL || value == NULL || is_default)
+    return;
+
+  gconf_value_cache_publish (db->value_cache, key, value,
+			     is_writable, schema_name);
+}
+
 static void              database_unregistered_func         (DBusConnection   *connection,
 							     GConfDatabase    *db);
 static DBusHandlerResult database_message_func              (DBusConnection   *connection,
@@ -60,6 +109,9 @@ static void     database_handle_lookup_ext        (DBusConnection   *conn,
 static void     database_handle_lookup_default    (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
+static void     database_handle_lookup_many       (DBusConnection   *conn,
+						   DBusMessage      *message,
+						   GConfDatabase    *db);
 static void     database_handle_set               (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
@@ -75,15 +127,29 @@ static void     database_handle_dir_exists        (DBusConnection   *conn,
 static void     database_handle_get_all_entries   (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
+static void     database_handle_get_all_entries_recursive (DBusConnection *conn,
+							   DBusMessage    *message,
+							   GConfDatabase  *db);
 static void     database_handle_get_all_dirs      (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
 static void     database_handle_set_schema        (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
+static void     database_handle_commit_change_set (DBusConnection   *conn,
+						   DBusMessage      *message,
+						   GConfDatabase    *db);
 static void     database_handle_suggest_sync      (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
+static void     database_queue_batched_notify     (GConfDatabase    *db,
+						   const gchar      *service,
+						   const gchar      *namespace_section,
+						   const gchar      *key,
+						   const GConfValue *value,
+						   gboolean          is_default,
+						   gboolean          is_writable);
+static void     database_flush_batches            (GConfDatabase    *db);
 static void     database_handle_add_notify        (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
@@ -134,6 +200,11 @@ database_message_func (DBusConnection *connection,
 					GCONF_DBUS_DATABASE_LOOKUP_DEFAULT)) {
     database_handle_lookup_default (connection, message, db);
   }
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_DATABASE_INTERFACE,
+					GCONF_DBUS_DATABASE_LOOKUP_MANY)) {
+    database_handle_lookup_many (connection, message, db);
+  }
   else if (dbus_message_is_method_call (message,
 					GCONF_DBUS_DATABASE_INTERFACE,
 					GCONF_DBUS_DATABASE_SET)) {
@@ -159,6 +230,11 @@ database_message_func (DBusConnection *connection,
 					GCONF_DBUS_DATABASE_GET_ALL_ENTRIES)) {
     database_handle_get_all_entries (connection, message, db);
   }
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_DATABASE_INTERFACE,
+					GCONF_DBUS_DATABASE_GET_ALL_ENTRIES_RECURSIVE)) {
+    database_handle_get_all_entries_recursive (connection, message, db);
+  }
   else if (dbus_message_is_method_call (message,
 					GCONF_DBUS_DATABASE_INTERFACE,
 					GCONF_DBUS_DATABASE_GET_ALL_DIRS)) {
@@ -174,6 +250,11 @@ database_message_func (DBusConnection *connection,
 					GCONF_DBUS_DATABASE_SUGGEST_SYNC)) {
     database_handle_suggest_sync (connection, message, db);
   }
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_DATABASE_INTERFACE,
+					GCONF_DBUS_DATABASE_COMMIT_CHANGE_SET)) {
+    database_handle_commit_change_set (connection, message, db);
+  }
   else if (dbus_message_is_method_call (message,
 					GCONF_DBUS_DATABASE_INTERFACE,
 					GCONF_DBUS_DATABASE_ADD_NOTIFY)) {
@@ -355,6 +436,9 @@ database_handle_lookup_ext (DBusConnection *conn,
 					  value_is_default,
 					  value_is_writable,
 					  schema_name);
+
+  database_publish_value (db, key, value, value_is_default,
+			  value_is_writable, schema_name);
   
   dbus_connection_send (conn, reply, NULL);
   dbus_message_unref (reply);
@@ -409,6 +493,66 @@ database_handle_lookup_default (DBusConnection *conn,
     gconf_value_free (value);
 }
 
+static void
+database_handle_lookup_many (DBusConnection *conn,
+			     DBusMessage    *message,
+			     GConfDatabase  *db)
+{
+  GSList *entries, *l;
+  gchar **keys;
+  gint n_keys;
+  gchar *locale;
+  GConfLocaleList *locales;
+  gboolean use_schema_default;
+  GError *gerror = NULL;
+  DBusMessage *reply;
+  DBusMessageIter iter;
+
+  if (!gconfd_dbus_get_message_args (conn, message,
+				     DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &keys, &n_keys,
+				     DBUS_TYPE_STRING, &locale,
+				     DBUS_TYPE_BOOLEAN, &use_schema_default,
+				     DBUS_TYPE_INVALID))
+    return;
+
+  locales = gconfd_locale_cache_lookup (locale);
+
+  entries = gconf_database_query_entries (db, (const gchar **) keys,
+					  locales->list, use_schema_default,
+					  &gerror);
+  dbus_free_string_array (keys);
+
+  if (gconfd_dbus_set_exception (conn, message, &gerror))
+    return;
+
+  reply = dbus_message_new_method_return (message);
+
+  dbus_message_iter_init_append (reply, &iter);
+
+  /* Optional protocol version after keys, locale and use_schema_default */
+  gconf_dbus_utils_append_entries (&iter, entries,
+				   gconf_dbus_utils_get_protocol (message, 3));
+
+  for (l = entries; l; l = l->next)
+    {
+      GConfEntry *entry = l->data;
+
+      database_publish_value (db,
+			      entry->key,
+			      gconf_entry_get_value (entry),
+			      gconf_entry_get_is_default (entry),
+			      gconf_entry_get_is_writable (entry),
+			      gconf_entry_get_schema_name (entry));
+
+      gconf_entry_free (entry);
+    }
+
+  dbus_connection_send (conn, reply, NULL);
+  dbus_message_unref (reply);
+
+  g_slist_free (entries);
+}
+
 static void
 database_handle_set (DBusConnection *conn,
                      DBusMessage    *message,
@@ -471,6 +615,80 @@ database_handle_unset (DBusConnection *conn,
 
 }
                                                                                
+static void
+database_handle_commit_change_set (DBusConnection *conn,
+				   DBusMessage    *message,
+				   GConfDatabase  *db)
+{
+  GSList *entries;
+  GSList *failed_keys, *errors;
+  GSList *k, *e;
+  const gchar *locale;
+  DBusMessage *reply;
+  DBusMessageIter iter, array_iter;
+
+  dbus_message_iter_init (message, &iter);
+  if (dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_ARRAY)
+    {
+      reply = dbus_message_new_error (message,
+				      GCONF_DBUS_ERROR_FAILED,
+				      _("Got a malformed message."));
+      dbus_connection_send (conn, reply, NULL);
+      dbus_message_unref (reply);
+      return;
+    }
+
+  /* Keys are fully qualified */
+  entries = g_slist_reverse (gconf_dbus_utils_get_entries (&iter, "/"));
+
+  locale = "";
+  if (dbus_message_iter_next (&iter) &&
+      dbus_message_iter_get_arg_type (&iter) == DBUS_TYPE_STRING)
+    dbus_message_iter_get_basic (&iter, &locale);
+
+  gconf_database_commit_entries (db, entries,
+				 locale[0] != '\0' ? locale : NULL,
+				 &failed_keys, &errors);
+
+  /* Like Unset, get it all to disk soon */
+  gconf_database_sync (db, NULL);
+
+  reply = dbus_message_new_method_return (message);
+  dbus_message_iter_init_append (reply, &iter);
+  dbus_message_iter_open_container (&iter,
+				    DBUS_TYPE_ARRAY,
+				    GCONF_DBUS_COMMIT_ERROR_SIGNATURE,
+				    &array_iter);
+
+  for (k = failed_keys, e = errors; k && e; k = k->next, e = e->next)
+    {
+      DBusMessageIter struct_iter;
+      const gchar *key = k->data;
+      GError *error = e->data;
+      dbus_int32_t code = error->code;
+
+      dbus_message_iter_open_container (&array_iter, DBUS_TYPE_STRUCT,
+					NULL, &struct_iter);
+      dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING, &key);
+      dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_INT32, &code);
+      dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING,
+				      &error->message);
+      dbus_message_iter_close_container (&array_iter, &struct_iter);
+
+      g_error_free (error);
+    }
+
+  dbus_message_iter_close_container (&iter, &array_iter);
+
+  dbus_connection_send (conn, reply, NULL);
+  dbus_message_unref (reply);
+
+  g_slist_free (failed_keys);
+  g_slist_free (errors);
+  g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+  g_slist_free (entries);
+}
+
 static void
 database_handle_recursive_unset  (DBusConnection *conn,
                                   DBusMessage    *message,
@@ -565,7 +783,9 @@ database_handle_get_all_entries (DBusConnection *conn,
 
   dbus_message_iter_init_append (reply, &iter);
 
-  gconf_dbus_utils_append_entries (&iter, entries);
+  /* Optional protocol version after dir and locale */
+  gconf_dbus_utils_append_entries (&iter, entries,
+				   gconf_dbus_utils_get_protocol (message, 2));
 
   for (l = entries; l; l = l->next)
     {
@@ -580,6 +800,73 @@ database_handle_get_all_entries (DBusConnection *conn,
   g_slist_free (entries);
 }
                                                                                 
+/* Replies with the entries below dir, with full keys, and the full
+ * names of all dirs below it, so preloading a tree is one round trip.
+ */
+static void
+database_handle_get_all_entries_recursive (DBusConnection *conn,
+					   DBusMessage    *message,
+					   GConfDatabase  *db)
+{
+  GSList          *entries, *dirs, *l;
+  gchar           *dir;
+  gchar           *locale;
+  GError          *gerror = NULL;
+  GConfLocaleList *locales;
+  DBusMessage     *reply;
+  DBusMessageIter  iter;
+  DBusMessageIter  array_iter;
+
+  if (!gconfd_dbus_get_message_args (conn, message,
+				     DBUS_TYPE_STRING, &dir,
+				     DBUS_TYPE_STRING, &locale,
+				     DBUS_TYPE_INVALID))
+    return;
+
+  locales = gconfd_locale_cache_lookup (locale);
+
+  entries = gconf_database_all_entries_recursive (db, dir, locales->list,
+						  &dirs, &gerror);
+
+  if (gconfd_dbus_set_exception (conn, message, &gerror))
+    return;
+
+  reply = dbus_message_new_method_return (message);
+
+  dbus_message_iter_init_append (reply, &iter);
+
+  /* Optional protocol version after dir and locale */
+  gconf_dbus_utils_append_entries (&iter, entries,
+				   gconf_dbus_utils_get_protocol (message, 2));
+
+  dbus_message_iter_open_container (&iter,
+				    DBUS_TYPE_ARRAY,
+				    DBUS_TYPE_STRING_AS_STRING,
+				    &array_iter);
+
+  for (l = dirs; l; l = l->next)
+    {
+      gchar *str = l->data;
+
+      dbus_message_iter_append_basic (&array_iter,
+				      DBUS_TYPE_STRING,
+				      &str);
+
+      g_free (str);
+    }
+
+  dbus_message_iter_close_container (&iter, &array_iter);
+
+  for (l = entries; l; l = l->next)
+    gconf_entry_free (l->data);
+
+  dbus_connection_send (conn, reply, NULL);
+  dbus_message_unref (reply);
+
+  g_slist_free (entries);
+  g_slist_free (dirs);
+}
+
 static void
 database_handle_get_all_dirs (DBusConnection *conn,
                               DBusMessage    *message,
@@ -688,12 +975,23 @@ database_handle_add_notify (DBusConnection    *conn,
   const char *sender;
   NotificationData *notification;
   ListeningClientData *client;
+  DBusMessageIter iter;
+  dbus_bool_t supports_batch;
 
   if (!gconfd_dbus_get_message_args (conn, message,
 				     DBUS_TYPE_STRING, &namespace_section,
 				     DBUS_TYPE_INVALID)) 
     return;
 
+  /* Newer clients append a boolean saying they understand
+   * NotifyBatch; older ones only send the namespace section.
+   */
+  supports_batch = FALSE;
+  dbus_message_iter_init (message, &iter);
+  if (dbus_message_iter_next (&iter) &&
+      dbus_message_iter_get_arg_type (&iter) == DBUS_TYPE_BOOLEAN)
+    dbus_message_iter_get_basic (&iter, &supports_batch);
+
   sender = dbus_message_get_sender (message);
   
   client = g_hash_table_lookup (db->listening_clients, sender);
@@ -705,6 +1003,9 @@ database_handle_add_notify (DBusConnection    *conn,
     {
       client->nr_of_notifications++;
     }
+
+  client->supports_batch = supports_batch != FALSE;
+  client->protocol = gconf_dbus_utils_get_protocol (message, 2);
   
   notification = g_hash_table_lookup (db->notifications, namespace_section);
   
@@ -834,11 +1135,228 @@ database_remove_listening_client (GConfDatabase       *db,
   dbus_bus_remove_match (gconfd_dbus_get_connection (), rule, NULL);
   g_free (rule);
 
+  /* No point sending what's queued to a client that's gone */
+  g_hash_table_remove (db->pending_batches, client->service);
+
   g_hash_table_remove (db->listening_clients, client->service);
   g_free (client->service);
   g_free (client);
 }
 
+static void
+pending_notify_free (PendingNotify *pending)
+{
+  g_free (pending->key);
+
+  if (pending->value)
+    gconf_value_free (pending->value);
+
+  g_slist_foreach (pending->namespace_sections, (GFunc) g_free, NULL);
+  g_slist_free (pending->namespace_sections);
+
+  g_free (pending);
+}
+
+static void
+pending_batch_free (PendingBatch *batch)
+{
+  g_queue_foreach (batch->notifies, (GFunc) pending_notify_free, NULL);
+  g_queue_free (batch->notifies);
+
+  g_hash_table_destroy (batch->notifies_by_key);
+
+  g_free (batch);
+}
+
+/* How long to collect changes before sending a batch, in ms, from
+ * GCONF_NOTIFY_BATCH_WINDOW. 0 means until the main loop goes idle,
+ * i.e. everything changed while handling the pending requests.
+ */
+static guint
+database_get_batch_window (void)
+{
+  static gint window = -1;
+
+  if (window < 0)
+    {
+      const gchar *str;
+
+      str = g_getenv ("GCONF_NOTIFY_BATCH_WINDOW");
+      window = str ? MAX (atoi (str), 0) : 0;
+    }
+
+  return window;
+}
+
+static void
+database_send_batch (GConfDatabase *db,
+		     const gchar   *service,
+		     PendingBatch  *batch)
+{
+  DBusMessage     *message;
+  DBusMessageIter  iter;
+  DBusMessageIter  array_iter;
+  GList           *l;
+  ListeningClientData *client;
+  gboolean         typed;
+
+  client = g_hash_table_lookup (db->listening_clients, service);
+  typed = client && client->protocol >= GCONF_DBUS_PROTOCOL_TYPED;
+
+  message = dbus_message_new_method_call (service,
+					  GCONF_DBUS_CLIENT_OBJECT,
+					  GCONF_DBUS_CLIENT_INTERFACE,
+					  GCONF_DBUS_LISTENER_NOTIFY_BATCH);
+
+  dbus_message_iter_init_append (message, &iter);
+
+  dbus_message_iter_append_basic (&iter,
+				  DBUS_TYPE_OBJECT_PATH,
+				  &db->object_path);
+
+  dbus_message_iter_open_container (&iter,
+				    DBUS_TYPE_ARRAY,
+				    typed ?
+				    GCONF_DBUS_NOTIFY_BATCH_TYPED_ITEM_SIGNATURE :
+				    GCONF_DBUS_NOTIFY_BATCH_ITEM_SIGNATURE,
+				    &array_iter);
+
+  for (l = batch->notifies->head; l; l = l->next)
+    {
+      PendingNotify *pending = l->data;
+      GSList        *tmp;
+
+      for (tmp = pending->namespace_sections; tmp; tmp = tmp->next)
+	{
+	  const gchar     *namespace_section = tmp->data;
+	  DBusMessageIter  struct_iter;
+
+	  dbus_message_iter_open_container (&array_iter,
+					    DBUS_TYPE_STRUCT,
+					    NULL, /* for structs */
+					    &struct_iter);
+
+	  dbus_message_iter_append_basic (&struct_iter,
+					  DBUS_TYPE_STRING,
+					  &namespace_section);
+
+	  if (typed)
+	    gconf_dbus_utils_append_entry_values_typed (&struct_iter,
+							pending->key,
+							pending->value,
+							pending->is_default,
+							pending->is_writable,
+							NULL);
+	  else
+	    gconf_dbus_utils_append_entry_values_stringified (&struct_iter,
+							      pending->key,
+							      pending->value,
+							      pending->is_default,
+							      pending->is_writable,
+							      NULL);
+
+	  dbus_message_iter_close_container (&array_iter, &struct_iter);
+	}
+    }
+
+  dbus_message_iter_close_container (&iter, &array_iter);
+
+  dbus_message_set_no_reply (message, TRUE);
+
+  dbus_connection_send (gconfd_dbus_get_connection (), message, NULL);
+  dbus_message_unref (message);
+}
+
+static void
+database_flush_batches (GConfDatabase *db)
+{
+  GHashTableIter  iter;
+  gpointer        service;
+  gpointer        batch;
+
+  db->batch_flush_id = 0;
+
+  g_hash_table_iter_init (&iter, db->pending_batches);
+  while (g_hash_table_iter_next (&iter, &service, &batch))
+    database_send_batch (db, service, batch);
+
+  g_hash_table_remove_all (db->pending_batches);
+}
+
+static gboolean
+database_flush_batches_callback (gpointer data)
+{
+  database_flush_batches (data);
+
+  return FALSE;
+}
+
+static void
+database_queue_batched_notify (GConfDatabase    *db,
+			       const gchar      *service,
+			       const gchar      *namespace_section,
+			       const gchar      *key,
+			       const GConfValue *value,
+			       gboolean          is_default,
+			       gboolean          is_writable)
+{
+  PendingBatch  *batch;
+  PendingNotify *pending;
+
+  batch = g_hash_table_lookup (db->pending_batches, service);
+  if (batch == NULL)
+    {
+      batch = g_new0 (PendingBatch, 1);
+      batch->notifies = g_queue_new ();
+      batch->notifies_by_key = g_hash_table_new (g_str_hash, g_str_equal);
+
+      g_hash_table_insert (db->pending_batches, g_strdup (service), batch);
+    }
+
+  pending = g_hash_table_lookup (batch->notifies_by_key, key);
+  if (pending == NULL)
+    {
+      pending = g_new0 (PendingNotify, 1);
+      pending->key = g_strdup (key);
+
+      g_queue_push_tail (batch->notifies, pending);
+      g_hash_table_insert (batch->notifies_by_key, pending->key, pending);
+    }
+
+  /* Coalesce: a later change to the key replaces the queued one */
+  if (pending->change_serial != change_serial)
+    {
+      if (pending->value)
+	gconf_value_free (pending->value);
+
+      pending->value = value ? gconf_value_ref ((GConfValue *) value) : NULL;
+      pending->is_default = is_default;
+      pending->is_writable = is_writable;
+      pending->change_serial = change_serial;
+    }
+
+  if (g_slist_find_custom (pending->namespace_sections,
+			   namespace_section,
+			   (GCompareFunc) strcmp) == NULL)
+    pending->namespace_sections = g_slist_append (pending->namespace_sections,
+						  g_strdup (namespace_section));
+
+  if (db->batch_flush_id == 0)
+    {
+      guint window;
+
+      window = database_get_batch_window ();
+
+      if (window > 0)
+	db->batch_flush_id = g_timeout_add (window,
+					    database_flush_batches_callback,
+					    db);
+      else
+	db->batch_flush_id = g_idle_add (database_flush_batches_callback,
+					 db);
+    }
+}
+
 void
 gconf_database_dbus_setup (GConfDatabase *db)
 {
@@ -859,6 +1377,11 @@ gconf_database_dbus_setup (GConfDatabase *db)
 
   db->notifications = g_hash_table_new (g_str_hash, g_str_equal);
   db->listening_clients = g_hash_table_new (g_str_hash, g_str_equal);
+  db->pending_batches = g_hash_table_new_full (g_str_hash, g_str_equal,
+					       g_free,
+					       (GDestroyNotify) pending_batch_free);
+  db->batch_flush_id = 0;
+  db->value_cache = NULL;
  
   dbus_connection_add_filter (conn,
 			      (DBusHandleMessageFunction)database_filter_func,
@@ -873,6 +1396,13 @@ gconf_database_dbus_teardown (GConfDatabase *db)
 
   conn = gconfd_dbus_get_connection ();
 
+  /* Don't lose notifications that are still queued */
+  if (db->batch_flush_id != 0)
+    {
+      g_source_remove (db->batch_flush_id);
+      database_flush_batches (db);
+    }
+
   gconfd_emit_db_gone (db->object_path);
   dbus_connection_unregister_object_path (conn, db->object_path);
   
@@ -887,6 +1417,56 @@ gconf_database_dbus_teardown (GConfDatabase *db)
 
   g_hash_table_destroy (db->listening_clients);
   db->listening_clients = NULL;
+
+  g_hash_table_destroy (db->pending_batches);
+  db->pending_batches = NULL;
+
+  if (db->value_cache != NULL)
+    {
+      gconf_value_cache_retire (db->value_cache);
+      db->value_cache = NULL;
+    }
+}
+
+void
+gconf_database_dbus_publish_values (GConfDatabase *db)
+{
+  GError *error = NULL;
+
+  g_return_if_fail (db->value_cache == NULL);
+
+  gconf_value_cache_remove_stale ();
+
+  db->value_cache = gconf_value_cache_create (&error);
+  if (error != NULL)
+    {
+      gconf_log (GCL_WARNING, "%s", error->message);
+      g_error_free (error);
+    }
+}
+
+const gchar *
+gconf_database_dbus_get_value_cache (GConfDatabase *db)
+{
+  if (db->value_cache == NULL)
+    return NULL;
+
+  return gconf_value_cache_get_filename (db->value_cache);
+}
+
+void
+gconf_database_dbus_clear_value_cache (GConfDatabase *db)
+{
+  if (db->value_cache != NULL)
+    gconf_value_cache_clear (db->value_cache);
+}
+
+void
+gconf_database_dbus_forget_value (GConfDatabase *db,
+				  const gchar   *key)
+{
+  if (db->value_cache != NULL)
+    gconf_value_cache_remove (db->value_cache, key);
 }
 
 const char *
@@ -912,6 +1492,12 @@ gconf_database_dbus_notify_listeners (GConfDatabase    *db,
   
   dir = g_strdup (key);
 
+  ++change_serial;
+
+  /* The next LookupExtended publishes the new value again */
+  if (db->value_cache != NULL)
+    gconf_value_cache_remove (db->value_cache, key);
+
   /* Lookup the key in the namespace hierarchy, start with the full key and then
    * remove the leaf, lookup again, remove the leaf, and so on until a match is
    * found. Notify the clients (identified by their base service) that
@@ -927,7 +1513,21 @@ gconf_database_dbus_notify_listeners (GConfDatabase    *db,
 	  for (l = notification->clients; l; l = l->next)
 	    {
 	      const char *base_service = l->data;
+	      ListeningClientData *client;
 	      DBusMessageIter iter;
+
+	      client = g_hash_table_lookup (db->listening_clients, base_service);
+	      if (client != NULL && client->supports_batch)
+		{
+		  database_queue_batched_notify (db,
+						 base_service,
+						 dir,
+						 key,
+						 value,
+						 is_default,
+						 is_writable);
+		  continue;
+		}
 	      
 	      message = dbus_message_new_method_call (base_service,
 						      GCONF_DBUS_CLIENT_OBJECT,
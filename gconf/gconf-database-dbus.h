@@ -34,4 +34,10 @@ void         gconf_database_dbus_notify_listeners (GConfDatabase    *db,
 						   gboolean          is_writable,
 						   gboolean          notify_others);
 
+void         gconf_database_dbus_publish_values   (GConfDatabase    *db);
+const gchar *gconf_database_dbus_get_value_cache  (GConfDatabase    *db);
+void         gconf_database_dbus_clear_value_cache (GConfDatabase   *db);
+void         gconf_database_dbus_forget_value     (GConfDatabase    *db,
+						   const gchar      *key);
+
 #endif
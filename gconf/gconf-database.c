@@ -280,8 +280,50 @@ impl_ConfigDatabase_batch_change (PortableServer_Servant servant,
                                   const ConfigDatabase_ValueList * values,
                                   CORBA_Environment * ev)
 {
+  GConfDatabase *db = (GConfDatabase*) servant;
+  GSList *entries = NULL;
+  GSList *failed_keys;
+  GSList *errors;
+  CORBA_unsigned_long i;
+
   if (gconfd_check_in_shutdown (ev))
     return;
+
+  if (keys->_length != values->_length)
+    {
+      GError *error;
+
+      error = g_error_new (GCONF_ERROR, GCONF_ERROR_FAILED,
+                           _("Got %u keys but %u values"),
+                           keys->_length, values->_length);
+      gconf_set_exception (&error, ev);
+      return;
+    }
+
+  for (i = 0; i < keys->_length; i++)
+    entries = g_slist_prepend (entries,
+                               gconf_entry_new_nocopy (g_strdup (keys->_buffer[i]),
+                                                       gconf_value_from_corba_value (&values->_buffer[i])));
+  entries = g_slist_reverse (entries);
+
+  if (*locale == '\0')
+    locale = NULL;
+
+  if (!gconf_database_commit_entries (db, entries, locale,
+                                      &failed_keys, &errors))
+    {
+      /* The interface only has room for one */
+      GError *error = errors->data;
+
+      gconf_set_exception (&error, ev);
+
+      g_slist_foreach (errors->next, (GFunc) g_error_free, NULL);
+    }
+
+  g_slist_free (failed_keys);
+  g_slist_free (errors);
+  g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+  g_slist_free (entries);
 }
 
 static CORBA_boolean
@@ -806,6 +848,11 @@ gconf_database_set_sources (GConfDatabase *db,
 
       gconf_sources_clear_cache(db->sources);
       gconf_sources_free(db->sources);
+
+#ifdef HAVE_DBUS
+      /* Nothing published came from the new sources */
+      gconf_database_dbus_clear_value_cache (db);
+#endif
     }
 
   db->sources = sources;
@@ -1383,6 +1430,65 @@ gconf_database_query_default_value (GConfDatabase  *db,
                                            err);
 }
 
+/* Looks up a whole list of keys for one request; returns one entry per
+ * key, in order, or NULL and the first error.
+ */
+GSList*
+gconf_database_query_entries (GConfDatabase  *db,
+                              const gchar   **keys,
+                              const gchar   **locales,
+                              gboolean        use_schema_default,
+                              GError    **err)
+{
+  GSList *entries;
+  int i;
+
+  g_return_val_if_fail(err == NULL || *err == NULL, NULL);
+  g_assert(db->listeners != NULL);
+
+  db->last_access = time(NULL);
+
+  entries = NULL;
+  for (i = 0; keys[i] != NULL; i++)
+    {
+      GConfValue *val;
+      GConfEntry *entry;
+      gboolean is_default = FALSE;
+      gboolean is_writable = TRUE;
+      gchar *schema_name = NULL;
+      GError *error = NULL;
+
+      val = gconf_sources_query_value(db->sources, keys[i], locales,
+                                      use_schema_default,
+                                      &is_default,
+                                      &is_writable,
+                                      &schema_name,
+                                      &error);
+
+      if (error != NULL)
+        {
+          gconf_log(GCL_ERR, _("Error getting value for `%s': %s"),
+                    keys[i], error->message);
+          g_propagate_error(err, error);
+
+          g_slist_foreach(entries, (GFunc) gconf_entry_free, NULL);
+          g_slist_free(entries);
+
+          return NULL;
+        }
+
+      entry = gconf_entry_new_nocopy(g_strdup(keys[i]), val);
+      gconf_entry_set_is_default(entry, is_default);
+      gconf_entry_set_is_writable(entry, is_writable);
+      gconf_entry_set_schema_name(entry, schema_name);
+      g_free(schema_name);
+
+      entries = g_slist_prepend(entries, entry);
+    }
+
+  return g_slist_reverse(entries);
+}
+
 void
 gconf_database_set   (GConfDatabase      *db,
                       const gchar        *key,
@@ -1543,6 +1649,183 @@ gconf_database_unset (GConfDatabase      *db,
     }
 }
 
+static void
+notify_committed_entry (GConfDatabase *db,
+                        GConfSources  *modified_sources,
+                        const gchar   *key,
+                        GConfValue    *value,
+                        gboolean       is_default,
+                        gboolean       is_writable)
+{
+#ifdef HAVE_CORBA
+  ConfigValue *cvalue;
+
+  if (value != NULL)
+    cvalue = gconf_corba_value_from_gconf_value (value);
+  else
+    cvalue = gconf_invalid_corba_value ();
+
+  gconf_database_notify_listeners (db,
+                                   modified_sources,
+                                   key,
+                                   cvalue,
+                                   is_default,
+                                   is_writable,
+                                   TRUE);
+  CORBA_free (cvalue);
+#endif
+#ifdef HAVE_DBUS
+  gconf_database_dbus_notify_listeners (db,
+                                        modified_sources,
+                                        key,
+                                        value,
+                                        is_default,
+                                        is_writable,
+                                        TRUE);
+#endif
+}
+
+gboolean
+gconf_database_commit_entries (GConfDatabase  *db,
+                               GSList         *entries,
+                               const gchar    *locale,
+                               GSList        **failed_keys,
+                               GSList        **errors)
+{
+  GConfSources **modified_sources;
+  const gchar *locale_list[] = { NULL, NULL };
+  GSList *tmp;
+  int n_entries;
+  int i;
+
+  g_assert(db->listeners != NULL);
+
+  *failed_keys = NULL;
+  *errors = NULL;
+
+  db->last_access = time(NULL);
+
+  gconf_log(GCL_DEBUG, "Received request to commit %u changes",
+            g_slist_length (entries));
+
+  /* Don't start unless all of it can go through; a backend can still
+   * fail halfway, but that is no different from a failed sync.
+   */
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry = tmp->data;
+      gboolean is_writable = TRUE;
+      GError *error = NULL;
+      GConfValue *val;
+
+      val = gconf_sources_query_value (db->sources, entry->key, NULL, FALSE,
+                                       NULL, &is_writable, NULL, &error);
+      if (val != NULL)
+        gconf_value_free (val);
+
+      if (error == NULL && !is_writable)
+        error = g_error_new (GCONF_ERROR, GCONF_ERROR_NO_WRITABLE_DATABASE,
+                             _("Key `%s' is not writable"), entry->key);
+
+      if (error != NULL)
+        {
+          *failed_keys = g_slist_prepend (*failed_keys, entry->key);
+          *errors = g_slist_prepend (*errors, error);
+        }
+    }
+
+  if (*failed_keys != NULL)
+    {
+      /* None of it went in; the other keys follow the culprits */
+      for (tmp = entries; tmp != NULL; tmp = tmp->next)
+        {
+          GConfEntry *entry = tmp->data;
+
+          if (g_slist_find (*failed_keys, entry->key) != NULL)
+            continue;
+
+          *failed_keys = g_slist_prepend (*failed_keys, entry->key);
+          *errors = g_slist_prepend (*errors,
+                                     g_error_new (GCONF_ERROR, GCONF_ERROR_FAILED,
+                                                  _("`%s' was not changed because other keys in the change set can't be"),
+                                                  entry->key));
+        }
+
+      *failed_keys = g_slist_reverse (*failed_keys);
+      *errors = g_slist_reverse (*errors);
+      return FALSE;
+    }
+
+  n_entries = g_slist_length (entries);
+  modified_sources = g_new0 (GConfSources *, n_entries);
+
+  for (tmp = entries, i = 0; tmp != NULL; tmp = tmp->next, i++)
+    {
+      GConfEntry *entry = tmp->data;
+      GError *error = NULL;
+
+      if (entry->value != NULL)
+        gconf_sources_set_value (db->sources, entry->key, entry->value,
+                                 &modified_sources[i], &error);
+      else
+        gconf_sources_unset_value (db->sources, entry->key, locale,
+                                   &modified_sources[i], &error);
+
+      if (error != NULL)
+        {
+          gconf_log (GCL_ERR, _("Error committing `%s': %s"),
+                     entry->key, error->message);
+
+          *failed_keys = g_slist_prepend (*failed_keys, entry->key);
+          *errors = g_slist_prepend (*errors, error);
+        }
+    }
+
+  gconf_database_schedule_sync (db);
+
+  /* Listeners only hear about the changes once all of them are in */
+  locale_list[0] = locale;
+  for (tmp = entries, i = 0; tmp != NULL; tmp = tmp->next, i++)
+    {
+      GConfEntry *entry = tmp->data;
+
+      if (g_slist_find (*failed_keys, entry->key) != NULL)
+        continue;
+
+      if (entry->value != NULL)
+        {
+          /* Not the default, and writable since setting it worked */
+          notify_committed_entry (db, modified_sources[i], entry->key,
+                                  entry->value, FALSE, TRUE);
+        }
+      else
+        {
+          GConfValue *def_value;
+          gboolean is_writable = TRUE;
+
+          /* Same assumption as gconf_database_unset() */
+          def_value = gconf_database_query_default_value (db,
+                                                          entry->key,
+                                                          locale_list,
+                                                          &is_writable,
+                                                          NULL);
+
+          notify_committed_entry (db, modified_sources[i], entry->key,
+                                  def_value, TRUE, is_writable);
+
+          if (def_value)
+            gconf_value_free (def_value);
+        }
+    }
+
+  g_free (modified_sources);
+
+  *failed_keys = g_slist_reverse (*failed_keys);
+  *errors = g_slist_reverse (*errors);
+
+  return *failed_keys == NULL;
+}
+
 void
 gconf_database_recursive_unset (GConfDatabase      *db,
                                 const gchar        *key,
@@ -1762,6 +2045,97 @@ gconf_database_all_dirs (GConfDatabase  *db,
   return subdirs;
 }
 
+/* The entries of dir and of every dir below it, with full keys. The
+ * full names of the dirs below dir go in dirs, parents before their
+ * children.
+ */
+GSList*
+gconf_database_all_entries_recursive (GConfDatabase  *db,
+                                      const gchar    *dir,
+                                      const gchar   **locales,
+                                      GSList        **dirs,
+                                      GError        **err)
+{
+  GSList *entries;
+  GSList *subdirs;
+  GQueue pending = G_QUEUE_INIT;
+  gchar *current;
+
+  g_return_val_if_fail(err == NULL || *err == NULL, NULL);
+  g_return_val_if_fail(dirs != NULL, NULL);
+
+  g_assert(db->listeners != NULL);
+
+  db->last_access = time(NULL);
+
+  gconf_log (GCL_DEBUG, "Received request to list all entries below `%s'", dir);
+
+  *dirs = NULL;
+  entries = NULL;
+  subdirs = NULL;
+
+  g_queue_push_tail (&pending, g_strdup (dir));
+
+  while ((current = g_queue_pop_head (&pending)) != NULL)
+    {
+      GSList *these, *children, *tmp;
+      GError *error = NULL;
+
+      these = gconf_sources_all_entries (db->sources, current, locales, &error);
+      children = NULL;
+      if (error == NULL)
+        children = gconf_sources_all_dirs (db->sources, current, &error);
+
+      if (error != NULL)
+        {
+          gconf_log (GCL_ERR, _("Failed to get all entries in `%s': %s"),
+                     current, error->message);
+          g_propagate_error (err, error);
+
+          g_free (current);
+          g_slist_foreach (these, (GFunc) gconf_entry_free, NULL);
+          g_slist_free (these);
+          g_queue_foreach (&pending, (GFunc) g_free, NULL);
+          g_queue_clear (&pending);
+          g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+          g_slist_free (entries);
+          g_slist_foreach (subdirs, (GFunc) g_free, NULL);
+          g_slist_free (subdirs);
+
+          return NULL;
+        }
+
+      for (tmp = these; tmp != NULL; tmp = tmp->next)
+        {
+          GConfEntry *entry = tmp->data;
+          gchar *full;
+
+          full = gconf_concat_dir_and_key (current, entry->key);
+          g_free (entry->key);
+          entry->key = full;
+        }
+      entries = g_slist_concat (these, entries);
+
+      for (tmp = children; tmp != NULL; tmp = tmp->next)
+        {
+          gchar *full;
+
+          full = gconf_concat_dir_and_key (current, tmp->data);
+          g_free (tmp->data);
+
+          subdirs = g_slist_prepend (subdirs, g_strdup (full));
+          g_queue_push_tail (&pending, full);
+        }
+      g_slist_free (children);
+
+      g_free (current);
+    }
+
+  *dirs = g_slist_reverse (subdirs);
+
+  return entries;
+}
+
 void
 gconf_database_set_schema (GConfDatabase  *db,
                            const gchar    *key,
@@ -1830,6 +2204,10 @@ gconf_database_clear_cache (GConfDatabase  *db,
   db->last_access = time(NULL);
 
   gconf_sources_clear_cache(db->sources);
+
+#ifdef HAVE_DBUS
+  gconf_database_dbus_clear_value_cache (db);
+#endif
 }
 
 void
@@ -34,6 +34,7 @@ G_BEGIN_DECLS
 
 #ifdef HAVE_DBUS
 #include <dbus/dbus.h>
+#include "gconf-value-cache.h"
 #endif
 
 #include "gconf-locale.h"
@@ -56,6 +57,15 @@ struct _GConfDatabase
   /* Information about clients that want notification. */
   GHashTable     *notifications;
   GHashTable     *listening_clients;
+
+  /* Coalesced notifications waiting to go out as NotifyBatch,
+   * by client base service.
+   */
+  GHashTable     *pending_batches;
+  guint           batch_flush_id;
+
+  /* Shared memory snapshot of hot keys, default database only */
+  GConfValueCache *value_cache;
 #endif
 
   GConfListeners* listeners;
@@ -111,6 +121,11 @@ GConfValue* gconf_database_query_default_value (GConfDatabase  *db,
                                                 const gchar   **locales,
                                                 gboolean       *is_writable,
                                                 GError    **err);
+GSList*     gconf_database_query_entries       (GConfDatabase  *db,
+                                                const gchar   **keys,
+                                                const gchar   **locales,
+                                                gboolean        use_schema_default,
+                                                GError    **err);
 
 
 
@@ -132,6 +147,18 @@ void gconf_database_recursive_unset (GConfDatabase      *db,
                                      GConfUnsetFlags     flags,
                                      GError            **err);
 
+/* Applies a change set given as entries, unsetting those without a
+ * value. Nothing is changed if any key is not writable, and then
+ * every key is reported. The keys that could not be changed go in
+ * failed_keys (not copied) and their errors in the same order in
+ * errors, the real causes first; TRUE if there were none.
+ */
+gboolean gconf_database_commit_entries (GConfDatabase  *db,
+                                        GSList         *entries,
+                                        const gchar    *locale,
+                                        GSList        **failed_keys,
+                                        GSList        **errors);
+
 
 gboolean gconf_database_dir_exists  (GConfDatabase  *db,
                                      const gchar    *dir,
@@ -146,6 +173,11 @@ GSList*  gconf_database_all_entries (GConfDatabase  *db,
 GSList*  gconf_database_all_dirs    (GConfDatabase  *db,
                                      const gchar    *dir,
                                      GError    **err);
+GSList*  gconf_database_all_entries_recursive (GConfDatabase  *db,
+                                               const gchar    *dir,
+                                               const gchar   **locales,
+                                               GSList        **dirs,
+                                               GError        **err);
 void     gconf_database_set_schema  (GConfDatabase  *db,
                                      const gchar    *key,
                                      const gchar    *schema_key,
@@ -560,6 +560,109 @@ utils_append_entry_values_stringified (DBusMessageIter  *main_iter,
     g_error ("Out of memory");
 }
 
+/* Signature of the struct utils_append_schema writes. */
+#define SCHEMA_SIGNATURE "(iiiibsbsbsbss)"
+
+/* Longest is a pair of schemas, "(i(ii" + 2 * SCHEMA_SIGNATURE + "))". */
+#define VALUE_SIGNATURE_MAX 64
+
+static const gchar *
+utils_fundamental_signature (GConfValueType type)
+{
+  switch (type)
+    {
+    case GCONF_VALUE_INT:
+      return DBUS_TYPE_INT32_AS_STRING;
+    case GCONF_VALUE_STRING:
+      return DBUS_TYPE_STRING_AS_STRING;
+    case GCONF_VALUE_FLOAT:
+      return DBUS_TYPE_DOUBLE_AS_STRING;
+    case GCONF_VALUE_BOOL:
+      return DBUS_TYPE_BOOLEAN_AS_STRING;
+    case GCONF_VALUE_SCHEMA:
+      return SCHEMA_SIGNATURE;
+    default:
+      return "";
+    }
+}
+
+/* Writes the signature of the struct utils_append_value writes for
+ * value into sig, which holds VALUE_SIGNATURE_MAX bytes.
+ */
+static void
+utils_get_value_signature (const GConfValue *value,
+			   gchar            *sig)
+{
+  GConfValue *car, *cdr;
+
+  if (!value)
+    {
+      g_strlcpy (sig, "(i)", VALUE_SIGNATURE_MAX);
+      return;
+    }
+
+  switch (value->type)
+    {
+    case GCONF_VALUE_LIST:
+      g_snprintf (sig, VALUE_SIGNATURE_MAX, "(i(ia%s))",
+		  utils_fundamental_signature (gconf_value_get_list_type (value)));
+      break;
+
+    case GCONF_VALUE_PAIR:
+      car = gconf_value_get_car (value);
+      cdr = gconf_value_get_cdr (value);
+      g_snprintf (sig, VALUE_SIGNATURE_MAX, "(i(ii%s%s))",
+		  car ? utils_fundamental_signature (car->type) : "",
+		  cdr ? utils_fundamental_signature (cdr->type) : "");
+      break;
+
+    default:
+      g_snprintf (sig, VALUE_SIGNATURE_MAX, "(i%s)",
+		  utils_fundamental_signature (value->type));
+      break;
+    }
+}
+
+/* Writes an entry, which is a struct, with the value in a variant. */
+static void
+utils_append_entry_values_typed (DBusMessageIter  *main_iter,
+				 const gchar      *key,
+				 const GConfValue *value,
+				 gboolean          is_default,
+				 gboolean          is_writable,
+				 const gchar      *schema_name)
+{
+  DBusMessageIter struct_iter;
+  DBusMessageIter variant_iter;
+  gchar           sig[VALUE_SIGNATURE_MAX];
+
+  d(g_print ("Appending entry %s\n", key));
+
+  dbus_message_iter_open_container (main_iter,
+				    DBUS_TYPE_STRUCT,
+				    NULL, /* for structs */
+				    &struct_iter);
+
+  dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING, &key);
+
+  utils_get_value_signature (value, sig);
+  dbus_message_iter_open_container (&struct_iter,
+				    DBUS_TYPE_VARIANT,
+				    sig,
+				    &variant_iter);
+  utils_append_value (&variant_iter, value);
+  dbus_message_iter_close_container (&struct_iter, &variant_iter);
+
+  utils_append_optional_string (&struct_iter, schema_name);
+
+  dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_BOOLEAN, &is_default);
+
+  dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_BOOLEAN, &is_writable);
+
+  if (!dbus_message_iter_close_container (main_iter, &struct_iter))
+    g_error ("Out of memory");
+}
+
 gboolean
 gconf_dbus_utils_get_entry_values (DBusMessageIter  *main_iter,
 				   gchar           **key_p,
@@ -672,6 +775,94 @@ utils_get_entry_values_stringified (DBusMessageIter  *main_iter,
   return TRUE;
 }
 
+/* Reads an entry written by utils_append_entry_values_typed. */
+static gboolean
+utils_get_entry_values_typed (DBusMessageIter  *main_iter,
+			      gchar           **key_p,
+			      GConfValue      **value_p,
+			      gboolean         *is_default_p,
+			      gboolean         *is_writable_p,
+			      gchar           **schema_name_p)
+{
+  DBusMessageIter  struct_iter;
+  DBusMessageIter  variant_iter;
+  gchar           *key;
+  GConfValue      *value;
+  gboolean         is_default;
+  gboolean         is_writable;
+  gchar           *schema_name;
+
+  dbus_message_iter_recurse (main_iter, &struct_iter);
+  dbus_message_iter_get_basic (&struct_iter, &key);
+
+  d(g_print ("Getting entry %s\n", key));
+
+  dbus_message_iter_next (&struct_iter);
+  dbus_message_iter_recurse (&struct_iter, &variant_iter);
+  value = utils_get_value (&variant_iter);
+
+  dbus_message_iter_next (&struct_iter);
+  schema_name = (gchar *) utils_get_optional_string (&struct_iter);
+
+  dbus_message_iter_next (&struct_iter);
+  dbus_message_iter_get_basic (&struct_iter, &is_default);
+
+  dbus_message_iter_next (&struct_iter);
+  dbus_message_iter_get_basic (&struct_iter, &is_writable);
+
+  if (key_p)
+    *key_p = key;
+
+  if (value_p)
+    *value_p = value;
+  else if (value)
+    gconf_value_free (value);
+
+  if (schema_name_p)
+    *schema_name_p = schema_name;
+
+  if (is_default_p)
+    *is_default_p = is_default;
+
+  if (is_writable_p)
+    *is_writable_p = is_writable;
+
+  return TRUE;
+}
+
+/* Reads an array entry in whichever encoding the sender used, told
+ * apart by the type of the value field.
+ */
+static gboolean
+utils_get_array_entry_values (DBusMessageIter  *main_iter,
+			      gchar           **key_p,
+			      GConfValue      **value_p,
+			      gboolean         *is_default_p,
+			      gboolean         *is_writable_p,
+			      gchar           **schema_name_p)
+{
+  DBusMessageIter struct_iter;
+
+  dbus_message_iter_recurse (main_iter, &struct_iter);
+  dbus_message_iter_next (&struct_iter);
+
+  if (dbus_message_iter_get_arg_type (&struct_iter) == DBUS_TYPE_VARIANT)
+    return utils_get_entry_values_typed (main_iter,
+					 key_p,
+					 value_p,
+					 is_default_p,
+					 is_writable_p,
+					 schema_name_p);
+  else
+    return utils_get_entry_values_stringified (main_iter,
+					       key_p,
+					       value_p,
+					       is_default_p,
+					       is_writable_p,
+					       schema_name_p);
+}
+
+
 
 /*
  * Getters
@@ -1051,36 +1242,137 @@ gconf_dbus_utils_append_entry_values (DBusMessageIter  *iter,
 			     schema_name);
 }
 
-/* Append the list of entries as an array. */
+void
+gconf_dbus_utils_append_entry_values_stringified (DBusMessageIter  *iter,
+						  const gchar      *key,
+						  const GConfValue *value,
+						  gboolean          is_default,
+						  gboolean          is_writable,
+						  const gchar      *schema_name)
+{
+  utils_append_entry_values_stringified (iter,
+					 key,
+					 value,
+					 is_default,
+					 is_writable,
+					 schema_name);
+}
+
+gboolean
+gconf_dbus_utils_get_entry_values_stringified (DBusMessageIter  *iter,
+					       const gchar     **key,
+					       GConfValue      **value,
+					       gboolean         *is_default,
+					       gboolean         *is_writable,
+					       const gchar     **schema_name)
+{
+  g_return_val_if_fail (dbus_message_iter_get_arg_type (iter) == DBUS_TYPE_STRUCT,
+			FALSE);
+
+  return utils_get_entry_values_stringified (iter,
+					     (gchar **) key,
+					     value,
+					     is_default,
+					     is_writable,
+					     (gchar **) schema_name);
+}
+
+void
+gconf_dbus_utils_append_entry_values_typed (DBusMessageIter  *iter,
+					    const gchar      *key,
+					    const GConfValue *value,
+					    gboolean          is_default,
+					    gboolean          is_writable,
+					    const gchar      *schema_name)
+{
+  utils_append_entry_values_typed (iter,
+				   key,
+				   value,
+				   is_default,
+				   is_writable,
+				   schema_name);
+}
+
+gboolean
+gconf_dbus_utils_get_array_entry_values (DBusMessageIter  *iter,
+					 const gchar     **key,
+					 GConfValue      **value,
+					 gboolean         *is_default,
+					 gboolean         *is_writable,
+					 const gchar     **schema_name)
+{
+  g_return_val_if_fail (dbus_message_iter_get_arg_type (iter) == DBUS_TYPE_STRUCT,
+			FALSE);
+
+  return utils_get_array_entry_values (iter,
+				       (gchar **) key,
+				       value,
+				       is_default,
+				       is_writable,
+				       (gchar **) schema_name);
+}
+
+guint32
+gconf_dbus_utils_get_protocol (DBusMessage *message,
+			       gint         position)
+{
+  DBusMessageIter iter;
+  dbus_uint32_t   protocol;
+
+  if (!dbus_message_iter_init (message, &iter))
+    return GCONF_DBUS_PROTOCOL_STRINGIFIED;
+
+  while (position-- > 0)
+    if (!dbus_message_iter_next (&iter))
+      return GCONF_DBUS_PROTOCOL_STRINGIFIED;
+
+  if (dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_UINT32)
+    return GCONF_DBUS_PROTOCOL_STRINGIFIED;
+
+  dbus_message_iter_get_basic (&iter, &protocol);
+
+  return MIN (protocol, GCONF_DBUS_PROTOCOL_VERSION);
+}
+
+/* Append the list of entries as an array, in the encoding protocol
+ * asks for.
+ */
 void
 gconf_dbus_utils_append_entries (DBusMessageIter *iter,
-				 GSList          *entries)
+				 GSList          *entries,
+				 guint32          protocol)
 {
   DBusMessageIter array_iter;
+  gboolean typed;
   GSList *l;
 
+  typed = protocol >= GCONF_DBUS_PROTOCOL_TYPED;
+
   dbus_message_iter_open_container (iter,
 				    DBUS_TYPE_ARRAY,
-				    DBUS_STRUCT_BEGIN_CHAR_AS_STRING
-				    DBUS_TYPE_STRING_AS_STRING
-				    DBUS_TYPE_STRING_AS_STRING
-				    DBUS_TYPE_BOOLEAN_AS_STRING
-				    DBUS_TYPE_STRING_AS_STRING
-				    DBUS_TYPE_BOOLEAN_AS_STRING
-				    DBUS_TYPE_BOOLEAN_AS_STRING
-				    DBUS_STRUCT_END_CHAR_AS_STRING,
+				    typed ?
+				    GCONF_DBUS_ENTRY_TYPED_SIGNATURE :
+				    GCONF_DBUS_ENTRY_STRINGIFIED_SIGNATURE,
 				    &array_iter);
 
   for (l = entries; l; l = l->next)
     {
       GConfEntry *entry = l->data;
 
-      utils_append_entry_values_stringified (&array_iter,
-					     entry->key,
-					     gconf_entry_get_value (entry),
-					     gconf_entry_get_is_default (entry),
-					     gconf_entry_get_is_writable (entry),
-					     gconf_entry_get_schema_name (entry));
+      if (typed)
+	utils_append_entry_values_typed (&array_iter,
+					 entry->key,
+					 gconf_entry_get_value (entry),
+					 gconf_entry_get_is_default (entry),
+					 gconf_entry_get_is_writable (entry),
+					 gconf_entry_get_schema_name (entry));
+      else
+	utils_append_entry_values_stringified (&array_iter,
+					       entry->key,
+					       gconf_entry_get_value (entry),
+					       gconf_entry_get_is_default (entry),
+					       gconf_entry_get_is_writable (entry),
+					       gconf_entry_get_schema_name (entry));
     }
 
   dbus_message_iter_close_container (iter, &array_iter);
@@ -1107,12 +1399,12 @@ gconf_dbus_utils_get_entries (DBusMessageIter *iter, const gchar *dir)
       gchar      *schema_name;
       GConfEntry *entry;
 
-      if (!utils_get_entry_values_stringified (&array_iter,
-					       &key,
-					       &value,
-					       &is_default,
-					       &is_writable,
-					       &schema_name))
+      if (!utils_get_array_entry_values (&array_iter,
+					 &key,
+					 &value,
+					 &is_default,
+					 &is_writable,
+					 &schema_name))
 	break;
 
       entry = gconf_entry_new_nocopy (gconf_concat_dir_and_key (dir, key), value);
@@ -40,25 +40,97 @@
 #define GCONF_DBUS_DATABASE_LOOKUP          "Lookup"
 #define GCONF_DBUS_DATABASE_LOOKUP_EXTENDED "LookupExtended" 
 #define GCONF_DBUS_DATABASE_LOOKUP_DEFAULT  "LookupDefault" 
+#define GCONF_DBUS_DATABASE_LOOKUP_MANY     "LookupMany"
 #define GCONF_DBUS_DATABASE_SET             "Set"
 #define GCONF_DBUS_DATABASE_UNSET           "UnSet"
 #define GCONF_DBUS_DATABASE_RECURSIVE_UNSET "RecursiveUnset"
 #define GCONF_DBUS_DATABASE_DIR_EXISTS      "DirExists"
 #define GCONF_DBUS_DATABASE_GET_ALL_ENTRIES "AllEntries"
+#define GCONF_DBUS_DATABASE_GET_ALL_ENTRIES_RECURSIVE "AllEntriesRecursive"
 #define GCONF_DBUS_DATABASE_GET_ALL_DIRS    "AllDirs"
 #define GCONF_DBUS_DATABASE_SET_SCHEMA      "SetSchema"
 #define GCONF_DBUS_DATABASE_SUGGEST_SYNC    "SuggestSync"
+#define GCONF_DBUS_DATABASE_COMMIT_CHANGE_SET "CommitChangeSet"
 
 #define GCONF_DBUS_DATABASE_ADD_NOTIFY      "AddNotify"
 #define GCONF_DBUS_DATABASE_REMOVE_NOTIFY   "RemoveNotify"
  
 #define GCONF_DBUS_LISTENER_NOTIFY          "Notify"
+#define GCONF_DBUS_LISTENER_NOTIFY_BATCH    "NotifyBatch"
 
 #define GCONF_DBUS_CLIENT_SERVICE           "org.gnome.GConf.ClientService"
 #define GCONF_DBUS_CLIENT_OBJECT            "/org/gnome/GConf/Client"
 #define GCONF_DBUS_CLIENT_INTERFACE         "org.gnome.GConf.Client"
 
 #define GCONF_DBUS_UNSET_INCLUDING_SCHEMA_NAMES 0x1
+
+/* Wire protocol versions. The daemon appends the version it speaks
+ * after the database path in the GetDatabase/GetDefaultDatabase reply.
+ * Clients pass the agreed version as a trailing argument to the calls
+ * whose reply depends on it (AllEntries, AllEntriesRecursive,
+ * LookupMany, AddNotify). Peers that don't know about versions neither
+ * send nor read the argument and get the stringified encoding.
+ *
+ * After the version comes the file name of the database's shared
+ * memory value cache, or "" if it has none (see gconf-value-cache.h).
+ */
+#define GCONF_DBUS_PROTOCOL_STRINGIFIED 0
+#define GCONF_DBUS_PROTOCOL_TYPED       1
+/* The daemon implements AllEntriesRecursive */
+#define GCONF_DBUS_PROTOCOL_RECURSIVE   2
+/* The daemon implements CommitChangeSet */
+#define GCONF_DBUS_PROTOCOL_COMMIT      3
+#define GCONF_DBUS_PROTOCOL_VERSION     GCONF_DBUS_PROTOCOL_COMMIT
+
+/* Signature of an entry with its value encoded as a string, used
+ * wherever entries go in an array.
+ */
+#define GCONF_DBUS_ENTRY_STRINGIFIED_SIGNATURE	\
+  DBUS_STRUCT_BEGIN_CHAR_AS_STRING		\
+  DBUS_TYPE_STRING_AS_STRING			\
+  DBUS_TYPE_STRING_AS_STRING			\
+  DBUS_TYPE_BOOLEAN_AS_STRING			\
+  DBUS_TYPE_STRING_AS_STRING			\
+  DBUS_TYPE_BOOLEAN_AS_STRING			\
+  DBUS_TYPE_BOOLEAN_AS_STRING			\
+  DBUS_STRUCT_END_CHAR_AS_STRING
+
+/* Signature of an entry with its value as a variant holding the same
+ * struct Lookup uses, for GCONF_DBUS_PROTOCOL_TYPED.
+ */
+#define GCONF_DBUS_ENTRY_TYPED_SIGNATURE	\
+  DBUS_STRUCT_BEGIN_CHAR_AS_STRING		\
+  DBUS_TYPE_STRING_AS_STRING			\
+  DBUS_TYPE_VARIANT_AS_STRING			\
+  DBUS_TYPE_BOOLEAN_AS_STRING			\
+  DBUS_TYPE_STRING_AS_STRING			\
+  DBUS_TYPE_BOOLEAN_AS_STRING			\
+  DBUS_TYPE_BOOLEAN_AS_STRING			\
+  DBUS_STRUCT_END_CHAR_AS_STRING
+
+/* CommitChangeSet takes an array of entries, those without a value
+ * being unset, and a locale for the unsets. It replies with an array
+ * of (key, GConfError code, message) for the keys that failed.
+ */
+#define GCONF_DBUS_COMMIT_ERROR_SIGNATURE	\
+  DBUS_STRUCT_BEGIN_CHAR_AS_STRING		\
+  DBUS_TYPE_STRING_AS_STRING			\
+  DBUS_TYPE_INT32_AS_STRING			\
+  DBUS_TYPE_STRING_AS_STRING			\
+  DBUS_STRUCT_END_CHAR_AS_STRING
+
+/* NotifyBatch carries an array of (namespace_section, entry) */
+#define GCONF_DBUS_NOTIFY_BATCH_ITEM_SIGNATURE	\
+  DBUS_STRUCT_BEGIN_CHAR_AS_STRING		\
+  DBUS_TYPE_STRING_AS_STRING			\
+  GCONF_DBUS_ENTRY_STRINGIFIED_SIGNATURE	\
+  DBUS_STRUCT_END_CHAR_AS_STRING
+
+#define GCONF_DBUS_NOTIFY_BATCH_TYPED_ITEM_SIGNATURE	\
+  DBUS_STRUCT_BEGIN_CHAR_AS_STRING			\
+  DBUS_TYPE_STRING_AS_STRING				\
+  GCONF_DBUS_ENTRY_TYPED_SIGNATURE			\
+  DBUS_STRUCT_END_CHAR_AS_STRING
  
 #define GCONF_DBUS_ERROR_FAILED               "org.gnome.GConf.Error.Failed"
 #define GCONF_DBUS_ERROR_NO_PERMISSION        "org.gnome.GConf.Error.NoPermission"
@@ -91,8 +163,46 @@ gboolean    gconf_dbus_utils_get_entry_values   (DBusMessageIter   *iter,
 						 gboolean          *is_writable,
 						 gchar            **schema_name);
 
+void        gconf_dbus_utils_append_entry_values_stringified (DBusMessageIter   *iter,
+							      const gchar       *key,
+							      const GConfValue  *value,
+							      gboolean           is_default,
+							      gboolean           is_writable,
+							      const gchar       *schema_name);
+/* The returned key and schema_name point into the message */
+gboolean    gconf_dbus_utils_get_entry_values_stringified    (DBusMessageIter   *iter,
+							      const gchar      **key,
+							      GConfValue       **value,
+							      gboolean          *is_default,
+							      gboolean          *is_writable,
+							      const gchar      **schema_name);
+
+void        gconf_dbus_utils_append_entry_values_typed (DBusMessageIter   *iter,
+							const gchar       *key,
+							const GConfValue  *value,
+							gboolean           is_default,
+							gboolean           is_writable,
+							const gchar       *schema_name);
+
+/* Reads an entry written in either array encoding. The returned key
+ * and schema_name point into the message.
+ */
+gboolean    gconf_dbus_utils_get_array_entry_values (DBusMessageIter   *iter,
+						     const gchar      **key,
+						     GConfValue       **value,
+						     gboolean          *is_default,
+						     gboolean          *is_writable,
+						     const gchar      **schema_name);
+
+/* The protocol version passed as argument number position (from 0) of
+ * message, or GCONF_DBUS_PROTOCOL_STRINGIFIED if there is none.
+ */
+guint32 gconf_dbus_utils_get_protocol (DBusMessage *message,
+				       gint         position);
+
 void gconf_dbus_utils_append_entries (DBusMessageIter *iter,
-				      GSList          *entries);
+				      GSList          *entries,
+				      guint32          protocol);
 
 GSList *gconf_dbus_utils_get_entries (DBusMessageIter *iter, const gchar *dir);
 
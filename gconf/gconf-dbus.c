@@ -25,8 +25,10 @@
 #include "gconf.h"
 #include "gconf-dbus-utils.h"
 #include "gconf-internals.h"
+#include "gconf-changeset.h"
 #include "gconf-sources.h"
 #include "gconf-locale.h"
+#include "gconf-value-cache.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -104,6 +106,10 @@ static GConfEngine    *default_engine = NULL;
 static GHashTable     *engines_by_db = NULL;
 static GHashTable     *engines_by_address = NULL;
 static gboolean        dbus_disconnected = FALSE;
+/* Protocol version the daemon announced when we got a database */
+static guint32         daemon_protocol = GCONF_DBUS_PROTOCOL_STRINGIFIED;
+/* Values the daemon publishes for the default database */
+static GConfValueCache *value_cache = NULL;
 
 static gboolean     ensure_dbus_connection      (GError **error);
 static gboolean     ensure_service              (gboolean          start_if_not_found,
@@ -156,6 +162,9 @@ static DBusHandlerResult
                     handle_notify               (DBusConnection   *connection,
 						 DBusMessage      *message,
 						 GConfEngine      *conf);
+static DBusHandlerResult
+                    handle_notify_batch         (DBusConnection   *connection,
+						 DBusMessage      *message);
 
 
 #define CHECK_OWNER_USE(engine) \
@@ -207,7 +216,7 @@ dbus_error_name_to_gconf_errno (const char *name)
 static gboolean
 gconf_handle_dbus_exception (DBusMessage *message, DBusError *derr, GError **gerr)
 {
-  char *error_string;
+  const char *error_string = NULL;
   const char *name;
 
   if (message == NULL)
@@ -238,11 +247,13 @@ gconf_handle_dbus_exception (DBusMessage *message, DBusError *derr, GError **ger
   if (derr)
     dbus_error_free (derr);
 
-  name = dbus_message_get_member (message);
+  /* Error replies carry an error name, not a member */
+  name = dbus_message_get_error_name (message);
 
-  dbus_message_get_args (message, NULL,
-			 DBUS_TYPE_STRING, &error_string,
-			 DBUS_TYPE_INVALID);
+  if (!dbus_message_get_args (message, NULL,
+			      DBUS_TYPE_STRING, &error_string,
+			      DBUS_TYPE_INVALID))
+    error_string = "";
   
   if (g_str_has_prefix (name, "org.freedesktop.DBus.Error"))
     {
@@ -483,6 +494,43 @@ ensure_service (gboolean  start_if_not_found,
   return FALSE;
 }
 
+static void
+close_value_cache (void)
+{
+  if (value_cache != NULL)
+    {
+      gconf_value_cache_close (value_cache);
+      value_cache = NULL;
+    }
+}
+
+/* Maps the value cache named after the protocol version in a
+ * GetDefaultDatabase reply, if the daemon has one.
+ */
+static void
+open_value_cache (DBusMessage *reply)
+{
+  DBusMessageIter iter;
+  const gchar *filename;
+
+  if (!dbus_message_iter_init (reply, &iter) ||
+      !dbus_message_iter_next (&iter) ||
+      !dbus_message_iter_next (&iter) ||
+      dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_STRING)
+    return;
+
+  dbus_message_iter_get_basic (&iter, &filename);
+
+  if (value_cache != NULL &&
+      strcmp (gconf_value_cache_get_filename (value_cache), filename) == 0)
+    return;
+
+  close_value_cache ();
+
+  if (*filename != '\0')
+    value_cache = gconf_value_cache_open (filename);
+}
+
 static gboolean
 ensure_database (GConfEngine  *conf,
 		 gboolean      start_if_not_found,
@@ -560,6 +608,12 @@ ensure_database (GConfEngine  *conf,
                              DBUS_TYPE_INVALID);
     }
 
+  /* Daemons that know about protocol versions append theirs */
+  daemon_protocol = gconf_dbus_utils_get_protocol (reply, 1);
+
+  if (conf->addresses == NULL)
+    open_value_cache (reply);
+
   if (db == NULL)
     {
       if (err)
@@ -577,6 +631,23 @@ ensure_database (GConfEngine  *conf,
   return TRUE;
 }
 
+/* Tells the daemon which entry encoding we agreed on, for the calls
+ * that return entries in arrays. Must be the last argument.
+ */
+static void
+append_protocol (DBusMessage *message)
+{
+  dbus_uint32_t protocol;
+
+  if (daemon_protocol == GCONF_DBUS_PROTOCOL_STRINGIFIED)
+    return;
+
+  protocol = daemon_protocol;
+  dbus_message_append_args (message,
+			    DBUS_TYPE_UINT32, &protocol,
+			    DBUS_TYPE_INVALID);
+}
+
 static const gchar *
 gconf_engine_get_database (GConfEngine *conf,
                            gboolean start_if_not_found,
@@ -588,7 +659,7 @@ gconf_engine_get_database (GConfEngine *conf,
     return conf->database;
 }
 
-static gboolean
+gboolean
 gconf_engine_is_local (GConfEngine* conf)
 {
   return conf->is_local;
@@ -1003,6 +1074,7 @@ send_notify_add (GConfEngine *conf,
   const gchar *db;
   DBusMessage *message, *reply;
   DBusError error;
+  dbus_bool_t supports_batch;
     
   db = gconf_engine_get_database (conf, TRUE, err);
   
@@ -1017,10 +1089,16 @@ send_notify_add (GConfEngine *conf,
 					  db,
 					  GCONF_DBUS_DATABASE_INTERFACE,
 					  GCONF_DBUS_DATABASE_ADD_NOTIFY);
-  
+
+  /* Tell the daemon we can take NotifyBatch; older daemons ignore
+   * the extra argument and keep sending Notify.
+   */
+  supports_batch = TRUE;
   dbus_message_append_args (message,
 			    DBUS_TYPE_STRING, &cnxn->namespace_section,
+			    DBUS_TYPE_BOOLEAN, &supports_batch,
 			    DBUS_TYPE_INVALID);
+  append_protocol (message);
 
   dbus_error_init (&error);
   reply = dbus_connection_send_with_reply_and_block (global_conn,
@@ -1196,6 +1274,27 @@ gconf_engine_get_fuller (GConfEngine *conf,
   if (schema_name_p)
     *schema_name_p = NULL;
 
+  /* Hot keys the daemon published can be read without asking it */
+  if (conf->addresses == NULL && value_cache != NULL)
+    {
+      if (gconf_value_cache_is_retired (value_cache))
+	close_value_cache ();
+      else if (gconf_value_cache_lookup (value_cache, key, &val, &is_writable,
+					 schema_name_p ? &schema_name : NULL))
+	{
+	  if (is_default_p)
+	    *is_default_p = FALSE;
+
+	  if (is_writable_p)
+	    *is_writable_p = is_writable;
+
+	  if (schema_name_p)
+	    *schema_name_p = schema_name;
+
+	  return val;
+	}
+    }
+
   message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
 					  db,
 					  GCONF_DBUS_DATABASE_INTERFACE,
@@ -1313,6 +1412,123 @@ gconf_engine_get_entry (GConfEngine* conf,
 
   return entry;
 }
+
+/**
+ * gconf_engine_get_many:
+ * @conf: a #GConfEngine.
+ * @keys: (element-type utf8): list of keys to look up.
+ * @err: the return location for an allocated #GError, or <symbol>NULL</symbol> to ignore errors.
+ *
+ * Looks up all of @keys at once, as with gconf_engine_get_entry() in
+ * the current locale and including schema defaults.  With gconfd this
+ * takes a single round trip, which is much cheaper than a get per key
+ * when an application reads its settings on startup.
+ *
+ * Return value: (element-type GConfEntry) (transfer full): a list with
+ * one #GConfEntry per key, in the order of @keys; the entry's value is
+ * <symbol>NULL</symbol> if the key is unset.
+ */
+GSList*
+gconf_engine_get_many (GConfEngine *conf,
+                       GSList      *keys,
+                       GError     **err)
+{
+  GSList *entries;
+  GSList *tmp;
+  const gchar *db;
+  const gchar *locale;
+  const gchar **key_array;
+  gboolean use_schema_default;
+  DBusMessage *message, *reply;
+  DBusError error;
+  DBusMessageIter iter;
+  int n_keys;
+
+  g_return_val_if_fail (conf != NULL, NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  n_keys = 0;
+  for (tmp = keys; tmp != NULL; tmp = tmp->next)
+    {
+      if (!gconf_key_check (tmp->data, err))
+        return NULL;
+      n_keys++;
+    }
+
+  if (n_keys == 0)
+    return NULL;
+
+  if (gconf_engine_is_local (conf))
+    {
+      entries = NULL;
+      for (tmp = keys; tmp != NULL; tmp = tmp->next)
+        {
+          GConfEntry *entry;
+          GError *error = NULL;
+
+          entry = gconf_engine_get_entry (conf, tmp->data, NULL, TRUE, &error);
+          if (error != NULL)
+            {
+              g_propagate_error (err, error);
+              g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+              g_slist_free (entries);
+              return NULL;
+            }
+
+          entries = g_slist_prepend (entries, entry);
+        }
+
+      return g_slist_reverse (entries);
+    }
+
+  g_assert (!gconf_engine_is_local (conf));
+
+  db = gconf_engine_get_database (conf, TRUE, err);
+
+  if (db == NULL)
+    {
+      g_return_val_if_fail (err == NULL || *err != NULL, NULL);
+      return NULL;
+    }
+
+  key_array = g_new (const gchar *, n_keys);
+  n_keys = 0;
+  for (tmp = keys; tmp != NULL; tmp = tmp->next)
+    key_array[n_keys++] = tmp->data;
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_LOOKUP_MANY);
+
+  locale = gconf_current_locale ();
+  use_schema_default = TRUE;
+  dbus_message_append_args (message,
+			    DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &key_array, n_keys,
+			    DBUS_TYPE_STRING, &locale,
+			    DBUS_TYPE_BOOLEAN, &use_schema_default,
+			    DBUS_TYPE_INVALID);
+  append_protocol (message);
+  g_free (key_array);
+
+  dbus_error_init (&error);
+  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  dbus_message_unref (message);
+
+  if (gconf_handle_dbus_exception (reply, &error, err))
+    return NULL;
+
+  dbus_message_iter_init (reply, &iter);
+
+  /* Keys come back fully qualified */
+  entries = gconf_dbus_utils_get_entries (&iter, "/");
+
+  dbus_message_unref (reply);
+
+  return g_slist_reverse (entries);
+}
      
 GConfValue*  
 gconf_engine_get (GConfEngine* conf, const gchar* key, GError** err)
@@ -1514,6 +1730,150 @@ gconf_engine_set (GConfEngine* conf, const gchar* key,
   return TRUE;
 }
 
+struct CommitEntriesData {
+  GSList *entries;
+  GError *error;
+};
+
+static void
+commit_entries_foreach (GConfChangeSet *cs,
+                        const gchar    *key,
+                        GConfValue     *value,
+                        gpointer        user_data)
+{
+  struct CommitEntriesData *cd = user_data;
+  GError *error = NULL;
+
+  if (!gconf_key_check (key, &error) ||
+      (value != NULL && !gconf_value_validate (value, &error)))
+    {
+      if (cd->error == NULL)
+        cd->error = error;
+      else
+        g_error_free (error);
+      return;
+    }
+
+  cd->entries = g_slist_prepend (cd->entries,
+                                 gconf_entry_new_nocopy (g_strdup (key),
+                                                         value ? gconf_value_copy (value) : NULL));
+}
+
+static void
+all_keys_foreach (GConfChangeSet *cs,
+                  const gchar    *key,
+                  GConfValue     *value,
+                  gpointer        user_data)
+{
+  GSList **keys = user_data;
+
+  *keys = g_slist_prepend (*keys, g_strdup (key));
+}
+
+gboolean
+gconf_engine_commit_change_set_at_once (GConfEngine     *conf,
+                                        GConfChangeSet  *cs,
+                                        GSList         **failed_keys,
+                                        GError         **err)
+{
+  struct CommitEntriesData cd = { NULL, NULL };
+  const gchar *db;
+  const gchar *empty;
+  DBusMessage *message, *reply;
+  DBusError error;
+  DBusMessageIter iter, array_iter;
+
+  g_return_val_if_fail (conf != NULL, FALSE);
+  g_return_val_if_fail (cs != NULL, FALSE);
+  g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
+
+  *failed_keys = NULL;
+
+  CHECK_OWNER_USE (conf);
+
+  if (gconf_engine_is_local (conf))
+    return FALSE;
+
+  db = gconf_engine_get_database (conf, TRUE, NULL);
+
+  /* Let the key by key path report the error */
+  if (db == NULL || daemon_protocol < GCONF_DBUS_PROTOCOL_COMMIT)
+    return FALSE;
+
+  /* Nothing is sent if any of it is bad, as gconfd does when it can't
+   * write some of the keys.
+   */
+  gconf_change_set_foreach (cs, commit_entries_foreach, &cd);
+
+  if (cd.error != NULL)
+    {
+      g_propagate_error (err, cd.error);
+      g_slist_foreach (cd.entries, (GFunc) gconf_entry_free, NULL);
+      g_slist_free (cd.entries);
+
+      /* Nothing was sent, so nothing was committed */
+      gconf_change_set_foreach (cs, all_keys_foreach, failed_keys);
+
+      return TRUE;
+    }
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_COMMIT_CHANGE_SET);
+
+  dbus_message_iter_init_append (message, &iter);
+  gconf_dbus_utils_append_entries (&iter, cd.entries,
+				   GCONF_DBUS_PROTOCOL_TYPED);
+  empty = "";
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &empty);
+
+  g_slist_foreach (cd.entries, (GFunc) gconf_entry_free, NULL);
+  g_slist_free (cd.entries);
+
+  dbus_error_init (&error);
+  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  dbus_message_unref (message);
+
+  if (gconf_handle_dbus_exception (reply, &error, err))
+    {
+      /* No telling how far it got */
+      gconf_change_set_foreach (cs, all_keys_foreach, failed_keys);
+      return TRUE;
+    }
+
+  dbus_message_iter_init (reply, &iter);
+  dbus_message_iter_recurse (&iter, &array_iter);
+
+  while (dbus_message_iter_get_arg_type (&array_iter) == DBUS_TYPE_STRUCT)
+    {
+      DBusMessageIter struct_iter;
+      const gchar *key;
+      const gchar *msg;
+      dbus_int32_t code;
+
+      dbus_message_iter_recurse (&array_iter, &struct_iter);
+      dbus_message_iter_get_basic (&struct_iter, &key);
+      dbus_message_iter_next (&struct_iter);
+      dbus_message_iter_get_basic (&struct_iter, &code);
+      dbus_message_iter_next (&struct_iter);
+      dbus_message_iter_get_basic (&struct_iter, &msg);
+
+      *failed_keys = g_slist_prepend (*failed_keys, g_strdup (key));
+
+      if (err && *err == NULL)
+        *err = g_error_new_literal (GCONF_ERROR, code, msg);
+
+      dbus_message_iter_next (&array_iter);
+    }
+
+  dbus_message_unref (reply);
+
+  *failed_keys = g_slist_reverse (*failed_keys);
+
+  return TRUE;
+}
+
 gboolean
 gconf_engine_unset (GConfEngine* conf, const gchar* key, GError** err)
 {
@@ -1853,6 +2213,7 @@ gconf_engine_all_entries (GConfEngine* conf, const gchar* dir, GError** err)
 			    DBUS_TYPE_STRING, &dir,
 			    DBUS_TYPE_STRING, &locale,
 			    DBUS_TYPE_INVALID);
+  append_protocol (message);
   
   dbus_error_init (&error);
   reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
@@ -1872,51 +2233,433 @@ gconf_engine_all_entries (GConfEngine* conf, const gchar* dir, GError** err)
   return entries;
 }
 
+/*
+ * Asynchronous calls
+ *
+ * These send the method call with a DBusPendingCall and finish from the
+ * main loop global_conn is attached to, so a busy gconfd doesn't stall
+ * the caller.  Local engines just do the work right away.
+ */
+
+typedef void (* AsyncReplyFunc) (GTask       *task,
+                                 DBusMessage *reply);
+
+typedef struct {
+  GTask          *task;
+  AsyncReplyFunc  parse;
+} AsyncCall;
+
+static void
+async_call_free (void *data)
+{
+  AsyncCall *call = data;
+
+  g_object_unref (call->task);
+  g_free (call);
+}
+
 static void
-qualify_keys (GSList *keys, const char *dir)
+async_call_notify (DBusPendingCall *pending,
+                   void            *data)
 {
-  GSList *tmp = keys;
-  while (tmp != NULL)
+  AsyncCall *call = data;
+  DBusMessage *reply;
+  GError *error = NULL;
+
+  reply = dbus_pending_call_steal_reply (pending);
+
+  if (gconf_handle_dbus_exception (reply, NULL, &error))
     {
-      char *key = tmp->data;
-      gchar *full;
+      g_task_return_error (call->task, error);
+      return;
+    }
 
-      full = gconf_concat_dir_and_key (dir, key);
+  (* call->parse) (call->task, reply);
 
-      g_free (tmp->data);
-      tmp->data = full;
+  dbus_message_unref (reply);
+}
 
-      tmp = g_slist_next (tmp);
+/* Takes over the task */
+static void
+async_call_send (DBusMessage    *message,
+                 GTask          *task,
+                 AsyncReplyFunc  parse)
+{
+  DBusPendingCall *pending = NULL;
+  AsyncCall *call;
+
+  if (!dbus_connection_send_with_reply (global_conn, message, &pending, -1) ||
+      pending == NULL)
+    {
+      g_task_return_new_error (task, GCONF_ERROR, GCONF_ERROR_NO_SERVER,
+                               _("Failed to send request to the configuration server"));
+      g_object_unref (task);
+      return;
     }
+
+  call = g_new (AsyncCall, 1);
+  call->task = task;
+  call->parse = parse;
+
+  dbus_pending_call_set_notify (pending, async_call_notify, call, async_call_free);
+  dbus_pending_call_unref (pending);
 }
 
-GSList*      
-gconf_engine_all_dirs(GConfEngine* conf, const gchar* dir, GError** err)
+/* Returns the database to send to, or NULL after failing the task */
+static const gchar *
+async_get_database (GConfEngine *conf,
+                    GTask       *task)
 {
-  GSList* subdirs = NULL;
   const gchar *db;
-  DBusMessage *message, *reply;
-  DBusError error;
-  DBusMessageIter iter;
-  DBusMessageIter array_iter;
-  
-  g_return_val_if_fail(conf != NULL, NULL);
-  g_return_val_if_fail(dir != NULL, NULL);
-  g_return_val_if_fail(err == NULL || *err == NULL, NULL);
-  
-  CHECK_OWNER_USE (conf);
-  
-  if (!gconf_key_check(dir, err))
-    return NULL;
-  
-  if (gconf_engine_is_local(conf))
+  GError *error = NULL;
+
+  db = gconf_engine_get_database (conf, TRUE, &error);
+
+  if (db == NULL)
     {
-      GError* error = NULL;
-      GSList* retval;
-      
-      retval = gconf_sources_all_dirs(conf->local_sources,
-                                      dir,
-                                      &error);
+      if (error == NULL)
+        error = gconf_error_new (GCONF_ERROR_NO_SERVER, _("Unknown error"));
+
+      g_task_return_error (task, error);
+      g_object_unref (task);
+    }
+
+  return db;
+}
+
+static void
+get_entry_reply (GTask       *task,
+                 DBusMessage *reply)
+{
+  DBusMessageIter iter;
+  GConfValue *val = NULL;
+  gchar *schema_name = NULL;
+  gboolean is_default = FALSE;
+  gboolean is_writable = TRUE;
+  GConfEntry *entry;
+
+  dbus_message_iter_init (reply, &iter);
+
+  /* If there is no struct (entry) here, there is no value. */
+  if (dbus_message_iter_get_arg_type (&iter) == DBUS_TYPE_STRUCT &&
+      !gconf_dbus_utils_get_entry_values (&iter,
+                                          NULL,
+                                          &val,
+                                          &is_default,
+                                          &is_writable,
+                                          &schema_name))
+    {
+      g_task_return_new_error (task, GCONF_ERROR, GCONF_ERROR_FAILED,
+                               _("Couldn't get value"));
+      return;
+    }
+
+  if (schema_name && schema_name[0] != '/')
+    {
+      g_free (schema_name);
+      schema_name = NULL;
+    }
+
+  entry = gconf_entry_new_nocopy (g_strdup (g_task_get_task_data (task)), val);
+
+  gconf_entry_set_is_default (entry, is_default);
+  gconf_entry_set_is_writable (entry, is_writable);
+  gconf_entry_set_schema_name (entry, schema_name);
+
+  g_free (schema_name);
+
+  g_task_return_pointer (task, entry, (GDestroyNotify) gconf_entry_free);
+}
+
+void
+gconf_engine_get_entry_async (GConfEngine         *conf,
+                              const gchar         *key,
+                              gboolean             use_schema_default,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data)
+{
+  GTask *task;
+  const gchar *db;
+  const gchar *locale;
+  DBusMessage *message;
+  GError *error = NULL;
+
+  g_return_if_fail (conf != NULL);
+  g_return_if_fail (key != NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  g_task_set_source_tag (task, gconf_engine_get_entry_async);
+
+  if (gconf_engine_is_local (conf) || !gconf_key_check (key, NULL))
+    {
+      GConfEntry *entry;
+
+      entry = gconf_engine_get_entry (conf, key, NULL, use_schema_default,
+                                      &error);
+      if (error != NULL)
+        g_task_return_error (task, error);
+      else
+        g_task_return_pointer (task, entry, (GDestroyNotify) gconf_entry_free);
+
+      g_object_unref (task);
+      return;
+    }
+
+  db = async_get_database (conf, task);
+  if (db == NULL)
+    return;
+
+  g_task_set_task_data (task, g_strdup (key), g_free);
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_LOOKUP_EXTENDED);
+
+  locale = gconf_current_locale ();
+  dbus_message_append_args (message,
+			    DBUS_TYPE_STRING, &key,
+			    DBUS_TYPE_STRING, &locale,
+			    DBUS_TYPE_BOOLEAN, &use_schema_default,
+			    DBUS_TYPE_INVALID);
+
+  async_call_send (message, task, get_entry_reply);
+
+  dbus_message_unref (message);
+}
+
+static void
+done_reply (GTask       *task,
+            DBusMessage *reply)
+{
+  g_task_return_boolean (task, TRUE);
+}
+
+void
+gconf_engine_set_async (GConfEngine         *conf,
+                        const gchar         *key,
+                        const GConfValue    *value,
+                        GAsyncReadyCallback  callback,
+                        gpointer             user_data)
+{
+  GTask *task;
+  const gchar *db;
+  DBusMessage *message;
+  DBusMessageIter iter;
+  GError *error = NULL;
+
+  g_return_if_fail (conf != NULL);
+  g_return_if_fail (key != NULL);
+  g_return_if_fail (value != NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  g_task_set_source_tag (task, gconf_engine_set_async);
+
+  if (gconf_engine_is_local (conf) ||
+      !gconf_key_check (key, NULL) ||
+      !gconf_value_validate (value, NULL))
+    {
+      if (gconf_engine_set (conf, key, value, &error))
+        g_task_return_boolean (task, TRUE);
+      else
+        g_task_return_error (task, error);
+
+      g_object_unref (task);
+      return;
+    }
+
+  db = async_get_database (conf, task);
+  if (db == NULL)
+    return;
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_SET);
+
+  dbus_message_append_args (message,
+			    DBUS_TYPE_STRING, &key,
+			    DBUS_TYPE_INVALID);
+
+  dbus_message_iter_init_append (message, &iter);
+  gconf_dbus_utils_append_value (&iter, value);
+
+  async_call_send (message, task, done_reply);
+
+  dbus_message_unref (message);
+}
+
+void
+gconf_engine_unset_async (GConfEngine         *conf,
+                          const gchar         *key,
+                          GAsyncReadyCallback  callback,
+                          gpointer             user_data)
+{
+  GTask *task;
+  const gchar *db;
+  const gchar *empty;
+  DBusMessage *message;
+  GError *error = NULL;
+
+  g_return_if_fail (conf != NULL);
+  g_return_if_fail (key != NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  g_task_set_source_tag (task, gconf_engine_unset_async);
+
+  if (gconf_engine_is_local (conf) || !gconf_key_check (key, NULL))
+    {
+      if (gconf_engine_unset (conf, key, &error))
+        g_task_return_boolean (task, TRUE);
+      else
+        g_task_return_error (task, error);
+
+      g_object_unref (task);
+      return;
+    }
+
+  db = async_get_database (conf, task);
+  if (db == NULL)
+    return;
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_UNSET);
+
+  empty = "";
+  dbus_message_append_args (message,
+			    DBUS_TYPE_STRING, &key,
+			    DBUS_TYPE_STRING, &empty,
+			    DBUS_TYPE_INVALID);
+
+  async_call_send (message, task, done_reply);
+
+  dbus_message_unref (message);
+}
+
+static void
+all_entries_reply (GTask       *task,
+                   DBusMessage *reply)
+{
+  DBusMessageIter iter;
+  GSList *entries;
+
+  dbus_message_iter_init (reply, &iter);
+
+  entries = gconf_dbus_utils_get_entries (&iter, g_task_get_task_data (task));
+
+  g_task_return_pointer (task, entries, gconf_entry_list_free);
+}
+
+void
+gconf_engine_all_entries_async (GConfEngine         *conf,
+                                const gchar         *dir,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+  GTask *task;
+  const gchar *db;
+  const gchar *locale;
+  DBusMessage *message;
+  GError *error = NULL;
+
+  g_return_if_fail (conf != NULL);
+  g_return_if_fail (dir != NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  g_task_set_source_tag (task, gconf_engine_all_entries_async);
+
+  if (gconf_engine_is_local (conf) || !gconf_key_check (dir, NULL))
+    {
+      GSList *entries;
+
+      entries = gconf_engine_all_entries (conf, dir, &error);
+      if (error != NULL)
+        g_task_return_error (task, error);
+      else
+        g_task_return_pointer (task, entries, gconf_entry_list_free);
+
+      g_object_unref (task);
+      return;
+    }
+
+  db = async_get_database (conf, task);
+  if (db == NULL)
+    return;
+
+  g_task_set_task_data (task, g_strdup (dir), g_free);
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_GET_ALL_ENTRIES);
+
+  locale = gconf_current_locale ();
+  dbus_message_append_args (message,
+			    DBUS_TYPE_STRING, &dir,
+			    DBUS_TYPE_STRING, &locale,
+			    DBUS_TYPE_INVALID);
+  append_protocol (message);
+
+  async_call_send (message, task, all_entries_reply);
+
+  dbus_message_unref (message);
+}
+
+static void
+qualify_keys (GSList *keys, const char *dir)
+{
+  GSList *tmp = keys;
+  while (tmp != NULL)
+    {
+      char *key = tmp->data;
+      gchar *full;
+
+      full = gconf_concat_dir_and_key (dir, key);
+
+      g_free (tmp->data);
+      tmp->data = full;
+
+      tmp = g_slist_next (tmp);
+    }
+}
+
+GSList*      
+gconf_engine_all_dirs(GConfEngine* conf, const gchar* dir, GError** err)
+{
+  GSList* subdirs = NULL;
+  const gchar *db;
+  DBusMessage *message, *reply;
+  DBusError error;
+  DBusMessageIter iter;
+  DBusMessageIter array_iter;
+  
+  g_return_val_if_fail(conf != NULL, NULL);
+  g_return_val_if_fail(dir != NULL, NULL);
+  g_return_val_if_fail(err == NULL || *err == NULL, NULL);
+  
+  CHECK_OWNER_USE (conf);
+  
+  if (!gconf_key_check(dir, err))
+    return NULL;
+  
+  if (gconf_engine_is_local(conf))
+    {
+      GError* error = NULL;
+      GSList* retval;
+      
+      retval = gconf_sources_all_dirs(conf->local_sources,
+                                      dir,
+                                      &error);
       
       if (error != NULL)
         {
@@ -1988,6 +2731,94 @@ gconf_engine_all_dirs(GConfEngine* conf, const gchar* dir, GError** err)
   return subdirs;
 }
 
+GSList*
+gconf_engine_all_entries_recursive (GConfEngine  *conf,
+				    const gchar  *dir,
+				    GSList      **subdirs,
+				    GError      **err)
+{
+  GSList *entries;
+  const gchar *db;
+  DBusMessage *message, *reply;
+  DBusError error;
+  DBusMessageIter iter;
+  DBusMessageIter array_iter;
+  const gchar *locale;
+
+  g_return_val_if_fail (conf != NULL, NULL);
+  g_return_val_if_fail (dir != NULL, NULL);
+  g_return_val_if_fail (subdirs != NULL, NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  *subdirs = NULL;
+
+  if (!gconf_key_check (dir, err))
+    return NULL;
+
+  if (gconf_engine_is_local (conf))
+    return gconf_engine_all_entries_walk (conf, dir, subdirs, err);
+
+  db = gconf_engine_get_database (conf, TRUE, err);
+
+  if (db == NULL)
+    {
+      g_return_val_if_fail (err == NULL || *err != NULL, NULL);
+
+      return NULL;
+    }
+
+  /* Older daemons only know about one dir at a time */
+  if (daemon_protocol < GCONF_DBUS_PROTOCOL_RECURSIVE)
+    return gconf_engine_all_entries_walk (conf, dir, subdirs, err);
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_GET_ALL_ENTRIES_RECURSIVE);
+
+  locale = gconf_current_locale ();
+  dbus_message_append_args (message,
+			    DBUS_TYPE_STRING, &dir,
+			    DBUS_TYPE_STRING, &locale,
+			    DBUS_TYPE_INVALID);
+  append_protocol (message);
+
+  dbus_error_init (&error);
+  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  dbus_message_unref (message);
+
+  if (gconf_handle_dbus_exception (reply, &error, err))
+    return NULL;
+
+  dbus_message_iter_init (reply, &iter);
+
+  /* Keys come back fully qualified */
+  entries = gconf_dbus_utils_get_entries (&iter, "/");
+
+  if (dbus_message_iter_next (&iter) &&
+      dbus_message_iter_get_arg_type (&iter) == DBUS_TYPE_ARRAY)
+    {
+      dbus_message_iter_recurse (&iter, &array_iter);
+      while (dbus_message_iter_get_arg_type (&array_iter) == DBUS_TYPE_STRING)
+	{
+	  const gchar *subdir;
+
+	  dbus_message_iter_get_basic (&array_iter, &subdir);
+	  *subdirs = g_slist_prepend (*subdirs, g_strdup (subdir));
+
+	  dbus_message_iter_next (&array_iter);
+	}
+
+      *subdirs = g_slist_reverse (*subdirs);
+    }
+
+  dbus_message_unref (reply);
+
+  return entries;
+}
+
 /* annoyingly, this is REQUIRED for local sources */
 void 
 gconf_engine_suggest_sync(GConfEngine* conf, GError** err)
@@ -2270,6 +3101,12 @@ gconf_dbus_message_filter (DBusConnection    *dbus_conn,
     {
       return handle_notify (dbus_conn, message, NULL);
     }
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_CLIENT_INTERFACE,
+					GCONF_DBUS_LISTENER_NOTIFY_BATCH))
+    {
+      return handle_notify_batch (dbus_conn, message);
+    }
   else if (dbus_message_is_signal (message,
 				   DBUS_INTERFACE_LOCAL,
 				   "Disconnected"))
@@ -2321,6 +3158,8 @@ gconf_dbus_message_filter (DBusConnection    *dbus_conn,
 	{
 	  /* GConfd is gone, set the state so we can detect that we're down. */
 	  service_running = FALSE;
+	  daemon_protocol = GCONF_DBUS_PROTOCOL_STRINGIFIED;
+	  close_value_cache ();
 	  needs_reconnect = TRUE;
   
 	  d(g_print ("*** GConf Service deleted\n"));
@@ -2397,6 +3236,43 @@ gconf_debug_shutdown (void)
   return 0;
 }
 
+/* Notify the connections on conf that listen exactly on
+ * namespace_section; returns whether there were any.
+ */
+static gboolean
+dispatch_notify (GConfEngine *conf,
+		 const gchar *namespace_section,
+		 const gchar *key,
+		 GConfValue  *value)
+{
+  GList *list, *l;
+  gboolean match = FALSE;
+
+  d(g_print ("Got notify on %s (%s)\n", key, namespace_section));
+
+  list = gconf_cnxn_lookup_dir (conf, namespace_section);
+  for (l = list; l; l = l->next)
+    {
+      GConfCnxn *cnxn = l->data;
+      GConfEntry *entry;
+
+      d(g_print ("match? %s\n", cnxn->namespace_section));
+      
+      if (strcmp (cnxn->namespace_section, namespace_section) == 0)
+	{
+	  d(g_print ("yes: %s\n", key));
+	  
+	  entry = gconf_entry_new (key, value);
+	  gconf_cnxn_notify (cnxn, entry);
+	  gconf_entry_free (entry);
+	  
+	  match = TRUE;
+	}
+    }
+
+  return match;
+}
+
 static DBusHandlerResult
 handle_notify (DBusConnection *connection,
 	       DBusMessage *message,
@@ -2407,9 +3283,7 @@ handle_notify (DBusConnection *connection,
   gboolean is_default, is_writable;
   DBusMessageIter iter;
   GConfValue *value;
-  GConfEntry* entry;
-  GList *list, *l;
-  gboolean match = FALSE;
+  gboolean match;
   gchar *namespace_section, *db;
 
   dbus_message_iter_init (message, &iter);
@@ -2444,26 +3318,7 @@ handle_notify (DBusConnection *connection,
       return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
     }
   
-  d(g_print ("Got notify on %s (%s)\n", key, namespace_section));
-
-  list = gconf_cnxn_lookup_dir (conf, namespace_section);
-  for (l = list; l; l = l->next)
-    {
-      GConfCnxn *cnxn = l->data;
-
-      d(g_print ("match? %s\n", cnxn->namespace_section));
-      
-      if (strcmp (cnxn->namespace_section, namespace_section) == 0)
-	{
-	  d(g_print ("yes: %s\n", key));
-	  
-	  entry = gconf_entry_new (key, value);
-	  gconf_cnxn_notify (cnxn, entry);
-	  gconf_entry_free (entry);
-	  
-	  match = TRUE;
-	}
-    }
+  match = dispatch_notify (conf, namespace_section, key, value);
 
   if (value)
     gconf_value_free (value);
@@ -2476,6 +3331,64 @@ handle_notify (DBusConnection *connection,
   return DBUS_HANDLER_RESULT_HANDLED;
 }
 
+/* A NotifyBatch carries the database and an array of
+ * (namespace_section, entry) for all changes the daemon coalesced.
+ */
+static DBusHandlerResult
+handle_notify_batch (DBusConnection *connection,
+		     DBusMessage    *message)
+{
+  GConfEngine *conf;
+  DBusMessageIter iter, array_iter;
+  gchar *db;
+
+  dbus_message_iter_init (message, &iter);
+
+  if (dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_OBJECT_PATH)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  dbus_message_iter_get_basic (&iter, &db);
+
+  if (!dbus_message_iter_next (&iter) ||
+      dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_ARRAY)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  conf = lookup_engine_by_database (db);
+  if (conf == NULL)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  dbus_message_iter_recurse (&iter, &array_iter);
+
+  while (dbus_message_iter_get_arg_type (&array_iter) == DBUS_TYPE_STRUCT)
+    {
+      DBusMessageIter struct_iter;
+      const gchar *namespace_section;
+      const gchar *key;
+      GConfValue *value;
+
+      dbus_message_iter_recurse (&array_iter, &struct_iter);
+      dbus_message_iter_get_basic (&struct_iter, &namespace_section);
+      dbus_message_iter_next (&struct_iter);
+
+      if (!gconf_dbus_utils_get_array_entry_values (&struct_iter,
+						    &key,
+						    &value,
+						    NULL,
+						    NULL,
+						    NULL))
+	break;
+
+      dispatch_notify (conf, namespace_section, key, value);
+
+      if (value)
+	gconf_value_free (value);
+
+      dbus_message_iter_next (&array_iter);
+    }
+
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
+
 
 /*
  * Daemon control
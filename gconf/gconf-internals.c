@@ -127,6 +127,81 @@ gconf_key_key        (const gchar* key)
   return end;
 }
 
+/*
+ * Key interning
+ *
+ * The same keys and directory names end up in the listener table,
+ * the client cache, change sets and the markup tree all at once;
+ * with hundreds of thousands of keys the copies add up.
+ */
+
+typedef struct {
+  guint refcount;
+  gchar str[1];
+} InternedKey;
+
+#define INTERNED_KEY(str) \
+  ((InternedKey*) ((gchar*) (str) - G_STRUCT_OFFSET (InternedKey, str)))
+
+G_LOCK_DEFINE_STATIC (interned_keys);
+static GHashTable* interned_keys = NULL; /* str -> InternedKey */
+
+const gchar*
+gconf_key_intern (const gchar* key)
+{
+  InternedKey* ik;
+
+  g_return_val_if_fail (key != NULL, NULL);
+
+  G_LOCK (interned_keys);
+
+  if (interned_keys == NULL)
+    interned_keys = g_hash_table_new (g_str_hash, g_str_equal);
+
+  ik = g_hash_table_lookup (interned_keys, key);
+  if (ik == NULL)
+    {
+      gsize len;
+
+      len = strlen (key);
+      ik = g_malloc (G_STRUCT_OFFSET (InternedKey, str) + len + 1);
+      ik->refcount = 0;
+      memcpy (ik->str, key, len + 1);
+
+      g_hash_table_insert (interned_keys, ik->str, ik);
+    }
+
+  ik->refcount += 1;
+
+  G_UNLOCK (interned_keys);
+
+  return ik->str;
+}
+
+void
+gconf_key_unintern (const gchar* key)
+{
+  InternedKey* ik;
+
+  if (key == NULL)
+    return;
+
+  ik = INTERNED_KEY (key);
+
+  G_LOCK (interned_keys);
+
+  g_assert (ik->refcount > 0);
+
+  ik->refcount -= 1;
+  if (ik->refcount == 0)
+    {
+      g_hash_table_remove (interned_keys, ik->str);
+      g_free (ik);
+    }
+
+  G_UNLOCK (interned_keys);
+}
+
 /*
  *  Random stuff 
  */
@@ -2048,7 +2123,14 @@ gconf_value_encode (GConfValue* val)
       break;
 
     case GCONF_VALUE_FLOAT:
-      retval = g_strdup_printf("f%g", gconf_value_get_float(val));
+      {
+        gchar* tmp;
+
+        /* "%g" would drop precision and use the locale's decimal point */
+        tmp = gconf_double_to_string(gconf_value_get_float(val));
+        retval = g_strconcat("f", tmp, NULL);
+        g_free(tmp);
+      }
       break;
 
     case GCONF_VALUE_STRING:
@@ -32,6 +32,7 @@
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <glib/gi18n-lib.h>
+#include <gio/gio.h>
 #include "gconf-error.h"
 #include "gconf-value.h"
 #include "gconf-engine.h"
@@ -91,6 +92,13 @@ const char *_gconf_win32_get_home_dir (void);
 gchar*       gconf_key_directory  (const gchar* key);
 const gchar* gconf_key_key        (const gchar* key);
 
+/* Shared refcounted copies of keys and key components; release with
+ * gconf_key_unintern(), never g_free().  Interned strings are equal
+ * exactly when the pointers are.
+ */
+const gchar* gconf_key_intern     (const gchar* key);
+void         gconf_key_unintern   (const gchar* key);
+
 #ifdef HAVE_CORBA
 GConfValue*  gconf_value_from_corba_value            (const ConfigValue *value);
 ConfigValue* gconf_corba_value_from_gconf_value      (const GConfValue  *value);
@@ -170,6 +178,22 @@ GSList*      gconf_value_steal_list   (GConfValue *value);
 GConfSchema* gconf_value_steal_schema (GConfValue *value);
 char*        gconf_value_steal_string (GConfValue *value);
 
+/* Debug counters for the GConfValue/GConfEntry allocator; live_bytes
+ * covers the value and entry structs only, not strings or lists.
+ */
+typedef struct {
+  guint live_values;
+  guint live_entries;
+  gsize live_bytes;
+} GConfAllocStats;
+
+void gconf_value_get_alloc_stats (GConfAllocStats *stats);
+
+/* A rough figure of the memory value keeps alive, for caches that
+ * want to stay under a byte budget.
+ */
+gsize gconf_value_get_size (const GConfValue *value);
+
 /* These are a hack to encode values into strings and ship them over CORBA,
  * necessary for obscure reasons (ORBit doesn't like recursive datatypes yet)
  */
@@ -259,11 +283,66 @@ void gconf_engine_push_owner_usage (GConfEngine *engine,
 void gconf_engine_pop_owner_usage  (GConfEngine *engine,
                                     gpointer     client);
 
+/* TRUE if the engine reads and writes its sources itself, not via gconfd */
+gboolean gconf_engine_is_local (GConfEngine *conf);
+
 gboolean gconf_engine_recursive_unset (GConfEngine      *engine,
                                        const char       *key,
                                        GConfUnsetFlags   flags,
                                        GError          **err);
 
+/* GDestroyNotify for a list of GConfEntry */
+void gconf_entry_list_free (gpointer entries);
+
+/* The entries of dir and of every dir below it, with full keys, and in
+ * subdirs the full names of the dirs below it, parents first. The D-Bus
+ * engine gets all of it from gconfd in one call; the walk asks dir by
+ * dir and is the fallback for everything else.
+ */
+GSList* gconf_engine_all_entries_recursive (GConfEngine  *conf,
+                                            const gchar  *dir,
+                                            GSList      **subdirs,
+                                            GError      **err);
+GSList* gconf_engine_all_entries_walk      (GConfEngine  *conf,
+                                            const gchar  *dir,
+                                            GSList      **subdirs,
+                                            GError      **err);
+
+/* Non-blocking engine calls behind the GConfClient _async API.  Only
+ * the D-Bus engine really goes asynchronous; local and CORBA engines
+ * do the work immediately and complete from the main loop.
+ */
+void        gconf_engine_get_entry_async     (GConfEngine         *conf,
+                                              const gchar         *key,
+                                              gboolean             use_schema_default,
+                                              GAsyncReadyCallback  callback,
+                                              gpointer             user_data);
+GConfEntry* gconf_engine_get_entry_finish    (GConfEngine         *conf,
+                                              GAsyncResult        *result,
+                                              GError             **err);
+void        gconf_engine_set_async           (GConfEngine         *conf,
+                                              const gchar         *key,
+                                              const GConfValue    *value,
+                                              GAsyncReadyCallback  callback,
+                                              gpointer             user_data);
+gboolean    gconf_engine_set_finish          (GConfEngine         *conf,
+                                              GAsyncResult        *result,
+                                              GError             **err);
+void        gconf_engine_unset_async         (GConfEngine         *conf,
+                                              const gchar         *key,
+                                              GAsyncReadyCallback  callback,
+                                              gpointer             user_data);
+gboolean    gconf_engine_unset_finish        (GConfEngine         *conf,
+                                              GAsyncResult        *result,
+                                              GError             **err);
+void        gconf_engine_all_entries_async   (GConfEngine         *conf,
+                                              const gchar         *dir,
+                                              GAsyncReadyCallback  callback,
+                                              gpointer             user_data);
+GSList*     gconf_engine_all_entries_finish  (GConfEngine         *conf,
+                                              GAsyncResult        *result,
+                                              GError             **err);
+
 #ifdef HAVE_CORBA
 gboolean gconf_CORBA_Object_equal (gconstpointer a,
                                    gconstpointer b);
@@ -20,6 +20,7 @@
 #include <config.h>
 #include "gconf-listeners.h"
 #include "gconf.h"
+#include "gconf-internals.h"
 
 #include <string.h>
 #include <unistd.h>
@@ -69,16 +70,25 @@ struct _LTable {
   
   /* Connection array indexes to be recycled */
   GSList* removed_indices;
+
+  /* Scratch space reused by ltable_notify() so a notify doesn't
+   * allocate; key_buf holds the key being split in place, and
+   * to_notify collects matched listeners (nested notifies from
+   * inside a callback append past the outer notify's range).
+   */
+  GString* key_buf;
+  GPtrArray* to_notify;
 };
 
 typedef struct _LTableEntry LTableEntry;
 
 struct _LTableEntry {
-  gchar* name; /* The name of this "directory" */
+  const gchar* name; /* The name of this "directory", interned */
   GList* listeners; /* Each listener listening *exactly* here. You probably 
                         want to notify all listeners *below* this node as well. 
                      */
-  gchar *full_name; /* fully-qualified name */
+  const gchar *full_name; /* fully-qualified name, interned */
+  GHashTable* children; /* child name -> GNode, NULL until there are children */
 };
 
 static LTable* ltable_new(void);
@@ -279,6 +289,9 @@ ltable_new(void)
   lt->removed_indices = NULL;
 
   lt->next_cnxn = 1; /* 0 is invalid */
+
+  lt->key_buf = g_string_new (NULL);
+  lt->to_notify = g_ptr_array_new ();
   
   return lt;
 }
@@ -361,8 +374,21 @@ ltable_insert(LTable* lt, const gchar* where, Listener* l)
       /* Find this dirname on this level, or add it. */
       g_assert (cur != NULL);        
 
+      lte = cur->data;
+
       found = NULL;
 
+      if (lte->children != NULL)
+        found = g_hash_table_lookup (lte->children, dirnames[i]);
+
+      if (found != NULL)
+        {
+          cur = found;
+          ++i;
+          continue;
+        }
+
+      /* Not there; find the sorted position to insert at */
       across = cur->children;
 
       while (across != NULL)
@@ -373,12 +399,9 @@ ltable_insert(LTable* lt, const gchar* where, Listener* l)
 
           cmp = strcmp(lte->name, dirnames[i]);
 
-          if (cmp == 0)
-            {
-              found = across;
-              break;
-            }
-          else if (cmp > 0)
+          g_assert (cmp != 0);
+
+          if (cmp > 0)
             {
               /* Past it */
               break;
@@ -389,18 +412,20 @@ ltable_insert(LTable* lt, const gchar* where, Listener* l)
             }
         }
 
-      if (found == NULL)
-        {
-          ne = ltable_entry_new(dirnames, i);
+      ne = ltable_entry_new(dirnames, i);
               
-          if (across != NULL) /* Across is at the one past */
-            found = g_node_insert_data_before(cur, across, ne);
-          else                /* Never went past, append - could speed this up by saving last visited */
-            found = g_node_append_data(cur, ne);
-        }
+      if (across != NULL) /* Across is at the one past */
+        found = g_node_insert_data_before(cur, across, ne);
+      else                /* Never went past, append - could speed this up by saving last visited */
+        found = g_node_append_data(cur, ne);
 
       g_assert(found != NULL);
 
+      lte = cur->data;
+      if (lte->children == NULL)
+        lte->children = g_hash_table_new (g_str_hash, g_str_equal);
+      g_hash_table_insert (lte->children, (gchar*) ne->name, found);
+
       cur = found;
 
       ++i;
@@ -511,6 +536,18 @@ ltable_remove(LTable* lt, guint cnxn)
           {
             if (cur == lt->tree)
               lt->tree = NULL;
+
+            if (parent != NULL)
+              {
+                LTableEntry* parent_lte = parent->data;
+
+                g_hash_table_remove (parent_lte->children, lte->name);
+                if (g_hash_table_size (parent_lte->children) == 0)
+                  {
+                    g_hash_table_destroy (parent_lte->children);
+                    parent_lte->children = NULL;
+                  }
+              }
               
             ltable_entry_destroy(lte);
             g_node_destroy(cur);
@@ -567,16 +604,16 @@ ltable_destroy(LTable* ltable)
   g_ptr_array_free(ltable->listeners, TRUE);
 
   g_slist_free(ltable->removed_indices);
+
+  g_string_free(ltable->key_buf, TRUE);
+  g_ptr_array_free(ltable->to_notify, TRUE);
   
   g_free(ltable);
 }
 
 static void
-notify_listener_list(GConfListeners* listeners,
-                     GList* list,
-                     const gchar* key,
-                     GConfListenersCallback callback,
-                     gpointer user_data)
+collect_listener_list(GPtrArray* to_notify,
+                      GList* list)
 {
   GList* tmp;
 
@@ -585,9 +622,8 @@ notify_listener_list(GConfListeners* listeners,
     {
       Listener* l = tmp->data;
 
-      /* don't notify listeners that were removed during the notify */
-      if (!l->removed)
-        (*callback)(listeners, key, l->cnxn, l->listener_data, user_data);
+      listener_ref (l);
+      g_ptr_array_add (to_notify, l);
 
       tmp = g_list_next(tmp);
     }
@@ -597,13 +633,10 @@ static void
 ltable_notify(LTable* lt, const gchar* key,
               GConfListenersCallback callback, gpointer user_data)
 {
-  gchar** dirs;
-  guint i;
-  const gchar* noroot_key;
+  gchar* component;
   GNode* cur;
-  GList *to_notify;
-  
-  noroot_key = key + 1;
+  guint start;
+  guint i;
 
   g_return_if_fail(*key == '/');
   g_return_if_fail(gconf_valid_key(key, NULL));
@@ -611,55 +644,62 @@ ltable_notify(LTable* lt, const gchar* key,
   if (lt->tree == NULL)
     return; /* no one to notify */
 
-  /* we build a list "to_notify" to be safe against tree
-   * modifications during the notification.
+  /* we collect the listeners into to_notify, holding a ref on each,
+   * to be safe against tree modifications during the notification.
+   * If a callback notifies again, the nested call uses the part of
+   * the array past our range and truncates back to it when done.
    */
-  
+  start = lt->to_notify->len;
+
   /* Notify "/" listeners */
-  to_notify = g_list_copy (((LTableEntry*)lt->tree->data)->listeners);  
+  collect_listener_list (lt->to_notify,
+                         ((LTableEntry*)lt->tree->data)->listeners);
 
-  dirs = g_strsplit (noroot_key, "/", -1);
+  /* Split the key in place, one component at a time */
+  g_string_assign (lt->key_buf, key + 1);
+  component = lt->key_buf->str;
 
   cur = lt->tree;
-  i = 0;
-  while (dirs[i] && cur)
+  while (*component != '\0' && cur != NULL)
     {
-      GNode* child = cur->children;
+      LTableEntry* lte = cur->data;
+      gchar* slash;
 
-      while (child != NULL)
-        {
-          LTableEntry* lte = child->data;
-
-          if (strcmp(lte->name, dirs[i]) == 0)
-            {
-              GList *copy = g_list_copy (lte->listeners);
-              to_notify = g_list_concat (to_notify, copy);
+      slash = strchr (component, '/');
+      if (slash != NULL)
+        *slash = '\0';
 
-              break;
-            }
+      if (lte->children != NULL)
+        cur = g_hash_table_lookup (lte->children, component);
+      else
+        cur = NULL; /* end of the line */
 
-          child = g_node_next_sibling(child);
-        }
+      if (cur != NULL)
+        collect_listener_list (lt->to_notify,
+                               ((LTableEntry*)cur->data)->listeners);
 
-      if (child != NULL) /* we found a child, scan below it */
-        cur = child;
-      else               /* end of the line */
-        cur = NULL;
+      if (slash == NULL)
+        break;
 
-      ++i;
+      component = slash + 1;
     }
-  
-  g_strfreev(dirs);
 
-  g_list_foreach (to_notify, (GFunc) listener_ref, NULL);
-  
-  notify_listener_list ((GConfListeners*)lt,
-                        to_notify, key,
-                        callback, user_data);
+  /* The array may be reallocated by nested notifies, so always
+   * index it rather than holding on to its data
+   */
+  for (i = start; i < lt->to_notify->len; i++)
+    {
+      Listener* l = g_ptr_array_index (lt->to_notify, i);
+
+      /* don't notify listeners that were removed during the notify */
+      if (!l->removed)
+        (*callback)((GConfListeners*)lt, key, l->cnxn, l->listener_data, user_data);
+    }
 
-  g_list_foreach (to_notify, (GFunc) listener_unref, NULL);
+  for (i = start; i < lt->to_notify->len; i++)
+    listener_unref (g_ptr_array_index (lt->to_notify, i));
 
-  g_list_free (to_notify);
+  g_ptr_array_set_size (lt->to_notify, start);
 }
 
 struct NodeTraverseData
@@ -840,7 +880,7 @@ ltable_entry_new(gchar **pathv,
       GString* full_name;
       guint i;
 
-      lte->name = g_strdup(pathv[end]);
+      lte->name = gconf_key_intern(pathv[end]);
 
       full_name = g_string_new("/");
       i = 0;
@@ -851,12 +891,13 @@ ltable_entry_new(gchar **pathv,
 	    g_string_append_c(full_name, '/');
 	  i++;
 	}
-      lte->full_name = g_string_free(full_name, FALSE);
+      lte->full_name = gconf_key_intern(full_name->str);
+      g_string_free(full_name, TRUE);
     }
   else
     {
-      lte->name = g_strdup("/");
-      lte->full_name = g_strdup("/");
+      lte->name = gconf_key_intern("/");
+      lte->full_name = gconf_key_intern("/");
     }
   
   return lte;
@@ -866,8 +907,10 @@ static void
 ltable_entry_destroy(LTableEntry* lte)
 {
   g_return_if_fail(lte->listeners == NULL); /* should destroy all listeners first. */
-  g_free(lte->name);
-  g_free(lte->full_name);
+  if (lte->children != NULL)
+    g_hash_table_destroy(lte->children);
+  gconf_key_unintern(lte->name);
+  gconf_key_unintern(lte->full_name);
   g_free(lte);
 }
 
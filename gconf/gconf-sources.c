@@ -445,6 +445,280 @@ gconf_sources_new_from_source       (GConfSource* source)
   return sources;
 }
 
+/*
+ * Resolved query cache
+ *
+ * Walking the whole path for each key asks every source at least for
+ * writability and metainfo, so the outcome of gconf_sources_query_value()
+ * is kept per key and locale list. Anything that goes through these
+ * sources and changes a key drops its results, and the results of
+ * keys whose value was a default from it if it is a schema.
+ *
+ * gconfd lives as long as the session, so once results are kept for
+ * QUERY_CACHE_MAX_KEYS keys the cache starts over rather than growing
+ * with every key anybody ever read.
+ */
+
+#define QUERY_CACHE_MAX_KEYS 4096
+
+typedef struct {
+  gchar** locales;
+  GConfValue* value;
+  gchar* schema_name;
+  guint use_schema_default : 1;
+  guint is_default : 1;
+  guint is_writable : 1;
+} QueryResult;
+
+static void
+query_result_free (QueryResult *result)
+{
+  g_strfreev (result->locales);
+  if (result->value)
+    gconf_value_free (result->value);
+  g_free (result->schema_name);
+  g_slice_free (QueryResult, result);
+}
+
+static void
+query_result_list_free (GSList *results)
+{
+  g_slist_foreach (results, (GFunc) query_result_free, NULL);
+  g_slist_free (results);
+}
+
+/* Unset keys only need the default out of their schema; keeping just
+ * that spares copying the whole schema, descriptions and all, for
+ * every key that uses it.
+ */
+typedef struct {
+  gchar** locales;
+  /* NULL if the schema isn't installed or has no default */
+  GConfValue* value;
+} SchemaDefault;
+
+static void
+schema_default_free (SchemaDefault *sd)
+{
+  g_strfreev (sd->locales);
+  if (sd->value)
+    gconf_value_free (sd->value);
+  g_slice_free (SchemaDefault, sd);
+}
+
+static void
+schema_default_list_free (GSList *defaults)
+{
+  g_slist_foreach (defaults, (GFunc) schema_default_free, NULL);
+  g_slist_free (defaults);
+}
+
+static gboolean
+locales_equal (const gchar **a,
+               const gchar **b)
+{
+  if (a == NULL || b == NULL)
+    return a == b;
+
+  while (*a && *b)
+    {
+      if (strcmp (*a, *b) != 0)
+        return FALSE;
+      a++;
+      b++;
+    }
+
+  return *a == *b;
+}
+
+static QueryResult*
+query_cache_lookup (GConfSources  *sources,
+                    const gchar   *key,
+                    const gchar  **locales,
+                    gboolean       use_schema_default)
+{
+  GSList *tmp;
+
+  if (sources->query_cache == NULL)
+    return NULL;
+
+  for (tmp = g_hash_table_lookup (sources->query_cache, key);
+       tmp != NULL;
+       tmp = tmp->next)
+    {
+      QueryResult *result = tmp->data;
+
+      if (result->use_schema_default == (use_schema_default != FALSE) &&
+          locales_equal ((const gchar **) result->locales, locales))
+        return result;
+    }
+
+  return NULL;
+}
+
+static void
+query_cache_insert (GConfSources  *sources,
+                    const gchar   *key,
+                    QueryResult   *result)
+{
+  GSList *results;
+  gchar *orig_key;
+
+  if (sources->query_cache != NULL &&
+      g_hash_table_size (sources->query_cache) >= QUERY_CACHE_MAX_KEYS &&
+      g_hash_table_lookup (sources->query_cache, key) == NULL)
+    {
+      g_hash_table_destroy (sources->query_cache);
+      sources->query_cache = NULL;
+      g_hash_table_destroy (sources->query_dependents);
+      sources->query_dependents = NULL;
+    }
+
+  if (sources->query_cache == NULL)
+    {
+      sources->query_cache =
+        g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                               (GDestroyNotify) query_result_list_free);
+      sources->query_dependents =
+        g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                               (GDestroyNotify) g_hash_table_destroy);
+    }
+
+  if (g_hash_table_lookup_extended (sources->query_cache, key,
+                                    (gpointer *) &orig_key,
+                                    (gpointer *) &results))
+    {
+      g_hash_table_steal (sources->query_cache, key);
+      g_hash_table_insert (sources->query_cache, orig_key,
+                           g_slist_prepend (results, result));
+    }
+  else
+    g_hash_table_insert (sources->query_cache, g_strdup (key),
+                         g_slist_prepend (NULL, result));
+
+  if (result->is_default && result->schema_name != NULL)
+    {
+      GHashTable *dependents;
+
+      dependents = g_hash_table_lookup (sources->query_dependents,
+                                        result->schema_name);
+      if (dependents == NULL)
+        {
+          dependents = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, NULL);
+          g_hash_table_insert (sources->query_dependents,
+                               g_strdup (result->schema_name), dependents);
+        }
+
+      if (g_hash_table_lookup (dependents, key) == NULL)
+        g_hash_table_insert (dependents, g_strdup (key), GINT_TO_POINTER (1));
+    }
+}
+
+static void
+query_cache_remove_dependents (GConfSources *sources,
+                               const gchar  *schema_key)
+{
+  GHashTable *dependents;
+  GHashTableIter iter;
+  gpointer key;
+
+  dependents = g_hash_table_lookup (sources->query_dependents, schema_key);
+  if (dependents == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, dependents);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_hash_table_remove (sources->query_cache, key);
+
+  g_hash_table_remove (sources->query_dependents, schema_key);
+}
+
+static gboolean
+at_or_below (const gchar *location,
+             const gchar *key)
+{
+  return strcmp (location, key) == 0 || gconf_key_is_below (location, key);
+}
+
+static void
+query_cache_forget_key (GConfSources *sources,
+                        const gchar  *key)
+{
+  if (sources->schema_defaults != NULL)
+    g_hash_table_remove (sources->schema_defaults, key);
+
+  if (sources->query_cache == NULL)
+    return;
+
+  g_hash_table_remove (sources->query_cache, key);
+  query_cache_remove_dependents (sources, key);
+}
+
+void
+gconf_sources_invalidate (GConfSources *sources,
+                          const gchar  *location)
+{
+  GHashTableIter iter;
+  gpointer key;
+  GSList *schema_keys;
+  GSList *tmp;
+
+  if (sources->schema_defaults != NULL)
+    {
+      g_hash_table_iter_init (&iter, sources->schema_defaults);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        {
+          if (at_or_below (location, key))
+            g_hash_table_iter_remove (&iter);
+        }
+    }
+
+  if (sources->query_cache == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, sources->query_cache);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      if (at_or_below (location, key))
+        g_hash_table_iter_remove (&iter);
+    }
+
+  /* Schemas in there may have been the defaults of keys elsewhere */
+  schema_keys = NULL;
+  g_hash_table_iter_init (&iter, sources->query_dependents);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      if (at_or_below (location, key))
+        schema_keys = g_slist_prepend (schema_keys, g_strdup (key));
+    }
+
+  for (tmp = schema_keys; tmp != NULL; tmp = tmp->next)
+    {
+      query_cache_remove_dependents (sources, tmp->data);
+      g_free (tmp->data);
+    }
+  g_slist_free (schema_keys);
+}
+
+static void
+query_cache_clear (GConfSources *sources)
+{
+  if (sources->schema_defaults != NULL)
+    {
+      g_hash_table_destroy (sources->schema_defaults);
+      sources->schema_defaults = NULL;
+    }
+
+  if (sources->query_cache == NULL)
+    return;
+
+  g_hash_table_destroy (sources->query_cache);
+  sources->query_cache = NULL;
+  g_hash_table_destroy (sources->query_dependents);
+  sources->query_dependents = NULL;
+}
+
 void
 gconf_sources_free(GConfSources* sources)
 {
@@ -461,6 +735,8 @@ gconf_sources_free(GConfSources* sources)
 
   g_list_free(sources->sources);
 
+  query_cache_clear (sources);
+
   g_free(sources);
 }
 
@@ -469,6 +745,8 @@ gconf_sources_clear_cache        (GConfSources  *sources)
 {
   GList* tmp;
 
+  query_cache_clear (sources);
+
   tmp = sources->sources;
 
   while (tmp != NULL)
@@ -497,9 +775,6 @@ gconf_sources_clear_cache_for_sources (GConfSources  *sources,
 
       GList* tmp2;
 
-      if (source->backend->vtable.clear_cache == NULL)
-        continue;
-
       tmp2 = affected->sources;
 
       while (tmp2 != NULL)
@@ -509,6 +784,8 @@ gconf_sources_clear_cache_for_sources (GConfSources  *sources,
 	  if (source->backend == affected_source->backend &&
 	      strcmp (source_resource, get_address_resource (affected_source->address)) == 0)
 	    {
+	      query_cache_clear (sources);
+
 	      if (source->backend->vtable.clear_cache)
 		(*source->backend->vtable.clear_cache)(source);
 	    }
@@ -520,34 +797,106 @@ gconf_sources_clear_cache_for_sources (GConfSources  *sources,
     }
 }
 
-GConfValue*   
-gconf_sources_query_value (GConfSources* sources, 
-                           const gchar* key,
-                           const gchar** locales,
-                           gboolean use_schema_default,
-                           gboolean* value_is_default,
-                           gboolean* value_is_writable,
-                           gchar   **schema_namep,
-                           GError** err)
+static GConfValue* query_value_uncached (GConfSources  *sources,
+                                         const gchar   *key,
+                                         const gchar  **locales,
+                                         gboolean       use_schema_default,
+                                         gboolean      *value_is_default,
+                                         gboolean      *value_is_writable,
+                                         gchar        **schema_namep,
+                                         GError       **err);
+
+/* The default value schema_key gives key, or NULL */
+static GConfValue*
+query_schema_default (GConfSources  *sources,
+                      const gchar   *key,
+                      const gchar   *schema_key,
+                      const gchar  **locales,
+                      GError       **err)
+{
+  SchemaDefault *sd;
+  GSList *defaults;
+  GSList *tmp;
+  GConfValue *val;
+  GError *error;
+
+  defaults = NULL;
+  if (sources->schema_defaults != NULL)
+    defaults = g_hash_table_lookup (sources->schema_defaults, schema_key);
+
+  for (tmp = defaults; tmp != NULL; tmp = tmp->next)
+    {
+      sd = tmp->data;
+
+      if (locales_equal ((const gchar **) sd->locales, locales))
+        return sd->value ? gconf_value_copy (sd->value) : NULL;
+    }
+
+  error = NULL;
+  val = query_value_uncached (sources, schema_key, locales, FALSE,
+                              NULL, NULL, NULL, &error);
+  if (error != NULL)
+    {
+      g_propagate_error (err, error);
+      return NULL;
+    }
+
+  if (val != NULL && val->type != GCONF_VALUE_SCHEMA)
+    {
+      gconf_set_error (err, GCONF_ERROR_FAILED,
+                       _("Schema `%s' specified for `%s' stores a non-schema value"), schema_key, key);
+      gconf_value_free (val);
+      return NULL;
+    }
+
+  sd = g_slice_new (SchemaDefault);
+  sd->locales = g_strdupv ((gchar **) locales);
+  sd->value = NULL;
+
+  if (val != NULL)
+    {
+      sd->value = gconf_schema_steal_default_value (gconf_value_get_schema (val));
+      gconf_value_free (val);
+    }
+
+  if (sources->schema_defaults == NULL)
+    sources->schema_defaults =
+      g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                             (GDestroyNotify) schema_default_list_free);
+
+  if (defaults != NULL)
+    {
+      /* Keep the existing table key */
+      defaults->next = g_slist_prepend (defaults->next, sd);
+    }
+  else
+    g_hash_table_insert (sources->schema_defaults, g_strdup (schema_key),
+                         g_slist_prepend (NULL, sd));
+
+  return sd->value ? gconf_value_copy (sd->value) : NULL;
+}
+
+static GConfValue*
+query_value_uncached (GConfSources* sources, 
+                      const gchar* key,
+                      const gchar** locales,
+                      gboolean use_schema_default,
+                      gboolean* value_is_default,
+                      gboolean* value_is_writable,
+                      gchar   **schema_namep,
+                      GError** err)
 {
   GList* tmp;
   gchar* schema_name;
   GError* error;
   GConfValue* val;
   
-  g_return_val_if_fail (sources != NULL, NULL);
-  g_return_val_if_fail (key != NULL, NULL);
-  g_return_val_if_fail ((err == NULL) || (*err == NULL), NULL);
-
   /* A value is writable if it is unset and a writable source exists,
    * or if it's set and the setting is within or after a writable source.
    * So basically if we see a writable source before we get the value,
    * or get the value from a writable source, the value is writable.
    */
   
-  if (!gconf_key_check(key, err))
-    return NULL;
-
   if (value_is_default)
     *value_is_default = FALSE;
 
@@ -586,7 +935,6 @@ gconf_sources_query_value (GConfSources* sources,
           
           val = gconf_source_query_value (source, key, locales,
                                           schema_name_retloc, &error);
-
         }
       else if (schema_name_retloc != NULL)
         {
@@ -661,10 +1009,7 @@ gconf_sources_query_value (GConfSources* sources,
         *value_is_default = TRUE;
 
       if (use_schema_default)
-        {
-          val = gconf_sources_query_value (sources, schema_name, locales,
-                                           FALSE, NULL, NULL, NULL, &error);
-        }
+        val = query_schema_default (sources, key, schema_name, locales, &error);
       
       if (error != NULL)
         {
@@ -676,46 +1021,80 @@ gconf_sources_query_value (GConfSources* sources,
           g_free(schema_name);
           return NULL;
         }
-      else if (val != NULL &&
-               val->type != GCONF_VALUE_SCHEMA)
-        {
-          gconf_set_error (err, GCONF_ERROR_FAILED,
-                           _("Schema `%s' specified for `%s' stores a non-schema value"), schema_name, key);
 
-          if (schema_namep)
-            *schema_namep = schema_name;
-          else
-            g_free (schema_name);
+      if (schema_namep)
+        *schema_namep = schema_name;
+      else
+        g_free (schema_name);
 
-          return NULL;
-        }
-      else if (val != NULL)
-        {
-          GConfValue* retval;
+      return val;
+    }
+  
+  return NULL;
+}
+
+GConfValue*   
+gconf_sources_query_value (GConfSources* sources, 
+                           const gchar* key,
+                           const gchar** locales,
+                           gboolean use_schema_default,
+                           gboolean* value_is_default,
+                           gboolean* value_is_writable,
+                           gchar   **schema_namep,
+                           GError** err)
+{
+  QueryResult *result;
+  GError *error;
+  
+  g_return_val_if_fail (sources != NULL, NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+  g_return_val_if_fail ((err == NULL) || (*err == NULL), NULL);
 
-          retval = gconf_schema_steal_default_value (gconf_value_get_schema (val));          
+  if (!gconf_key_check(key, err))
+    return NULL;
 
-          gconf_value_free (val);
+  result = query_cache_lookup (sources, key, locales, use_schema_default);
 
-          if (schema_namep)
-            *schema_namep = schema_name;
-          else
-            g_free (schema_name);
-          
-          return retval;
-        }
-      else
+  if (result == NULL)
+    {
+      gboolean is_default;
+      gboolean is_writable;
+      gchar *schema_name;
+      GConfValue *val;
+
+      /* Ask for everything so the result can answer any query */
+      error = NULL;
+      val = query_value_uncached (sources, key, locales, use_schema_default,
+                                  &is_default, &is_writable, &schema_name,
+                                  &error);
+      if (error != NULL)
         {
-          if (schema_namep)
-            *schema_namep = schema_name;
-          else
-            g_free (schema_name);
-          
+          g_propagate_error (err, error);
+          g_free (schema_name);
           return NULL;
         }
+
+      result = g_slice_new (QueryResult);
+      result->locales = g_strdupv ((gchar **) locales);
+      result->value = val;
+      result->schema_name = schema_name;
+      result->use_schema_default = use_schema_default != FALSE;
+      result->is_default = is_default != FALSE;
+      result->is_writable = is_writable != FALSE;
+
+      query_cache_insert (sources, key, result);
     }
-  
-  return NULL;
+
+  if (value_is_default)
+    *value_is_default = result->is_default;
+
+  if (value_is_writable)
+    *value_is_writable = result->is_writable;
+
+  if (schema_namep)
+    *schema_namep = g_strdup (result->schema_name);
+
+  return result->value ? gconf_value_copy (result->value) : NULL;
 }
 
 void
@@ -745,6 +1124,8 @@ gconf_sources_set_value   (GConfSources* sources,
                       _("The '/' name can only be a directory, not a key"));
       return;
     }
+
+  query_cache_forget_key (sources, key);
   
   tmp = sources->sources;
 
@@ -810,6 +1191,8 @@ gconf_sources_unset_value   (GConfSources* sources,
   /* We unset in every layer we can write to... */
   GList* tmp;
   GError* error = NULL;
+
+  query_cache_forget_key (sources, key);
   
   tmp = sources->sources;
 
@@ -1045,6 +1428,8 @@ gconf_sources_recursive_unset (GConfSources   *sources,
   g_return_if_fail (key != NULL);
   g_return_if_fail (err == NULL || *err == NULL);
 
+  gconf_sources_invalidate (sources, key);
+
   first_error = NULL;
   recursive_unset_helper (sources, key, locale, flags,
                           notifies, &first_error);
@@ -1109,6 +1494,8 @@ gconf_sources_remove_dir (GConfSources* sources,
   
   if (!gconf_key_check(dir, err))
     return;
+
+  gconf_sources_invalidate (sources, dir);
   
   tmp = sources->sources;
 
@@ -1152,6 +1539,8 @@ gconf_sources_set_schema (GConfSources *sources,
 
   if (schema_key && !gconf_key_check (schema_key, err))
     return;
+
+  query_cache_forget_key (sources, key);
   
   tmp = sources->sources;
 
@@ -1740,6 +2129,18 @@ gconf_sources_query_default_value(GConfSources* sources,
     }
 }
 
+/* Changes a backend reports itself may be at any key in location */
+static void
+sources_notify_cb (GConfSource  *source,
+                   const gchar  *location,
+                   GConfSources *sources)
+{
+  gconf_sources_invalidate (sources, location);
+
+  if (sources->notify_func)
+    (* sources->notify_func) (source, location, sources->notify_data);
+}
+
 void
 gconf_sources_set_notify_func (GConfSources          *sources,
 			       GConfSourceNotifyFunc  notify_func,
@@ -1747,10 +2148,15 @@ gconf_sources_set_notify_func (GConfSources          *sources,
 {
   GList *tmp;
 
+  sources->notify_func = notify_func;
+  sources->notify_data = user_data;
+
   tmp = sources->sources;
   while (tmp != NULL)
     {
-      gconf_source_set_notify_func (tmp->data, notify_func, user_data);
+      gconf_source_set_notify_func (tmp->data,
+                                    notify_func ? (GConfSourceNotifyFunc) sources_notify_cb : NULL,
+                                    notify_func ? sources : NULL);
 
       tmp = tmp->next;
     }
@@ -1808,36 +2214,36 @@ get_address_resource (const char *address)
   return start;
 }
 
-/* Return TRUE if
- *  1. @sources contains @modified_src and
- *  2. @key is not set in any source above @modified_src.
- */
-gboolean
-gconf_sources_is_affected (GConfSources *sources,
-                           GConfSource  *modified_src,
-                           const char   *key)
+static GList*
+find_source_by_resource (GConfSources *sources,
+                         GConfBackend *backend,
+                         const char   *resource)
 {
-  const char *modified_resource;
-  GList      *tmp;
-
-  modified_resource = get_address_resource (modified_src->address);
+  GList *tmp;
 
   tmp = sources->sources;
   while (tmp != NULL)
     {
       GConfSource *source = tmp->data;
 
-      if (source->backend == modified_src->backend &&
-          strcmp (modified_resource, get_address_resource (source->address)) == 0)
-        break;
+      if (source->backend == backend &&
+          strcmp (resource, get_address_resource (source->address)) == 0)
+        return tmp;
 
       tmp = tmp->next;
     }
 
-  if (tmp == NULL)
-    return FALSE;
-  
-  tmp = tmp->prev;
+  return NULL;
+}
+
+/* TRUE if @key is set in a source before @link */
+static gboolean
+set_in_sources_above (GList      *link,
+                      const char *key)
+{
+  GList *tmp;
+
+  tmp = link->prev;
   while (tmp != NULL)
     {
       GConfValue *val;
@@ -1846,11 +2252,77 @@ gconf_sources_is_affected (GConfSources *sources,
       if (val != NULL)
 	{
 	  gconf_value_free (val);
-	  return FALSE;
+	  return TRUE;
 	}
       
       tmp = tmp->prev;
     }
-  
+
+  return FALSE;
+}
+
+/* Return TRUE if
+ *  1. @sources contains @modified_src and
+ *  2. @key is not set in any source above @modified_src.
+ */
+gboolean
+gconf_sources_is_affected (GConfSources *sources,
+                           GConfSource  *modified_src,
+                           const char   *key)
+{
+  GList *link;
+
+  link = find_source_by_resource (sources, modified_src->backend,
+                                  get_address_resource (modified_src->address));
+  if (link == NULL)
+    return FALSE;
+
+  return !set_in_sources_above (link, key);
+}
+
+/* gconf_sources_is_affected() for a whole NULL-terminated list of keys,
+ * looking for the modified source only once. The source is given by
+ * its backend and address, so it doesn't have to be alive anymore.
+ * Returns the affected keys in order; the strings are not copied.
+ */
+GSList*
+gconf_sources_affected_keys (GConfSources  *sources,
+                             GConfBackend  *modified_backend,
+                             const char    *modified_address,
+                             const char   **keys)
+{
+  GSList *affected;
+  GList *link;
+  int i;
+
+  link = find_source_by_resource (sources, modified_backend,
+                                  get_address_resource (modified_address));
+  if (link == NULL)
+    return NULL;
+
+  affected = NULL;
+  for (i = 0; keys[i] != NULL; i++)
+    {
+      if (!set_in_sources_above (link, keys[i]))
+        affected = g_slist_prepend (affected, (char *) keys[i]);
+    }
+
+  return g_slist_reverse (affected);
+}
+
+gboolean
+gconf_sources_invalidate_from (GConfSources *sources,
+                               GConfSource  *modified_src,
+                               const char   *key)
+{
+  /* Whether it was shadowed by a source above can wait for the lookup;
+   * dropping a result that didn't change only costs a query.
+   */
+  if (find_source_by_resource (sources, modified_src->backend,
+                               get_address_resource (modified_src->address)) == NULL)
+    return FALSE;
+
+  gconf_sources_invalidate (sources, key);
+
   return TRUE;
 }
@@ -65,6 +65,18 @@ typedef struct _GConfSources GConfSources;
 
 struct _GConfSources {
   GList* sources;
+
+  /* Resolved gconf_sources_query_value() results: key -> list of
+   * results for different locales. NULL until the first query.
+   */
+  GHashTable* query_cache;
+  /* Schema key -> set of keys whose cached value is its default */
+  GHashTable* query_dependents;
+  /* Schema key -> list of default values for different locales */
+  GHashTable* schema_defaults;
+
+  GConfSourceNotifyFunc notify_func;
+  gpointer notify_data;
 };
 
 typedef struct
@@ -84,6 +96,11 @@ void          gconf_sources_free               (GConfSources  *sources);
 void          gconf_sources_clear_cache        (GConfSources  *sources);
 void          gconf_sources_clear_cache_for_sources (GConfSources  *sources,
 						     GConfSources  *affected);
+/* Drops resolved values at or below location, for changes made
+ * behind the back of these sources
+ */
+void          gconf_sources_invalidate         (GConfSources  *sources,
+                                                const gchar   *location);
 GConfValue*   gconf_sources_query_value        (GConfSources  *sources,
                                                 const gchar   *key,
                                                 const gchar  **locales,
@@ -151,5 +168,15 @@ void          gconf_sources_remove_listener    (GConfSources          *sources,
 gboolean      gconf_sources_is_affected        (GConfSources *sources,
 						GConfSource  *modified_src,
 						const char   *key);
+GSList*       gconf_sources_affected_keys      (GConfSources  *sources,
+                                                GConfBackend  *modified_backend,
+                                                const char    *modified_address,
+                                                const char   **keys);
+/* gconf_sources_invalidate() for key if modified_src is one of sources;
+ * returns whether it is
+ */
+gboolean      gconf_sources_invalidate_from    (GConfSources  *sources,
+                                                GConfSource   *modified_src,
+                                                const char    *key);
 
 #endif
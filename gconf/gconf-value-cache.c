@@ -0,0 +1,566 @@
+/* GConf
+ * Copyright (C) 1999, 2000 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <config.h>
+#include "gconf-value-cache.h"
+#include "gconf-internals.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/* File layout: a header, then N_SLOTS fixed size slots forming an
+ * open addressed hash table with linear probing. A key is in at most
+ * one slot; the daemon keeps an index to guarantee that, so a reader
+ * that finds a key can trust it is the current value.
+ */
+
+#define CACHE_MAGIC   0x43564347 /* "GCVC" */
+#define CACHE_VERSION 1
+
+#define N_SLOTS    4096
+#define SLOT_SIZE  256
+#define MAX_PROBES 8
+
+#define FILENAME_PREFIX "value-cache-"
+
+typedef struct {
+  guint32 magic;
+  guint32 version;
+  guint32 n_slots;
+  guint32 slot_size;
+  /* Set when the daemon goes away; the file is stale from then on */
+  gint    retired;
+  guint32 padding[3];
+} CacheHeader;
+
+#define SLOT_DATA_SIZE (SLOT_SIZE - 4 * sizeof (guint32))
+
+typedef struct {
+  /* Odd while the daemon rewrites the slot */
+  gint    seq;
+  /* 0 for an empty slot */
+  guint32 hash;
+  guint16 key_len;
+  guint16 schema_len;
+  guint16 value_len;
+  guint8  is_writable;
+  guint8  has_schema;
+  /* key, schema name and gconf_value_encode()d value, unterminated */
+  gchar   data[SLOT_DATA_SIZE];
+} CacheSlot;
+
+struct _GConfValueCache {
+  gchar       *filename;
+  gsize        size;
+  CacheHeader *header;
+  CacheSlot   *slots;
+
+  /* Daemon only: key to slot number + 1 */
+  GHashTable  *index;
+  /* Daemon only: rotates which slot of a full probe chain goes */
+  guint        evict;
+  /* Client only: to tell whether the writer is still around */
+  int          fd;
+  pid_t        pid;
+};
+
+static gsize
+cache_size (void)
+{
+  return sizeof (CacheHeader) + N_SLOTS * sizeof (CacheSlot);
+}
+
+/* FNV-1a; it ends up in a file shared between processes, so it must
+ * not depend on the GLib version either side uses.
+ */
+static guint32
+cache_hash (const gchar *key)
+{
+  guint32 h = 2166136261u;
+
+  while (*key)
+    {
+      h ^= (guchar) *key++;
+      h *= 16777619u;
+    }
+
+  return h ? h : 1;
+}
+
+static gboolean
+cache_map (GConfValueCache *cache,
+           int              fd,
+           gboolean         writable)
+{
+  gpointer mem;
+
+  mem = mmap (NULL, cache->size,
+              writable ? PROT_READ | PROT_WRITE : PROT_READ,
+              MAP_SHARED, fd, 0);
+  if (mem == MAP_FAILED)
+    return FALSE;
+
+  cache->header = mem;
+  cache->slots = (CacheSlot *) ((gchar *) mem + sizeof (CacheHeader));
+
+  return TRUE;
+}
+
+
+/*
+ * Daemon side
+ */
+
+GConfValueCache*
+gconf_value_cache_create (GError **err)
+{
+  GConfValueCache *cache;
+  gchar *dir;
+  gchar *basename;
+  int fd;
+
+  dir = gconf_get_daemon_dir ();
+  g_mkdir_with_parents (dir, 0700);
+
+  basename = g_strdup_printf (FILENAME_PREFIX "%s-%d",
+                              g_get_host_name (), (int) getpid ());
+
+  cache = g_new0 (GConfValueCache, 1);
+  cache->filename = g_build_filename (dir, basename, NULL);
+  cache->size = cache_size ();
+
+  g_free (basename);
+  g_free (dir);
+
+  fd = open (cache->filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0)
+    {
+      gconf_set_error (err, GCONF_ERROR_FAILED,
+                       _("Failed to create value cache `%s': %s"),
+                       cache->filename, g_strerror (errno));
+      goto failed;
+    }
+
+  if (ftruncate (fd, cache->size) < 0 ||
+      !cache_map (cache, fd, TRUE))
+    {
+      gconf_set_error (err, GCONF_ERROR_FAILED,
+                       _("Failed to map value cache `%s': %s"),
+                       cache->filename, g_strerror (errno));
+      close (fd);
+      unlink (cache->filename);
+      goto failed;
+    }
+
+  close (fd);
+
+  /* ftruncate() zero filled the slots; the magic goes last */
+  cache->header->version = CACHE_VERSION;
+  cache->header->n_slots = N_SLOTS;
+  cache->header->slot_size = SLOT_SIZE;
+  g_atomic_int_set ((gint *) &cache->header->magic, CACHE_MAGIC);
+
+  cache->index = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                        g_free, NULL);
+
+  return cache;
+
+ failed:
+  g_free (cache->filename);
+  g_free (cache);
+
+  return NULL;
+}
+
+const gchar*
+gconf_value_cache_get_filename (GConfValueCache *cache)
+{
+  return cache->filename;
+}
+
+static void
+slot_clear (CacheSlot *slot)
+{
+  g_atomic_int_inc (&slot->seq);
+
+  slot->hash = 0;
+  slot->key_len = 0;
+  slot->schema_len = 0;
+  slot->value_len = 0;
+
+  g_atomic_int_inc (&slot->seq);
+}
+
+static void
+slot_forget (GConfValueCache *cache,
+             guint            n)
+{
+  CacheSlot *slot = &cache->slots[n];
+  gchar *key;
+
+  if (slot->hash == 0)
+    return;
+
+  key = g_strndup (slot->data, slot->key_len);
+  g_hash_table_remove (cache->index, key);
+  g_free (key);
+
+  slot_clear (slot);
+}
+
+/* The slot key is in, or the one it should go in */
+static guint
+cache_find_slot (GConfValueCache *cache,
+                 const gchar     *key,
+                 guint32          hash)
+{
+  gpointer found;
+  guint i;
+
+  found = g_hash_table_lookup (cache->index, key);
+  if (found != NULL)
+    return GPOINTER_TO_UINT (found) - 1;
+
+  for (i = 0; i < MAX_PROBES; i++)
+    {
+      guint n = (hash + i) & (N_SLOTS - 1);
+
+      if (cache->slots[n].hash == 0)
+        return n;
+    }
+
+  /* Whole chain taken, push one of them out */
+  i = cache->evict++ % MAX_PROBES;
+
+  return (hash + i) & (N_SLOTS - 1);
+}
+
+void
+gconf_value_cache_publish (GConfValueCache  *cache,
+                           const gchar      *key,
+                           const GConfValue *value,
+                           gboolean          is_writable,
+                           const gchar      *schema_name)
+{
+  CacheSlot *slot;
+  gchar *encoded;
+  gsize key_len, schema_len, value_len;
+  guint32 hash;
+  guint n;
+
+  if (value == NULL || value->type == GCONF_VALUE_SCHEMA)
+    {
+      gconf_value_cache_remove (cache, key);
+      return;
+    }
+
+  encoded = gconf_value_encode ((GConfValue *) value);
+
+  key_len = strlen (key);
+  schema_len = schema_name ? strlen (schema_name) : 0;
+  value_len = strlen (encoded);
+
+  /* Too big for a slot; make sure an older value doesn't linger */
+  if (key_len + schema_len + value_len > SLOT_DATA_SIZE)
+    {
+      gconf_value_cache_remove (cache, key);
+      g_free (encoded);
+      return;
+    }
+
+  hash = cache_hash (key);
+  n = cache_find_slot (cache, key, hash);
+  slot = &cache->slots[n];
+
+  if (slot->hash != 0 &&
+      (slot->key_len != key_len || memcmp (slot->data, key, key_len) != 0))
+    slot_forget (cache, n);
+
+  g_atomic_int_inc (&slot->seq);
+
+  slot->hash = hash;
+  slot->key_len = key_len;
+  slot->schema_len = schema_len;
+  slot->value_len = value_len;
+  slot->is_writable = is_writable != FALSE;
+  slot->has_schema = schema_name != NULL;
+  memcpy (slot->data, key, key_len);
+  if (schema_len > 0)
+    memcpy (slot->data + key_len, schema_name, schema_len);
+  memcpy (slot->data + key_len + schema_len, encoded, value_len);
+
+  g_atomic_int_inc (&slot->seq);
+
+  g_hash_table_replace (cache->index, g_strdup (key), GUINT_TO_POINTER (n + 1));
+
+  g_free (encoded);
+}
+
+void
+gconf_value_cache_remove (GConfValueCache *cache,
+                          const gchar     *key)
+{
+  gpointer found;
+
+  found = g_hash_table_lookup (cache->index, key);
+  if (found == NULL)
+    return;
+
+  slot_clear (&cache->slots[GPOINTER_TO_UINT (found) - 1]);
+  g_hash_table_remove (cache->index, key);
+}
+
+gboolean
+gconf_value_cache_contains (GConfValueCache *cache,
+                            const gchar     *key)
+{
+  return g_hash_table_lookup (cache->index, key) != NULL;
+}
+
+void
+gconf_value_cache_clear (GConfValueCache *cache)
+{
+  guint n;
+
+  for (n = 0; n < N_SLOTS; n++)
+    if (cache->slots[n].hash != 0)
+      slot_clear (&cache->slots[n]);
+
+  g_hash_table_remove_all (cache->index);
+}
+
+void
+gconf_value_cache_retire (GConfValueCache *cache)
+{
+  g_atomic_int_set (&cache->header->retired, 1);
+
+  unlink (cache->filename);
+  munmap (cache->header, cache->size);
+
+  g_hash_table_destroy (cache->index);
+  g_free (cache->filename);
+  g_free (cache);
+}
+
+void
+gconf_value_cache_remove_stale (void)
+{
+  gchar *dir;
+  gchar *prefix;
+  GDir *d;
+  const gchar *name;
+
+  dir = gconf_get_daemon_dir ();
+  d = g_dir_open (dir, 0, NULL);
+  if (d == NULL)
+    {
+      g_free (dir);
+      return;
+    }
+
+  prefix = g_strdup_printf (FILENAME_PREFIX "%s-", g_get_host_name ());
+
+  while ((name = g_dir_read_name (d)) != NULL)
+    {
+      int pid;
+
+      if (!g_str_has_prefix (name, prefix))
+        continue;
+
+      pid = atoi (name + strlen (prefix));
+
+      if (pid > 0 && pid != getpid () &&
+          kill (pid, 0) < 0 && errno == ESRCH)
+        {
+          gchar *filename;
+
+          filename = g_build_filename (dir, name, NULL);
+          unlink (filename);
+          g_free (filename);
+        }
+    }
+
+  g_free (prefix);
+  g_dir_close (d);
+  g_free (dir);
+}
+
+
+/*
+ * Client side
+ */
+
+GConfValueCache*
+gconf_value_cache_open (const gchar *filename)
+{
+  GConfValueCache *cache;
+  struct stat st;
+  gchar *basename;
+  gchar *prefix;
+  gboolean same_host;
+  int pid = 0;
+  int fd;
+
+  /* A mapping is only coherent on the host that writes it, and a
+   * daemon dir in an NFS home is visible from everywhere.
+   */
+  basename = g_path_get_basename (filename);
+  prefix = g_strdup_printf (FILENAME_PREFIX "%s-", g_get_host_name ());
+  same_host = g_str_has_prefix (basename, prefix);
+  if (same_host)
+    pid = atoi (basename + strlen (prefix));
+  g_free (prefix);
+  g_free (basename);
+
+  if (!same_host || pid <= 0)
+    return NULL;
+
+  fd = open (filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  cache = g_new0 (GConfValueCache, 1);
+  cache->size = cache_size ();
+
+  if (fstat (fd, &st) < 0 || (gsize) st.st_size != cache->size ||
+      !cache_map (cache, fd, FALSE))
+    {
+      close (fd);
+      g_free (cache);
+      return NULL;
+    }
+
+  if (g_atomic_int_get ((gint *) &cache->header->magic) != CACHE_MAGIC ||
+      cache->header->version != CACHE_VERSION ||
+      cache->header->n_slots != N_SLOTS ||
+      cache->header->slot_size != SLOT_SIZE)
+    {
+      munmap (cache->header, cache->size);
+      close (fd);
+      g_free (cache);
+      return NULL;
+    }
+
+  cache->filename = g_strdup (filename);
+  cache->fd = fd;
+  cache->pid = pid;
+
+  return cache;
+}
+
+void
+gconf_value_cache_close (GConfValueCache *cache)
+{
+  munmap (cache->header, cache->size);
+  close (cache->fd);
+  g_free (cache->filename);
+  g_free (cache);
+}
+
+gboolean
+gconf_value_cache_is_retired (GConfValueCache *cache)
+{
+  struct stat st;
+
+  if (g_atomic_int_get (&cache->header->retired) != 0)
+    return TRUE;
+
+  /* A daemon that crashed never set retired; check that it still
+   * runs, and since its pid may be reused, that no new daemon has
+   * removed its file.
+   */
+  if (kill (cache->pid, 0) < 0 && errno == ESRCH)
+    return TRUE;
+
+  return fstat (cache->fd, &st) < 0 || st.st_nlink == 0;
+}
+
+gboolean
+gconf_value_cache_lookup (GConfValueCache  *cache,
+                          const gchar      *key,
+                          GConfValue      **value,
+                          gboolean         *is_writable,
+                          gchar           **schema_name)
+{
+  guint32 hash;
+  gsize key_len;
+  guint i;
+
+  if (g_atomic_int_get (&cache->header->retired) != 0)
+    return FALSE;
+
+  key_len = strlen (key);
+  if (key_len > SLOT_DATA_SIZE)
+    return FALSE;
+
+  hash = cache_hash (key);
+
+  for (i = 0; i < MAX_PROBES; i++)
+    {
+      CacheSlot *slot = &cache->slots[(hash + i) & (N_SLOTS - 1)];
+      CacheSlot copy;
+      gchar *encoded;
+      GConfValue *val;
+      gint seq;
+
+      seq = g_atomic_int_get (&slot->seq);
+      if (seq & 1)
+        continue;
+
+      if (slot->hash != hash || slot->key_len != key_len)
+        continue;
+
+      memcpy (&copy, slot, sizeof (CacheSlot));
+
+      /* The daemon got in; whatever we copied may be torn */
+      if (g_atomic_int_get (&slot->seq) != seq)
+        return FALSE;
+
+      if (copy.key_len + copy.schema_len + copy.value_len > SLOT_DATA_SIZE ||
+          memcmp (copy.data, key, key_len) != 0)
+        continue;
+
+      encoded = g_strndup (copy.data + copy.key_len + copy.schema_len,
+                           copy.value_len);
+      val = gconf_value_decode (encoded);
+      g_free (encoded);
+
+      if (val == NULL)
+        return FALSE;
+
+      *value = val;
+
+      if (is_writable)
+        *is_writable = copy.is_writable;
+
+      if (schema_name)
+        *schema_name = copy.has_schema ?
+          g_strndup (copy.data + copy.key_len, copy.schema_len) : NULL;
+
+      return TRUE;
+    }
+
+  return FALSE;
+}
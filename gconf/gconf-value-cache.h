@@ -0,0 +1,73 @@
+/* GConf
+ * Copyright (C) 1999, 2000 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef GCONF_GCONF_VALUE_CACHE_H
+#define GCONF_GCONF_VALUE_CACHE_H
+
+#include <glib.h>
+#include "gconf-value.h"
+
+G_BEGIN_DECLS
+
+/*
+ * A read-only snapshot of hot keys that gconfd publishes in a
+ * memory-mapped file, so clients on the same host can read those
+ * values without a round trip. Each slot is guarded by a sequence
+ * counter that gconfd keeps odd while rewriting the slot; readers
+ * treat a torn read as a miss and ask the daemon. Only values set
+ * explicitly (not schema defaults), and not schemas themselves, are
+ * published, so the locale never matters.
+ */
+typedef struct _GConfValueCache GConfValueCache;
+
+/* Daemon side. */
+GConfValueCache* gconf_value_cache_create  (GError          **err);
+const gchar*     gconf_value_cache_get_filename (GConfValueCache *cache);
+void             gconf_value_cache_publish (GConfValueCache  *cache,
+                                            const gchar      *key,
+                                            const GConfValue *value,
+                                            gboolean          is_writable,
+                                            const gchar      *schema_name);
+void             gconf_value_cache_remove  (GConfValueCache  *cache,
+                                            const gchar      *key);
+gboolean         gconf_value_cache_contains (GConfValueCache *cache,
+                                             const gchar     *key);
+void             gconf_value_cache_clear   (GConfValueCache  *cache);
+/* Tells readers the snapshot is dead, removes the file and frees cache */
+void             gconf_value_cache_retire  (GConfValueCache  *cache);
+/* Removes files left behind by daemons on this host that died */
+void             gconf_value_cache_remove_stale (void);
+
+/* Client side. */
+GConfValueCache* gconf_value_cache_open    (const gchar      *filename);
+void             gconf_value_cache_close   (GConfValueCache  *cache);
+/* Also TRUE once the daemon that wrote the file is known to be gone;
+ * check it before each lookup
+ */
+gboolean         gconf_value_cache_is_retired (GConfValueCache *cache);
+/* TRUE on a hit; schema_name may be NULL if the caller doesn't care */
+gboolean         gconf_value_cache_lookup  (GConfValueCache  *cache,
+                                            const gchar      *key,
+                                            GConfValue      **value,
+                                            gboolean         *is_writable,
+                                            gchar           **schema_name);
+
+G_END_DECLS
+
+#endif
@@ -28,6 +28,9 @@
 
 typedef struct {
   GConfValueType type;
+  gint refcount;
+  /* Shared by all copies of a string value, NULL while unshared */
+  gint *string_refs;
   union {
     gchar* string_data;
     gint int_data;
@@ -47,6 +50,197 @@ typedef struct {
 
 #define REAL_VALUE(x) ((GConfRealValue*)(x))
 
+/* Values handed out with gconf_value_ref() are read-only */
+#define VALUE_IS_SHARED(x) (REAL_VALUE (x)->refcount > 1)
+
+typedef struct {
+  char *key;
+  GConfValue *value;
+  char *schema_name;
+  int refcount;
+  guint is_default : 1;
+  guint is_writable : 1;
+} GConfRealEntry;
+
+#define REAL_ENTRY(x) ((GConfRealEntry*)(x))
+
+/*
+ * Allocation
+ *
+ * Values and entries are created and thrown away all the time (every
+ * GConfClient cache hit hands out fresh copies), so each thread keeps a
+ * small magazine of free blocks in front of g_slice.
+ */
+
+#define MAGAZINE_SIZE 64
+
+typedef struct {
+  gpointer blocks[MAGAZINE_SIZE];
+  guint    n_blocks;
+} Magazine;
+
+typedef struct {
+  Magazine values;
+  Magazine entries;
+} Magazines;
+
+static void
+magazines_free (gpointer data)
+{
+  Magazines *mags = data;
+  guint i;
+
+  for (i = 0; i < mags->values.n_blocks; i++)
+    g_slice_free1 (sizeof (GConfRealValue), mags->values.blocks[i]);
+
+  for (i = 0; i < mags->entries.n_blocks; i++)
+    g_slice_free1 (sizeof (GConfRealEntry), mags->entries.blocks[i]);
+
+  g_free (mags);
+}
+
+static GPrivate magazines_key = G_PRIVATE_INIT (magazines_free);
+
+static volatile gint n_live_values = 0;
+static volatile gint n_live_entries = 0;
+
+static Magazines*
+get_magazines (void)
+{
+  Magazines *mags;
+
+  mags = g_private_get (&magazines_key);
+  if (G_UNLIKELY (mags == NULL))
+    {
+      mags = g_new0 (Magazines, 1);
+      g_private_set (&magazines_key, mags);
+    }
+
+  return mags;
+}
+
+static inline gpointer
+magazine_pop (Magazine *mag,
+              gsize     block_size)
+{
+  if (mag->n_blocks > 0)
+    return mag->blocks[--mag->n_blocks];
+  else
+    return g_slice_alloc (block_size);
+}
+
+static inline void
+magazine_push (Magazine *mag,
+               gsize     block_size,
+               gpointer  block)
+{
+  if (mag->n_blocks < MAGAZINE_SIZE)
+    mag->blocks[mag->n_blocks++] = block;
+  else
+    g_slice_free1 (block_size, block);
+}
+
+static GConfRealValue*
+real_value_alloc (void)
+{
+  GConfRealValue *real;
+
+  real = magazine_pop (&get_magazines ()->values, sizeof (GConfRealValue));
+  memset (real, 0, sizeof (GConfRealValue));
+  g_atomic_int_inc (&n_live_values);
+
+  return real;
+}
+
+static void
+real_value_free (GConfRealValue *real)
+{
+  magazine_push (&get_magazines ()->values, sizeof (GConfRealValue), real);
+  g_atomic_int_add (&n_live_values, -1);
+}
+
+static GConfRealEntry*
+real_entry_alloc (void)
+{
+  GConfRealEntry *real;
+
+  real = magazine_pop (&get_magazines ()->entries, sizeof (GConfRealEntry));
+  g_atomic_int_inc (&n_live_entries);
+
+  return real;
+}
+
+static void
+real_entry_free (GConfRealEntry *real)
+{
+  magazine_push (&get_magazines ()->entries, sizeof (GConfRealEntry), real);
+  g_atomic_int_add (&n_live_entries, -1);
+}
+
+void
+gconf_value_get_alloc_stats (GConfAllocStats *stats)
+{
+  g_return_if_fail (stats != NULL);
+
+  stats->live_values = g_atomic_int_get (&n_live_values);
+  stats->live_entries = g_atomic_int_get (&n_live_entries);
+  stats->live_bytes =
+    stats->live_values * sizeof (GConfRealValue) +
+    stats->live_entries * sizeof (GConfRealEntry);
+}
+
+gsize
+gconf_value_get_size (const GConfValue *value)
+{
+  gsize size = sizeof (GConfRealValue);
+  GSList *tmp;
+
+  g_return_val_if_fail (value != NULL, 0);
+
+  switch (value->type)
+    {
+    case GCONF_VALUE_STRING:
+      size += strlen (gconf_value_get_string (value)) + 1;
+      break;
+
+    case GCONF_VALUE_LIST:
+      for (tmp = gconf_value_get_list (value); tmp != NULL; tmp = tmp->next)
+        size += sizeof (GSList) + gconf_value_get_size (tmp->data);
+      break;
+
+    case GCONF_VALUE_PAIR:
+      if (gconf_value_get_car (value))
+        size += gconf_value_get_size (gconf_value_get_car (value));
+      if (gconf_value_get_cdr (value))
+        size += gconf_value_get_size (gconf_value_get_cdr (value));
+      break;
+
+    case GCONF_VALUE_SCHEMA:
+      {
+        GConfSchema *schema = gconf_value_get_schema (value);
+        const char *s;
+
+        size += 8 * sizeof (gpointer);
+        if ((s = gconf_schema_get_locale (schema)))
+          size += strlen (s) + 1;
+        if ((s = gconf_schema_get_short_desc (schema)))
+          size += strlen (s) + 1;
+        if ((s = gconf_schema_get_long_desc (schema)))
+          size += strlen (s) + 1;
+        if ((s = gconf_schema_get_owner (schema)))
+          size += strlen (s) + 1;
+        if (gconf_schema_get_default_value (schema))
+          size += gconf_value_get_size (gconf_schema_get_default_value (schema));
+      }
+      break;
+
+    default:
+      break;
+    }
+
+  return size;
+}
+
 static void
 set_string(gchar** dest, const gchar* src)
 {
@@ -54,6 +248,70 @@ set_string(gchar** dest, const gchar* src)
   *dest = g_strdup(src);
 }
 
+/* Copies of a string value share its string_data; the first copy
+ * hangs a refcount off the source, and whoever changes or steals the
+ * string later takes a private copy of it.
+ */
+static gint*
+value_share_string (GConfRealValue *real)
+{
+  gint *refs;
+
+  refs = g_atomic_pointer_get (&real->string_refs);
+  if (refs == NULL)
+    {
+      refs = g_new (gint, 1);
+      *refs = 1;
+
+      /* Someone copying the same value from another thread may beat us */
+      if (!g_atomic_pointer_compare_and_exchange (&real->string_refs,
+                                                  NULL, refs))
+        {
+          g_free (refs);
+          refs = g_atomic_pointer_get (&real->string_refs);
+        }
+    }
+
+  g_atomic_int_inc (refs);
+
+  return refs;
+}
+
+static void
+value_release_string (GConfRealValue *real)
+{
+  if (real->string_refs == NULL)
+    g_free (real->d.string_data);
+  else if (g_atomic_int_dec_and_test (real->string_refs))
+    {
+      g_free (real->d.string_data);
+      g_free (real->string_refs);
+    }
+
+  real->d.string_data = NULL;
+  real->string_refs = NULL;
+}
+
+static void
+value_unshare_string (GConfRealValue *real)
+{
+  char *copy;
+
+  if (real->string_refs == NULL)
+    return;
+
+  if (g_atomic_int_get (real->string_refs) == 1)
+    {
+      g_free (real->string_refs);
+      real->string_refs = NULL;
+      return;
+    }
+
+  copy = g_strdup (real->d.string_data);
+  value_release_string (real);
+  real->d.string_data = copy;
+}
+
 /*
  * Values
  */
@@ -72,11 +330,12 @@ gconf_value_new(GConfValueType type)
       initted = TRUE;
     }
   
-  value = (GConfValue*) g_slice_new0 (GConfRealValue);
+  value = (GConfValue*) real_value_alloc ();
 
   value->type = type;
+  REAL_VALUE (value)->refcount = 1;
 
-  /* the g_new0() is important: sets list type to invalid, NULLs all
+  /* the zero-fill is important: sets list type to invalid, NULLs all
    * pointers
    */
   
@@ -742,7 +1001,11 @@ gconf_value_copy (const GConfValue* src)
       dest->d = real->d;
       break;
     case GCONF_VALUE_STRING:
-      set_string(&dest->d.string_data, real->d.string_data);
+      if (real->d.string_data != NULL)
+        {
+          dest->string_refs = value_share_string (real);
+          dest->d.string_data = real->d.string_data;
+        }
       break;
     case GCONF_VALUE_SCHEMA:
       if (real->d.schema_data)
@@ -815,11 +1078,16 @@ gconf_value_free(GConfValue* value)
   g_return_if_fail(value != NULL);
 
   real = REAL_VALUE (value);
+
+  g_return_if_fail (real->refcount > 0);
+
+  if (!g_atomic_int_dec_and_test (&real->refcount))
+    return;
   
   switch (real->type)
     {
     case GCONF_VALUE_STRING:
-      g_free(real->d.string_data);
+      value_release_string (real);
       break;
     case GCONF_VALUE_SCHEMA:
       if (real->d.schema_data != NULL)
@@ -839,7 +1107,42 @@ gconf_value_free(GConfValue* value)
       break;
     }
   
-  g_slice_free(GConfRealValue, real);
+  real_value_free (real);
+}
+
+/**
+ * gconf_value_ref:
+ * @value: a #GConfValue.
+ *
+ * Adds a reference to @value, letting several owners share one
+ * instance.  A value with more than one reference is read-only; use
+ * gconf_value_copy() (which is cheap) to get one you can modify.
+ * Release the reference with gconf_value_unref() or gconf_value_free().
+ *
+ * Return value: @value.
+ */
+GConfValue*
+gconf_value_ref (GConfValue *value)
+{
+  g_return_val_if_fail (value != NULL, NULL);
+  g_return_val_if_fail (REAL_VALUE (value)->refcount > 0, NULL);
+
+  g_atomic_int_inc (&REAL_VALUE (value)->refcount);
+
+  return value;
+}
+
+/**
+ * gconf_value_unref:
+ * @value: a #GConfValue.
+ *
+ * Drops a reference to @value, freeing it when the last one goes away.
+ * Same as gconf_value_free().
+ */
+void
+gconf_value_unref (GConfValue *value)
+{
+  gconf_value_free (value);
 }
 
 const char*
@@ -862,6 +1165,8 @@ gconf_value_steal_string (GConfValue *value)
 
   real = REAL_VALUE (value);
 
+  value_unshare_string (real);
+
   string = real->d.string_data;
   real->d.string_data = NULL;
 
@@ -991,6 +1296,7 @@ gconf_value_set_int(GConfValue* value, gint the_int)
 {
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_INT);
+  g_return_if_fail(!VALUE_IS_SHARED (value));
 
   REAL_VALUE (value)->d.int_data = the_int;
 }
@@ -1010,10 +1316,11 @@ gconf_value_set_string_nocopy (GConfValue *value,
 
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_STRING);
+  g_return_if_fail(!VALUE_IS_SHARED (value));
 
   real = REAL_VALUE (value);
 
-  g_free (real->d.string_data);
+  value_release_string (real);
   real->d.string_data = str;
 }
 
@@ -1022,6 +1329,7 @@ gconf_value_set_float(GConfValue* value, gdouble the_float)
 {
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_FLOAT);
+  g_return_if_fail(!VALUE_IS_SHARED (value));
 
   REAL_VALUE (value)->d.float_data = the_float;
 }
@@ -1031,6 +1339,7 @@ gconf_value_set_bool(GConfValue* value, gboolean the_bool)
 {
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_BOOL);
+  g_return_if_fail(!VALUE_IS_SHARED (value));
 
   REAL_VALUE (value)->d.bool_data = the_bool;
 }
@@ -1042,6 +1351,7 @@ gconf_value_set_schema(GConfValue* value, const GConfSchema* sc)
   
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_SCHEMA);
+  g_return_if_fail(!VALUE_IS_SHARED (value));
 
   real = REAL_VALUE (value);
   
@@ -1058,6 +1368,7 @@ gconf_value_set_schema_nocopy(GConfValue* value, GConfSchema* sc)
   
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_SCHEMA);
+  g_return_if_fail(!VALUE_IS_SHARED (value));
   g_return_if_fail(sc != NULL);
 
   real = REAL_VALUE (value);
@@ -1081,6 +1392,7 @@ gconf_value_set_car_nocopy(GConfValue* value, GConfValue* car)
   
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_PAIR);
+  g_return_if_fail(!VALUE_IS_SHARED (value));
 
   real = REAL_VALUE (value);
   
@@ -1103,6 +1415,7 @@ gconf_value_set_cdr_nocopy(GConfValue* value, GConfValue* cdr)
   
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_PAIR);
+  g_return_if_fail(!VALUE_IS_SHARED (value));
 
   real = REAL_VALUE (value);
   
@@ -1120,6 +1433,7 @@ gconf_value_set_list_type (GConfValue    *value,
   
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_LIST);
+  g_return_if_fail(!VALUE_IS_SHARED (value));
   g_return_if_fail(type != GCONF_VALUE_LIST);
   g_return_if_fail(type != GCONF_VALUE_PAIR);
 
@@ -1142,6 +1456,7 @@ gconf_value_set_list_nocopy (GConfValue* value,
   
   g_return_if_fail (value != NULL);
   g_return_if_fail (value->type == GCONF_VALUE_LIST);
+  g_return_if_fail (!VALUE_IS_SHARED (value));
 
   real = REAL_VALUE (value);
   
@@ -1161,6 +1476,7 @@ gconf_value_set_list       (GConfValue* value,
   
   g_return_if_fail (value != NULL);
   g_return_if_fail (value->type == GCONF_VALUE_LIST);
+  g_return_if_fail (!VALUE_IS_SHARED (value));
 
   real = REAL_VALUE (value);
 
@@ -1452,17 +1768,6 @@ gconf_meta_info_set_mod_time(GConfMetaInfo* gcmi,
  * GConfEntry
  */
 
-typedef struct {
-  char *key;
-  GConfValue *value;
-  char *schema_name;
-  int refcount;
-  guint is_default : 1;
-  guint is_writable : 1;
-} GConfRealEntry;
-
-#define REAL_ENTRY(x) ((GConfRealEntry*)(x))
-
 GType
 gconf_entry_get_type ()
 {
@@ -1489,7 +1794,7 @@ gconf_entry_new_nocopy (char* key, GConfValue* val)
 {
   GConfRealEntry* real;
 
-  real = g_slice_new (GConfRealEntry);
+  real = real_entry_alloc ();
 
   real->key   = key;
   real->value = val;
@@ -1529,7 +1834,7 @@ gconf_entry_unref (GConfEntry *entry)
       if (real->value)
         gconf_value_free (real->value);
       g_free (real->schema_name);
-      g_slice_free (GConfRealEntry, real);
+      real_entry_free (real);
     }
 }
 
@@ -80,6 +80,8 @@ GConfValue* gconf_value_new_from_string      (GConfValueType type,
 GType       gconf_value_get_type             (void) G_GNUC_CONST;
 GConfValue* gconf_value_copy                 (const GConfValue* src);
 void        gconf_value_free                 (GConfValue* value);
+GConfValue* gconf_value_ref                  (GConfValue* value);
+void        gconf_value_unref                (GConfValue* value);
 
 void        gconf_value_set_int              (GConfValue* value,
                                               gint the_int);
@@ -23,6 +23,7 @@
 
 #include "gconf.h"
 #include "gconf-internals.h"
+#include "gconf-changeset.h"
 #include "gconf-sources.h"
 #include "gconf-locale.h"
 #include <string.h>
@@ -443,7 +444,7 @@ gconf_engine_get_database (GConfEngine *conf,
     return conf->database;
 }
 
-static gboolean
+gboolean
 gconf_engine_is_local(GConfEngine* conf)
 {
   return conf->is_local;
@@ -1185,6 +1186,167 @@ gconf_engine_get_entry(GConfEngine* conf,
 
   return entry;
 }
+
+/**
+ * gconf_engine_get_many:
+ * @conf: a #GConfEngine.
+ * @keys: (element-type utf8): list of keys to look up.
+ * @err: the return location for an allocated #GError, or <symbol>NULL</symbol> to ignore errors.
+ *
+ * Looks up all of @keys at once, as with gconf_engine_get_entry() in
+ * the current locale and including schema defaults.  With gconfd this
+ * takes a single round trip, which is much cheaper than a get per key
+ * when an application reads its settings on startup.
+ *
+ * Return value: (element-type GConfEntry) (transfer full): a list with
+ * one #GConfEntry per key, in the order of @keys; the entry's value is
+ * <symbol>NULL</symbol> if the key is unset.
+ */
+GSList*
+gconf_engine_get_many (GConfEngine *conf,
+                       GSList      *keys,
+                       GError     **err)
+{
+  GSList *entries;
+  GSList *tmp;
+
+  g_return_val_if_fail (conf != NULL, NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  /* gconfd never implemented ConfigDatabase::batch_lookup, so over
+   * CORBA this is still one request per key.
+   */
+  entries = NULL;
+  for (tmp = keys; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry;
+      GError *error = NULL;
+
+      if (!gconf_key_check (tmp->data, &error))
+        entry = NULL;
+      else
+        entry = gconf_engine_get_entry (conf, tmp->data, NULL, TRUE, &error);
+
+      if (error != NULL)
+        {
+          g_propagate_error (err, error);
+          g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+          g_slist_free (entries);
+          return NULL;
+        }
+
+      entries = g_slist_prepend (entries, entry);
+    }
+
+  return g_slist_reverse (entries);
+}
+
+/* ConfigDatabase::batch_change can't say which keys failed, so change
+ * sets are still committed key by key over CORBA.
+ */
+gboolean
+gconf_engine_commit_change_set_at_once (GConfEngine     *conf,
+                                        GConfChangeSet  *cs,
+                                        GSList         **failed_keys,
+                                        GError         **err)
+{
+  *failed_keys = NULL;
+
+  return FALSE;
+}
+
+/* There are no asynchronous calls over CORBA; these answer right away
+ * and let GTask deliver the result from the main loop.
+ */
+void
+gconf_engine_get_entry_async (GConfEngine         *conf,
+                              const gchar         *key,
+                              gboolean             use_schema_default,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data)
+{
+  GTask *task;
+  GConfEntry *entry;
+  GError *error = NULL;
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  g_task_set_source_tag (task, gconf_engine_get_entry_async);
+
+  entry = gconf_engine_get_entry (conf, key, NULL, use_schema_default, &error);
+
+  if (error != NULL)
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, entry, (GDestroyNotify) gconf_entry_free);
+
+  g_object_unref (task);
+}
+
+void
+gconf_engine_set_async (GConfEngine         *conf,
+                        const gchar         *key,
+                        const GConfValue    *value,
+                        GAsyncReadyCallback  callback,
+                        gpointer             user_data)
+{
+  GTask *task;
+  GError *error = NULL;
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  g_task_set_source_tag (task, gconf_engine_set_async);
+
+  if (gconf_engine_set (conf, key, value, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+
+  g_object_unref (task);
+}
+
+void
+gconf_engine_unset_async (GConfEngine         *conf,
+                          const gchar         *key,
+                          GAsyncReadyCallback  callback,
+                          gpointer             user_data)
+{
+  GTask *task;
+  GError *error = NULL;
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  g_task_set_source_tag (task, gconf_engine_unset_async);
+
+  if (gconf_engine_unset (conf, key, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+
+  g_object_unref (task);
+}
+
+void
+gconf_engine_all_entries_async (GConfEngine         *conf,
+                                const gchar         *dir,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+  GTask *task;
+  GSList *entries;
+  GError *error = NULL;
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  g_task_set_source_tag (task, gconf_engine_all_entries_async);
+
+  entries = gconf_engine_all_entries (conf, dir, &error);
+
+  if (error != NULL)
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, entries, gconf_entry_list_free);
+
+  g_object_unref (task);
+}
      
 GConfValue*  
 gconf_engine_get (GConfEngine* conf, const gchar* key, GError** err)
@@ -1941,6 +2103,23 @@ gconf_engine_all_dirs(GConfEngine* conf, const gchar* dir, GError** err)
   return subdirs;
 }
 
+GSList*
+gconf_engine_all_entries_recursive (GConfEngine  *conf,
+                                    const gchar  *dir,
+                                    GSList      **subdirs,
+                                    GError      **err)
+{
+  g_return_val_if_fail (conf != NULL, NULL);
+  g_return_val_if_fail (dir != NULL, NULL);
+  g_return_val_if_fail (subdirs != NULL, NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  /* gconfd has no CORBA call for a whole tree */
+  return gconf_engine_all_entries_walk (conf, dir, subdirs, err);
+}
+
 /* annoyingly, this is REQUIRED for local sources */
 void 
 gconf_engine_suggest_sync(GConfEngine* conf, GError** err)
@@ -2644,6 +2823,124 @@ gconf_get_config_listener(void)
 }
 #endif /* HAVE_CORBA */
 
+GSList*
+gconf_engine_all_entries_walk (GConfEngine  *conf,
+                               const gchar  *dir,
+                               GSList      **subdirs,
+                               GError      **err)
+{
+  GSList *entries;
+  GSList *dirs;
+  GQueue pending = G_QUEUE_INIT;
+  gchar *current;
+
+  *subdirs = NULL;
+  entries = NULL;
+  dirs = NULL;
+
+  g_queue_push_tail (&pending, g_strdup (dir));
+
+  while ((current = g_queue_pop_head (&pending)) != NULL)
+    {
+      GSList *these, *children, *tmp;
+      GError *error = NULL;
+
+      these = gconf_engine_all_entries (conf, current, &error);
+      children = NULL;
+      if (error == NULL)
+        children = gconf_engine_all_dirs (conf, current, &error);
+
+      g_free (current);
+
+      if (error != NULL)
+        {
+          g_propagate_error (err, error);
+
+          gconf_entry_list_free (these);
+          g_queue_foreach (&pending, (GFunc) g_free, NULL);
+          g_queue_clear (&pending);
+          gconf_entry_list_free (entries);
+          g_slist_foreach (dirs, (GFunc) g_free, NULL);
+          g_slist_free (dirs);
+
+          return NULL;
+        }
+
+      entries = g_slist_concat (these, entries);
+
+      /* all_dirs hands back full names */
+      for (tmp = children; tmp != NULL; tmp = tmp->next)
+        {
+          dirs = g_slist_prepend (dirs, g_strdup (tmp->data));
+          g_queue_push_tail (&pending, tmp->data);
+        }
+      g_slist_free (children);
+    }
+
+  *subdirs = g_slist_reverse (dirs);
+
+  return entries;
+}
+
+/*
+ * Finishing asynchronous engine calls, shared by all engine kinds
+ */
+
+void
+gconf_entry_list_free (gpointer entries)
+{
+  g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+  g_slist_free (entries);
+}
+
+GConfEntry*
+gconf_engine_get_entry_finish (GConfEngine   *conf,
+                               GAsyncResult  *result,
+                               GError       **err)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) ==
+                        gconf_engine_get_entry_async, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), err);
+}
+
+gboolean
+gconf_engine_set_finish (GConfEngine   *conf,
+                         GAsyncResult  *result,
+                         GError       **err)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) ==
+                        gconf_engine_set_async, FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), err);
+}
+
+gboolean
+gconf_engine_unset_finish (GConfEngine   *conf,
+                           GAsyncResult  *result,
+                           GError       **err)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) ==
+                        gconf_engine_unset_async, FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), err);
+}
+
+GSList*
+gconf_engine_all_entries_finish (GConfEngine   *conf,
+                                 GAsyncResult  *result,
+                                 GError       **err)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) ==
+                        gconf_engine_all_entries_async, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), err);
+}
+
 void
 gconf_preinit (gpointer app, gpointer mod_info)
 {
@@ -63,6 +63,11 @@ GConfEntry* gconf_engine_get_entry                (GConfEngine  *conf,
                                                    gboolean      use_schema_default,
                                                    GError  **err);
 
+/* Returns one entry per key, in order */
+GSList*     gconf_engine_get_many                 (GConfEngine  *conf,
+                                                   GSList       *keys,
+                                                   GError  **err);
+
 
 /* Locale only matters if you are expecting to get a schema, or if you
    don't know what you are expecting and it might be a schema. Note
@@ -125,6 +125,8 @@ server_real_handle_get_db (DBusConnection *connection,
   DBusMessage   *reply;
   GError        *gerror = NULL;
   const gchar   *str;
+  const gchar   *value_cache;
+  dbus_uint32_t  protocol;
  
   if (gconfd_dbus_check_in_shutdown (connection, message))
     return;
@@ -138,9 +140,16 @@ server_real_handle_get_db (DBusConnection *connection,
   if (reply == NULL) 
       g_error ("No memory");
 
+  /* Older clients only read the path and ignore the rest */
   str = gconf_database_dbus_get_path (db);
+  protocol = GCONF_DBUS_PROTOCOL_VERSION;
+  value_cache = gconf_database_dbus_get_value_cache (db);
+  if (value_cache == NULL)
+    value_cache = "";
   dbus_message_append_args (reply,
 			    DBUS_TYPE_OBJECT_PATH, &str,
+			    DBUS_TYPE_UINT32, &protocol,
+			    DBUS_TYPE_STRING, &value_cache,
 			    DBUS_TYPE_INVALID);
   
   if (!dbus_connection_send (connection, reply, NULL)) 
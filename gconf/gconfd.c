@@ -29,6 +29,7 @@
 
 #include "gconf-internals.h"
 #include "gconf-sources.h"
+#include "gconf-backend.h"
 #include "gconf-listeners.h"
 #include "gconf-locale.h"
 #include "gconf-schema.h"
@@ -161,6 +162,9 @@ static GConfDatabase*       lookup_database (GSList *addresses);
 static void                 drop_old_databases (void);
 static gboolean             no_databases_in_use (void);
 
+static void                 forget_pending_changes_by (GConfDatabase *db);
+static void                 drop_pending_changes (void);
+
 /*
  * Flag indicating that we are shutting down, so return errors
  * on any attempted operation. We do this instead of unregistering with
@@ -1066,6 +1070,15 @@ periodic_cleanup_timeout(gpointer data)
     }
   
   gconf_log (GCL_DEBUG, "Performing periodic cleanup, expiring cache cruft");
+
+  if (gconf_log_debug_messages)
+    {
+      GConfAllocStats stats;
+
+      gconf_value_get_alloc_stats (&stats);
+      gconf_log (GCL_DEBUG, "%u values and %u entries live (%" G_GSIZE_FORMAT " bytes)",
+                 stats.live_values, stats.live_entries, stats.live_bytes);
+    }
   
 #ifdef HAVE_CORBA
   drop_old_clients ();
@@ -1170,6 +1183,10 @@ set_default_database (GConfDatabase* db)
   
   default_db = db;
 
+#ifdef HAVE_DBUS
+  gconf_database_dbus_publish_values (db);
+#endif
+
   register_database (db);
 }
 
@@ -1199,6 +1216,8 @@ unregister_database (GConfDatabase *db)
 
   db_list = g_list_remove (db_list, db);
 
+  forget_pending_changes_by (db);
+
   gconf_database_free (db);
 }
 
@@ -1316,6 +1335,8 @@ shutdown_databases (void)
    * so check that everything != NULL
    */
   
+  drop_pending_changes ();
+
   tmp_list = db_list;
 
   while (tmp_list)
@@ -1404,6 +1425,249 @@ no_databases_in_use (void)
   return FALSE;
 }
 
+/*
+ * Changes that other databases need to hear about are not looked up
+ * and sent right away; they are collected until the main loop is idle
+ * and then handled per modified source, so a bulk write costs one
+ * batched lookup and one round of notifications per affected database
+ * instead of one per key. What those databases have cached for the
+ * keys is dropped right away though, so nobody reads a stale value in
+ * the meantime.
+ */
+
+typedef struct _PendingChanges PendingChanges;
+
+struct _PendingChanges {
+  GConfBackend *backend;   /* the modified source, which may be */
+  gchar        *address;   /* gone by the time we get to it      */
+  GPtrArray    *keys;      /* in order of change, owned by modified_by */
+  GHashTable   *modified_by; /* key -> database that already notified
+                              * its own listeners, or NULL
+                              */
+};
+
+static GSList *pending_changes = NULL;
+static guint pending_changes_idle = 0;
+
+static void
+pending_changes_free (PendingChanges *changes)
+{
+  gconf_backend_unref (changes->backend);
+  g_free (changes->address);
+  g_ptr_array_free (changes->keys, TRUE);
+  g_hash_table_destroy (changes->modified_by);
+  g_free (changes);
+}
+
+static PendingChanges*
+lookup_pending_changes (GConfSource *source)
+{
+  PendingChanges *changes;
+  GSList *tmp;
+
+  for (tmp = pending_changes; tmp != NULL; tmp = tmp->next)
+    {
+      changes = tmp->data;
+
+      if (changes->backend == source->backend &&
+          strcmp (changes->address, source->address) == 0)
+        return changes;
+    }
+
+  changes = g_new0 (PendingChanges, 1);
+  changes->backend = source->backend;
+  gconf_backend_ref (changes->backend);
+  changes->address = g_strdup (source->address);
+  changes->keys = g_ptr_array_new ();
+  changes->modified_by = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, NULL);
+
+  pending_changes = g_slist_prepend (pending_changes, changes);
+
+  return changes;
+}
+
+static void
+notify_pending_changes (GConfDatabase  *db,
+                        PendingChanges *changes)
+{
+  const char **keys;
+  GSList *affected;
+  GSList *entries;
+  GSList *tmp;
+  GError *error;
+  guint n_keys;
+  guint i;
+
+  /* Leave out the keys db changed itself */
+  keys = g_new (const char *, changes->keys->len + 1);
+  n_keys = 0;
+  for (i = 0; i < changes->keys->len; i++)
+    {
+      const char *key = g_ptr_array_index (changes->keys, i);
+
+      if (g_hash_table_lookup (changes->modified_by, key) != db)
+        keys[n_keys++] = key;
+    }
+  keys[n_keys] = NULL;
+
+  affected = gconf_sources_affected_keys (db->sources,
+                                          changes->backend,
+                                          changes->address,
+                                          keys);
+  g_free (keys);
+
+  if (affected == NULL)
+    return;
+
+  n_keys = g_slist_length (affected);
+  keys = g_new (const char *, n_keys + 1);
+  for (tmp = affected, i = 0; tmp != NULL; tmp = tmp->next, i++)
+    keys[i] = tmp->data;
+  keys[n_keys] = NULL;
+  g_slist_free (affected);
+
+  error = NULL;
+  entries = gconf_database_query_entries (db, keys, NULL, TRUE, &error);
+  g_free (keys);
+
+  if (error != NULL)
+    {
+      gconf_log (GCL_WARNING,
+                 _("Error obtaining new values for changes in `%s': %s"),
+                 changes->address, error->message);
+      g_error_free (error);
+      return;
+    }
+
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry = tmp->data;
+#ifdef HAVE_CORBA
+      ConfigValue *cvalue;
+
+      if (entry->value != NULL)
+        cvalue = gconf_corba_value_from_gconf_value (entry->value);
+      else
+        cvalue = gconf_invalid_corba_value ();
+
+      gconf_database_notify_listeners (db,
+                                       NULL,
+                                       entry->key,
+                                       cvalue,
+                                       gconf_entry_get_is_default (entry),
+                                       gconf_entry_get_is_writable (entry),
+                                       FALSE);
+      CORBA_free (cvalue);
+#endif
+#ifdef HAVE_DBUS
+      gconf_database_dbus_notify_listeners (db,
+                                            NULL,
+                                            entry->key,
+                                            entry->value,
+                                            gconf_entry_get_is_default (entry),
+                                            gconf_entry_get_is_writable (entry),
+                                            FALSE);
+#endif
+
+      gconf_entry_free (entry);
+    }
+
+  g_slist_free (entries);
+}
+
+static gboolean
+flush_pending_changes (gpointer data)
+{
+  GSList *changes;
+  GSList *tmp;
+
+  pending_changes_idle = 0;
+
+  /* Notifications may queue more changes; those get the next idle */
+  changes = g_slist_reverse (pending_changes);
+  pending_changes = NULL;
+
+  for (tmp = changes; tmp != NULL; tmp = tmp->next)
+    {
+      GList *tmp2;
+
+      for (tmp2 = db_list; tmp2 != NULL; tmp2 = tmp2->next)
+        notify_pending_changes (tmp2->data, tmp->data);
+
+      pending_changes_free (tmp->data);
+    }
+
+  g_slist_free (changes);
+
+  return FALSE;
+}
+
+static void
+forget_pending_changes_by (GConfDatabase *db)
+{
+  GSList *tmp;
+
+  /* Don't let a new database at the same address miss out */
+  for (tmp = pending_changes; tmp != NULL; tmp = tmp->next)
+    {
+      PendingChanges *changes = tmp->data;
+      GHashTableIter iter;
+      gpointer value;
+
+      g_hash_table_iter_init (&iter, changes->modified_by);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          if (value == db)
+            g_hash_table_iter_replace (&iter, NULL);
+        }
+    }
+}
+
+static void
+drop_pending_changes (void)
+{
+  if (pending_changes_idle != 0)
+    {
+      g_source_remove (pending_changes_idle);
+      pending_changes_idle = 0;
+    }
+
+  g_slist_foreach (pending_changes, (GFunc) pending_changes_free, NULL);
+  g_slist_free (pending_changes);
+  pending_changes = NULL;
+}
+
+static void
+invalidate_other_databases (GConfDatabase *modified_db,
+                            GConfSources  *modified_sources,
+                            const char    *key)
+{
+  GList *tmp;
+
+  for (tmp = db_list; tmp != NULL; tmp = tmp->next)
+    {
+      GConfDatabase *db = tmp->data;
+      GList *tmp2;
+
+      /* The write itself took care of those */
+      if (db == modified_db || db->sources == modified_sources)
+        continue;
+
+      /* It changed behind db's back */
+      for (tmp2 = modified_sources->sources; tmp2 != NULL; tmp2 = tmp2->next)
+        {
+          if (gconf_sources_invalidate_from (db->sources, tmp2->data, key))
+            {
+#ifdef HAVE_DBUS
+              gconf_database_dbus_forget_value (db, key);
+#endif
+              break;
+            }
+        }
+    }
+}
+
 void
 gconfd_notify_other_listeners (GConfDatabase *modified_db,
 			       GConfSources  *modified_sources,
@@ -1413,86 +1677,36 @@ gconfd_notify_other_listeners (GConfDatabase *modified_db,
 
   if (!modified_sources)
     return;
-  
-  tmp = db_list;
+
+  invalidate_other_databases (modified_db, modified_sources, key);
+
+  tmp = modified_sources->sources;
   while (tmp != NULL)
     {
-      GConfDatabase *db = tmp->data;
+      PendingChanges *changes;
+      gpointer modified_by;
 
-      if (db != modified_db)
-	{
-	  GList *tmp2;
-
-	  tmp2 = modified_sources->sources;
-	  while (tmp2)
-	    {
-	      GConfSource *modified_source = tmp2->data;
+      changes = lookup_pending_changes (tmp->data);
 
-	      if (gconf_sources_is_affected (db->sources, modified_source, key))
-		{
-		  GConfValue  *value;
-#ifdef HAVE_CORBA
-		  ConfigValue *cvalue;
-#endif
-		  GError      *error;
-		  gboolean     is_default;
-		  gboolean     is_writable;
-
-		  error = NULL;
-		  value = gconf_database_query_value (db,
-						      key,
-						      NULL,
-						      TRUE,
-						      NULL,
-						      &is_default,
-						      &is_writable,
-						      &error);
-		  if (error != NULL)
-		    {
-		      gconf_log (GCL_WARNING,
-				 _("Error obtaining new value for `%s': %s"),
-				 key, error->message);
-		      g_error_free (error);
-		      return;
-		    }
-
-#if HAVE_CORBA
-		  if (value != NULL)
-		    {
-		      cvalue = gconf_corba_value_from_gconf_value (value);
-		      gconf_value_free (value);
-		    }
-		  else
-		    {
-		      cvalue = gconf_invalid_corba_value ();
-		    }
-
-		  gconf_database_notify_listeners (db,
-						   NULL,
-						   key,
-						   cvalue,
-						   is_default,
-						   is_writable,
-						   FALSE);
-		  CORBA_free (cvalue);
-#endif
-#ifdef HAVE_DBUS
-		  gconf_database_dbus_notify_listeners (db,
-							NULL,
-							key,
-							value,
-							is_default,
-							is_writable,
-							FALSE);
-#endif
-		}
+      if (!g_hash_table_lookup_extended (changes->modified_by, key,
+                                         NULL, &modified_by))
+        {
+          char *copy = g_strdup (key);
 
-	      tmp2 = tmp2->next;
-	    }
-	}
+          g_ptr_array_add (changes->keys, copy);
+          g_hash_table_insert (changes->modified_by, copy, modified_db);
+        }
+      else if (modified_by != modified_db)
+        {
+          /* Changed through two databases, they all get to hear it */
+          g_hash_table_insert (changes->modified_by, g_strdup (key), NULL);
+        }
 
       tmp = tmp->next;
     }
+
+  if (pending_changes_idle == 0)
+    pending_changes_idle = g_idle_add (flush_pending_changes, NULL);
 }
 
 void
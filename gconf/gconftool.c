@@ -25,6 +25,7 @@
 #include <string.h>
 #include <libxml/tree.h>
 #include <libxml/parser.h>
+#include <libxml/xmlreader.h>
 #include <libxml/globals.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -556,6 +557,8 @@ static int do_recursive_unset (GConfEngine* conf, const gchar** args);
 static int do_all_subdirs(GConfEngine* conf, const gchar** args);
 static int do_load_file(GConfEngine* conf, LoadType load_type, gboolean unload, const gchar* file, const gchar** base_dirs);
 static int do_sync(GConfEngine* conf);
+static int do_bulk_install(GConfEngine* conf, const gchar** files,
+                           gboolean all_or_nothing);
 static int do_short_docs (GConfEngine *conf, const gchar **args);
 static int do_long_docs (GConfEngine *conf, const gchar **args);
 static int do_get_schema_name (GConfEngine *conf, const gchar **args);
@@ -987,6 +990,28 @@ main (int argc, char** argv)
     {
       gint retval;
 
+      if (args != NULL)
+        {
+          GPtrArray* files;
+          const gchar** tmp;
+
+          /* Any further arguments are schema files too; install them
+           * all in one go.
+           */
+          files = g_ptr_array_new();
+          g_ptr_array_add(files, schema_file);
+          for (tmp = args; *tmp != NULL; tmp++)
+            g_ptr_array_add(files, (gpointer) *tmp);
+          g_ptr_array_add(files, NULL);
+
+          retval = do_bulk_install(conf, (const gchar**) files->pdata, TRUE);
+
+          g_ptr_array_free(files, TRUE);
+          gconf_engine_unref(conf);
+
+          return retval;
+        }
+
       retval = do_load_file(conf, LOAD_SCHEMA_FILE, FALSE, schema_file, NULL);
       if (!retval)
 	retval = do_sync(conf);
@@ -1470,6 +1495,37 @@ do_search_key_regex(GConfEngine* conf, const gchar** args)
   return 0;
 }
 
+/* Number of directories dumped, or entries loaded, between two
+ * releases of the local sources' cache. Without them a --direct dump
+ * or load would end up with the whole database in memory.
+ */
+#define DUMP_BATCH_DIRS    64
+#define LOAD_BATCH_ENTRIES 1024
+
+static guint n_dumped_dirs = 0;
+
+/* Drops whatever a local engine holds on to; a no-op for gconfd */
+static void
+release_cached_dirs(GConfEngine* conf)
+{
+  GError* err = NULL;
+
+  /* For gconfd this would be a full sync of the server each batch */
+  if (!gconf_engine_is_local(conf))
+    return;
+
+  gconf_synchronous_sync(conf, &err);
+  if (err != NULL)
+    {
+      g_printerr (_("Error syncing configuration data: %s"),
+		  err->message);
+      g_error_free(err);
+      return;
+    }
+
+  gconf_clear_cache(conf, NULL);
+}
+
 static void 
 recurse_subdir_dump(GConfEngine* conf, GSList* dirs, const gchar* base_dir)
 {
@@ -1484,6 +1540,9 @@ recurse_subdir_dump(GConfEngine* conf, GSList* dirs, const gchar* base_dir)
       
       dump_entries_in_dir(conf, s, base_dir);
 
+      if (++n_dumped_dirs % DUMP_BATCH_DIRS == 0)
+        release_cached_dirs(conf);
+
       subdirs = g_slist_sort(gconf_engine_all_dirs(conf, s, NULL),
 			     (GCompareFunc)strcmp);
 
@@ -3717,6 +3776,27 @@ process_locale_info(xmlNodePtr node, SchemaInfo* info)
   return 0;
 }
 
+static void
+associate_key(GConfEngine* conf, gboolean unload, const gchar* schema_name, const gchar* key)
+{
+  GError* error = NULL;
+
+  if (!gconf_engine_associate_schema(conf, key, !unload ? schema_name : NULL, &error))
+    {
+      g_assert(error != NULL);
+
+      g_printerr (_("WARNING: failed to associate schema `%s' with key `%s': %s\n"),
+                  schema_name, key, error->message);
+      g_error_free(error);
+    }
+  else
+    {
+      g_assert(error == NULL);
+      g_print (_("Attached schema `%s' to key `%s'\n"),
+               schema_name, key);
+    }
+}
+
 static int
 process_key_list(GConfEngine* conf, gboolean unload, const gchar* schema_name, GSList* keylist)
 {
@@ -3725,23 +3805,7 @@ process_key_list(GConfEngine* conf, gboolean unload, const gchar* schema_name, G
   tmp = keylist;
   while (tmp != NULL)
     {
-      GError* error = NULL;
-
-      if (!gconf_engine_associate_schema(conf, tmp->data, !unload ? schema_name : NULL, &error))
-        {
-          g_assert(error != NULL);
-          
-          g_printerr (_("WARNING: failed to associate schema `%s' with key `%s': %s\n"),
-		      schema_name, (gchar*)tmp->data, error->message);
-          g_error_free(error);
-          error = NULL;
-        }
-      else
-        {
-          g_assert(error == NULL);
-          g_print (_("Attached schema `%s' to key `%s'\n"),
-		   schema_name, (gchar*)tmp->data);
-        }
+      associate_key(conf, unload, schema_name, tmp->data);
           
       tmp = g_slist_next(tmp);
     }
@@ -3968,16 +4032,22 @@ process_list(GConfEngine* conf, LoadType load_type, gboolean unload, xmlNodePtr
 #undef LOAD_TYPE_TO_LIST
 }
 
-static int
-do_load_file(GConfEngine* conf, LoadType load_type, gboolean unload, const gchar* file, const gchar** base_dirs)
-{
 #define LOAD_TYPE_TO_ROOT(t) ((t == LOAD_SCHEMA_FILE) ? "gconfschemafile" : "gconfentryfile")
 #define LOAD_TYPE_TO_LIST(t) ((t == LOAD_SCHEMA_FILE) ? "schemalist" : "entrylist")
 
+/* Parses file and returns its <gconfschemafile> or <gconfentryfile>
+ * node, or NULL after printing why not. Safe to call from several
+ * threads at once.
+ */
+static xmlNodePtr
+load_file_root(LoadType load_type, const gchar* file, xmlDocPtr* docp)
+{
   xmlDocPtr doc;
   xmlNodePtr iter;
   /* file comes from the command line, is thus in locale charset */
-  gchar *utf8_file = g_locale_to_utf8 (file, -1, NULL, NULL, NULL);;
+  gchar *utf8_file = g_locale_to_utf8 (file, -1, NULL, NULL, NULL);
+
+  *docp = NULL;
 
   errno = 0;
   doc = xmlParseFile(file);
@@ -3987,14 +4057,18 @@ do_load_file(GConfEngine* conf, LoadType load_type, gboolean unload, const gchar
       if (errno != 0)
         g_printerr (_("Failed to open `%s': %s\n"),
 		    utf8_file, g_strerror(errno));
-      return 1;
+      g_free (utf8_file);
+      return NULL;
     }
 
+  *docp = doc;
+
   if (doc->xmlRootNode == NULL)
     {
       g_printerr (_("Document `%s' is empty?\n"),
 		  utf8_file);
-      return 1;
+      g_free (utf8_file);
+      return NULL;
     }
 
   iter = doc->xmlRootNode;
@@ -4006,7 +4080,8 @@ do_load_file(GConfEngine* conf, LoadType load_type, gboolean unload, const gchar
             {
               g_printerr (_("Document `%s' has the wrong type of root node (<%s>, should be <%s>)\n"),
 			  utf8_file, iter->name, LOAD_TYPE_TO_ROOT(load_type));
-              return 1;
+              g_free (utf8_file);
+              return NULL;
             }
           else
             break;
@@ -4019,6 +4094,139 @@ do_load_file(GConfEngine* conf, LoadType load_type, gboolean unload, const gchar
     {
       g_printerr (_("Document `%s' has no top level <%s> node\n"),
 		  utf8_file, LOAD_TYPE_TO_ROOT(load_type));
+      g_free (utf8_file);
+      return NULL;
+    }
+
+  g_free (utf8_file);
+
+  return iter;
+}
+
+/* Entry files can hold a whole user database, so rather than
+ * building a tree of the document they are read with a pull parser
+ * that expands one <entry> at a time and frees it before moving on.
+ */
+static int
+load_entry_file(GConfEngine* conf, gboolean unload, const gchar* file, const gchar** base_dirs)
+{
+  xmlTextReaderPtr reader;
+  char* orig_base = NULL;
+  gchar* utf8_file;
+  guint n_entries = 0;
+  int retval = 0;
+  int ret;
+
+  /* file comes from the command line, is thus in locale charset */
+  utf8_file = g_locale_to_utf8 (file, -1, NULL, NULL, NULL);
+
+  errno = 0;
+  reader = xmlReaderForFile(file, NULL, 0);
+  if (reader == NULL)
+    {
+      if (errno != 0)
+        g_printerr (_("Failed to open `%s': %s\n"),
+		    utf8_file, g_strerror(errno));
+      g_free (utf8_file);
+      return 1;
+    }
+
+  ret = xmlTextReaderRead(reader);
+  while (ret == 1)
+    {
+      const char* name;
+      int depth;
+
+      if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT)
+        {
+          ret = xmlTextReaderRead(reader);
+          continue;
+        }
+
+      name = (const char *)xmlTextReaderConstName(reader);
+      depth = xmlTextReaderDepth(reader);
+
+      if (depth == 0)
+        {
+          if (strcmp(name, LOAD_TYPE_TO_ROOT(LOAD_ENTRY_FILE)) != 0)
+            {
+              g_printerr (_("Document `%s' has the wrong type of root node (<%s>, should be <%s>)\n"),
+			  utf8_file, name, LOAD_TYPE_TO_ROOT(LOAD_ENTRY_FILE));
+              retval = 1;
+              break;
+            }
+        }
+      else if (depth == 1)
+        {
+          if (strcmp(name, LOAD_TYPE_TO_LIST(LOAD_ENTRY_FILE)) == 0)
+            {
+              if (orig_base)
+                xmlFree(orig_base);
+              orig_base = (char *)xmlTextReaderGetAttribute(reader, (xmlChar *)"base");
+            }
+          else
+            {
+              g_printerr (_("WARNING: node <%s> below <%s> not understood\n"),
+			  name, LOAD_TYPE_TO_ROOT(LOAD_ENTRY_FILE));
+              ret = xmlTextReaderNext(reader);
+              continue;
+            }
+        }
+      else if (depth == 2)
+        {
+          if (strcmp(name, "entry") == 0)
+            {
+              xmlNodePtr node;
+
+              node = xmlTextReaderExpand(reader);
+              if (node == NULL)
+                {
+                  retval = 1;
+                  break;
+                }
+
+              process_entry(conf, unload, node, base_dirs, orig_base);
+
+              if (++n_entries % LOAD_BATCH_ENTRIES == 0)
+                release_cached_dirs(conf);
+            }
+          else
+            g_printerr (_("WARNING: node <%s> not understood below <%s>\n"),
+			name, LOAD_TYPE_TO_LIST(LOAD_ENTRY_FILE));
+
+          ret = xmlTextReaderNext(reader);
+          continue;
+        }
+
+      ret = xmlTextReaderRead(reader);
+    }
+
+  /* libxml2 has already reported what went wrong */
+  if (ret == -1)
+    retval = 1;
+
+  if (orig_base)
+    xmlFree(orig_base);
+  xmlFreeTextReader(reader);
+  g_free (utf8_file);
+
+  return retval;
+}
+
+static int
+do_load_file(GConfEngine* conf, LoadType load_type, gboolean unload, const gchar* file, const gchar** base_dirs)
+{
+  xmlDocPtr doc;
+  xmlNodePtr iter;
+
+  if (load_type == LOAD_ENTRY_FILE)
+    return load_entry_file(conf, unload, file, base_dirs);
+
+  iter = load_file_root(load_type, file, &doc);
+  if (iter == NULL)
+    {
+      if (doc != NULL)
+        xmlFreeDoc(doc);
       return 1;
     }
 
@@ -4037,11 +4245,14 @@ do_load_file(GConfEngine* conf, LoadType load_type, gboolean unload, const gchar
           
       iter = iter->next;
     }
+
+  xmlFreeDoc(doc);
   
   return 0;
+}
+
 #undef LOAD_TYPE_TO_LIST
 #undef LOAD_TYPE_TO_ROOT
-}
 
 static int
 do_sync(GConfEngine* conf)
@@ -4061,6 +4272,291 @@ do_sync(GConfEngine* conf)
   return 0;
 }
 
+/*
+ * Bulk schema installation: the files are parsed on a thread pool,
+ * which never touches the engine, then merged in command line order
+ * (a later file wins for the same key and locale, as it would when
+ * installing one file after the other) and applied with a single
+ * sync at the end.
+ */
+
+typedef struct {
+  const gchar* file;
+  GSList* schemas;              /* ParsedSchema, in file order */
+  int retval;
+} ParsedSchemaFile;
+
+typedef struct {
+  gchar* key;
+  GHashTable* hash;             /* locale -> GConfSchema */
+  GSList* apply_to;
+} ParsedSchema;
+
+typedef struct {
+  GHashTable* schemas;          /* key -> GHashTable of locale -> GConfSchema */
+  GPtrArray* schema_keys;       /* in the order first seen */
+  GHashTable* apply_to;         /* applyto key -> schema key */
+  GPtrArray* apply_to_keys;     /* in the order first seen */
+} MergedSchemas;
+
+static void
+free_schema_foreach(gpointer key, gpointer value, gpointer user_data)
+{
+  gconf_schema_free(value);
+}
+
+static void
+parsed_schema_free(ParsedSchema* schema)
+{
+  if (schema->hash != NULL)
+    {
+      g_hash_table_foreach(schema->hash, free_schema_foreach, NULL);
+      g_hash_table_destroy(schema->hash);
+    }
+  g_slist_free_full(schema->apply_to, g_free);
+  g_free(schema->key);
+  g_free(schema);
+}
+
+static void
+parse_schema_file(gpointer data, gpointer user_data)
+{
+  ParsedSchemaFile* parsed = data;
+  xmlDocPtr doc;
+  xmlNodePtr root;
+  xmlNodePtr list;
+
+  root = load_file_root(LOAD_SCHEMA_FILE, parsed->file, &doc);
+  if (root == NULL)
+    {
+      if (doc != NULL)
+        xmlFreeDoc(doc);
+      parsed->retval = 1;
+      return;
+    }
+
+  for (list = root->xmlChildrenNode; list != NULL; list = list->next)
+    {
+      xmlNodePtr iter;
+
+      if (list->type != XML_ELEMENT_NODE)
+        continue;
+
+      if (strcmp((char *)list->name, "schemalist") != 0)
+        {
+          g_printerr (_("WARNING: node <%s> below <%s> not understood\n"),
+                      list->name, "gconfschemafile");
+          continue;
+        }
+
+      for (iter = list->xmlChildrenNode; iter != NULL; iter = iter->next)
+        {
+          ParsedSchema* schema;
+
+          if (iter->type != XML_ELEMENT_NODE)
+            continue;
+
+          if (strcmp((char *)iter->name, "schema") != 0)
+            {
+              g_printerr (_("WARNING: node <%s> not understood below <%s>\n"),
+                          iter->name, "schemalist");
+              continue;
+            }
+
+          schema = g_new0(ParsedSchema, 1);
+
+          if (get_schema_from_xml(iter, &schema->key, &schema->hash,
+                                  &schema->apply_to) == 1)
+            {
+              g_free(schema);
+              continue;
+            }
+
+          if (schema->key == NULL)
+            {
+              g_printerr (_("WARNING: no key specified for schema\n"));
+              parsed_schema_free(schema);
+              continue;
+            }
+
+          parsed->schemas = g_slist_prepend(parsed->schemas, schema);
+        }
+    }
+
+  parsed->schemas = g_slist_reverse(parsed->schemas);
+
+  xmlFreeDoc(doc);
+}
+
+static void
+merge_schema_foreach(gpointer key, gpointer value, gpointer user_data)
+{
+  GHashTable* locales = user_data;
+  GConfSchema* old;
+
+  old = g_hash_table_lookup(locales, key);
+  if (old != NULL)
+    {
+      /* the old key string belongs to old */
+      g_hash_table_remove(locales, key);
+      gconf_schema_free(old);
+    }
+
+  g_hash_table_insert(locales, key, value);
+}
+
+static void
+merge_parsed_schema(MergedSchemas* merged, ParsedSchema* schema)
+{
+  GHashTable* locales;
+  gpointer schema_key;
+  GSList* tmp;
+
+  if (g_hash_table_lookup_extended(merged->schemas, schema->key,
+                                   &schema_key, (gpointer*) &locales))
+    {
+      g_free(schema->key);
+    }
+  else
+    {
+      schema_key = schema->key;
+      locales = g_hash_table_new(g_str_hash, g_str_equal);
+      g_hash_table_insert(merged->schemas, schema_key, locales);
+      g_ptr_array_add(merged->schema_keys, schema_key);
+    }
+
+  /* The schemas move over; their locale strings keep being the keys */
+  g_hash_table_foreach(schema->hash, merge_schema_foreach, locales);
+  g_hash_table_destroy(schema->hash);
+
+  for (tmp = schema->apply_to; tmp != NULL; tmp = tmp->next)
+    {
+      if (!g_hash_table_contains(merged->apply_to, tmp->data))
+        g_ptr_array_add(merged->apply_to_keys, tmp->data);
+
+      /* frees tmp->data if the key was already there */
+      g_hash_table_insert(merged->apply_to, tmp->data, schema_key);
+    }
+
+  g_slist_free(schema->apply_to);
+  g_free(schema);
+}
+
+static void
+apply_merged_schemas(GConfEngine* conf, MergedSchemas* merged)
+{
+  struct {
+    GConfEngine* conf;
+    gboolean unload;
+    char* key;
+  } hash_foreach_info;
+  guint i;
+
+  hash_foreach_info.conf = conf;
+  hash_foreach_info.unload = FALSE;
+
+  for (i = 0; i < merged->apply_to_keys->len; i++)
+    {
+      const gchar* key = g_ptr_array_index(merged->apply_to_keys, i);
+
+      associate_key(conf, FALSE, g_hash_table_lookup(merged->apply_to, key), key);
+    }
+
+  for (i = 0; i < merged->schema_keys->len; i++)
+    {
+      GHashTable* locales;
+
+      hash_foreach_info.key = g_ptr_array_index(merged->schema_keys, i);
+      locales = g_hash_table_lookup(merged->schemas, hash_foreach_info.key);
+
+      /* frees the schemas */
+      g_hash_table_foreach(locales, hash_install_foreach, &hash_foreach_info);
+      g_hash_table_remove_all(locales);
+    }
+}
+
+/* With all_or_nothing, nothing is applied or synced unless every file
+ * could be loaded, as --install-schema-file always did for its file;
+ * otherwise the files that did load are installed, as for
+ * --makefile-install-rule.
+ */
+static int
+do_bulk_install(GConfEngine* conf, const gchar** files,
+                gboolean all_or_nothing)
+{
+  ParsedSchemaFile* parsed;
+  MergedSchemas merged;
+  GThreadPool* pool;
+  guint n_files;
+  guint n_threads;
+  guint i;
+  int retval = 0;
+
+  n_files = g_strv_length((gchar**) files);
+  parsed = g_new0(ParsedSchemaFile, n_files);
+
+  /* libxml2 must be initialized before parsing on several threads */
+  xmlInitParser();
+
+  n_threads = MIN(g_get_num_processors(), n_files);
+  pool = NULL;
+  if (n_threads > 1)
+    pool = g_thread_pool_new(parse_schema_file, NULL, n_threads, TRUE, NULL);
+
+  for (i = 0; i < n_files; i++)
+    {
+      parsed[i].file = files[i];
+
+      if (pool != NULL)
+        g_thread_pool_push(pool, &parsed[i], NULL);
+      else
+        parse_schema_file(&parsed[i], NULL);
+    }
+
+  if (pool != NULL)
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+  merged.schemas = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                         (GDestroyNotify) g_hash_table_destroy);
+  merged.schema_keys = g_ptr_array_new();
+  merged.apply_to = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  merged.apply_to_keys = g_ptr_array_new();
+
+  for (i = 0; i < n_files; i++)
+    {
+      GSList* tmp;
+
+      retval |= parsed[i].retval;
+
+      for (tmp = parsed[i].schemas; tmp != NULL; tmp = tmp->next)
+        merge_parsed_schema(&merged, tmp->data);
+
+      g_slist_free(parsed[i].schemas);
+    }
+
+  g_free(parsed);
+
+  if (!all_or_nothing || retval == 0)
+    apply_merged_schemas(conf, &merged);
+  else
+    {
+      for (i = 0; i < merged.schema_keys->len; i++)
+        g_hash_table_foreach(g_hash_table_lookup(merged.schemas,
+                                                 g_ptr_array_index(merged.schema_keys, i)),
+                             free_schema_foreach, NULL);
+    }
+
+  g_ptr_array_free(merged.apply_to_keys, TRUE);
+  g_hash_table_destroy(merged.apply_to);
+  g_ptr_array_free(merged.schema_keys, TRUE);
+  g_hash_table_destroy(merged.schemas);
+
+  if (!all_or_nothing || retval == 0)
+    retval |= do_sync(conf);
+
+  return retval;
+}
+
 static int
 do_makefile_install(GConfEngine* conf, const gchar** args, gboolean unload)
 {
@@ -4072,6 +4568,9 @@ do_makefile_install(GConfEngine* conf, const gchar** args, gboolean unload)
       return 1;
     }
 
+  if (!unload)
+    return do_bulk_install(conf, args, FALSE);
+
   while (*args)
     {
       if (do_load_file(conf, LOAD_SCHEMA_FILE, unload, *args, NULL) != 0)
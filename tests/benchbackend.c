@@ -0,0 +1,205 @@
+/* GConf
+ * Copyright (C) 2002 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Times key lookups in a single directory as it grows, e.g.
+ *
+ *   ./benchbackend xml:readwrite:/tmp/gconf-bench [max_entries]
+ *
+ * With an indexed backend the per-lookup time should stay roughly
+ * flat from 100 to 100000 entries.  Every lookup is checked, so
+ * runtests.sh also runs this, only up to 1000 entries.
+ */
+
+#include <gconf/gconf-backend.h>
+#include <gconf/gconf-internals.h>
+#include <gconf/gconf-locale.h>
+#include <gconf/gconf.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+
+#define BENCH_DIR      "/bench/flat"
+#define LOOKUPS        20000
+#define MAX_ENTRIES    100000
+
+static const char **locales = NULL;
+
+static void
+exit_if_error (GError *error)
+{
+  if (error != NULL)
+    {
+      g_printerr ("Error: %s\n", error->message);
+      g_error_free (error);
+      exit (1);
+    }
+}
+
+static char*
+bench_key (int i)
+{
+  return g_strdup_printf (BENCH_DIR "/key_%d", i);
+}
+
+static void
+fill_to (GConfSource *source,
+         int          from,
+         int          to)
+{
+  GConfValue *value;
+  GError *error;
+  int i;
+
+  value = gconf_value_new (GCONF_VALUE_INT);
+
+  for (i = from; i < to; i++)
+    {
+      char *key;
+
+      key = bench_key (i);
+      gconf_value_set_int (value, i);
+
+      error = NULL;
+      (* source->backend->vtable.set_value) (source, key, value, &error);
+      exit_if_error (error);
+
+      g_free (key);
+    }
+
+  gconf_value_free (value);
+}
+
+static double
+time_lookups (GConfSource *source,
+              int          n_entries)
+{
+  GTimer *timer;
+  char **keys;
+  int *wanted;
+  double elapsed;
+  int i;
+
+  /* Build the keys up front so we only time the backend */
+  keys = g_new (char *, LOOKUPS);
+  wanted = g_new (int, LOOKUPS);
+  for (i = 0; i < LOOKUPS; i++)
+    {
+      wanted[i] = g_random_int_range (0, n_entries);
+      keys[i] = bench_key (wanted[i]);
+    }
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < LOOKUPS; i++)
+    {
+      GConfValue *value;
+      GError *error;
+
+      error = NULL;
+      value = (* source->backend->vtable.query_value) (source, keys[i],
+                                                       locales, NULL,
+                                                       &error);
+      exit_if_error (error);
+
+      if (value == NULL)
+        {
+          g_printerr ("Lookup of \"%s\" returned no value\n", keys[i]);
+          exit (1);
+        }
+
+      if (value->type != GCONF_VALUE_INT ||
+          gconf_value_get_int (value) != wanted[i])
+        {
+          g_printerr ("Lookup of \"%s\" returned the wrong value\n", keys[i]);
+          exit (1);
+        }
+
+      gconf_value_free (value);
+    }
+
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  for (i = 0; i < LOOKUPS; i++)
+    g_free (keys[i]);
+  g_free (keys);
+  g_free (wanted);
+
+  return elapsed;
+}
+
+int
+main (int argc, char **argv)
+{
+  GConfSource *source;
+  GError *error;
+  int max_entries;
+  int n_entries;
+  int filled;
+
+  if (argc < 2)
+    {
+      g_printerr ("Must specify a config source address on the command line\n");
+      return 1;
+    }
+
+  max_entries = argc > 2 ? atoi (argv[2]) : MAX_ENTRIES;
+
+  setlocale (LC_ALL, "");
+
+  locales = (const char**) gconf_split_locale (gconf_current_locale ());
+
+  error = NULL;
+  source = gconf_resolve_address (argv[1], &error);
+  if (error != NULL)
+    {
+      g_printerr ("Could not resolve address: %s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  g_print ("%10s %16s\n", "entries", "usec/lookup");
+
+  filled = 0;
+  for (n_entries = 100; n_entries <= max_entries; n_entries *= 10)
+    {
+      double elapsed;
+
+      fill_to (source, filled, n_entries);
+      filled = n_entries;
+
+      elapsed = time_lookups (source, n_entries);
+
+      g_print ("%10d %16.3f\n", n_entries, elapsed * 1e6 / LOOKUPS);
+    }
+
+  /* Don't leave 100k keys behind in the source */
+  error = NULL;
+  (* source->backend->vtable.remove_dir) (source, BENCH_DIR, &error);
+  exit_if_error (error);
+
+  error = NULL;
+  (* source->backend->vtable.sync_all) (source, &error);
+  exit_if_error (error);
+
+  gconf_source_free (source);
+
+  return 0;
+}
@@ -0,0 +1,307 @@
+/* GConf
+ * Copyright (C) 1999, 2000 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Times an AllEntries-style round trip over a private peer to peer
+ * connection with the stringified and the typed entry encoding: the
+ * server thread encodes a directory of entries, the client decodes
+ * them.
+ *
+ *   ./benchdbusvalues [n_entries] [n_calls]
+ */
+
+#include <gconf/gconf-value.h>
+#include <gconf/gconf-internals.h>
+#include <gconf/gconf-dbus-utils.h>
+#include <dbus/dbus-glib-lowlevel.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_PATH "/org/gnome/GConf/Bench"
+
+static GSList *served_entries = NULL;
+
+static GConfValue*
+bench_value (int i)
+{
+  GConfValue *value;
+
+  switch (i % 6)
+    {
+    case 0:
+      value = gconf_value_new (GCONF_VALUE_INT);
+      gconf_value_set_int (value, i);
+      break;
+    case 1:
+      value = gconf_value_new (GCONF_VALUE_BOOL);
+      gconf_value_set_bool (value, i % 12 == 1);
+      break;
+    case 2:
+      value = gconf_value_new (GCONF_VALUE_FLOAT);
+      gconf_value_set_float (value, i / 7.0);
+      break;
+    case 3:
+      value = gconf_value_new (GCONF_VALUE_STRING);
+      gconf_value_set_string (value, "A string with \"quotes\", commas, and 'such'");
+      break;
+    case 4:
+      {
+        GSList *list = NULL;
+        int j;
+
+        for (j = 0; j < 8; j++)
+          {
+            GConfValue *elem;
+
+            elem = gconf_value_new (GCONF_VALUE_STRING);
+            gconf_value_set_string (elem, "list element");
+            list = g_slist_prepend (list, elem);
+          }
+
+        value = gconf_value_new (GCONF_VALUE_LIST);
+        gconf_value_set_list_type (value, GCONF_VALUE_STRING);
+        gconf_value_set_list_nocopy (value, list);
+      }
+      break;
+    default:
+      {
+        GConfValue *car, *cdr;
+
+        car = gconf_value_new (GCONF_VALUE_INT);
+        gconf_value_set_int (car, i);
+        cdr = gconf_value_new (GCONF_VALUE_STRING);
+        gconf_value_set_string (cdr, "cdr");
+
+        value = gconf_value_new (GCONF_VALUE_PAIR);
+        gconf_value_set_car_nocopy (value, car);
+        gconf_value_set_cdr_nocopy (value, cdr);
+      }
+      break;
+    }
+
+  return value;
+}
+
+static DBusHandlerResult
+server_message_func (DBusConnection *connection,
+                     DBusMessage    *message,
+                     void           *user_data)
+{
+  DBusMessage *reply;
+  DBusMessageIter iter;
+
+  reply = dbus_message_new_method_return (message);
+  dbus_message_iter_init_append (reply, &iter);
+
+  gconf_dbus_utils_append_entries (&iter, served_entries,
+                                   gconf_dbus_utils_get_protocol (message, 0));
+
+  dbus_connection_send (connection, reply, NULL);
+  dbus_message_unref (reply);
+
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static DBusObjectPathVTable server_vtable = {
+  NULL,
+  server_message_func,
+  NULL,
+};
+
+static void
+new_connection_func (DBusServer     *server,
+                     DBusConnection *connection,
+                     void           *user_data)
+{
+  dbus_connection_ref (connection);
+  dbus_connection_setup_with_g_main (connection, user_data);
+  dbus_connection_register_object_path (connection, BENCH_PATH,
+                                        &server_vtable, NULL);
+}
+
+static gpointer
+server_thread (gpointer data)
+{
+  g_main_loop_run (data);
+
+  return NULL;
+}
+
+static GSList*
+call (DBusConnection *connection,
+      guint32         protocol)
+{
+  DBusMessage *message, *reply;
+  DBusMessageIter iter;
+  DBusError error;
+  GSList *entries;
+
+  message = dbus_message_new_method_call (NULL, BENCH_PATH,
+                                          GCONF_DBUS_DATABASE_INTERFACE,
+                                          GCONF_DBUS_DATABASE_GET_ALL_ENTRIES);
+  dbus_message_append_args (message,
+                            DBUS_TYPE_UINT32, &protocol,
+                            DBUS_TYPE_INVALID);
+
+  dbus_error_init (&error);
+  reply = dbus_connection_send_with_reply_and_block (connection, message,
+                                                     -1, &error);
+  dbus_message_unref (message);
+
+  if (reply == NULL)
+    {
+      g_printerr ("Call failed: %s\n", error.message);
+      exit (1);
+    }
+
+  dbus_message_iter_init (reply, &iter);
+  entries = gconf_dbus_utils_get_entries (&iter, "/");
+
+  dbus_message_unref (reply);
+
+  return g_slist_reverse (entries);
+}
+
+static void
+check_entries (GSList *entries)
+{
+  GSList *a, *b;
+
+  for (a = entries, b = served_entries; a && b; a = a->next, b = b->next)
+    {
+      if (gconf_value_compare (gconf_entry_get_value (a->data),
+                               gconf_entry_get_value (b->data)) != 0)
+        {
+          g_printerr ("Value of %s did not survive the round trip\n",
+                      gconf_entry_get_key (b->data));
+          exit (1);
+        }
+    }
+
+  if (a || b)
+    {
+      g_printerr ("Got a different number of entries back\n");
+      exit (1);
+    }
+}
+
+static double
+time_calls (DBusConnection *connection,
+            guint32         protocol,
+            guint           n_calls)
+{
+  GTimer *timer;
+  double elapsed;
+  guint i;
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < n_calls; i++)
+    {
+      GSList *entries;
+
+      entries = call (connection, protocol);
+      if (i == 0)
+        check_entries (entries);
+      gconf_entry_list_free (entries);
+    }
+
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  return elapsed;
+}
+
+int
+main (int argc, char **argv)
+{
+  GMainContext *context;
+  GMainLoop *loop;
+  GThread *thread;
+  DBusServer *server;
+  DBusConnection *connection;
+  DBusError error;
+  char *address;
+  guint n_entries;
+  guint n_calls;
+  double stringified, typed;
+  guint i;
+
+  n_entries = argc > 1 ? atoi (argv[1]) : 200;
+  n_calls = argc > 2 ? atoi (argv[2]) : 2000;
+
+  dbus_threads_init_default ();
+
+  for (i = 0; i < n_entries; i++)
+    served_entries = g_slist_prepend (served_entries,
+                                      gconf_entry_new_nocopy (g_strdup_printf ("/apps/bench/key%u", i),
+                                                              bench_value (i)));
+  served_entries = g_slist_reverse (served_entries);
+
+  dbus_error_init (&error);
+  server = dbus_server_listen ("unix:tmpdir=/tmp", &error);
+  if (server == NULL)
+    {
+      g_printerr ("Could not listen: %s\n", error.message);
+      return 1;
+    }
+
+  context = g_main_context_new ();
+  loop = g_main_loop_new (context, FALSE);
+
+  dbus_server_set_new_connection_function (server, new_connection_func,
+                                           context, NULL);
+  dbus_server_setup_with_g_main (server, context);
+
+  thread = g_thread_new ("server", server_thread, loop);
+
+  address = dbus_server_get_address (server);
+  connection = dbus_connection_open_private (address, &error);
+  dbus_free (address);
+  if (connection == NULL)
+    {
+      g_printerr ("Could not connect: %s\n", error.message);
+      return 1;
+    }
+
+  stringified = time_calls (connection, GCONF_DBUS_PROTOCOL_STRINGIFIED, n_calls);
+  typed = time_calls (connection, GCONF_DBUS_PROTOCOL_TYPED, n_calls);
+
+  printf ("%u entries, %u calls\n", n_entries, n_calls);
+  printf ("%12s %16s\n", "encoding", "usec/entry");
+  printf ("%12s %16.3f\n", "stringified",
+          stringified * 1e6 / ((double) n_calls * n_entries));
+  printf ("%12s %16.3f\n", "typed",
+          typed * 1e6 / ((double) n_calls * n_entries));
+
+  dbus_connection_close (connection);
+  dbus_connection_unref (connection);
+
+  g_main_loop_quit (loop);
+  g_thread_join (thread);
+
+  dbus_server_disconnect (server);
+  dbus_server_unref (server);
+
+  g_main_loop_unref (loop);
+  g_main_context_unref (context);
+
+  gconf_entry_list_free (served_entries);
+
+  return 0;
+}
@@ -0,0 +1,124 @@
+/* GConf
+ * Copyright (C) 1999, 2000 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Times gconf_listeners_notify() on a table shaped like a busy
+ * gconfd: many apps, each with many listened-to dirs.  Every other
+ * key has exactly one listener above it, which the callback count
+ * is checked against.
+ *
+ *   ./benchlisteners [n_listeners] [n_notifies]
+ */
+
+#include <gconf/gconf-listeners.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_APPS 100
+
+static void
+null_destroy_notify (gpointer data)
+{
+}
+
+static void
+count_callback (GConfListeners *listeners,
+                const gchar    *all_above_key,
+                guint           cnxn_id,
+                gpointer        listener_data,
+                gpointer        user_data)
+{
+  guint *count = user_data;
+
+  *count += 1;
+}
+
+static char*
+listen_point (int i)
+{
+  return g_strdup_printf ("/apps/app%d/section%d", i % N_APPS, i / N_APPS);
+}
+
+int
+main (int argc, char **argv)
+{
+  GConfListeners *listeners;
+  GTimer *timer;
+  char **keys;
+  guint n_listeners;
+  guint n_notifies;
+  guint count;
+  guint i;
+
+  n_listeners = argc > 1 ? atoi (argv[1]) : 50000;
+  n_notifies = argc > 2 ? atoi (argv[2]) : 1000000;
+
+  listeners = gconf_listeners_new ();
+
+  for (i = 0; i < n_listeners; i++)
+    {
+      char *where;
+
+      where = listen_point (i);
+      gconf_listeners_add (listeners, where, NULL, null_destroy_notify);
+      g_free (where);
+    }
+
+  /* Half of the keys hit a listener, half only walk part way down */
+  keys = g_new (char *, n_notifies);
+  for (i = 0; i < n_notifies; i++)
+    {
+      int j = g_random_int_range (0, n_listeners);
+
+      if (i % 2)
+        keys[i] = g_strdup_printf ("/apps/app%d/section%d/key%d",
+                                   j % N_APPS, j / N_APPS, i);
+      else
+        keys[i] = g_strdup_printf ("/apps/app%d/nosuchsection/key%d",
+                                   j % N_APPS, i);
+    }
+
+  count = 0;
+  timer = g_timer_new ();
+
+  for (i = 0; i < n_notifies; i++)
+    gconf_listeners_notify (listeners, keys[i], count_callback, &count);
+
+  g_timer_stop (timer);
+
+  printf ("%u listeners, %u notifies, %u callbacks: %.3f usec/notify\n",
+          n_listeners, n_notifies, count,
+          g_timer_elapsed (timer, NULL) * 1e6 / n_notifies);
+
+  g_timer_destroy (timer);
+
+  for (i = 0; i < n_notifies; i++)
+    g_free (keys[i]);
+  g_free (keys);
+
+  gconf_listeners_free (listeners);
+
+  if (count != n_notifies / 2)
+    {
+      g_printerr ("Got %u callbacks rather than %u\n", count, n_notifies / 2);
+      return 1;
+    }
+
+  return 0;
+}
@@ -0,0 +1,154 @@
+/* GConf
+ * Copyright (C) 1999, 2000 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Times GConfClient lookups of keys that don't exist below a
+ * recursively preloaded tree, e.g.
+ *
+ *   ./benchnegative xml:readwrite:/tmp/gconf-bench [n_lookups]
+ *
+ * Half of the keys are missing from a fully cached dir, the other
+ * half are in dirs that don't exist. All of them should be answered
+ * from the cache.
+ */
+
+#include <gconf/gconf-client.h>
+#include <gconf/gconf-engine.h>
+#include <gconf/gconf-internals.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define BENCH_DIR "/bench/negative"
+#define N_DIRS    50
+#define N_KEYS    20
+#define N_PROBES  1000
+
+static void
+exit_if_error (GError *error)
+{
+  if (error != NULL)
+    {
+      g_printerr ("Error: %s\n", error->message);
+      g_error_free (error);
+      exit (1);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  GConfEngine *engine;
+  GConfClient *client;
+  GConfClientCacheStats stats;
+  GError *error;
+  GTimer *timer;
+  char **probes;
+  guint n_lookups;
+  guint i;
+
+  if (argc < 2)
+    {
+      g_printerr ("Usage: %s ADDRESS [N_LOOKUPS]\n", argv[0]);
+      return 1;
+    }
+
+  n_lookups = argc > 2 ? atoi (argv[2]) : 5000000;
+
+  error = NULL;
+  /* A local engine can't be watched, so add_dir needs the daemon */
+  engine = gconf_engine_get_for_address (argv[1], &error);
+  exit_if_error (error);
+
+  for (i = 0; i < N_DIRS * N_KEYS; i++)
+    {
+      char *key;
+
+      key = g_strdup_printf (BENCH_DIR "/dir%u/sub/key%u",
+                             i / N_KEYS, i % N_KEYS);
+      gconf_engine_set_int (engine, key, i, &error);
+      exit_if_error (error);
+      g_free (key);
+    }
+
+  client = gconf_client_get_for_engine (engine);
+
+  /* Preloading only caches dirs the client is watching */
+  gconf_client_add_dir (client, BENCH_DIR, GCONF_CLIENT_PRELOAD_NONE, &error);
+  exit_if_error (error);
+
+  gconf_client_preload (client, BENCH_DIR, GCONF_CLIENT_PRELOAD_RECURSIVE,
+                        &error);
+  exit_if_error (error);
+
+  probes = g_new (char *, N_PROBES);
+  for (i = 0; i < N_PROBES; i++)
+    {
+      if (i % 2)
+        probes[i] = g_strdup_printf (BENCH_DIR "/dir%u/sub/nosuchkey%u",
+                                     i % N_DIRS, i);
+      else
+        probes[i] = g_strdup_printf (BENCH_DIR "/dir%u/nosuchdir/deeper/key%u",
+                                     i % N_DIRS, i);
+    }
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < n_lookups; i++)
+    {
+      GConfValue *value;
+
+      value = gconf_client_get (client, probes[i % N_PROBES], NULL);
+      if (value != NULL)
+        {
+          g_printerr ("%s should not exist\n", probes[i % N_PROBES]);
+          return 1;
+        }
+    }
+
+  g_timer_stop (timer);
+
+  gconf_client_get_cache_stats (client, &stats);
+
+  printf ("%u lookups (%u hits, %u misses): %.3f nsec/lookup\n",
+          n_lookups, stats.hits, stats.misses,
+          g_timer_elapsed (timer, NULL) * 1e9 / n_lookups);
+
+  g_timer_destroy (timer);
+
+  for (i = 0; i < N_PROBES; i++)
+    g_free (probes[i]);
+  g_free (probes);
+
+  gconf_client_remove_dir (client, BENCH_DIR, NULL);
+  g_object_unref (client);
+
+  gconf_engine_recursive_unset (engine, BENCH_DIR, 0, &error);
+  exit_if_error (error);
+  gconf_engine_suggest_sync (engine, &error);
+  exit_if_error (error);
+
+  gconf_engine_unref (engine);
+
+  if (stats.misses != 0)
+    {
+      g_printerr ("%u lookups went to the engine\n", stats.misses);
+      return 1;
+    }
+
+  return 0;
+}
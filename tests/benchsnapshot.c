@@ -0,0 +1,169 @@
+/* GConf
+ * Copyright (C) 2002 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Times loading a merged tree from %gconf-tree.xml against loading
+ * it from its snapshot, e.g.
+ *
+ *   ./benchsnapshot xml:merged:/etc/gconf/gconf.xml.defaults [key]
+ *
+ * The first pass parses the XML file (and writes the snapshot, so
+ * the tree must be writable), the second one reads the snapshot.
+ * Each pass times what gconfd does at startup, resolving the source
+ * and reading one key, and then walking every entry.
+ */
+
+#include <gconf/gconf-backend.h>
+#include <gconf/gconf-internals.h>
+#include <gconf/gconf-locale.h>
+#include <gconf/gconf.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+
+static const char **locales = NULL;
+
+static void
+exit_if_error (GError *error)
+{
+  if (error != NULL)
+    {
+      g_printerr ("Error: %s\n", error->message);
+      g_error_free (error);
+      exit (1);
+    }
+}
+
+static int
+walk (GConfSource *source,
+      const char  *dir)
+{
+  GSList *entries;
+  GSList *subdirs;
+  GSList *tmp;
+  GError *error;
+  int n_entries;
+
+  error = NULL;
+  entries = (* source->backend->vtable.all_entries) (source, dir,
+                                                     locales, &error);
+  exit_if_error (error);
+
+  n_entries = g_slist_length (entries);
+  g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+  g_slist_free (entries);
+
+  error = NULL;
+  subdirs = (* source->backend->vtable.all_subdirs) (source, dir, &error);
+  exit_if_error (error);
+
+  for (tmp = subdirs; tmp != NULL; tmp = tmp->next)
+    {
+      char *subdir;
+
+      subdir = gconf_concat_dir_and_key (dir, tmp->data);
+      n_entries += walk (source, subdir);
+      g_free (subdir);
+      g_free (tmp->data);
+    }
+  g_slist_free (subdirs);
+
+  return n_entries;
+}
+
+static void
+run_pass (const char *label,
+          const char *address,
+          const char *key)
+{
+  GConfSource *source;
+  GConfValue *value;
+  GError *error;
+  GTimer *timer;
+  double startup;
+  double walked;
+  int n_entries;
+
+  timer = g_timer_new ();
+
+  error = NULL;
+  source = gconf_resolve_address (address, &error);
+  exit_if_error (error);
+
+  error = NULL;
+  value = (* source->backend->vtable.query_value) (source, key, locales,
+                                                   NULL, &error);
+  exit_if_error (error);
+  if (value != NULL)
+    gconf_value_free (value);
+
+  startup = g_timer_elapsed (timer, NULL);
+
+  n_entries = walk (source, "/");
+
+  walked = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  g_print ("%-10s %12.3f %12.3f %10d\n",
+           label, startup * 1e3, walked * 1e3, n_entries);
+
+  gconf_source_free (source);
+}
+
+int
+main (int argc, char **argv)
+{
+  char *root_dir;
+  char *snapshot;
+
+  if (argc < 2)
+    {
+      g_printerr ("Must specify a config source address on the command line\n");
+      return 1;
+    }
+
+  setlocale (LC_ALL, "");
+
+  locales = (const char**) gconf_split_locale (gconf_current_locale ());
+
+  /* Make sure the first pass really parses the XML */
+  root_dir = gconf_address_resource (argv[1]);
+  if (root_dir == NULL)
+    {
+      g_printerr ("Could not find the directory of \"%s\"\n", argv[1]);
+      return 1;
+    }
+
+  snapshot = g_build_filename (root_dir, "%gconf-tree.xml.snapshot", NULL);
+  g_unlink (snapshot);
+
+  g_print ("%-10s %12s %12s %10s\n", "", "startup ms", "walk ms", "entries");
+
+  run_pass ("xml", argv[1], argc > 2 ? argv[2] : "/apps");
+
+  if (!g_file_test (snapshot, G_FILE_TEST_EXISTS))
+    g_printerr ("No snapshot was written to \"%s\"\n", snapshot);
+
+  run_pass ("snapshot", argv[1], argc > 2 ? argv[2] : "/apps");
+
+  g_free (snapshot);
+  g_free (root_dir);
+
+  return 0;
+}
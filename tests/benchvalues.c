@@ -0,0 +1,152 @@
+/* GConf
+ * Copyright (C) 1999, 2000 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Times the get/copy/free cycle GConfClient goes through on every
+ * cache hit: copy a cached entry, read its value, free the copy.
+ *
+ *   ./benchvalues [n_cycles]
+ */
+
+#include <gconf/gconf-value.h>
+#include <gconf/gconf-internals.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_CACHED 64
+
+static GConfEntry*
+cached_entry (int i)
+{
+  GConfValue *value;
+  GConfEntry *entry;
+  char *key;
+
+  switch (i % 4)
+    {
+    case 0:
+      value = gconf_value_new (GCONF_VALUE_INT);
+      gconf_value_set_int (value, i);
+      break;
+    case 1:
+      value = gconf_value_new (GCONF_VALUE_BOOL);
+      gconf_value_set_bool (value, i % 8 == 1);
+      break;
+    case 2:
+      value = gconf_value_new (GCONF_VALUE_STRING);
+      gconf_value_set_string (value, "some/short/string");
+      break;
+    default:
+      {
+        GSList *list = NULL;
+        int j;
+
+        for (j = 0; j < 4; j++)
+          {
+            GConfValue *elem;
+
+            elem = gconf_value_new (GCONF_VALUE_INT);
+            gconf_value_set_int (elem, j);
+            list = g_slist_prepend (list, elem);
+          }
+
+        value = gconf_value_new (GCONF_VALUE_LIST);
+        gconf_value_set_list_type (value, GCONF_VALUE_INT);
+        gconf_value_set_list_nocopy (value, list);
+      }
+      break;
+    }
+
+  key = g_strdup_printf ("/apps/bench/key%d", i);
+  entry = gconf_entry_new_nocopy (key, value);
+
+  return entry;
+}
+
+int
+main (int argc, char **argv)
+{
+  GConfEntry *cache[N_CACHED];
+  GConfAllocStats stats;
+  GTimer *timer;
+  guint n_cycles;
+  guint n_ints;
+  guint i;
+
+  n_cycles = argc > 1 ? atoi (argv[1]) : 10000000;
+
+  for (i = 0; i < N_CACHED; i++)
+    cache[i] = cached_entry (i);
+
+  /* Copies must still be equal to what they were copied from */
+  for (i = 0; i < N_CACHED; i++)
+    {
+      GConfEntry *copy;
+
+      copy = gconf_entry_copy (cache[i]);
+      if (strcmp (gconf_entry_get_key (copy),
+                  gconf_entry_get_key (cache[i])) != 0 ||
+          gconf_value_compare (gconf_entry_get_value (copy),
+                               gconf_entry_get_value (cache[i])) != 0)
+        {
+          g_printerr ("Copy of %s differs\n", gconf_entry_get_key (cache[i]));
+          return 1;
+        }
+      gconf_entry_free (copy);
+    }
+
+  n_ints = 0;
+  timer = g_timer_new ();
+
+  for (i = 0; i < n_cycles; i++)
+    {
+      GConfEntry *copy;
+      GConfValue *value;
+
+      copy = gconf_entry_copy (cache[i % N_CACHED]);
+      value = gconf_entry_get_value (copy);
+      if (value->type == GCONF_VALUE_INT)
+        n_ints += 1;
+      gconf_entry_free (copy);
+    }
+
+  g_timer_stop (timer);
+
+  gconf_value_get_alloc_stats (&stats);
+
+  printf ("%u cycles (%u ints): %.3f nsec/cycle, %u values and %u entries live\n",
+          n_cycles, n_ints,
+          g_timer_elapsed (timer, NULL) * 1e9 / n_cycles,
+          stats.live_values, stats.live_entries);
+
+  g_timer_destroy (timer);
+
+  for (i = 0; i < N_CACHED; i++)
+    gconf_entry_free (cache[i]);
+
+  gconf_value_get_alloc_stats (&stats);
+  if (stats.live_values != 0 || stats.live_entries != 0)
+    {
+      g_printerr ("Leaked %u values and %u entries\n",
+                  stats.live_values, stats.live_entries);
+      return 1;
+    }
+
+  return 0;
+}
@@ -0,0 +1,336 @@
+/* GConf
+ * Copyright (C) 2002 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Measures how much memory the libxml backend needs to hold a
+ * synthetic 50000 key tree in its cache, as is, with the "compact"
+ * address flag and with a "cachesize" budget, e.g.
+ *
+ *   ./benchxmlmemory /tmp/gconf-bench-xml
+ *
+ * Each mode loads the tree in a child process of its own so the
+ * resident set sizes can be compared. The compact child also changes
+ * a key and syncs, to check that the regenerated file reads back.
+ */
+
+#include <gconf/gconf-backend.h>
+#include <gconf/gconf-internals.h>
+#include <gconf/gconf.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define BENCH_DIR  "/bench/memory"
+#define N_DIRS     500
+#define N_KEYS     100
+
+static const char *modes[] = {
+  "readwrite",
+  "readwrite,compact",
+  "readwrite,cachesize=1024"
+};
+
+static void
+exit_if_error (GError *error)
+{
+  if (error != NULL)
+    {
+      g_printerr ("Error: %s\n", error->message);
+      g_error_free (error);
+      exit (1);
+    }
+}
+
+static GConfSource*
+resolve (const char *root_dir,
+         const char *flags)
+{
+  GConfSource *source;
+  GError *error;
+  char *address;
+
+  address = g_strconcat ("oldxml:", flags, ":", root_dir, NULL);
+
+  error = NULL;
+  source = gconf_resolve_address (address, &error);
+  exit_if_error (error);
+
+  g_free (address);
+
+  return source;
+}
+
+static char*
+bench_dir (int i)
+{
+  return g_strdup_printf (BENCH_DIR "/dir%d", i);
+}
+
+static GConfValue*
+bench_value (int i)
+{
+  GConfValue *value;
+
+  switch (i % 4)
+    {
+    case 0:
+      value = gconf_value_new (GCONF_VALUE_INT);
+      gconf_value_set_int (value, i);
+      break;
+    case 1:
+      value = gconf_value_new (GCONF_VALUE_BOOL);
+      gconf_value_set_bool (value, i % 8 == 1);
+      break;
+    case 2:
+      value = gconf_value_new (GCONF_VALUE_STRING);
+      gconf_value_set_string (value, "a typical string preference");
+      break;
+    default:
+      {
+        GSList *list = NULL;
+        int j;
+
+        for (j = 0; j < 3; j++)
+          {
+            GConfValue *elem;
+
+            elem = gconf_value_new (GCONF_VALUE_STRING);
+            gconf_value_set_string (elem, "element");
+            list = g_slist_prepend (list, elem);
+          }
+
+        value = gconf_value_new (GCONF_VALUE_LIST);
+        gconf_value_set_list_type (value, GCONF_VALUE_STRING);
+        gconf_value_set_list_nocopy (value, list);
+      }
+      break;
+    }
+
+  return value;
+}
+
+/* Sets every key, or unsets them; this backend can't remove_dir */
+static void
+fill (GConfSource *source,
+      gboolean     unset)
+{
+  GError *error;
+  int i;
+
+  for (i = 0; i < N_DIRS * N_KEYS; i++)
+    {
+      char *dir;
+      char *key;
+
+      dir = bench_dir (i / N_KEYS);
+      key = g_strdup_printf ("%s/key%d", dir, i % N_KEYS);
+
+      error = NULL;
+      if (unset)
+        (* source->backend->vtable.unset_value) (source, key, NULL, &error);
+      else
+        {
+          GConfValue *value;
+
+          value = bench_value (i);
+          (* source->backend->vtable.set_value) (source, key, value, &error);
+          gconf_value_free (value);
+        }
+      exit_if_error (error);
+
+      g_free (key);
+      g_free (dir);
+    }
+
+  error = NULL;
+  (* source->backend->vtable.sync_all) (source, &error);
+  exit_if_error (error);
+}
+
+static long
+resident_kbytes (void)
+{
+  FILE *f;
+  long size, resident;
+
+  f = fopen ("/proc/self/statm", "r");
+  if (f == NULL)
+    return 0;
+
+  if (fscanf (f, "%ld %ld", &size, &resident) != 2)
+    resident = 0;
+  fclose (f);
+
+  return resident * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+static void
+check_value (GConfSource *source,
+             const char  *key,
+             int          expected)
+{
+  GConfValue *value;
+  GError *error;
+
+  error = NULL;
+  value = (* source->backend->vtable.query_value) (source, key, NULL,
+                                                   NULL, &error);
+  exit_if_error (error);
+
+  if (value == NULL || value->type != GCONF_VALUE_INT ||
+      gconf_value_get_int (value) != expected)
+    {
+      g_printerr ("Wrong value for %s after a compact sync\n", key);
+      exit (1);
+    }
+
+  gconf_value_free (value);
+}
+
+/* Runs in a child process */
+static void
+measure (const char *root_dir,
+         const char *flags)
+{
+  GConfSource *source;
+  GTimer *timer;
+  long before, after;
+  guint n_entries;
+  int i;
+
+  before = resident_kbytes ();
+  timer = g_timer_new ();
+
+  source = resolve (root_dir, flags);
+
+  n_entries = 0;
+  for (i = 0; i < N_DIRS; i++)
+    {
+      GSList *entries;
+      GError *error;
+      char *dir;
+
+      dir = bench_dir (i);
+
+      error = NULL;
+      entries = (* source->backend->vtable.all_entries) (source, dir, NULL,
+                                                         &error);
+      exit_if_error (error);
+
+      n_entries += g_slist_length (entries);
+      g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+      g_slist_free (entries);
+
+      g_free (dir);
+    }
+
+  g_timer_stop (timer);
+  after = resident_kbytes ();
+
+  if (n_entries != N_DIRS * N_KEYS)
+    {
+      g_printerr ("Loaded %u entries rather than %u\n",
+                  n_entries, N_DIRS * N_KEYS);
+      exit (1);
+    }
+
+  printf ("%26s %14ld %12.3f\n", flags,
+          after - before, g_timer_elapsed (timer, NULL));
+
+  if (strstr (flags, "compact") != NULL)
+    {
+      GConfValue *value;
+      GError *error;
+
+      /* A sync has to write out the keys it no longer has nodes for */
+      value = gconf_value_new (GCONF_VALUE_INT);
+      gconf_value_set_int (value, -1);
+
+      error = NULL;
+      (* source->backend->vtable.set_value) (source, BENCH_DIR "/dir0/key0",
+                                             value, &error);
+      exit_if_error (error);
+      gconf_value_free (value);
+
+      error = NULL;
+      (* source->backend->vtable.sync_all) (source, &error);
+      exit_if_error (error);
+
+      (* source->backend->vtable.clear_cache) (source);
+
+      check_value (source, BENCH_DIR "/dir0/key0", -1);
+      check_value (source, BENCH_DIR "/dir0/key4", 4);
+    }
+
+  g_timer_destroy (timer);
+  gconf_source_free (source);
+
+  exit (0);
+}
+
+int
+main (int argc, char **argv)
+{
+  GConfSource *source;
+  int failed;
+  int i;
+
+  if (argc != 2)
+    {
+      g_printerr ("Must specify a directory for the XML tree on the command line\n");
+      return 1;
+    }
+
+  source = resolve (argv[1], modes[0]);
+  fill (source, FALSE);
+  gconf_source_free (source);
+
+  g_print ("%u keys in %u directories\n", N_DIRS * N_KEYS, N_DIRS);
+  g_print ("%26s %14s %12s\n", "flags", "resident KiB", "load sec");
+  fflush (stdout);
+
+  failed = 0;
+  for (i = 0; i < (int) G_N_ELEMENTS (modes); i++)
+    {
+      pid_t pid;
+      int status;
+
+      pid = fork ();
+      if (pid < 0)
+        {
+          g_printerr ("Failed to fork\n");
+          return 1;
+        }
+      else if (pid == 0)
+        measure (argv[1], modes[i]);
+
+      if (waitpid (pid, &status, 0) < 0 ||
+          !WIFEXITED (status) || WEXITSTATUS (status) != 0)
+        failed = 1;
+    }
+
+  /* Don't leave 50k keys behind */
+  source = resolve (argv[1], modes[0]);
+  fill (source, TRUE);
+  gconf_source_free (source);
+
+  return failed;
+}
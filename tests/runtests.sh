@@ -2,7 +2,7 @@
 
 export GCONFTOOL=`pwd`/../gconf/gconftool
 LOGFILE=runtests.log
-POTENTIAL_TESTS='testdirlist testgconf testlisteners testschemas testpersistence testaddress'
+POTENTIAL_TESTS='testdirlist testgconf testlisteners testschemas testpersistence testjournal testsnapshot testaddress testasync testclient testsources testcommit'
 
 for I in $POTENTIAL_TESTS
 do
@@ -53,6 +53,45 @@ do
     done
 done
 
+# The benchmarks check their results as well; run them once, small
+BENCH_TMP=`mktemp -d`
+
+run_bench ()
+{
+    I=$1
+    shift
+
+    test -x $I || {
+        echo "WARNING: benchmark $I not found, not running"
+        return
+    }
+
+    echo "Running benchmark \"$I\", please wait:"
+    echo "" >> $LOGFILE
+    echo "Output of $I $@:" >> $LOGFILE
+    if ./$I "$@" >>$LOGFILE 2>&1; then
+        echo " passed"
+    else
+        echo
+        echo
+        echo '***'
+        echo " Test failed: $I"
+        echo " See $LOGFILE for errors"
+        echo
+        rm -rf $BENCH_TMP
+        exit 1
+    fi
+}
+
+run_bench benchbackend xml:readwrite:$BENCH_TMP/backend 1000
+run_bench benchlisteners 1000 10000
+run_bench benchvalues 100000
+run_bench benchdbusvalues 50 20
+run_bench benchnegative xml:readwrite:$BENCH_TMP/negative 10000
+run_bench benchxmlmemory $BENCH_TMP/xmlmemory
+
+rm -rf $BENCH_TMP
+
 echo 
 echo "All tests passed."
 
@@ -0,0 +1,164 @@
+/* GConf
+ * Copyright (C) 1999, 2000 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Checks the errors the async GConfClient calls report.  Errors from
+ * the daemon come back to them as D-Bus error replies.
+ */
+
+#include <gconf/gconf.h>
+#include <gconf/gconf-client.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+
+static GMainLoop *loop = NULL;
+
+static void
+check(gboolean condition, const gchar* fmt, ...)
+{
+  va_list args;
+  gchar* description;
+
+  va_start (args, fmt);
+  description = g_strdup_vprintf(fmt, args);
+  va_end (args);
+
+  if (condition)
+    {
+      printf(".");
+      fflush(stdout);
+    }
+  else
+    {
+      fprintf(stderr, "\n*** FAILED: %s\n", description);
+      exit(1);
+    }
+
+  g_free(description);
+}
+
+static void
+set_ready (GObject      *source,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+  GError **error = user_data;
+
+  check (!gconf_client_set_finish (GCONF_CLIENT (source), result, error),
+         "async set on a read-only database didn't fail");
+
+  g_main_loop_quit (loop);
+}
+
+static void
+get_ready (GObject      *source,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+  GError **error = user_data;
+  GConfValue *value;
+
+  value = gconf_client_get_finish (GCONF_CLIENT (source), result, error);
+
+  check (value == NULL, "got a value from an empty database");
+
+  g_main_loop_quit (loop);
+}
+
+static void
+check_async_errors (GConfClient *client)
+{
+  GConfValue *value;
+  GError *error = NULL;
+
+  value = gconf_value_new (GCONF_VALUE_INT);
+  gconf_value_set_int (value, 42);
+
+  gconf_client_set_async (client, "/testing/async/int", value,
+                          set_ready, &error);
+  g_main_loop_run (loop);
+
+  check (error != NULL, "async set failed without an error");
+  check (error->domain == GCONF_ERROR,
+         "async set error is not a GConf error: %s", error->message);
+  check (error->code == GCONF_ERROR_NO_WRITABLE_DATABASE,
+         "async set error code %d is not GCONF_ERROR_NO_WRITABLE_DATABASE: %s",
+         error->code, error->message);
+
+  g_error_free (error);
+  error = NULL;
+
+  /* A call that succeeds still completes */
+  gconf_client_get_async (client, "/testing/async/int", get_ready, &error);
+  g_main_loop_run (loop);
+
+  check (error == NULL, "async get failed: %s",
+         error ? error->message : "");
+
+  gconf_value_free (value);
+}
+
+int
+main (int argc, char** argv)
+{
+  GConfEngine *conf;
+  GConfClient *client;
+  GError *err = NULL;
+  gchar *dir;
+  gchar *address;
+
+  setlocale (LC_ALL, "");
+
+  g_type_init ();
+
+  dir = g_build_filename (g_get_tmp_dir (), "testasync-XXXXXX", NULL);
+  check (mkdtemp (dir) != NULL, "create %s", dir);
+
+  address = g_strconcat ("xml:readonly:", dir, NULL);
+
+  conf = gconf_engine_get_for_address (address, &err);
+  if (conf == NULL)
+    {
+      fprintf (stderr, "Failed to get an engine for %s: %s\n",
+               address, err->message);
+      g_error_free (err);
+      return 1;
+    }
+
+  client = gconf_client_get_for_engine (conf);
+  loop = g_main_loop_new (NULL, FALSE);
+
+  printf ("\nChecking async errors:");
+
+  check_async_errors (client);
+
+  g_object_unref (client);
+  gconf_engine_unref (conf);
+  g_main_loop_unref (loop);
+
+  g_rmdir (dir);
+  g_free (address);
+  g_free (dir);
+
+  printf ("\n\n");
+
+  return 0;
+}
@@ -0,0 +1,484 @@
+/* GConf
+ * Copyright (C) 1999, 2000 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Checks the GConfClient cache and notify queue.  The client has the
+ * daemon's engine, since add_dir needs a server to listen to.
+ */
+
+#include <gconf/gconf.h>
+#include <gconf/gconf-client.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+
+#define TEST_DIR  "/testing/client"
+#define N_KEYS    100
+
+static void
+check (gboolean condition, const gchar* fmt, ...)
+{
+  va_list args;
+  gchar* description;
+
+  va_start (args, fmt);
+  description = g_strdup_vprintf (fmt, args);
+  va_end (args);
+
+  if (condition)
+    {
+      printf (".");
+      fflush (stdout);
+    }
+  else
+    {
+      fprintf (stderr, "\n*** FAILED: %s\n", description);
+      exit (1);
+    }
+
+  g_free (description);
+}
+
+static void
+exit_if_error (GError *error)
+{
+  if (error != NULL)
+    {
+      fprintf (stderr, "Error: %s\n", error->message);
+      g_error_free (error);
+      exit (1);
+    }
+}
+
+static char*
+cache_key (int i)
+{
+  return g_strdup_printf (TEST_DIR "/cache/key%d", i);
+}
+
+static int
+get_int (GConfClient *client,
+         const char  *key)
+{
+  GConfValue *value;
+  GError *error = NULL;
+  int i;
+
+  value = gconf_client_get (client, key, &error);
+  exit_if_error (error);
+
+  check (value != NULL && value->type == GCONF_VALUE_INT,
+         "`%s' should be an int", key);
+
+  i = gconf_value_get_int (value);
+  gconf_value_free (value);
+
+  return i;
+}
+
+static void
+check_cache_limit (GConfEngine *engine)
+{
+  GConfClient *client;
+  GConfClientCacheStats before;
+  GConfClientCacheStats stats;
+  GError *error = NULL;
+  char *key;
+  int i;
+
+  for (i = 0; i < N_KEYS; i++)
+    {
+      key = cache_key (i);
+      gconf_engine_set_int (engine, key, i, &error);
+      exit_if_error (error);
+      g_free (key);
+    }
+
+  client = gconf_client_get_for_engine (engine);
+  gconf_client_add_dir (client, TEST_DIR, GCONF_CLIENT_PRELOAD_NONE, &error);
+  exit_if_error (error);
+
+  gconf_client_set_cache_limit (client, 10, 0);
+
+  for (i = 0; i < N_KEYS; i++)
+    {
+      key = cache_key (i);
+      check (get_int (client, key) == i, "`%s' should be %d", key, i);
+      g_free (key);
+
+      gconf_client_get_cache_stats (client, &stats);
+      check (stats.n_entries <= 10, "%u entries cached with a limit of 10",
+             stats.n_entries);
+    }
+
+  check (stats.evictions >= N_KEYS - 10, "only %u evictions",
+         stats.evictions);
+
+  /* A key read between every other one keeps its second chance */
+  key = cache_key (0);
+  get_int (client, key);
+  gconf_client_get_cache_stats (client, &before);
+
+  for (i = 1; i < N_KEYS; i++)
+    {
+      char *other;
+
+      other = cache_key (i);
+      get_int (client, other);
+      g_free (other);
+
+      check (get_int (client, key) == 0, "`%s' should be 0", key);
+    }
+
+  gconf_client_get_cache_stats (client, &stats);
+  check (stats.hits - before.hits == N_KEYS - 1,
+         "the hot key was evicted: %u hits for %u reads",
+         stats.hits - before.hits, N_KEYS - 1);
+  g_free (key);
+
+  /* And by size: each of these is a couple of hundred bytes */
+  gconf_client_clear_cache (client);
+  gconf_client_set_cache_limit (client, 0, 4096);
+
+  for (i = 0; i < N_KEYS; i++)
+    {
+      char *str;
+
+      key = cache_key (i);
+      str = g_strnfill (200, 'a' + i % 26);
+      gconf_engine_set_string (engine, key, str, &error);
+      exit_if_error (error);
+      g_free (str);
+      g_free (key);
+    }
+
+  for (i = 0; i < N_KEYS; i++)
+    {
+      char *str;
+
+      key = cache_key (i);
+      str = gconf_client_get_string (client, key, &error);
+      exit_if_error (error);
+      check (str != NULL && strlen (str) == 200 && str[0] == 'a' + i % 26,
+             "wrong value for `%s'", key);
+      g_free (str);
+      g_free (key);
+
+      gconf_client_get_cache_stats (client, &stats);
+      check (stats.n_bytes <= 4096, "%lu bytes cached with a limit of 4096",
+             (unsigned long) stats.n_bytes);
+    }
+
+  check (stats.n_entries < N_KEYS, "nothing was evicted by size");
+
+  gconf_client_remove_dir (client, TEST_DIR, NULL);
+  g_object_unref (client);
+}
+
+static void
+check_no_value (GConfClient *client,
+                const char  *key)
+{
+  GConfValue *value;
+  GError *error = NULL;
+
+  value = gconf_client_get (client, key, &error);
+  exit_if_error (error);
+
+  check (value == NULL, "`%s' should not exist", key);
+}
+
+static void
+check_negative (GConfEngine *engine)
+{
+  GConfClient *client;
+  GConfClientCacheStats before;
+  GConfClientCacheStats stats;
+  GError *error = NULL;
+  int i;
+
+  for (i = 0; i < 10; i++)
+    {
+      char *key;
+
+      key = g_strdup_printf (TEST_DIR "/negative/dir%d/key%d", i % 2, i);
+      gconf_engine_set_int (engine, key, i, &error);
+      exit_if_error (error);
+      g_free (key);
+    }
+
+  client = gconf_client_get_for_engine (engine);
+  gconf_client_add_dir (client, TEST_DIR "/negative",
+                        GCONF_CLIENT_PRELOAD_RECURSIVE, &error);
+  exit_if_error (error);
+
+  gconf_client_get_cache_stats (client, &before);
+
+  check (get_int (client, TEST_DIR "/negative/dir1/key3") == 3,
+         "`%s' should be 3", TEST_DIR "/negative/dir1/key3");
+  check_no_value (client, TEST_DIR "/negative/dir0/nosuchkey");
+  check_no_value (client, TEST_DIR "/negative/nosuchdir/key");
+  check_no_value (client, TEST_DIR "/negative/dir0/nosuchdir/key");
+  check_no_value (client, TEST_DIR "/negative/nosuchkey");
+
+  gconf_client_get_cache_stats (client, &stats);
+  check (stats.misses == before.misses,
+         "%u lookups below a preloaded dir went to the engine",
+         stats.misses - before.misses);
+
+  /* Once the cache is cleared the engine has to be asked again */
+  gconf_client_clear_cache (client);
+  gconf_client_get_cache_stats (client, &before);
+
+  check_no_value (client, TEST_DIR "/negative/dir0/nosuchkey");
+  check (get_int (client, TEST_DIR "/negative/dir0/key4") == 4,
+         "`%s' should be 4", TEST_DIR "/negative/dir0/key4");
+
+  gconf_client_get_cache_stats (client, &stats);
+  check (stats.misses - before.misses == 2,
+         "%u lookups went to the engine after clearing the cache rather than 2",
+         stats.misses - before.misses);
+
+  /* Nor is a dir known to be complete once one of its keys is evicted */
+  gconf_client_preload (client, TEST_DIR "/negative",
+                        GCONF_CLIENT_PRELOAD_RECURSIVE, &error);
+  exit_if_error (error);
+  gconf_client_set_cache_limit (client, 3, 0);
+  gconf_client_get_cache_stats (client, &before);
+
+  check_no_value (client, TEST_DIR "/negative/dir0/nosuchkey");
+  for (i = 0; i < 10; i++)
+    {
+      char *key;
+
+      key = g_strdup_printf (TEST_DIR "/negative/dir%d/key%d", i % 2, i);
+      check (get_int (client, key) == i, "`%s' should be %d", key, i);
+      g_free (key);
+    }
+
+  gconf_client_get_cache_stats (client, &stats);
+  check (stats.misses > before.misses,
+         "no lookups went to the engine with most of the dir evicted");
+
+  gconf_client_remove_dir (client, TEST_DIR "/negative", NULL);
+  g_object_unref (client);
+}
+
+static GString *notify_log = NULL;
+static GString *batch_log = NULL;
+
+static void
+log_notify (GConfClient *client,
+            guint        cnxn_id,
+            GConfEntry  *entry,
+            gpointer     user_data)
+{
+  g_string_append_printf (notify_log, "%s=%d ",
+                          gconf_entry_get_key (entry) + strlen (TEST_DIR "/notify/"),
+                          gconf_value_get_int (gconf_entry_get_value (entry)));
+}
+
+static void
+log_batch (GConfClient *client,
+           guint        cnxn_id,
+           GSList      *entries,
+           gpointer     user_data)
+{
+  g_string_append_printf (batch_log, "%u ", g_slist_length (entries));
+}
+
+static gboolean
+quit_loop (gpointer data)
+{
+  g_main_loop_quit (data);
+
+  return FALSE;
+}
+
+static void
+run_loop (guint msec)
+{
+  GMainLoop *loop;
+
+  loop = g_main_loop_new (NULL, FALSE);
+  g_timeout_add (msec, quit_loop, loop);
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+}
+
+/* The sets go straight to the engine, so all the client sees of them
+ * is the notifies from the server, and the interval gives those time
+ * to pile up before they are delivered.
+ */
+static void
+check_notify (GConfEngine *engine)
+{
+  GConfClient *client;
+  GError *error = NULL;
+  guint cnxn;
+  guint batch_cnxn;
+
+  notify_log = g_string_new (NULL);
+  batch_log = g_string_new (NULL);
+
+  client = gconf_client_get_for_engine (engine);
+  gconf_client_add_dir (client, TEST_DIR "/notify",
+                        GCONF_CLIENT_PRELOAD_NONE, &error);
+  exit_if_error (error);
+
+  cnxn = gconf_client_notify_add (client, TEST_DIR "/notify",
+                                  log_notify, NULL, NULL, &error);
+  exit_if_error (error);
+  batch_cnxn = gconf_client_batch_notify_add (client, TEST_DIR "/notify",
+                                              log_batch, NULL, NULL);
+
+  gconf_client_set_notify_interval (client, 500);
+
+  /* One notify per key, with its latest value, all in one batch */
+  gconf_engine_set_int (engine, TEST_DIR "/notify/a", 1, &error);
+  exit_if_error (error);
+  gconf_engine_set_int (engine, TEST_DIR "/notify/a", 2, &error);
+  exit_if_error (error);
+  gconf_engine_set_int (engine, TEST_DIR "/notify/a", 3, &error);
+  exit_if_error (error);
+
+  check (notify_log->len == 0, "notified before the main loop ran: %s",
+         notify_log->str);
+
+  run_loop (2000);
+
+  check (strcmp (notify_log->str, "a=3 ") == 0,
+         "three sets of a notified \"%s\" rather than \"a=3 \"",
+         notify_log->str);
+  check (strcmp (batch_log->str, "1 ") == 0,
+         "got batches \"%s\" rather than one of 1", batch_log->str);
+
+  g_string_truncate (notify_log, 0);
+  g_string_truncate (batch_log, 0);
+
+  gconf_engine_set_int (engine, TEST_DIR "/notify/b", 1, &error);
+  exit_if_error (error);
+  gconf_engine_set_int (engine, TEST_DIR "/notify/c", 1, &error);
+  exit_if_error (error);
+  gconf_engine_set_int (engine, TEST_DIR "/notify/b", 2, &error);
+  exit_if_error (error);
+
+  run_loop (2000);
+
+  check (notify_log->len == strlen ("b=2 c=1 ") &&
+         strstr (notify_log->str, "b=2 ") != NULL &&
+         strstr (notify_log->str, "c=1 ") != NULL,
+         "notified \"%s\" rather than b=2 and c=1", notify_log->str);
+  check (strcmp (batch_log->str, "2 ") == 0,
+         "got batches \"%s\" rather than one of 2", batch_log->str);
+
+  /* Without an interval a lone change still goes out on its own */
+  g_string_truncate (notify_log, 0);
+  g_string_truncate (batch_log, 0);
+
+  gconf_client_set_notify_interval (client, 0);
+
+  gconf_engine_set_int (engine, TEST_DIR "/notify/a", 4, &error);
+  exit_if_error (error);
+
+  run_loop (1000);
+
+  check (strcmp (notify_log->str, "a=4 ") == 0,
+         "notified \"%s\" rather than \"a=4 \"", notify_log->str);
+  check (strcmp (batch_log->str, "1 ") == 0,
+         "got batches \"%s\" rather than one of 1", batch_log->str);
+
+  gconf_client_batch_notify_remove (client, batch_cnxn);
+  gconf_client_notify_remove (client, cnxn);
+  gconf_client_remove_dir (client, TEST_DIR "/notify", NULL);
+  g_object_unref (client);
+
+  g_string_free (notify_log, TRUE);
+  g_string_free (batch_log, TRUE);
+}
+
+static void
+remove_tree (const char *path)
+{
+  GDir *dir;
+  const char *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL)
+    {
+      g_unlink (path);
+      return;
+    }
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      char *child;
+
+      child = g_build_filename (path, name, NULL);
+      remove_tree (child);
+      g_free (child);
+    }
+
+  g_dir_close (dir);
+  g_rmdir (path);
+}
+
+int
+main (int argc, char** argv)
+{
+  GConfEngine *engine;
+  GError *error = NULL;
+  char *root_dir;
+  char *address;
+
+  setlocale (LC_ALL, "");
+
+  g_type_init ();
+
+  root_dir = g_build_filename (g_get_tmp_dir (), "testclient-XXXXXX", NULL);
+  check (mkdtemp (root_dir) != NULL, "create %s", root_dir);
+
+  address = g_strconcat ("xml:readwrite:", root_dir, NULL);
+
+  engine = gconf_engine_get_for_address (address, &error);
+  exit_if_error (error);
+
+  printf ("\nChecking the cache limit:");
+
+  check_cache_limit (engine);
+
+  printf ("\nChecking negative lookups:");
+
+  check_negative (engine);
+
+  printf ("\nChecking notify delivery:");
+
+  check_notify (engine);
+
+  gconf_engine_unref (engine);
+
+  remove_tree (root_dir);
+  g_free (address);
+  g_free (root_dir);
+
+  printf ("\n\n");
+
+  return 0;
+}
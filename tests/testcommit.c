@@ -0,0 +1,338 @@
+/* GConf
+ * Copyright (C) 1999, 2000 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Checks that gconfd commits a change set all or nothing.  The
+ * database has a read-only source in front of a writable one, and
+ * the key set in the read-only one can't be written.
+ */
+
+#include <gconf/gconf.h>
+#include <gconf/gconf-backend.h>
+#include <gconf/gconf-changeset.h>
+#include <gconf/gconf-client.h>
+#include <gconf/gconf-internals.h>
+#include <gconf/gconf-sources.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+
+#define TEST_DIR "/testing/commit"
+
+static void
+check (gboolean condition, const gchar* fmt, ...)
+{
+  va_list args;
+  gchar* description;
+
+  va_start (args, fmt);
+  description = g_strdup_vprintf (fmt, args);
+  va_end (args);
+
+  if (condition)
+    {
+      printf (".");
+      fflush (stdout);
+    }
+  else
+    {
+      fprintf (stderr, "\n*** FAILED: %s\n", description);
+      exit (1);
+    }
+
+  g_free (description);
+}
+
+static void
+exit_if_error (GError *error)
+{
+  if (error != NULL)
+    {
+      fprintf (stderr, "Error: %s\n", error->message);
+      g_error_free (error);
+      exit (1);
+    }
+}
+
+/* -1 for unset */
+static int
+get_int (GConfEngine *engine,
+         const char  *key)
+{
+  GConfValue *value;
+  GError *error = NULL;
+  int i;
+
+  value = gconf_engine_get (engine, key, &error);
+  exit_if_error (error);
+
+  if (value == NULL)
+    return -1;
+
+  check (value->type == GCONF_VALUE_INT, "`%s' should be an int", key);
+  i = gconf_value_get_int (value);
+  gconf_value_free (value);
+
+  return i;
+}
+
+static void
+check_values (GConfEngine *engine,
+              int          a,
+              int          b,
+              int          c)
+{
+  check (get_int (engine, TEST_DIR "/locked") == 1,
+         "`%s' should still be 1", TEST_DIR "/locked");
+  check (get_int (engine, TEST_DIR "/a") == a,
+         "`%s' should be %d", TEST_DIR "/a", a);
+  check (get_int (engine, TEST_DIR "/b") == b,
+         "`%s' should be %d", TEST_DIR "/b", b);
+  check (get_int (engine, TEST_DIR "/c") == c,
+         "`%s' should be %d", TEST_DIR "/c", c);
+}
+
+static GConfChangeSet*
+new_change_set (gboolean with_locked)
+{
+  GConfChangeSet *cs;
+
+  cs = gconf_change_set_new ();
+  gconf_change_set_set_int (cs, TEST_DIR "/a", 2);
+  gconf_change_set_unset (cs, TEST_DIR "/b");
+  gconf_change_set_set_int (cs, TEST_DIR "/c", 3);
+  if (with_locked)
+    gconf_change_set_set_int (cs, TEST_DIR "/locked", 10);
+
+  return cs;
+}
+
+static void
+check_at_once (GConfEngine *engine)
+{
+  GConfChangeSet *cs;
+  GSList *failed_keys;
+  GError *error = NULL;
+
+  cs = new_change_set (TRUE);
+
+  check (gconf_engine_commit_change_set_at_once (engine, cs,
+                                                 &failed_keys, &error),
+         "gconfd doesn't take change sets in one call");
+
+  check (error != NULL && error->domain == GCONF_ERROR &&
+         error->code == GCONF_ERROR_NO_WRITABLE_DATABASE,
+         "a commit with a read-only key should fail with "
+         "GCONF_ERROR_NO_WRITABLE_DATABASE: %s",
+         error ? error->message : "no error");
+  g_error_free (error);
+
+  check (g_slist_length (failed_keys) == 4,
+         "%u keys failed rather than all 4", g_slist_length (failed_keys));
+  check (strcmp (failed_keys->data, TEST_DIR "/locked") == 0,
+         "`%s' failed first rather than `%s'",
+         (char *) failed_keys->data, TEST_DIR "/locked");
+
+  g_slist_foreach (failed_keys, (GFunc) g_free, NULL);
+  g_slist_free (failed_keys);
+
+  check_values (engine, -1, 4, -1);
+
+  gconf_change_set_unref (cs);
+}
+
+static void
+check_engine (GConfEngine *engine)
+{
+  GConfChangeSet *cs;
+  GError *error = NULL;
+
+  cs = new_change_set (TRUE);
+
+  check (!gconf_engine_commit_change_set (engine, cs, TRUE, &error),
+         "a commit with a read-only key succeeded");
+  check (error != NULL, "a failed commit set no error");
+  g_error_free (error);
+  error = NULL;
+
+  check (gconf_change_set_size (cs) == 4,
+         "%u of 4 changes left in the set after a failed commit",
+         gconf_change_set_size (cs));
+
+  check_values (engine, -1, 4, -1);
+
+  gconf_change_set_unref (cs);
+
+  /* And without the read-only key it all goes through */
+  cs = new_change_set (FALSE);
+
+  check (gconf_engine_commit_change_set (engine, cs, TRUE, &error),
+         "committing writable keys failed");
+  exit_if_error (error);
+  check (gconf_change_set_size (cs) == 0,
+         "%u changes left in the set after a commit",
+         gconf_change_set_size (cs));
+
+  check_values (engine, 2, -1, 3);
+
+  gconf_change_set_unref (cs);
+}
+
+static void
+check_client (GConfEngine *engine)
+{
+  GConfClient *client;
+  GConfChangeSet *cs;
+  GConfValue *value;
+  GError *error = NULL;
+
+  client = gconf_client_get_for_engine (engine);
+  gconf_client_add_dir (client, TEST_DIR, GCONF_CLIENT_PRELOAD_ONELEVEL,
+                        &error);
+  exit_if_error (error);
+
+  cs = gconf_change_set_new ();
+  gconf_change_set_set_int (cs, TEST_DIR "/a", 20);
+  gconf_change_set_set_int (cs, TEST_DIR "/locked", 10);
+
+  check (!gconf_client_commit_change_set (client, cs, TRUE, &error),
+         "a client commit with a read-only key succeeded");
+  check (error != NULL, "a failed client commit set no error");
+  g_error_free (error);
+  error = NULL;
+
+  /* Neither the cache nor the database took any of it */
+  value = gconf_client_get (client, TEST_DIR "/a", &error);
+  exit_if_error (error);
+  check (value != NULL && value->type == GCONF_VALUE_INT &&
+         gconf_value_get_int (value) == 2,
+         "the client cached a change that was never committed");
+  gconf_value_free (value);
+
+  check_values (engine, 2, -1, 3);
+
+  gconf_change_set_unref (cs);
+
+  gconf_client_remove_dir (client, TEST_DIR, NULL);
+  g_object_unref (client);
+}
+
+static void
+remove_tree (const char *path)
+{
+  GDir *dir;
+  const char *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL)
+    {
+      g_unlink (path);
+      return;
+    }
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      char *child;
+
+      child = g_build_filename (path, name, NULL);
+      remove_tree (child);
+      g_free (child);
+    }
+
+  g_dir_close (dir);
+  g_rmdir (path);
+}
+
+int
+main (int argc, char** argv)
+{
+  GConfEngine *engine;
+  GConfSource *source;
+  GConfValue *value;
+  GSList *addresses;
+  GError *error = NULL;
+  char *writable_dir;
+  char *readonly_dir;
+  char *address;
+
+  setlocale (LC_ALL, "");
+
+  g_type_init ();
+
+  writable_dir = g_build_filename (g_get_tmp_dir (), "testcommit-XXXXXX", NULL);
+  check (mkdtemp (writable_dir) != NULL, "create %s", writable_dir);
+  readonly_dir = g_build_filename (g_get_tmp_dir (), "testcommit-XXXXXX", NULL);
+  check (mkdtemp (readonly_dir) != NULL, "create %s", readonly_dir);
+
+  /* The key nobody gets to write */
+  address = g_strconcat ("xml:readwrite:", readonly_dir, NULL);
+  source = gconf_resolve_address (address, &error);
+  exit_if_error (error);
+  g_free (address);
+
+  value = gconf_value_new (GCONF_VALUE_INT);
+  gconf_value_set_int (value, 1);
+  (* source->backend->vtable.set_value) (source, TEST_DIR "/locked",
+                                         value, &error);
+  exit_if_error (error);
+  gconf_value_free (value);
+
+  (* source->backend->vtable.sync_all) (source, &error);
+  exit_if_error (error);
+  gconf_source_free (source);
+
+  addresses = NULL;
+  addresses = g_slist_append (addresses,
+                              g_strconcat ("xml:readonly:", readonly_dir, NULL));
+  addresses = g_slist_append (addresses,
+                              g_strconcat ("xml:readwrite:", writable_dir, NULL));
+
+  engine = gconf_engine_get_for_addresses (addresses, &error);
+  exit_if_error (error);
+
+  gconf_engine_set_int (engine, TEST_DIR "/b", 4, &error);
+  exit_if_error (error);
+
+  printf ("\nChecking a rejected commit in one call:");
+
+  check_at_once (engine);
+
+  printf ("\nChecking engine commits:");
+
+  check_engine (engine);
+
+  printf ("\nChecking client commits:");
+
+  check_client (engine);
+
+  gconf_engine_unref (engine);
+
+  g_slist_foreach (addresses, (GFunc) g_free, NULL);
+  g_slist_free (addresses);
+
+  remove_tree (writable_dir);
+  remove_tree (readonly_dir);
+  g_free (writable_dir);
+  g_free (readonly_dir);
+
+  printf ("\n\n");
+
+  return 0;
+}
@@ -0,0 +1,355 @@
+/* GConf
+ * Copyright (C) 1999, 2000 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Checks the %gconf-journal of the xml backend.  Freeing a source
+ * without syncing it leaves the XML files as they were, just like a
+ * crash would, so the changes must come back from the journal.
+ */
+
+#include <gconf/gconf-backend.h>
+#include <gconf/gconf-internals.h>
+#include <gconf/gconf-locale.h>
+#include <gconf/gconf.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <locale.h>
+
+static const char **locales = NULL;
+static char *root_dir = NULL;
+static char *address = NULL;
+static char *journal = NULL;
+
+static void
+check (gboolean condition, const gchar* fmt, ...)
+{
+  va_list args;
+  gchar* description;
+
+  va_start (args, fmt);
+  description = g_strdup_vprintf (fmt, args);
+  va_end (args);
+
+  if (condition)
+    {
+      g_print (".");
+    }
+  else
+    {
+      g_printerr ("\n*** FAILED: %s\n", description);
+      exit (1);
+    }
+
+  g_free (description);
+}
+
+static void
+exit_if_error (GError *error)
+{
+  if (error != NULL)
+    {
+      g_printerr ("Error: %s\n", error->message);
+      g_error_free (error);
+      exit (1);
+    }
+}
+
+static GConfSource*
+open_source (void)
+{
+  GConfSource *source;
+  GError *error = NULL;
+
+  source = gconf_resolve_address (address, &error);
+  exit_if_error (error);
+
+  return source;
+}
+
+static void
+sync_source (GConfSource *source)
+{
+  GError *error = NULL;
+
+  (* source->backend->vtable.sync_all) (source, &error);
+  exit_if_error (error);
+}
+
+static void
+set_int (GConfSource *source,
+         const char  *key,
+         int          i)
+{
+  GConfValue *value;
+  GError *error = NULL;
+
+  value = gconf_value_new (GCONF_VALUE_INT);
+  gconf_value_set_int (value, i);
+
+  (* source->backend->vtable.set_value) (source, key, value, &error);
+  exit_if_error (error);
+
+  gconf_value_free (value);
+}
+
+static void
+unset (GConfSource *source,
+       const char  *key)
+{
+  GError *error = NULL;
+
+  (* source->backend->vtable.unset_value) (source, key, NULL, &error);
+  exit_if_error (error);
+}
+
+static void
+check_int (GConfSource *source,
+           const char  *key,
+           int          i)
+{
+  GConfValue *value;
+  GError *error = NULL;
+
+  value = (* source->backend->vtable.query_value) (source, key, locales,
+                                                   NULL, &error);
+  exit_if_error (error);
+
+  check (value != NULL && value->type == GCONF_VALUE_INT &&
+         gconf_value_get_int (value) == i,
+         "`%s' should be %d", key, i);
+
+  if (value != NULL)
+    gconf_value_free (value);
+}
+
+static void
+check_unset (GConfSource *source,
+             const char  *key)
+{
+  GConfValue *value;
+  GError *error = NULL;
+
+  value = (* source->backend->vtable.query_value) (source, key, locales,
+                                                   NULL, &error);
+  exit_if_error (error);
+
+  check (value == NULL, "`%s' should be unset", key);
+
+  if (value != NULL)
+    gconf_value_free (value);
+}
+
+static void
+append_to_journal (const char *text)
+{
+  FILE *f;
+
+  f = fopen (journal, "a");
+  check (f != NULL, "open %s", journal);
+  fputs (text, f);
+  fclose (f);
+}
+
+/* A journal record made at @mod_time, as markup-tree.c writes them */
+static char*
+int_record (const char *key,
+            GTime       mod_time,
+            int         i)
+{
+  GConfValue *value;
+  char *encoded;
+  char *escaped;
+  char *record;
+
+  value = gconf_value_new (GCONF_VALUE_INT);
+  gconf_value_set_int (value, i);
+
+  encoded = gconf_value_encode (value);
+  escaped = g_strescape (encoded, NULL);
+  record = g_strdup_printf ("s\t%ld\t%s\t%s\t.\n",
+                            (long) mod_time, key, escaped);
+
+  g_free (escaped);
+  g_free (encoded);
+  gconf_value_free (value);
+
+  return record;
+}
+
+static void
+check_replay (void)
+{
+  GConfSource *source;
+
+  source = open_source ();
+  set_int (source, "/testing/journal/a", 1);
+  set_int (source, "/testing/journal/c", 3);
+  sync_source (source);
+
+  check (!g_file_test (journal, G_FILE_TEST_EXISTS),
+         "the journal should be gone after a sync");
+
+  set_int (source, "/testing/journal/a", 10);
+  unset (source, "/testing/journal/c");
+  set_int (source, "/testing/journal/b", 2);
+
+  check (g_file_test (journal, G_FILE_TEST_EXISTS),
+         "changes should be in the journal");
+
+  /* "Crash": the XML files still have a = 1, c = 3 */
+  gconf_source_free (source);
+
+  source = open_source ();
+  check_int (source, "/testing/journal/a", 10);
+  check_int (source, "/testing/journal/b", 2);
+  check_unset (source, "/testing/journal/c");
+
+  sync_source (source);
+  check (!g_file_test (journal, G_FILE_TEST_EXISTS),
+         "the replayed journal should be gone after a sync");
+  gconf_source_free (source);
+
+  /* And the XML files have it all now */
+  source = open_source ();
+  check_int (source, "/testing/journal/a", 10);
+  check_int (source, "/testing/journal/b", 2);
+  check_unset (source, "/testing/journal/c");
+  gconf_source_free (source);
+}
+
+static void
+check_truncated (void)
+{
+  GConfSource *source;
+  char *record;
+  char *cut;
+
+  source = open_source ();
+  set_int (source, "/testing/journal/d", 4);
+  gconf_source_free (source);
+
+  /* Died halfway through writing a record */
+  record = int_record ("/testing/journal/e", time (NULL), 5);
+  cut = g_strndup (record, strlen (record) - 3);
+  append_to_journal (cut);
+  g_free (cut);
+  g_free (record);
+
+  /* Replays, then appends after the cut line */
+  source = open_source ();
+  check_int (source, "/testing/journal/d", 4);
+  check_unset (source, "/testing/journal/e");
+  set_int (source, "/testing/journal/f", 6);
+  gconf_source_free (source);
+
+  source = open_source ();
+  check_int (source, "/testing/journal/d", 4);
+  check_unset (source, "/testing/journal/e");
+  check_int (source, "/testing/journal/f", 6);
+  sync_source (source);
+  check (!g_file_test (journal, G_FILE_TEST_EXISTS),
+         "the journal should be gone after a sync");
+  gconf_source_free (source);
+}
+
+static void
+check_newer_xml (void)
+{
+  GConfSource *source;
+  char *record;
+
+  source = open_source ();
+  set_int (source, "/testing/journal/g", 7);
+  sync_source (source);
+  gconf_source_free (source);
+
+  /* A journal left over from before the XML files were written */
+  record = int_record ("/testing/journal/g", 1, 70);
+  append_to_journal (record);
+  g_free (record);
+  record = int_record ("/testing/journal/h", 1, 8);
+  append_to_journal (record);
+  g_free (record);
+
+  source = open_source ();
+  check_int (source, "/testing/journal/g", 7);
+  check_int (source, "/testing/journal/h", 8);
+  sync_source (source);
+  gconf_source_free (source);
+}
+
+static void
+remove_tree (const char *path)
+{
+  GDir *dir;
+  const char *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL)
+    {
+      g_unlink (path);
+      return;
+    }
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      char *child;
+
+      child = g_build_filename (path, name, NULL);
+      remove_tree (child);
+      g_free (child);
+    }
+
+  g_dir_close (dir);
+  g_rmdir (path);
+}
+
+int
+main (int argc, char **argv)
+{
+  setlocale (LC_ALL, "");
+
+  locales = (const char**) gconf_split_locale (gconf_current_locale ());
+
+  root_dir = g_build_filename (g_get_tmp_dir (), "testjournal-XXXXXX", NULL);
+  check (mkdtemp (root_dir) != NULL, "create %s", root_dir);
+
+  address = g_strconcat ("xml:readwrite:", root_dir, NULL);
+  journal = g_build_filename (root_dir, "%gconf-journal", NULL);
+
+  g_print ("\nChecking replay after a crash:");
+
+  check_replay ();
+
+  g_print ("\nChecking a truncated last line:");
+
+  check_truncated ();
+
+  g_print ("\nChecking replay on top of newer XML:");
+
+  check_newer_xml ();
+
+  remove_tree (root_dir);
+
+  g_print ("\n\n");
+
+  return 0;
+}
@@ -466,6 +466,79 @@ check_notification(GConfListeners* listeners)
         "listener count isn't 0 after removing all the listeners");
 }
 
+struct reentrant_data {
+  guint remove_id;
+  guint outer_count;
+  guint inner_count;
+};
+
+static void
+inner_notify_callback(GConfListeners* listeners,
+                      const gchar* all_above_key,
+                      guint cnxn_id,
+                      gpointer listener_data,
+                      gpointer user_data)
+{
+  struct reentrant_data* rd = user_data;
+
+  rd->inner_count += 1;
+}
+
+static void
+reentrant_notify_callback(GConfListeners* listeners,
+                          const gchar* all_above_key,
+                          guint cnxn_id,
+                          gpointer listener_data,
+                          gpointer user_data)
+{
+  struct reentrant_data* rd = user_data;
+
+  rd->outer_count += 1;
+
+  /* The first listener removes the other one and notifies again
+   * from inside the callback; the removed listener must not be
+   * called by the outer notify afterwards.
+   */
+  if (rd->remove_id != 0)
+    {
+      gconf_listeners_remove(listeners, rd->remove_id);
+      rd->remove_id = 0;
+
+      gconf_listeners_notify(listeners, "/reentrant/a/b",
+                             inner_notify_callback, rd);
+    }
+}
+
+static void
+null_destroy_notify(gpointer data)
+{
+}
+
+static void
+check_reentrant_notify(GConfListeners* listeners)
+{
+  struct reentrant_data rd = { 0, 0, 0 };
+  guint ids[3];
+
+  ids[0] = gconf_listeners_add(listeners, "/reentrant/a", NULL, null_destroy_notify);
+  ids[1] = gconf_listeners_add(listeners, "/reentrant/a/b", NULL, null_destroy_notify);
+  ids[2] = gconf_listeners_add(listeners, "/reentrant", NULL, null_destroy_notify);
+
+  /* ids[2] is notified first since it's higher in the tree */
+  rd.remove_id = ids[1];
+
+  gconf_listeners_notify(listeners, "/reentrant/a/b/c",
+                         reentrant_notify_callback, &rd);
+
+  check(rd.outer_count == 2,
+        "expected 2 listeners notified around a removal, got %u", rd.outer_count);
+  check(rd.inner_count == 2,
+        "expected 2 listeners notified by the nested notify, got %u", rd.inner_count);
+
+  gconf_listeners_remove(listeners, ids[0]);
+  gconf_listeners_remove(listeners, ids[2]);
+}
+
 struct destroy_data {
   gchar* key;
   guint* destroy_count_loc;
@@ -551,6 +624,10 @@ main (int argc, char** argv)
   
   check_notification(listeners);
 
+  g_assert(gconf_listeners_count(listeners) == 0);
+
+  check_reentrant_notify(listeners);
+
   g_assert(gconf_listeners_count(listeners) == 0);
   
   gconf_listeners_free(listeners);
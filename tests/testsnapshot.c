@@ -0,0 +1,613 @@
+/* GConf
+ * Copyright (C) 2002 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Checks the %gconf-tree.xml.snapshot of merged xml trees: what is
+ * loaded lazily from a snapshot must be what parsing the XML gives,
+ * and a snapshot that is out of date or corrupt must not be used.
+ */
+
+#include <gconf/gconf-backend.h>
+#include <gconf/gconf-internals.h>
+#include <gconf/gconf-locale.h>
+#include <gconf/gconf.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+
+/* The header of a snapshot, as markup-tree.c writes it */
+typedef struct
+{
+  char    magic[8];
+  guint32 version;
+  guint32 byte_order;
+  guint64 xml_ino;
+  guint64 xml_size;
+  gint64  xml_mtime;
+  guint32 root;
+  guint32 reserved;
+} SnapshotHeader;
+
+static const char **locales = NULL;
+static char *root_dir = NULL;
+static char *address = NULL;
+static char *tree_file = NULL;
+static char *snapshot = NULL;
+
+static void
+check (gboolean condition, const gchar* fmt, ...)
+{
+  va_list args;
+  gchar* description;
+
+  va_start (args, fmt);
+  description = g_strdup_vprintf (fmt, args);
+  va_end (args);
+
+  if (condition)
+    {
+      g_print (".");
+    }
+  else
+    {
+      g_printerr ("\n*** FAILED: %s\n", description);
+      exit (1);
+    }
+
+  g_free (description);
+}
+
+static void
+exit_if_error (GError *error)
+{
+  if (error != NULL)
+    {
+      g_printerr ("Error: %s\n", error->message);
+      g_error_free (error);
+      exit (1);
+    }
+}
+
+static GConfSource*
+open_source (void)
+{
+  GConfSource *source;
+  GError *error = NULL;
+
+  source = gconf_resolve_address (address, &error);
+  exit_if_error (error);
+
+  return source;
+}
+
+static void
+set_value (GConfSource *source,
+           const char  *key,
+           GConfValue  *value)
+{
+  GError *error = NULL;
+
+  (* source->backend->vtable.set_value) (source, key, value, &error);
+  exit_if_error (error);
+
+  gconf_value_free (value);
+}
+
+static void
+set_int (GConfSource *source,
+         const char  *key,
+         int          i)
+{
+  GConfValue *value;
+
+  value = gconf_value_new (GCONF_VALUE_INT);
+  gconf_value_set_int (value, i);
+  set_value (source, key, value);
+}
+
+static int
+get_int (GConfSource *source,
+         const char  *key)
+{
+  GConfValue *value;
+  GError *error = NULL;
+  int i;
+
+  value = (* source->backend->vtable.query_value) (source, key, locales,
+                                                   NULL, &error);
+  exit_if_error (error);
+
+  check (value != NULL && value->type == GCONF_VALUE_INT,
+         "`%s' should be an int", key);
+
+  i = gconf_value_get_int (value);
+  gconf_value_free (value);
+
+  return i;
+}
+
+static void
+fill_tree (void)
+{
+  GConfSource *source;
+  GConfValue *value;
+  GConfValue *car;
+  GConfValue *cdr;
+  GConfSchema *schema;
+  GSList *list;
+  GError *error;
+  int i;
+
+  source = open_source ();
+
+  set_int (source, "/testing/snap/a/int", 42);
+
+  value = gconf_value_new (GCONF_VALUE_FLOAT);
+  gconf_value_set_float (value, 3.5);
+  set_value (source, "/testing/snap/a/float", value);
+
+  value = gconf_value_new (GCONF_VALUE_STRING);
+  gconf_value_set_string (value, "snap\tshot <&> \"\xc3\xa9\"");
+  set_value (source, "/testing/snap/a/string", value);
+
+  value = gconf_value_new (GCONF_VALUE_BOOL);
+  gconf_value_set_bool (value, TRUE);
+  set_value (source, "/testing/snap/b/bool", value);
+
+  list = NULL;
+  for (i = 0; i < 3; i++)
+    {
+      GConfValue *elem;
+
+      elem = gconf_value_new (GCONF_VALUE_INT);
+      gconf_value_set_int (elem, i);
+      list = g_slist_append (list, elem);
+    }
+  value = gconf_value_new (GCONF_VALUE_LIST);
+  gconf_value_set_list_type (value, GCONF_VALUE_INT);
+  gconf_value_set_list_nocopy (value, list);
+  set_value (source, "/testing/snap/b/list", value);
+
+  car = gconf_value_new (GCONF_VALUE_INT);
+  gconf_value_set_int (car, 1);
+  cdr = gconf_value_new (GCONF_VALUE_STRING);
+  gconf_value_set_string (cdr, "two");
+  value = gconf_value_new (GCONF_VALUE_PAIR);
+  gconf_value_set_car_nocopy (value, car);
+  gconf_value_set_cdr_nocopy (value, cdr);
+  set_value (source, "/testing/snap/b/pair", value);
+
+  schema = gconf_schema_new ();
+  gconf_schema_set_type (schema, GCONF_VALUE_INT);
+  gconf_schema_set_locale (schema, "C");
+  gconf_schema_set_short_desc (schema, "An int");
+  gconf_schema_set_long_desc (schema, "An int in a snapshot");
+  gconf_schema_set_owner (schema, "testsnapshot");
+  value = gconf_value_new (GCONF_VALUE_INT);
+  gconf_value_set_int (value, 7);
+  gconf_schema_set_default_value_nocopy (schema, value);
+  value = gconf_value_new (GCONF_VALUE_SCHEMA);
+  gconf_value_set_schema_nocopy (value, schema);
+  set_value (source, "/schemas/testing/snap/a/int", value);
+
+  error = NULL;
+  (* source->backend->vtable.set_schema) (source, "/testing/snap/a/int",
+                                          "/schemas/testing/snap/a/int",
+                                          &error);
+  exit_if_error (error);
+
+  set_int (source, "/testing/snap/g", 1);
+
+  error = NULL;
+  (* source->backend->vtable.sync_all) (source, &error);
+  exit_if_error (error);
+
+  gconf_source_free (source);
+}
+
+static int
+compare_entries (gconstpointer a,
+                 gconstpointer b)
+{
+  return strcmp (gconf_entry_get_key ((GConfEntry *) a),
+                 gconf_entry_get_key ((GConfEntry *) b));
+}
+
+static void
+dump_dir (GConfSource *source,
+          const char  *dir,
+          GString     *out)
+{
+  GSList *entries;
+  GSList *subdirs;
+  GSList *tmp;
+  GError *error;
+
+  error = NULL;
+  entries = (* source->backend->vtable.all_entries) (source, dir,
+                                                     locales, &error);
+  exit_if_error (error);
+
+  entries = g_slist_sort (entries, compare_entries);
+
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry = tmp->data;
+      GConfValue *value;
+      char *key;
+      char *str;
+
+      /* The backend gives relative keys */
+      key = gconf_concat_dir_and_key (dir, gconf_entry_get_key (entry));
+
+      value = gconf_entry_get_value (entry);
+      str = value ? gconf_value_to_string (value) : g_strdup ("<unset>");
+
+      g_string_append_printf (out, "%s = %s (%s)\n", key, str,
+                              gconf_entry_get_schema_name (entry) ?
+                              gconf_entry_get_schema_name (entry) : "");
+
+      /* The schema itself, with its descriptions */
+      if (value != NULL && value->type == GCONF_VALUE_SCHEMA)
+        {
+          GConfSchema *schema = gconf_value_get_schema (value);
+
+          g_string_append_printf (out, "  %s %s %s %s\n",
+                                  gconf_schema_get_locale (schema),
+                                  gconf_schema_get_short_desc (schema),
+                                  gconf_schema_get_long_desc (schema),
+                                  gconf_schema_get_owner (schema));
+        }
+
+      g_free (str);
+      g_free (key);
+      gconf_entry_free (entry);
+    }
+  g_slist_free (entries);
+
+  error = NULL;
+  subdirs = (* source->backend->vtable.all_subdirs) (source, dir, &error);
+  exit_if_error (error);
+
+  subdirs = g_slist_sort (subdirs, (GCompareFunc) strcmp);
+
+  for (tmp = subdirs; tmp != NULL; tmp = tmp->next)
+    {
+      char *subdir;
+
+      subdir = gconf_concat_dir_and_key (dir, tmp->data);
+      dump_dir (source, subdir, out);
+      g_free (subdir);
+      g_free (tmp->data);
+    }
+  g_slist_free (subdirs);
+}
+
+static char*
+dump (void)
+{
+  GConfSource *source;
+  GString *out;
+
+  out = g_string_new (NULL);
+
+  source = open_source ();
+  dump_dir (source, "/", out);
+  gconf_source_free (source);
+
+  return g_string_free (out, FALSE);
+}
+
+static GString*
+read_file (const char *filename)
+{
+  GError *error = NULL;
+  char *contents;
+  gsize len;
+
+  g_file_get_contents (filename, &contents, &len, &error);
+  exit_if_error (error);
+
+  return g_string_new_len (contents, len);
+}
+
+static void
+write_file (const char *filename,
+            GString    *contents)
+{
+  GError *error = NULL;
+
+  g_file_set_contents (filename, contents->str, contents->len, &error);
+  exit_if_error (error);
+}
+
+/* Puts @contents back as the snapshot, made to match the current XML
+ * file except for the ino, size or mtime (@wrong 0, 1 or 2).
+ */
+static void
+restore_snapshot (GString *contents,
+                  int      wrong)
+{
+  SnapshotHeader header;
+  struct stat statbuf;
+  GString *copy;
+
+  check (g_stat (tree_file, &statbuf) == 0, "stat %s", tree_file);
+
+  memcpy (&header, contents->str, sizeof (header));
+  header.xml_ino = (guint64) statbuf.st_ino + (wrong == 0);
+  header.xml_size = (guint64) statbuf.st_size + (wrong == 1);
+  header.xml_mtime = (gint64) statbuf.st_mtime + (wrong == 2);
+
+  copy = g_string_new_len (contents->str, contents->len);
+  memcpy (copy->str, &header, sizeof (header));
+  write_file (snapshot, copy);
+  g_string_free (copy, TRUE);
+}
+
+static guint32
+get_u32 (GString *data,
+         guint32  offset)
+{
+  guint32 word;
+
+  check (offset + 4 <= data->len, "offset %u in the snapshot", offset);
+  memcpy (&word, data->str + offset, 4);
+
+  return word;
+}
+
+static gboolean
+string_is (GString    *data,
+           guint32     offset,
+           const char *str)
+{
+  guint32 len;
+
+  len = get_u32 (data, offset);
+
+  return len == strlen (str) && memcmp (data->str + offset + 4, str, len) == 0;
+}
+
+/* dir: name, n_entries, n_subdirs, entries[], subdirs[] */
+static guint32
+find_subdir (GString    *data,
+             guint32     dir,
+             const char *name)
+{
+  guint32 n_entries;
+  guint32 n_subdirs;
+  guint32 i;
+
+  n_entries = get_u32 (data, dir + 4);
+  n_subdirs = get_u32 (data, dir + 8);
+
+  for (i = 0; i < n_subdirs; i++)
+    {
+      guint32 subdir;
+
+      subdir = get_u32 (data, dir + 12 + 4 * (n_entries + i));
+      if (string_is (data, get_u32 (data, subdir), name))
+        return subdir;
+    }
+
+  check (FALSE, "no subdir `%s' in the snapshot", name);
+
+  return 0;
+}
+
+static guint32
+find_entry (GString    *data,
+            guint32     dir,
+            const char *name)
+{
+  guint32 n_entries;
+  guint32 i;
+
+  n_entries = get_u32 (data, dir + 4);
+
+  for (i = 0; i < n_entries; i++)
+    {
+      guint32 entry;
+
+      entry = get_u32 (data, dir + 12 + 4 * i);
+      if (string_is (data, get_u32 (data, entry), name))
+        return entry;
+    }
+
+  check (FALSE, "no entry `%s' in the snapshot", name);
+
+  return 0;
+}
+
+static void
+check_lazy_load (void)
+{
+  char *from_snapshot;
+  char *from_xml;
+
+  check (g_file_test (snapshot, G_FILE_TEST_EXISTS),
+         "syncing should write %s", snapshot);
+
+  from_snapshot = dump ();
+
+  g_unlink (snapshot);
+  from_xml = dump ();
+
+  check (g_file_test (snapshot, G_FILE_TEST_EXISTS),
+         "parsing should write %s", snapshot);
+
+  check (strstr (from_xml, "/testing/snap/a/int = 42 "
+                 "(/schemas/testing/snap/a/int)") != NULL,
+         "missing values in\n%s", from_xml);
+  check (strcmp (from_snapshot, from_xml) == 0,
+         "the snapshot has\n%s\nbut the XML has\n%s",
+         from_snapshot, from_xml);
+
+  g_free (from_xml);
+  g_free (from_snapshot);
+}
+
+static void
+check_stale (GString *old)
+{
+  GConfSource *source;
+  GError *error;
+  int wrong;
+
+  /* The old snapshot says g is 1 */
+  source = open_source ();
+  set_int (source, "/testing/snap/g", 2);
+  error = NULL;
+  (* source->backend->vtable.sync_all) (source, &error);
+  exit_if_error (error);
+  gconf_source_free (source);
+
+  restore_snapshot (old, -1);
+  source = open_source ();
+  check (get_int (source, "/testing/snap/g") == 1,
+         "a snapshot matching the XML file should be used");
+  gconf_source_free (source);
+
+  for (wrong = 0; wrong < 3; wrong++)
+    {
+      restore_snapshot (old, wrong);
+      source = open_source ();
+      check (get_int (source, "/testing/snap/g") == 2,
+             "a snapshot with the wrong %s should be ignored",
+             wrong == 0 ? "inode" : wrong == 1 ? "size" : "mtime");
+      gconf_source_free (source);
+    }
+}
+
+static void
+check_corrupt (GString *old)
+{
+  SnapshotHeader header;
+  GString *corrupt;
+  GString *now;
+  guint32 dir;
+  guint32 entry;
+  guint32 value;
+  guint32 bad_type = 0xdead;
+  char *from_xml;
+  char *from_corrupt;
+
+  g_unlink (snapshot);
+  from_xml = dump ();
+
+  /* The old snapshot, up to date but for one bad value elsewhere than
+   * /testing/snap/g; none of it may be used.
+   */
+  restore_snapshot (old, -1);
+  corrupt = read_file (snapshot);
+
+  memcpy (&header, corrupt->str, sizeof (header));
+  dir = find_subdir (corrupt, header.root, "testing");
+  dir = find_subdir (corrupt, dir, "snap");
+  dir = find_subdir (corrupt, dir, "a");
+  entry = find_entry (corrupt, dir, "int");
+  value = get_u32 (corrupt, entry + 16);
+  check (value != 0, "/testing/snap/a/int has a value in the snapshot");
+  memcpy (corrupt->str + value, &bad_type, 4);
+  write_file (snapshot, corrupt);
+
+  from_corrupt = dump ();
+  check (strcmp (from_corrupt, from_xml) == 0,
+         "loading next to a corrupt snapshot gave\n%s\nbut the XML has\n%s",
+         from_corrupt, from_xml);
+
+  now = read_file (snapshot);
+  check (now->len != corrupt->len ||
+         memcmp (now->str, corrupt->str, now->len) != 0,
+         "a corrupt snapshot should be replaced");
+  g_string_free (now, TRUE);
+
+  g_string_free (corrupt, TRUE);
+  g_free (from_corrupt);
+  g_free (from_xml);
+}
+
+static void
+remove_tree (const char *path)
+{
+  GDir *dir;
+  const char *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL)
+    {
+      g_unlink (path);
+      return;
+    }
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      char *child;
+
+      child = g_build_filename (path, name, NULL);
+      remove_tree (child);
+      g_free (child);
+    }
+
+  g_dir_close (dir);
+  g_rmdir (path);
+}
+
+int
+main (int argc, char **argv)
+{
+  GString *old;
+
+  setlocale (LC_ALL, "");
+
+  locales = (const char**) gconf_split_locale (gconf_current_locale ());
+
+  root_dir = g_build_filename (g_get_tmp_dir (), "testsnapshot-XXXXXX", NULL);
+  check (mkdtemp (root_dir) != NULL, "create %s", root_dir);
+
+  address = g_strconcat ("xml:merged:readwrite:", root_dir, NULL);
+  tree_file = g_build_filename (root_dir, "%gconf-tree.xml", NULL);
+  snapshot = g_strconcat (tree_file, ".snapshot", NULL);
+
+  fill_tree ();
+
+  g_print ("\nChecking lazy loading against the XML:");
+
+  check_lazy_load ();
+
+  old = read_file (snapshot);
+
+  g_print ("\nChecking out of date snapshots:");
+
+  check_stale (old);
+
+  g_print ("\nChecking corrupt snapshots:");
+
+  check_corrupt (old);
+
+  g_string_free (old, TRUE);
+
+  remove_tree (root_dir);
+
+  g_print ("\n\n");
+
+  return 0;
+}
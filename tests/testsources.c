@@ -0,0 +1,321 @@
+/* GConf
+ * Copyright (C) 1999, 2000 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Checks that the values GConfSources has resolved and cached change
+ * with every kind of write: a writable source in front of a read-only
+ * one, each read before and after the write.
+ */
+
+#include <gconf/gconf-backend.h>
+#include <gconf/gconf-internals.h>
+#include <gconf/gconf-locale.h>
+#include <gconf/gconf-sources.h>
+#include <gconf/gconf.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+
+#define TEST_DIR "/testing/sources"
+
+static const char **locales = NULL;
+
+static void
+check (gboolean condition, const gchar* fmt, ...)
+{
+  va_list args;
+  gchar* description;
+
+  va_start (args, fmt);
+  description = g_strdup_vprintf (fmt, args);
+  va_end (args);
+
+  if (condition)
+    {
+      g_print (".");
+    }
+  else
+    {
+      g_printerr ("\n*** FAILED: %s\n", description);
+      exit (1);
+    }
+
+  g_free (description);
+}
+
+static void
+exit_if_error (GError *error)
+{
+  if (error != NULL)
+    {
+      g_printerr ("Error: %s\n", error->message);
+      g_error_free (error);
+      exit (1);
+    }
+}
+
+static GConfValue*
+int_value (int i)
+{
+  GConfValue *value;
+
+  value = gconf_value_new (GCONF_VALUE_INT);
+  gconf_value_set_int (value, i);
+
+  return value;
+}
+
+static GConfValue*
+schema_value (int default_value)
+{
+  GConfSchema *schema;
+  GConfValue *value;
+
+  schema = gconf_schema_new ();
+  gconf_schema_set_type (schema, GCONF_VALUE_INT);
+  gconf_schema_set_locale (schema, "C");
+  gconf_schema_set_default_value_nocopy (schema, int_value (default_value));
+
+  value = gconf_value_new (GCONF_VALUE_SCHEMA);
+  gconf_value_set_schema_nocopy (value, schema);
+
+  return value;
+}
+
+static void
+set_int (GConfSources *sources,
+         const char   *key,
+         int           i)
+{
+  GConfValue *value;
+  GError *error = NULL;
+
+  value = int_value (i);
+  gconf_sources_set_value (sources, key, value, NULL, &error);
+  exit_if_error (error);
+  gconf_value_free (value);
+}
+
+static void
+set_schema_default (GConfSources *sources,
+                    const char   *schema_key,
+                    int           i)
+{
+  GConfValue *value;
+  GError *error = NULL;
+
+  value = schema_value (i);
+  gconf_sources_set_value (sources, schema_key, value, NULL, &error);
+  exit_if_error (error);
+  gconf_value_free (value);
+}
+
+/* -1 for unset */
+static int
+query_int (GConfSources *sources,
+           const char   *key)
+{
+  GConfValue *value;
+  GError *error = NULL;
+  int i;
+
+  value = gconf_sources_query_value (sources, key, locales, TRUE,
+                                     NULL, NULL, NULL, &error);
+  exit_if_error (error);
+
+  if (value == NULL)
+    return -1;
+
+  check (value->type == GCONF_VALUE_INT, "`%s' should be an int", key);
+  i = gconf_value_get_int (value);
+  gconf_value_free (value);
+
+  return i;
+}
+
+static void
+check_writes (GConfSources *sources,
+              GConfSource  *behind)
+{
+  GConfValue *value;
+  GError *error = NULL;
+
+  /* From the read-only source, then shadowed by the writable one */
+  check (query_int (sources, TEST_DIR "/key") == 1,
+         "`%s' should come from the read-only source", TEST_DIR "/key");
+  set_int (sources, TEST_DIR "/key", 2);
+  check (query_int (sources, TEST_DIR "/key") == 2,
+         "a set should replace the cached value");
+
+  gconf_sources_unset_value (sources, TEST_DIR "/key", NULL, NULL, &error);
+  exit_if_error (error);
+  check (query_int (sources, TEST_DIR "/key") == 1,
+         "an unset should uncover the read-only value");
+
+  /* Schema defaults, through the key and through the schema */
+  check (query_int (sources, TEST_DIR "/schemaed") == -1,
+         "`%s' should have no value yet", TEST_DIR "/schemaed");
+
+  set_schema_default (sources, "/schemas" TEST_DIR "/first", 7);
+  set_schema_default (sources, "/schemas" TEST_DIR "/second", 8);
+
+  gconf_sources_set_schema (sources, TEST_DIR "/schemaed",
+                            "/schemas" TEST_DIR "/first", &error);
+  exit_if_error (error);
+  check (query_int (sources, TEST_DIR "/schemaed") == 7,
+         "set_schema should give the default of the schema");
+
+  gconf_sources_set_schema (sources, TEST_DIR "/schemaed",
+                            "/schemas" TEST_DIR "/second", &error);
+  exit_if_error (error);
+  check (query_int (sources, TEST_DIR "/schemaed") == 8,
+         "set_schema should replace the cached default");
+
+  set_schema_default (sources, "/schemas" TEST_DIR "/second", 9);
+  check (query_int (sources, TEST_DIR "/schemaed") == 9,
+         "changing the schema should change the cached default");
+
+  /* Everything below a recursively unset dir */
+  set_int (sources, TEST_DIR "/dir/a", 3);
+  set_int (sources, TEST_DIR "/dir/sub/b", 4);
+  check (query_int (sources, TEST_DIR "/dir/a") == 3 &&
+         query_int (sources, TEST_DIR "/dir/sub/b") == 4,
+         "values below `%s' should be set", TEST_DIR "/dir");
+
+  gconf_sources_recursive_unset (sources, TEST_DIR "/dir", NULL, 0,
+                                 NULL, &error);
+  exit_if_error (error);
+  check (query_int (sources, TEST_DIR "/dir/a") == -1 &&
+         query_int (sources, TEST_DIR "/dir/sub/b") == -1,
+         "a recursive unset should drop the cached values below it");
+
+  /* Written behind the back of the sources, then invalidated */
+  check (query_int (sources, TEST_DIR "/key") == 1,
+         "`%s' should still come from the read-only source",
+         TEST_DIR "/key");
+
+  value = int_value (5);
+  (* behind->backend->vtable.set_value) (behind, TEST_DIR "/key",
+                                         value, &error);
+  exit_if_error (error);
+  gconf_value_free (value);
+
+  gconf_sources_invalidate (sources, TEST_DIR);
+  check (query_int (sources, TEST_DIR "/key") == 5,
+         "invalidating should drop the cached value");
+}
+
+static void
+remove_tree (const char *path)
+{
+  GDir *dir;
+  const char *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL)
+    {
+      g_unlink (path);
+      return;
+    }
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      char *child;
+
+      child = g_build_filename (path, name, NULL);
+      remove_tree (child);
+      g_free (child);
+    }
+
+  g_dir_close (dir);
+  g_rmdir (path);
+}
+
+int
+main (int argc, char **argv)
+{
+  GConfSources *sources;
+  GConfSource *source;
+  GConfSource *behind;
+  GConfValue *value;
+  GSList *addresses;
+  GError *error = NULL;
+  char *writable_dir;
+  char *readonly_dir;
+  char *address;
+
+  setlocale (LC_ALL, "");
+
+  locales = (const char**) gconf_split_locale (gconf_current_locale ());
+
+  writable_dir = g_build_filename (g_get_tmp_dir (), "testsources-XXXXXX", NULL);
+  check (mkdtemp (writable_dir) != NULL, "create %s", writable_dir);
+  readonly_dir = g_build_filename (g_get_tmp_dir (), "testsources-XXXXXX", NULL);
+  check (mkdtemp (readonly_dir) != NULL, "create %s", readonly_dir);
+
+  /* What the read-only source has to offer */
+  address = g_strconcat ("xml:readwrite:", readonly_dir, NULL);
+  source = gconf_resolve_address (address, &error);
+  exit_if_error (error);
+  g_free (address);
+
+  value = int_value (1);
+  (* source->backend->vtable.set_value) (source, TEST_DIR "/key",
+                                         value, &error);
+  exit_if_error (error);
+  gconf_value_free (value);
+
+  (* source->backend->vtable.sync_all) (source, &error);
+  exit_if_error (error);
+  gconf_source_free (source);
+
+  addresses = NULL;
+  addresses = g_slist_append (addresses,
+                              g_strconcat ("xml:readwrite:", writable_dir, NULL));
+  addresses = g_slist_append (addresses,
+                              g_strconcat ("xml:readonly:", readonly_dir, NULL));
+
+  sources = gconf_sources_new_from_addresses (addresses, &error);
+  exit_if_error (error);
+
+  address = g_strconcat ("xml:readwrite:", writable_dir, NULL);
+  behind = gconf_resolve_address (address, &error);
+  exit_if_error (error);
+  g_free (address);
+
+  g_print ("\nChecking cached values across writes:");
+
+  check_writes (sources, behind);
+
+  gconf_source_free (behind);
+  gconf_sources_free (sources);
+
+  g_slist_foreach (addresses, (GFunc) g_free, NULL);
+  g_slist_free (addresses);
+
+  remove_tree (writable_dir);
+  remove_tree (readonly_dir);
+  g_free (writable_dir);
+  g_free (readonly_dir);
+
+  g_print ("\n\n");
+
+  return 0;
+}